@@ -13,8 +13,133 @@
 #include <stdio.h>
 #include "assert.h"
 #include "compress40.h"
+#include "codec_options.h"
+#include "codec40.h"
+#include "pipeline40.h"
+#include "transform40.h"
+#include "instrument.h"
 
-static void (*compress_or_decompress)(FILE *input) = compress40;
+static struct Codec_options options = CODEC_OPTIONS_DEFAULT;
+static bool pipelined = false;
+static bool gray = false;
+
+/* -c -l lays the codewords out coarse to fine (options.progressive);
+   -d -l decompresses as much of such an image as has arrived */
+static bool progressive = false;
+
+/* whether -y asked for raw yuv 4:2:0, and the size of a frame to
+   compress, which it gives as widthxheight */
+static bool yuv = false;
+static unsigned yuv_width = 0, yuv_height = 0;
+
+/* the compressed image -u patches, and the rectangles -r gives */
+static const char *patch_path = NULL;
+static struct Codec40_rect *rects = NULL;
+static size_t nrects = 0;
+
+/* the transform -t names */
+static const char *transform_name = NULL;
+
+/* compress_with_options()
+ * Purpose: Compress with the options given on the command line
+ * Parameters: A file pointer which accesses the file to be compressed
+ * Returns: None
+ * Notes: A yuv frame is never pipelined. Exits with a message if -e
+ *        and -l are both given, since a progressive image is never
+ *        entropy coded.
+ */
+static void compress_with_options(FILE *input)
+{
+        if (options.entropy && progressive) {
+                fprintf(stderr, "40image: -c takes -e or -l, not both\n"
+                        "Usage: 40image -c [-e | -l] [-q profile] "
+                        "[-p | -y wxh] [-s] [filename]\n");
+                exit(1);
+        }
+        options.progressive = progressive;
+        if (yuv) {
+                if (yuv_width == 0 || yuv_height == 0) {
+                        fprintf(stderr, "40image: -c -y needs the frame's "
+                                "size, as -y widthxheight\n");
+                        exit(1);
+                }
+                compress40_yuv(input, &options, yuv_width, yuv_height);
+        } else if (pipelined) {
+                compress40_pipelined(input, &options);
+        } else {
+                compress40_with(input, &options);
+        }
+}
+
+/* decompress_with_options()
+ * Purpose: Decompress, pipelined, to a pgm or yuv frame, or from a 
+ *          partial progressive image if the command line asked for it
+ * Parameters: A file pointer which accesses the file to be decompressed
+ * Returns: None
+ * Notes: A pgm, yuv frame or partial image is never pipelined
+ */
+static void decompress_with_options(FILE *input)
+{
+        if (progressive) {
+                decompress40_partial(input);
+        } else if (yuv) {
+                decompress40_yuv(input);
+        } else if (gray) {
+                decompress40_gray(input);
+        } else if (pipelined) {
+                decompress40_pipelined(input);
+        } else {
+                decompress40(input);
+        }
+}
+
+/* patch_with_options()
+ * Purpose: Patch the compressed image named by -u with a changed image
+ * Parameters: A file pointer which accesses the changed image
+ * Returns: None
+ */
+static void patch_with_options(FILE *input)
+{
+        patch40(patch_path, input, rects, nrects);
+}
+
+/* add_rect()
+ * Purpose: Add a rectangle given as x,y,width,height to the list for -u
+ * Parameters: The program's name and the argument
+ * Returns: None
+ * Notes: Exits with a message if the argument is not a rectangle
+ */
+static void add_rect(const char *program, const char *arg)
+{
+        struct Codec40_rect rect;
+        char extra;
+        if (sscanf(arg, "%u,%u,%u,%u%c", &rect.x, &rect.y, &rect.width,
+                   &rect.height, &extra) != 4) {
+                fprintf(stderr, "%s: bad rectangle '%s' "
+                        "(want x,y,width,height)\n", program, arg);
+                exit(1);
+        }
+        rects = realloc(rects, (nrects + 1) * sizeof(*rects));
+        assert(rects != NULL);
+        rects[nrects++] = rect;
+}
+
+/* transform_with_options()
+ * Purpose: Transform a compressed image as -t asks, cropped to the 
+ *          rectangle -r gives, if any
+ * Parameters: A file pointer which accesses the compressed image
+ * Returns: None
+ */
+static void transform_with_options(FILE *input)
+{
+        if (nrects > 1) {
+                fprintf(stderr, "40image: -t takes at most one -r\n");
+                exit(1);
+        }
+        transform40(input, transform_name, nrects == 1 ? rects : NULL);
+}
+
+static void (*compress_or_decompress)(FILE *input) = compress_with_options;
 
 int main(int argc, char *argv[])
 {
@@ -22,17 +147,68 @@ int main(int argc, char *argv[])
 
         for (i = 1; i < argc; i++) {
                 if (strcmp(argv[i], "-c") == 0) {
-                        compress_or_decompress = compress40;
+                        compress_or_decompress = compress_with_options;
+                } else if (strcmp(argv[i], "-s") == 0) {
+                        INSTRUMENT_ENABLE();
+                } else if (strcmp(argv[i], "-p") == 0) {
+                        pipelined = true;
+                } else if (strcmp(argv[i], "-g") == 0) {
+                        gray = true;
+                } else if (strcmp(argv[i], "-y") == 0) {
+                        unsigned width, height;
+                        char extra;
+                        yuv = true;
+                        if (i + 1 < argc &&
+                            sscanf(argv[i + 1], "%ux%u%c", &width, &height,
+                                   &extra) == 2) {
+                                yuv_width = width;
+                                yuv_height = height;
+                                i++;
+                        }
+                } else if (strcmp(argv[i], "-l") == 0) {
+                        progressive = true;
+                } else if (strcmp(argv[i], "-e") == 0) {
+                        options.entropy = true;
+                } else if (strcmp(argv[i], "-q") == 0 && i + 1 < argc) {
+                        options.profile = Profile_named(argv[++i]);
+                        if (options.profile == NULL) {
+                                fprintf(stderr, "%s: unknown profile '%s'\n",
+                                        argv[0], argv[i]);
+                                exit(1);
+                        }
                 } else if (strcmp(argv[i], "-d") == 0) {
-                        compress_or_decompress = decompress40;
+                        compress_or_decompress = decompress_with_options;
+                } else if (strcmp(argv[i], "-u") == 0 && i + 1 < argc) {
+                        patch_path = argv[++i];
+                        compress_or_decompress = patch_with_options;
+                } else if (strcmp(argv[i], "-i") == 0) {
+                        compress_or_decompress = stats40;
+                } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+                        transform_name = argv[++i];
+                        if (Transform40_named(transform_name) ==
+                            TRANSFORM40_COUNT) {
+                                fprintf(stderr, "%s: unknown transform "
+                                        "'%s'\n", argv[0], transform_name);
+                                exit(1);
+                        }
+                        compress_or_decompress = transform_with_options;
+                } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+                        add_rect(argv[0], argv[++i]);
                 } else if (*argv[i] == '-') {
                         fprintf(stderr, "%s: unknown option '%s'\n",
                                 argv[0], argv[i]);
                         exit(1);
                 } else if (argc - i > 2) {
-                        fprintf(stderr, "Usage: %s -d [filename]\n"
-                                "       %s -c [filename]\n",
-                                argv[0], argv[0]);
+                        fprintf(stderr, "Usage: %s -d [-g | -y | -l] [-p] "
+                                "[-s] [filename]\n"
+                                "       %s -c [-e | -l] [-q profile] "
+                                "[-p | -y wxh] [-s] [filename]\n"
+                                "       %s -u compressed [-r x,y,w,h]... "
+                                "[-s] [filename]\n"
+                                "       %s -t transform [-r x,y,w,h] [-s] "
+                                "[filename]\n"
+                                "       %s -i [-s] [filename]\n",
+                                argv[0], argv[0], argv[0], argv[0], argv[0]);
                         exit(1);
                 } else {
                         break;
@@ -47,6 +223,7 @@ int main(int argc, char *argv[])
         } else {
                 compress_or_decompress(stdin);
         }
+        free(rects);
 
         return EXIT_SUCCESS; 
 }
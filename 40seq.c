@@ -0,0 +1,262 @@
+/*
+ *     40seq.c
+ *     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
+ *     Date: 10-26-20
+ *     arith
+ *
+ *     Purpose: Compresses a sequence of ppm frames into one file of
+ *              keyframes and delta frames (see seq40.h), or decompresses
+ *              one back into numbered ppm files.
+ *
+ *              Usage: 40seq -c [-q profile] [-k frames] [-s]
+ *                              frame.ppm... > frames.s40
+ *                     40seq -d [-o prefix] [-s] [frames.s40]
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "assert.h"
+#include "a2methods.h"
+#include "a2plain.h"
+#include "pnm.h"
+#include "seq40.h"
+#include "instrument.h"
+
+/* check_status()
+ * Purpose: Exit with a message if the codec failed
+ * Parameters: What was being done, and the status the codec returned
+ * Returns: none
+ */
+static void check_status(const char *what, enum Codec40_status status)
+{
+    if (status != CODEC40_OK) {
+        fprintf(stderr, "40seq: %s: %s\n", what, Codec40_strerror(status));
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* store_rgb()
+ * Purpose: An apply function which copies one pixel into a flat image
+ * Parameters: The current column and row, the pixels array, a pointer
+ *             to the current element, and the flat image
+ * Returns: none
+ */
+static void store_rgb(int col, int row, A2Methods_UArray2 u2,
+                      void *elem, void *cl)
+{
+    (void)u2;
+    struct Codec40_image *image = cl;
+    Pnm_rgb rgb = elem;
+    unsigned char *pixel = image->pixels + (size_t)row * image->stride;
+
+    if (image->maxval < 256) {
+        pixel += (size_t)col * 3;
+        pixel[0] = rgb->red;
+        pixel[1] = rgb->green;
+        pixel[2] = rgb->blue;
+    } else {
+        uint16_t channels[3] = { rgb->red, rgb->green, rgb->blue };
+        memcpy(pixel + (size_t)col * sizeof(channels), channels,
+               sizeof(channels));
+    }
+}
+
+/* read_frame()
+ * Purpose: Read a ppm file into a flat image
+ * Parameters: The name of the file, and the image to fill in, whose
+ *             pixels are reused when it is the same size
+ * Returns: none
+ */
+static void read_frame(const char *path, struct Codec40_image *frame)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    A2Methods_T methods = uarray2_methods_plain;
+    Pnm_ppm pixmap = Pnm_ppmread(fp, methods);
+    assert(pixmap != NULL);
+    fclose(fp);
+
+    size_t stride = (size_t)pixmap->width * 3 *
+                    CODEC40_CHANNEL_BYTES(pixmap->denominator);
+    if (frame->pixels == NULL || frame->stride != stride ||
+        frame->height != pixmap->height) {
+        free(frame->pixels);
+        frame->pixels = malloc(stride * pixmap->height + 1);
+        assert(frame->pixels != NULL);
+    }
+    frame->width = pixmap->width;
+    frame->height = pixmap->height;
+    frame->maxval = pixmap->denominator;
+    frame->stride = stride;
+    methods->map_row_major(pixmap->pixels, store_rgb, frame);
+    Pnm_ppmfree(&pixmap);
+}
+
+/* compress_frames()
+ * Purpose: Compress ppm files, in order, into a sequence on stdout
+ * Parameters: The names of the files and how many, the options, and
+ *             how many frames apart keyframes are
+ * Returns: none
+ */
+static void compress_frames(char **paths, int n,
+                            const struct Codec_options *options,
+                            unsigned keyframe_every)
+{
+    Seq40_encoder_T encoder = Seq40_encoder_new(options, keyframe_every);
+    assert(encoder != NULL);
+    struct Codec40_image frame = { 0, 0, 0, 0, NULL };
+    unsigned char *out = NULL;
+    size_t capacity = 0;
+
+    for (int i = 0; i < n; i++) {
+        read_frame(paths[i], &frame);
+        size_t bound = Seq40_frame_bound(frame.width, frame.height);
+        if (bound > capacity) {
+            free(out);
+            capacity = bound;
+            out = malloc(capacity);
+            assert(out != NULL);
+        }
+        size_t len;
+        check_status(paths[i], Seq40_encode_frame(encoder, &frame, out,
+                                                  capacity, &len));
+        fwrite(out, 1, len, stdout);
+    }
+    free(out);
+    free(frame.pixels);
+    Seq40_encoder_free(&encoder);
+}
+
+/* read_all()
+ * Purpose: Read the whole of a file into memory
+ * Parameters: A file pointer, and where to put the number of bytes read
+ * Returns: The bytes, which the caller frees
+ */
+static unsigned char *read_all(FILE *input, size_t *len)
+{
+    size_t capacity = 1 << 16;
+    unsigned char *bytes = malloc(capacity);
+    assert(bytes != NULL);
+    size_t got;
+    *len = 0;
+    while ((got = fread(bytes + *len, 1, capacity - *len, input)) > 0) {
+        *len += got;
+        if (*len == capacity) {
+            capacity *= 2;
+            bytes = realloc(bytes, capacity);
+            assert(bytes != NULL);
+        }
+    }
+    return bytes;
+}
+
+/* decompress_frames()
+ * Purpose: Decompress a sequence into prefix00000.ppm, prefix00001.ppm
+ *          and so on
+ * Parameters: A file pointer which accesses the sequence, and the prefix
+ * Returns: none
+ */
+static void decompress_frames(FILE *input, const char *prefix)
+{
+    size_t len;
+    unsigned char *in = read_all(input, &len);
+    struct Codec40_image frame;
+    check_status("sequence", Seq40_decode_info(in, len, &frame.width,
+                                               &frame.height));
+    frame.maxval = 255;
+    frame.stride = (size_t)frame.width * 3;
+    frame.pixels = malloc(frame.stride * frame.height);
+    assert(frame.pixels != NULL);
+
+    Seq40_decoder_T decoder = Seq40_decoder_new();
+    assert(decoder != NULL);
+    size_t at = 0;
+    for (unsigned n = 0; at < len; n++) {
+        size_t used;
+        check_status("sequence", Seq40_decode_frame(decoder, in + at,
+                                                    len - at, &used,
+                                                    &frame));
+        at += used;
+
+        char path[4096];
+        snprintf(path, sizeof(path), "%s%05u.ppm", prefix, n);
+        FILE *fp = fopen(path, "wb");
+        if (fp == NULL) {
+            perror(path);
+            exit(EXIT_FAILURE);
+        }
+        fprintf(fp, "P6\n%u %u\n%u\n", frame.width, frame.height, 255);
+        fwrite(frame.pixels, 1, frame.stride * frame.height, fp);
+        fclose(fp);
+    }
+    Seq40_decoder_free(&decoder);
+    free(frame.pixels);
+    free(in);
+}
+
+/* usage()
+ * Purpose: Print how to run the program, and exit
+ * Parameters: The program's name
+ * Returns: none
+ */
+static void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s -c [-q profile] [-k frames] [-s] "
+            "frame.ppm... > frames.s40\n"
+            "       %s -d [-o prefix] [-s] [frames.s40]\n",
+            program, program);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    struct Codec_options options = CODEC_OPTIONS_DEFAULT;
+    unsigned keyframe_every = 0;
+    const char *prefix = "frame";
+    int mode = 0;
+    int i;
+
+    for (i = 1; i < argc && *argv[i] == '-'; i++) {
+        if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "-d") == 0) {
+            mode = argv[i][1];
+        } else if (strcmp(argv[i], "-s") == 0) {
+            INSTRUMENT_ENABLE();
+        } else if (strcmp(argv[i], "-q") == 0 && i + 1 < argc) {
+            options.profile = Profile_named(argv[++i]);
+            if (options.profile == NULL) {
+                fprintf(stderr, "%s: unknown profile '%s'\n", argv[0],
+                        argv[i]);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+            keyframe_every = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            prefix = argv[++i];
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    if (mode == 'c' && i < argc) {
+        compress_frames(argv + i, argc - i, &options, keyframe_every);
+    } else if (mode == 'd' && argc - i <= 1) {
+        FILE *fp = i < argc ? fopen(argv[i], "rb") : stdin;
+        if (fp == NULL) {
+            perror(argv[i]);
+            exit(EXIT_FAILURE);
+        }
+        decompress_frames(fp, prefix);
+        if (fp != stdin) {
+            fclose(fp);
+        }
+    } else {
+        usage(argv[0]);
+    }
+    INSTRUMENT_REPORT();
+    return EXIT_SUCCESS;
+}
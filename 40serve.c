@@ -0,0 +1,55 @@
+/*
+ *     40serve.c
+ *     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
+ *     Date: 10-26-20
+ *     arith
+ *
+ *     Purpose: Runs the codec server (see serve40.h) on a Unix socket
+ *              until it is sent SIGINT or SIGTERM, then prints its
+ *              metrics, as JSON, to stderr. With -s (or ARITH40_STATS),
+ *              the workers' stage table (see instrument.h) follows,
+ *              summed over every job.
+ *
+ *              Usage: 40serve [-j workers] [-s] socket
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "serve40.h"
+#include "instrument.h"
+
+static void usage(const char *progname)
+{
+    fprintf(stderr, "Usage: %s [-j workers] [-s] socket\n", progname);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+    struct Serve40_config config = { NULL, 0 };
+    int i;
+
+    for (i = 1; i < argc && *argv[i] == '-'; i++) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            config.workers = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-s") == 0) {
+            INSTRUMENT_ENABLE();
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (i + 1 != argc) {
+        usage(argv[0]);
+    }
+    config.path = argv[i];
+
+    struct Serve40_metrics metrics;
+    if (!Serve40_run(&config, &metrics)) {
+        perror(config.path);
+        return EXIT_FAILURE;
+    }
+    Serve40_print_metrics(stderr, &metrics);
+    INSTRUMENT_REPORT();
+    return EXIT_SUCCESS;
+}
@@ -2,6 +2,7 @@
 
 #include <a2blocked.h>
 #include "uarray2b.h"
+#include "a2order.h"
 
 // define a private version of each function in A2Methods_T that we implement
 
@@ -94,3 +95,74 @@ static struct A2Methods_T uarray2_methods_blocked_struct = {
 // finally the payoff: here is the exported pointer to the struct
 
 A2Methods_T uarray2_methods_blocked = &uarray2_methods_blocked_struct;
+
+// the same suite with the blocks made and mapped in each other order;
+// a suite is a table of plain function pointers, so each order gets
+// its own copies of the functions that depend on it
+
+#define ORDERED_SUITE(name, order)					\
+static A2 new_##name(int width, int height, int size)			\
+{									\
+	return UArray2b_new_64K_block_ordered(width, height, size, order); \
+}									\
+static A2 new_with_blocksize_##name(int width, int height, int size,	\
+				    int blocksize)			\
+{									\
+	return UArray2b_new_ordered(width, height, size, blocksize, order); \
+}									\
+static void map_##name(A2 array2, A2Methods_applyfun apply, void *cl)	\
+{									\
+	UArray2b_map_ordered(array2, order, (applyfun *) apply, cl);	\
+}									\
+static void small_map_##name(A2 a2, A2Methods_smallapplyfun apply,	\
+			     void *cl)					\
+{									\
+	struct small_closure mycl = { apply, cl };			\
+	UArray2b_map_ordered(a2, order, apply_small, &mycl);		\
+}									\
+static struct A2Methods_T suite_##name = {				\
+	new_##name, new_with_blocksize_##name, a2free, width, height,	\
+	size, blocksize, at, NULL, NULL, map_##name, map_##name,	\
+	NULL, NULL, small_map_##name, small_map_##name,			\
+};
+
+ORDERED_SUITE(rows, A2_ORDER_ROWS)
+ORDERED_SUITE(morton, A2_ORDER_MORTON)
+#undef ORDERED_SUITE
+
+static const char *order_names[A2_ORDER_COUNT] = {
+	"columns", "rows", "morton"
+};
+
+A2Methods_T uarray2_methods_blocked_in(enum A2_order order)
+{
+	switch (order) {
+	case A2_ORDER_ROWS:
+		return &suite_rows;
+	case A2_ORDER_MORTON:
+		return &suite_morton;
+	default:
+		return uarray2_methods_blocked;
+	}
+}
+
+enum A2_order A2_order_of(const struct A2Methods_T *methods)
+{
+	for (int order = 0; order < A2_ORDER_COUNT; order++) {
+		if (methods == uarray2_methods_blocked_in(order)) {
+			return order;
+		}
+	}
+	return A2_ORDER_COUNT;
+}
+
+enum A2_order A2_order_named(const char *name)
+{
+	int order;
+	for (order = 0; order < A2_ORDER_COUNT; order++) {
+		if (strcmp(order_names[order], name) == 0) {
+			break;
+		}
+	}
+	return order;
+}
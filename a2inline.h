@@ -0,0 +1,109 @@
+/*
+ *     a2inline.h
+ *     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
+ *     Date: 10-26-20
+ *     arith
+ *
+ *     Purpose: Maps over plain and blocked arrays that the compiler can
+ *              see through. Mapping through an A2Methods_T costs two
+ *              calls per cell that can never be inlined: the suite's
+ *              map, and then the apply function. The macros below define
+ *              a map for one element type and one apply function, as a
+ *              static function of the file that uses it, so that the
+ *              loop, the element stride and the body of apply are
+ *              compiled together. The A2Methods_T interface is left as
+ *              it is for code which does not know its arrays.
+ *
+ *              A2_PLAIN_MAP(name, type, apply) defines an A2_plain_map
+ *              which visits a UArray2 of type in row-major order, as
+ *              map_row_major does.
+ *
+ *              A2_BLOCKED_MAP(name, type, blocksize, apply) defines an
+ *              A2_blocked_map which visits a UArray2b of type made by
+ *              the given methods, as their map_block_major does. Blocks
+ *              laid out down columns or along rows (see a2order.h) are
+ *              walked inline; other orders go through the methods.
+ *
+ *              apply has the A2Methods_applyfun signature and must be
+ *              defined in the same file to be inlined. Both maps rely on
+ *              how a2plain.c and uarray2b.c store cells: each row of a
+ *              UArray2, and each block of a UArray2b, is one UArray, so
+ *              its cells are next to each other in memory.
+ */
+
+#ifndef A2INLINE_INCLUDED
+#define A2INLINE_INCLUDED
+
+#include "assert.h"
+#include "a2methods.h"
+#include "uarray2.h"
+#include "uarray2b.h"
+#include "a2order.h"
+
+/* the first cell of block (bx, by) of a UArray2b, which the rest of the
+   block's cells follow (from uarray2b.c) */
+extern void *UArray2b_block_at(UArray2b_T array2b, int bx, int by);
+
+/* the functions the macros define */
+typedef void A2_plain_map(A2Methods_UArray2 array, void *cl);
+typedef void A2_blocked_map(const struct A2Methods_T *methods,
+                            A2Methods_UArray2 array, void *cl);
+
+#define A2_PLAIN_MAP(name, type, apply)                                     \
+static void name(A2Methods_UArray2 array, void *cl)                         \
+{                                                                           \
+    int width = UArray2_width(array);                                       \
+    int height = UArray2_height(array);                                     \
+    assert(UArray2_size(array) == sizeof(type));                            \
+    for (int row = 0; row < height && width > 0; row++) {                   \
+        type *cells = UArray2_at(array, 0, row);                            \
+        for (int col = 0; col < width; col++) {                             \
+            apply(col, row, array, &cells[col], cl);                        \
+        }                                                                   \
+    }                                                                       \
+}
+
+#define A2_BLOCKED_MAP(name, type, blocksize, apply)                        \
+static inline void name##_block(A2Methods_UArray2 array, int bx, int by,    \
+                                int width, int height, void *cl)            \
+{                                                                           \
+    int col0 = bx * (blocksize), row0 = by * (blocksize);                   \
+    type *cells = UArray2b_block_at(array, bx, by);                         \
+    for (int cell = 0; cell < (blocksize) * (blocksize); cell++) {          \
+        int col = col0 + cell / (blocksize);                                \
+        int row = row0 + cell % (blocksize);                                \
+        if (col < width && row < height) {                                  \
+            apply(col, row, array, &cells[cell], cl);                       \
+        }                                                                   \
+    }                                                                       \
+}                                                                           \
+static void name(const struct A2Methods_T *methods,                         \
+                 A2Methods_UArray2 array, void *cl)                         \
+{                                                                           \
+    enum A2_order order = A2_order_of(methods);                             \
+    if (order != A2_ORDER_ROWS && order != A2_ORDER_COLUMNS) {              \
+        methods->map_block_major(array, apply, cl);                         \
+        return;                                                             \
+    }                                                                       \
+    int width = UArray2b_width(array);                                      \
+    int height = UArray2b_height(array);                                    \
+    int blocks_wide = (width + (blocksize) - 1) / (blocksize);              \
+    int blocks_high = (height + (blocksize) - 1) / (blocksize);             \
+    assert(UArray2b_blocksize(array) == (blocksize));                       \
+    assert(UArray2b_size(array) == sizeof(type));                           \
+    if (order == A2_ORDER_ROWS) {                                           \
+        for (int by = 0; by < blocks_high; by++) {                          \
+            for (int bx = 0; bx < blocks_wide; bx++) {                      \
+                name##_block(array, bx, by, width, height, cl);             \
+            }                                                               \
+        }                                                                   \
+    } else {                                                                \
+        for (int bx = 0; bx < blocks_wide; bx++) {                          \
+            for (int by = 0; by < blocks_high; by++) {                      \
+                name##_block(array, bx, by, width, height, cl);             \
+            }                                                               \
+        }                                                                   \
+    }                                                                       \
+}
+
+#endif
@@ -0,0 +1,52 @@
+/*
+ *     a2order.h
+ *     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
+ *     Date: 10-26-20
+ *     arith
+ *
+ *     Purpose: Orders in which the blocks of a UArray2b can be laid out
+ *              and mapped over, and blocked method suites which use
+ *              them. UArray2b_map() goes down columns of blocks; going
+ *              along rows of blocks instead matches images and
+ *              compressed files, which are both stored a row at a time.
+ *              The cells of a block are mapped over in the same order in
+ *              every case.
+ */
+
+#ifndef A2ORDER_INCLUDED
+#define A2ORDER_INCLUDED
+
+#include "a2methods.h"
+#include "uarray2b.h"
+
+enum A2_order
+{
+    A2_ORDER_COLUMNS = 0,   /* down each column of blocks in turn */
+    A2_ORDER_ROWS,          /* along each row of blocks in turn */
+    A2_ORDER_MORTON,        /* Z order, by quadrants of quadrants */
+    A2_ORDER_COUNT
+};
+
+extern UArray2b_T UArray2b_new_ordered(int width, int height, int size,
+                                       int blocksize, enum A2_order order);
+extern UArray2b_T UArray2b_new_64K_block_ordered(int width, int height,
+                                                 int size,
+                                                 enum A2_order order);
+extern void UArray2b_map_ordered(UArray2b_T array2b, enum A2_order order,
+                                 void apply(int col, int row,
+                                            UArray2b_T array2b,
+                                            void *elem, void *cl),
+                                 void *cl);
+
+/* uarray2_methods_blocked, but making and mapping blocks in an order */
+extern A2Methods_T uarray2_methods_blocked_in(enum A2_order order);
+
+/* the order a suite from uarray2_methods_blocked_in() was made with, or
+   A2_ORDER_COUNT for any other suite */
+extern enum A2_order A2_order_of(const struct A2Methods_T *methods);
+
+/* the order with a name ("columns", "rows" or "morton"), or
+   A2_ORDER_COUNT if there is none */
+extern enum A2_order A2_order_named(const char *name);
+
+#endif
@@ -5,16 +5,33 @@
  *     arith 
  *
  *     Purpose: Contains series of arithmetic functions which 
- *              read from image files, decompress images, and 
- *              print the decompressed images in big-endian order.
+ *              convert in-memory rgb images, compress them, and 
+ *              store the compressed images in big-endian order.
  *              Also contains arithmetic functions which do the 
- *              reverse: read from compressed files, unpack bitpacked 
- *              words, and print out a similar image to the original 
+ *              reverse: read compressed images, unpack bitpacked 
+ *              words, and store a similar image to the original 
  *              (decompressed) image. 
  */ 
 
 
+#include <string.h>
+#include <ctype.h>
 #include "arith_helper.h"
+#include "a2inline.h"
+#include "entropy.h"
+#include "progressive40.h"
+#include "pages40.h"
+#include "instrument.h"
+
+/* the order blocks go in when ARITH40_ORDER does not say (see 
+   block_order()) */
+#define DEFAULT_ORDER A2_ORDER_ROWS
+
+/* first line of a compressed image; for the default profile with plain 
+   32-bit codewords it is exactly this, otherwise an 'r' follows if the 
+   codewords are entropy coded or a 'p' if they are laid out coarse to 
+   fine, then a space and the profile's name */
+#define MAGIC "COMP40 Compressed image format 2"
 
 /* stores compnent video data */
 struct Pnm_cv_T
@@ -48,110 +65,204 @@ struct Codeword
     A2Methods_T methods; 
 }; 
 
-/*read_and_populate()
- * Purpose: read from a file and populate an A2Methods_UArray 
- *          with a blocksize of 2 with pixel information from the file
- * Parameters: A pointer to an open file, and the methods suite
- * Returns: The populated Pnm_ppm pixmap
- * Notes: Cuts off the last row or column of an image 
-          if and only if either appear in an odd number
+/* pixel_at()
+ * Purpose: Find the first channel of one pixel of an in-memory image
+ * Parameters: The image, and the column and row of the pixel
+ * Returns: A pointer to the pixel's red channel
  */
-Pnm_ppm read_and_populate(FILE *input, A2Methods_T methods)
+static inline unsigned char *pixel_at(const struct Codec40_image *image,
+                                      int col, int row)
 {
-    assert(input != NULL);
-    assert(methods != NULL); 
-    /* Since we cannot choose the blocksize in ppmread, we must 
-    populate a default blocked array and manually dictate the blocksize */
-    Pnm_ppm pixmap = Pnm_ppmread(input, methods);
-    assert(pixmap != NULL);
-
-    int width = pixmap->width;
-    int height = pixmap->height;
-    int size = methods->size(pixmap->pixels);
-
-    /*if the width or the height is an odd number, 
-    delete the last row or column*/
-    if ((width % 2) != 0) {
-        width--;
-    }
-    if ((height % 2) != 0) {
-        height--;
-    }
+    return image->pixels + (size_t)row * image->stride + 
+           (size_t)col * 3 * CODEC40_CHANNEL_BYTES(image->maxval);
+}
 
-    /* Create a new UArray2b with a blocksize of 2,
-    which will make accessing a 2x2 block simpler */
-    A2Methods_UArray2 new_array = methods->new_with_blocksize(
-                                  width, height, size, 2);
-    assert(new_array != NULL);
+/* the passes which are the same for every profile, as maps with their 
+   apply functions inlined (see a2inline.h) */
+A2_BLOCKED_MAP(map_to_floating, struct Pnm_cv_T, 2, to_floating)
+A2_BLOCKED_MAP(map_to_rgb, struct Pnm_cv_T, 2, to_rgb)
+A2_BLOCKED_MAP(map_populate_small, struct Pnm_cv_T, 2, populate_small)
+A2_BLOCKED_MAP(map_populate_big, struct Codeword, 1, populate_big)
+A2_PLAIN_MAP(map_store_codeword, uint32_t, store_codeword)
+A2_PLAIN_MAP(map_load_codeword, uint32_t, load_codeword)
+A2_PLAIN_MAP(map_flatten_word, uint32_t, flatten_word)
+A2_PLAIN_MAP(map_unflatten_word, uint32_t, unflatten_word)
+
+/* workspace_init()
+ * Purpose: Start a workspace with no arrays
+ * Parameters: The workspace
+ * Returns: none
+ */
+void workspace_init(struct Workspace *ws)
+{
+    memset(ws, 0, sizeof(*ws));
+}
 
-    A2Methods_UArray2 old_array = pixmap->pixels;
-    methods->map_block_major(old_array, populate_new, new_array);
-    pixmap->pixels = new_array;
-    free_old_array(old_array, methods); 
+/* workspace_free()
+ * Purpose: Free the arrays of a workspace, leaving it empty
+ * Parameters: The workspace
+ * Returns: none
+ */
+void workspace_free(struct Workspace *ws)
+{
+    free_old_array(ws->video, ws->blocked);
+    free_old_array(ws->codewords, ws->blocked);
+    free_old_array(ws->words, uarray2_methods_plain);
+    size_t nblocks = (size_t)(ws->width / 2) * (ws->height / 2);
+    Pages40_free(ws->y, 4 * nblocks * sizeof(float));
+    Pages40_free(ws->pb, nblocks * sizeof(float));
+    Pages40_free(ws->pr, nblocks * sizeof(float));
+    Pages40_free(ws->flat, nblocks * sizeof(uint32_t) + 1);
+    Pages40_free(ws->payload, ws->payload_size);
+    Pages40_free(ws->scratch, Entropy_scratch_bytes(ws->width / 2, 
+                                                    ws->height / 2));
+    Pages40_free(ws->repeats, nblocks + 1);
+    workspace_init(ws);
+}
 
-    /*if the width and height were changed, 
-    update the corresponding pixmap fields*/
-    pixmap->width = width;
-    pixmap->height = height;
+/* block_order()
+ * Purpose: Find the order the blocked arrays are laid out and mapped in
+ * Parameters: none
+ * Returns: The order ARITH40_ORDER names ("columns", "rows" or 
+ *          "morton"), or else DEFAULT_ORDER
+ * Notes: Every order gives the same output; rows matches the order 
+ *        that images and compressed files are read and written in
+ */
+static enum A2_order block_order(void)
+{
+    const char *name = getenv("ARITH40_ORDER");
+    enum A2_order order = name != NULL ? A2_order_named(name) 
+                                       : A2_ORDER_COUNT;
+    return order != A2_ORDER_COUNT ? order : DEFAULT_ORDER;
+}
 
-    return pixmap;
+/* planar_layout()
+ * Purpose: Find whether images go through planes or through arrays of 
+ *          component video structs
+ * Parameters: none
+ * Returns: false if ARITH40_LAYOUT is "interleaved", true otherwise
+ * Notes: Both give the same output; the interleaved layout is kept to 
+ *        measure the planes against
+ */
+static bool planar_layout(void)
+{
+    const char *name = getenv("ARITH40_LAYOUT");
+    return name == NULL || strcmp(name, "interleaved") != 0;
 }
 
-/* populate_new()
- * Purpose: An apply function which will populate one pixel in the pixmap
- * Parameters: The current column and row, the original pixels array, 
-               a pointer to the current element, and the new array
- * Returns: Nothing
- * Notes: Populates the new pixmap
+/* workspace_fit()
+ * Purpose: Make sure a workspace has arrays for an image of a given size
+ * Parameters: The workspace, and the width and height of the image in 
+ *             pixels, which must be even
+ * Returns: none
+ * Notes: Arrays are only made again when the size changes, so images 
+ *        of one size share them. The entropy coder's buffers are sized 
+ *        for the largest profile.
  */
-void populate_new(int col, int row, A2Methods_UArray2 u2, 
-                  void *elem, void *new_array)
+void workspace_fit(struct Workspace *ws, unsigned width, unsigned height)
 {
-    (void)u2;
-    A2Methods_UArray2 array = (A2Methods_UArray2)new_array;
-    A2Methods_T methods = uarray2_methods_blocked;
-    
-    Pnm_rgb new_location = (Pnm_rgb)methods->at(array, col, row);
-    *new_location = *(Pnm_rgb)elem;
+    assert(width % 2 == 0 && height % 2 == 0);
+    if (ws->words != NULL && ws->width == width && ws->height == height) {
+        return;
+    }
+    workspace_free(ws);
+    A2Methods_T blocked = uarray2_methods_blocked_in(block_order());
+    A2Methods_T plain = uarray2_methods_plain;
+    unsigned blocks_wide = width / 2, blocks_high = height / 2;
+    size_t nblocks = (size_t)blocks_wide * blocks_high;
+
+    ws->width = width;
+    ws->height = height;
+    ws->blocked = blocked;
+    ws->planar = planar_layout();
+    if (ws->planar) {
+        ws->y = Pages40_alloc(4 * nblocks * sizeof(float));
+        ws->pb = Pages40_alloc(nblocks * sizeof(float));
+        ws->pr = Pages40_alloc(nblocks * sizeof(float));
+        assert(ws->y != NULL && ws->pb != NULL && ws->pr != NULL);
+    } else {
+        ws->video = blocked->new_with_blocksize(width, height, 
+                                                sizeof(struct Pnm_cv_T), 2);
+        ws->codewords = blocked->new_with_blocksize(blocks_wide, 
+                                                    blocks_high, 
+                                                    sizeof(struct Codeword),
+                                                    1);
+        assert(ws->video != NULL && ws->codewords != NULL);
+    }
+    ws->words = plain->new(blocks_wide, blocks_high, sizeof(uint32_t));
+    ws->flat = Pages40_alloc(nblocks * sizeof(uint32_t) + 1);
+    ws->payload_size = 0;
+    for (int id = 0; id < PROFILE_COUNT; id++) {
+        size_t bound = Entropy_bound(blocks_wide, blocks_high, 
+                                     &Profile_table[id]);
+        if (bound > ws->payload_size) {
+            ws->payload_size = bound;
+        }
+    }
+    ws->payload = Pages40_alloc(ws->payload_size);
+    ws->scratch = Pages40_alloc(Entropy_scratch_bytes(blocks_wide, 
+                                                      blocks_high));
+    ws->repeats = Pages40_alloc(nblocks + 1);
+    assert(ws->repeats != NULL);
+    assert(ws->words != NULL);
+    assert(ws->flat != NULL && ws->payload != NULL && ws->scratch != NULL);
 }
 
 /* convert_to_floating()
- * Purpose: Convert the rgb values of a pixmap to floating component video
- * Parameters: The pixmap and the methods suite
- * Returns: The Pnm_ppm pixmap, newly populated with component video data
+ * Purpose: Convert the rgb values of an image to floating component video
+ * Parameters: The image, the pixmap to fill in, and the workspace
+ * Returns: The pixmap, populated with component video data in the 
+ *          workspace's UArray2b with a blocksize of 2, which makes 
+ *          accessing a 2x2 block simpler
+ * Notes: Cuts off the last row or column of an image 
+ *        if and only if either appear in an odd number
  */
-Pnm_ppm convert_to_floating(Pnm_ppm pixmap)
+Pnm_ppm convert_to_floating(const struct Codec40_image *image, 
+                            Pnm_ppm pixmap, struct Workspace *ws)
 { 
-    A2Methods_UArray2 old_array = pixmap->pixels;
-    A2Methods_UArray2 new_array = pixmap->methods->new_with_blocksize(
-                                  pixmap->width, pixmap->height, 
-                                  sizeof(struct Pnm_cv_T), 2);
-    pixmap->pixels = new_array;
-    pixmap->methods->map_block_major(old_array, to_floating, pixmap);
-    if (old_array != NULL) {
-       pixmap->methods->free(&old_array);
-    }
+    assert(image != NULL);
+    assert(pixmap != NULL);
+    STAGE_BEGIN(mark);
+
+    /*if the width or the height is an odd number, 
+    leave out the last row or column*/
+    pixmap->width = image->width - image->width % 2;
+    pixmap->height = image->height - image->height % 2;
+    pixmap->denominator = image->maxval;
+    workspace_fit(ws, pixmap->width, pixmap->height);
+    A2Methods_T methods = ws->blocked;
+    pixmap->methods = methods;
+    pixmap->pixels = ws->video;
+    map_to_floating(methods, pixmap->pixels, (void *)image);
+    STAGE_END(mark, "to_floating", (size_t)pixmap->width * pixmap->height);
     return pixmap;
 }
 
 /*to_floating()
  * Purpose: An apply function which converts one rgb pixel to component video
- * Parameters: The current column and row, the original pixels array, 
-               a pointer to the current element, and the pixmap
+ * Parameters: The current column and row, the component video array, 
+               a pointer to the current element, and the rgb image
  * Returns: none
- * Notes: Information on the original rgb values of each pixel is lost 
  */
 void to_floating(int col, int row, A2Methods_UArray2 u2, 
-                 void *elem, void *pixmap)
+                 void *elem, void *image)
 {
     (void)u2;
-    Pnm_ppm pix = (Pnm_ppm)pixmap; 
-    A2Methods_T methods = uarray2_methods_blocked;
-    Pnm_rgb rgb = (Pnm_rgb)elem;
-     
-    float red = (float)rgb->red / pix->denominator;
-    float blue = (float)rgb->blue / pix->denominator;
-    float green = (float)rgb->green / pix->denominator;
+    const struct Codec40_image *img = image;
+    const unsigned char *rgb = pixel_at(img, col, row);
+    float red, green, blue;
+
+    if (img->maxval < 256) {
+        red = (float)rgb[0] / img->maxval;
+        green = (float)rgb[1] / img->maxval;
+        blue = (float)rgb[2] / img->maxval;
+    } else {
+        uint16_t channels[3];
+        memcpy(channels, rgb, sizeof(channels));
+        red = (float)channels[0] / img->maxval;
+        green = (float)channels[1] / img->maxval;
+        blue = (float)channels[2] / img->maxval;
+    }
 
     float y = 0.299 * red + 0.587 * green + 0.114 * blue;
     float pb = -0.168736 * red - 0.331264 * green + 0.5 * blue;
@@ -161,46 +272,37 @@ void to_floating(int col, int row, A2Methods_UArray2 u2,
     push_into_range(&pb, 0.5, -0.5);
     push_into_range(&pr, 0.5, -0.5);
 
-    struct Pnm_cv_T comp_vid; 
-    comp_vid.y = y;
-    comp_vid.pb = pb;
-    comp_vid.pr = pr;
-
-    Pnm_cv new_location = (Pnm_cv)methods->at(pix->pixels, col, row);
-    *new_location = comp_vid;
+    Pnm_cv comp_vid = (Pnm_cv)elem;
+    comp_vid->y = y;
+    comp_vid->pb = pb;
+    comp_vid->pr = pr;
 }
 
 /* convert_to_rgb()
  * Purpose: Convert the component video values of a pixmap to rgb values
- * Parameters: The pixmap and the methods suite
- * Returns: The Pnm_ppm pixmap, newly populated with rgb data
+ * Parameters: The pixmap, and the image to store the rgb values in, 
+ *             which is the same size as the pixmap
+ * Returns: none
  */
-Pnm_ppm convert_to_rgb(Pnm_ppm pixmap)
+void convert_to_rgb(Pnm_ppm pixmap, const struct Codec40_image *image)
 {
-    A2Methods_UArray2 old_array = pixmap->pixels;
-    A2Methods_UArray2 new_array = pixmap->methods->new_with_blocksize(
-                                  pixmap->width, pixmap->height, 
-                                  sizeof(struct Pnm_rgb), 2);
-    pixmap->pixels = new_array;
-    pixmap->methods->map_block_major(old_array, to_rgb, pixmap);
-    
-    if (old_array != NULL) {
-        pixmap->methods->free(&old_array);
-    }
-    return pixmap; 
+    assert(pixmap != NULL);
+    assert(image != NULL);
+    STAGE_BEGIN(mark);
+    map_to_rgb(pixmap->methods, pixmap->pixels, (void *)image);
+    STAGE_END(mark, "to_rgb", (size_t)pixmap->width * pixmap->height);
 }
 
-/*to_floating()
+/*to_rgb()
  * Purpose: An apply function which converts one component video pixel to rgb
- * Parameters: The current column and row, the original pixels array, 
-               a pointer to the current element, and the pixmap
+ * Parameters: The current column and row, the component video array, 
+               a pointer to the current element, and the rgb image
  * Returns: none
  */
-void to_rgb(int col, int row, A2Methods_UArray2 u2, void *elem, void *pixmap)
+void to_rgb(int col, int row, A2Methods_UArray2 u2, void *elem, void *image)
 {
     (void)u2;
-    Pnm_ppm pix = (Pnm_ppm)pixmap; 
-    A2Methods_T methods = uarray2_methods_blocked;
+    const struct Codec40_image *img = image;
 
     Pnm_cv cv = (Pnm_cv)elem;
     float y = cv->y;
@@ -215,7 +317,7 @@ void to_rgb(int col, int row, A2Methods_UArray2 u2, void *elem, void *pixmap)
     push_into_range(&green, 1.0, 0.0);
     push_into_range(&blue, 1.0, 0.0);
 
-    int denominator = pix->denominator;
+    int denominator = img->maxval;
     red *= denominator;
     green *= denominator;
     blue *= denominator;
@@ -224,66 +326,965 @@ void to_rgb(int col, int row, A2Methods_UArray2 u2, void *elem, void *pixmap)
     unsigned green_u = (unsigned)round((double)green);
     unsigned blue_u = (unsigned)round((double)blue);
 
-    struct Pnm_rgb rgb;
-    rgb.red = red_u;
-    rgb.green = green_u;
-    rgb.blue = blue_u;
+    unsigned char *rgb = pixel_at(img, col, row);
+    if (img->maxval < 256) {
+        rgb[0] = red_u;
+        rgb[1] = green_u;
+        rgb[2] = blue_u;
+    } else {
+        uint16_t channels[3] = { red_u, green_u, blue_u };
+        memcpy(rgb, channels, sizeof(channels));
+    }
+}
+
+/* quantize_chroma()
+ * Purpose: Converts the average pb and pr values of a 2x2 block to indices
+ * Parameters: The codeword, and the number of bits per chroma index
+ * Returns: None
+ * Notes: The exact pb and pr values of the 2x2 block are lost in this 
+ *        step. 4-bit indices use the Arith40 table; other widths 
+ *        quantize the range -0.5 to 0.5 uniformly.
+ */
+static inline void quantize_chroma(struct Codeword *codeword, 
+                                   unsigned chroma_bits)
+{
+    if (chroma_bits == 4) {
+        codeword->pb_index = Arith40_index_of_chroma(codeword->avg_pb); 
+        codeword->pr_index = Arith40_index_of_chroma(codeword->avg_pr); 
+    } else {
+        double steps = (1u << chroma_bits) - 2;
+        codeword->pb_index = round((codeword->avg_pb + 0.5) * steps);
+        codeword->pr_index = round((codeword->avg_pr + 0.5) * steps);
+    }
+}
+
+/* dequantize_chroma()
+ * Purpose: Convert one block's pb and pr index to its chroma value
+ * Parameters: The codeword, and the number of bits per chroma index
+ * Returns: None
+ * Notes: The pb and pr values which are populated by this function 
+ *        are the closest that we can achieve to the original value, since 
+ *        the original value was quantized
+ */
+static inline void dequantize_chroma(struct Codeword *codeword, 
+                                     unsigned chroma_bits)
+{
+    if (chroma_bits == 4) {
+        codeword->avg_pb = Arith40_chroma_of_index(codeword->pb_index); 
+        codeword->avg_pr = Arith40_chroma_of_index(codeword->pr_index);  
+    } else {
+        double steps = (1u << chroma_bits) - 2;
+        codeword->avg_pb = codeword->pb_index / steps - 0.5;
+        codeword->avg_pr = codeword->pr_index / steps - 0.5;
+    }
+}
+
+/* quantize_abcd()
+ * Purpose: Covert a, b, c, d into their a, b, c, d indices
+ * Parameters: The codeword, the number of bits for a, and the scale 
+ *             and clamp for b, c and d
+ * Returns: None
+ */
+static inline void quantize_abcd(struct Codeword *codeword, unsigned a_bits,
+                                 double bcd_scale, double bcd_max)
+{
+    float b = codeword->b;
+    float c = codeword->c;
+    float d = codeword->d;
+    push_into_range(&b, bcd_max, -bcd_max);
+    push_into_range(&c, bcd_max, -bcd_max);
+    push_into_range(&d, bcd_max, -bcd_max);
+
+    codeword->a_int = round(codeword->a * (double)((1u << a_bits) - 1));
+    codeword->b_int = round(b * bcd_scale);
+    codeword->c_int = round(c * bcd_scale);
+    codeword->d_int = round(d * bcd_scale);
+}
+
+/* dequantize_abcd()
+ * Purpose: Covert the a, b, c, d indices back into a, b, c, d
+ * Parameters: The codeword, the number of bits for a, and the scale 
+ *             for b, c and d
+ * Returns: None
+ */
+static inline void dequantize_abcd(struct Codeword *codeword, 
+                                   unsigned a_bits, double bcd_scale)
+{
+    codeword->a = (float)(codeword->a_int / (double)((1u << a_bits) - 1));
+    codeword->b = (float)(codeword->b_int / bcd_scale);
+    codeword->c = (float)(codeword->c_int / bcd_scale);
+    codeword->d = (float)(codeword->d_int / bcd_scale);
+}
+
+/*
+ * Unchecked field access for the pack and unpack kernels. Bitpack checks
+ * every width, lsb and value on every call (and Bitpack_newu tests the
+ * value with pow()); here the widths come from the profile table, which
+ * is checked to fit in 32 bits at compile time, and the values come from
+ * the quantizers, which clamp to the field. The header and payload
+ * length are validated once before a decode starts (see read_header()
+ * and read_words()), so nothing in the per-block loops can fail.
+ */
+
+/* field_put()
+ * Purpose: Store the low width bits of value at lsb in an empty field
+ * Parameters: The word, the width and lsb of the field, and the value
+ * Returns: The new word
+ * Notes: Bits of value above width are dropped, so a value that is out
+ *        of range can only spoil its own field
+ */
+static inline uint32_t field_put(uint32_t word, unsigned width, unsigned lsb,
+                                 uint32_t value)
+{
+    return word | ((value & ((UINT32_C(1) << width) - 1)) << lsb);
+}
 
-    Pnm_rgb new_location = (Pnm_rgb)methods->at(pix->pixels, col, row);
-    *new_location = rgb;
+/* field_getu()
+ * Purpose: Extract an unsigned field
+ * Parameters: The word, and the width and lsb of the field (width < 32)
+ * Returns: The field
+ */
+static inline uint32_t field_getu(uint32_t word, unsigned width, unsigned lsb)
+{
+    return (word >> lsb) & ((UINT32_C(1) << width) - 1);
+}
+
+/* field_gets()
+ * Purpose: Extract a signed field
+ * Parameters: The word, and the width and lsb of the field
+ * Returns: The field, sign extended
+ */
+static inline int32_t field_gets(uint32_t word, unsigned width, unsigned lsb)
+{
+    return (int32_t)(word << (32 - width - lsb)) >> (32 - width);
+}
+
+/* pack_luma()
+ * Purpose: Pack the a, b, c, d indices of a codeword
+ * Parameters: The codeword, and the field widths of the profile
+ * Returns: A word with only the a, b, c and d fields set
+ */
+static inline uint32_t pack_luma(const struct Codeword *codeword, 
+                                 unsigned a_bits, unsigned bcd_bits, 
+                                 unsigned chroma_bits)
+{
+    unsigned d_lsb = 2 * chroma_bits;
+
+    uint32_t word = 0;
+    word = field_put(word, a_bits, d_lsb + 3 * bcd_bits, codeword->a_int);
+    word = field_put(word, bcd_bits, d_lsb + 2 * bcd_bits, codeword->b_int);
+    word = field_put(word, bcd_bits, d_lsb + bcd_bits, codeword->c_int);
+    word = field_put(word, bcd_bits, d_lsb, codeword->d_int);
+    return word;
+}
+
+/* pack_chroma()
+ * Purpose: Pack the pb and pr indices of a codeword
+ * Parameters: The codeword, and the chroma field width of the profile
+ * Returns: A word with only the pb and pr fields set
+ */
+static inline uint32_t pack_chroma(const struct Codeword *codeword, 
+                                   unsigned chroma_bits)
+{
+    uint32_t word = 0;
+    word = field_put(word, chroma_bits, chroma_bits, codeword->pb_index);
+    word = field_put(word, chroma_bits, 0, codeword->pr_index);
+    return word;
+}
+
+/* pack_word()
+ * Purpose: Pack a, b, c, d, average pb, and average pr into a 32-bit word
+ * Parameters: The codeword, and the field widths of the profile
+ * Returns: The packed word
+ */
+static inline uint32_t pack_word(const struct Codeword *codeword, 
+                                 unsigned a_bits, unsigned bcd_bits, 
+                                 unsigned chroma_bits)
+{
+    return pack_luma(codeword, a_bits, bcd_bits, chroma_bits) | 
+           pack_chroma(codeword, chroma_bits);
+}
+
+/* unpack_luma()
+ * Purpose: Unpack the a, b, c, d indices of a 32-bit word
+ * Parameters: The word, the codeword to fill in, and the field widths 
+ *             of the profile
+ * Returns: None
+ */
+static inline void unpack_luma(uint32_t word, struct Codeword *codeword,
+                               unsigned a_bits, unsigned bcd_bits, 
+                               unsigned chroma_bits)
+{
+    unsigned d_lsb = 2 * chroma_bits;
+
+    codeword->a_int = field_getu(word, a_bits, d_lsb + 3 * bcd_bits);
+    codeword->b_int = field_gets(word, bcd_bits, d_lsb + 2 * bcd_bits);
+    codeword->c_int = field_gets(word, bcd_bits, d_lsb + bcd_bits);
+    codeword->d_int = field_gets(word, bcd_bits, d_lsb);
+}
+
+/* unpack_chroma()
+ * Purpose: Unpack the pb and pr indices of a 32-bit word
+ * Parameters: The word, the codeword to fill in, and the chroma field 
+ *             width of the profile
+ * Returns: None
+ */
+static inline void unpack_chroma(uint32_t word, struct Codeword *codeword,
+                                 unsigned chroma_bits)
+{
+    codeword->pb_index = field_getu(word, chroma_bits, chroma_bits);
+    codeword->pr_index = field_getu(word, chroma_bits, 0);
+}
+
+/* unpack_word()
+ * Purpose: Unpack one 32-bit word to reveal a, b, c, d, pb, and pr index
+ * Parameters: The word, the codeword to fill in, and the field widths 
+ *             of the profile
+ * Returns: None
+ */
+static inline void unpack_word(uint32_t word, struct Codeword *codeword,
+                               unsigned a_bits, unsigned bcd_bits, 
+                               unsigned chroma_bits)
+{
+    unpack_luma(word, codeword, a_bits, bcd_bits, chroma_bits);
+    unpack_chroma(word, codeword, chroma_bits);
+}
+
+/* block_to_video()
+ * Purpose: Take one 2x2 block of an image to the y of each pixel and 
+ *          the average pb and pr of the block
+ * Parameters: The image, the column and row of the block, where to put
+ *             the four y, left to right and then top to bottom, and the
+ *             codeword whose average pb and pr to fill in
+ * Returns: none
+ * Notes: Does exactly the sums that to_floating() and populate_small() 
+ *        do, in the order map_block_major() visits a block, so the 
+ *        averages come out the same to the bit
+ */
+static inline void block_to_video(const struct Codec40_image *image,
+                                  int col, int row, float y[4],
+                                  struct Codeword *codeword)
+{
+    struct Pnm_cv_T cv[4];
+    to_floating(2 * col, 2 * row, NULL, &cv[0], (void *)image);
+    to_floating(2 * col, 2 * row + 1, NULL, &cv[1], (void *)image);
+    to_floating(2 * col + 1, 2 * row, NULL, &cv[2], (void *)image);
+    to_floating(2 * col + 1, 2 * row + 1, NULL, &cv[3], (void *)image);
+
+    float pb_sum = 0.0, pr_sum = 0.0;
+    for (int i = 0; i < 4; i++) {
+        pb_sum += cv[i].pb;
+        pr_sum += cv[i].pr;
+    }
+    float avg_pb = pb_sum / 4.0;
+    float avg_pr = pr_sum / 4.0;
+    push_into_range(&avg_pb, 0.5, -0.5);
+    push_into_range(&avg_pr, 0.5, -0.5);
+    codeword->avg_pb = avg_pb;
+    codeword->avg_pr = avg_pr;
+
+    y[0] = cv[0].y;
+    y[1] = cv[2].y;
+    y[2] = cv[1].y;
+    y[3] = cv[3].y;
+}
+
+/* block_to_codeword()
+ * Purpose: Take one 2x2 block of an image straight to its average pb 
+ *          and pr and its a, b, c, d, without the component video array
+ * Parameters: The image, the column and row of the block, and the 
+ *             codeword to fill in
+ * Returns: none
+ */
+static inline void block_to_codeword(const struct Codec40_image *image,
+                                     int col, int row, 
+                                     struct Codeword *codeword)
+{
+    float y_array[4];
+    block_to_video(image, col, row, y_array, codeword);
+    compute_dct(y_array, codeword);
+}
+
+/* inverse_dct()
+ * Purpose: Find the y of each pixel of a 2x2 block from its a, b, c, d
+ * Parameters: The codeword, and where to put the four y, left to right 
+ *             and then top to bottom
+ * Returns: none
+ */
+static inline void inverse_dct(const struct Codeword *codeword, float y[4])
+{
+    float a = codeword->a, b = codeword->b;
+    float c = codeword->c, d = codeword->d;
+    y[0] = a - b - c + d;
+    y[1] = a - b + c - d;
+    y[2] = a + b - c - d;
+    y[3] = a + b + c + d;
+    for (int i = 0; i < 4; i++) {
+        push_into_range(&y[i], 1.0, 0.0);
+    }
+}
+
+/* codeword_to_block()
+ * Purpose: Take one codeword straight to the rgb pixels of its 2x2 
+ *          block, without the component video array
+ * Parameters: The codeword, with a, b, c, d and the average pb and pr,
+ *             the image, and the column and row of the block
+ * Returns: none
+ * Notes: Does exactly the sums that populate_big() and to_rgb() do, so 
+ *        the pixels come out the same
+ */
+static inline void codeword_to_block(const struct Codeword *codeword,
+                                     const struct Codec40_image *image,
+                                     int col, int row)
+{
+    float y[4];
+    inverse_dct(codeword, y);
+    for (int i = 0; i < 4; i++) {
+        struct Pnm_cv_T cv = { y[i], codeword->avg_pb, codeword->avg_pr };
+        to_rgb(2 * col + i % 2, 2 * row + i / 2, NULL, &cv, (void *)image);
+    }
+}
+
+/*
+ * The apply functions of each quantization profile. They are generated 
+ * from PROFILE_TABLE with the profile's numbers as constants, so each 
+ * profile gets its own specialized loop bodies, and the choice of 
+ * profile is made once per image (see kernels_of()), never per pixel.
+ *
+ *   to_index:      average pb and pr of a codeword -> chroma indices
+ *   abcd_to_index: a, b, c, d of a codeword -> their indices
+ *   packing:       codeword -> 32-bit word, stored into the Image_data 
+ *                  array at the same col and row
+ *   get_bits:      32-bit word -> codeword indices, stored into the 
+ *                  Image_data array at the same col and row
+ *   index_to_abcd: indices of a codeword -> a, b, c, d
+ *   to_chroma:     chroma indices of a codeword -> average pb and pr
+ *   encode_block:  2x2 block of an image -> 32-bit word, all in one go
+ *   decode_block:  32-bit word -> 2x2 block of an image, all in one go
+ *
+ * and the row kernels of the planar layout, which go along one row of 
+ * 2x2 blocks and touch only the planes they need (see encode_planes()):
+ *
+ *   luma_to_words:   y of the block row's two pixel rows -> a, b, c, d
+ *                    fields of its words
+ *   chroma_to_words: pb and pr of the block row -> pb and pr fields, 
+ *                    added to its words
+ *   words_to_luma:   words -> y of the block row's two pixel rows
+ *   words_to_chroma: words -> pb and pr of the block row
+ */
+
+/* one row of 2x2 blocks between its words and two rows of planes: the y
+   of its top and bottom pixel rows, or its pb and pr */
+typedef void Planes_to_words(const float *first, const float *second,
+                             uint32_t *words, unsigned n);
+typedef void Words_to_planes(const uint32_t *words, float *first,
+                             float *second, unsigned n);
+
+#define PROFILE_KERNELS(name, a_bits, bcd_bits, chroma_bits,                \
+                        bcd_scale, bcd_max)                                 \
+static void to_index_##name(int col, int row, A2Methods_UArray2 u2,         \
+                            void *elem, void *cl)                           \
+{                                                                           \
+    (void)col; (void)row; (void)u2; (void)cl;                               \
+    quantize_chroma(elem, chroma_bits);                                     \
+}                                                                           \
+static void abcd_to_index_##name(int col, int row, A2Methods_UArray2 u2,    \
+                                 void *elem, void *cl)                      \
+{                                                                           \
+    (void)col; (void)row; (void)u2; (void)cl;                               \
+    quantize_abcd(elem, a_bits, bcd_scale, bcd_max);                        \
+}                                                                           \
+static void packing_##name(int col, int row, A2Methods_UArray2 u2,          \
+                           void *elem, void *Image_data)                    \
+{                                                                           \
+    (void)u2;                                                               \
+    struct Image_data *image = (struct Image_data *)Image_data;             \
+    uint32_t *location = image->methods->at(image->array, col, row);        \
+    *location = pack_word(elem, a_bits, bcd_bits, chroma_bits);             \
+}                                                                           \
+static void get_bits_##name(int col, int row, A2Methods_UArray2 u2,         \
+                            void *elem, void *Image_data)                   \
+{                                                                           \
+    (void)u2;                                                               \
+    struct Image_data *image = (struct Image_data *)Image_data;             \
+    struct Codeword *location = image->methods->at(image->array, col, row); \
+    unpack_word(*(uint32_t *)elem, location, a_bits, bcd_bits, chroma_bits);\
+}                                                                           \
+static void index_to_abcd_##name(int col, int row, A2Methods_UArray2 u2,    \
+                                 void *elem, void *cl)                      \
+{                                                                           \
+    (void)col; (void)row; (void)u2; (void)cl;                               \
+    dequantize_abcd(elem, a_bits, bcd_scale);                               \
+}                                                                           \
+static void to_chroma_##name(int col, int row, A2Methods_UArray2 u2,        \
+                             void *elem, void *cl)                          \
+{                                                                           \
+    (void)col; (void)row; (void)u2; (void)cl;                               \
+    dequantize_chroma(elem, chroma_bits);                                   \
+}                                                                           \
+A2_BLOCKED_MAP(map_to_index_##name, struct Codeword, 1, to_index_##name)    \
+A2_BLOCKED_MAP(map_abcd_to_index_##name, struct Codeword, 1,                \
+               abcd_to_index_##name)                                        \
+A2_BLOCKED_MAP(map_packing_##name, struct Codeword, 1, packing_##name)      \
+A2_PLAIN_MAP(map_get_bits_##name, uint32_t, get_bits_##name)                \
+A2_BLOCKED_MAP(map_index_to_abcd_##name, struct Codeword, 1,                \
+               index_to_abcd_##name)                                        \
+A2_BLOCKED_MAP(map_to_chroma_##name, struct Codeword, 1, to_chroma_##name)  \
+static uint32_t encode_block_##name(const struct Codec40_image *image,      \
+                                    int col, int row)                       \
+{                                                                           \
+    struct Codeword codeword;                                               \
+    block_to_codeword(image, col, row, &codeword);                          \
+    quantize_chroma(&codeword, chroma_bits);                                \
+    quantize_abcd(&codeword, a_bits, bcd_scale, bcd_max);                   \
+    return pack_word(&codeword, a_bits, bcd_bits, chroma_bits);             \
+}                                                                           \
+static void decode_block_##name(uint32_t word,                              \
+                                const struct Codec40_image *image,          \
+                                int col, int row)                           \
+{                                                                           \
+    struct Codeword codeword;                                               \
+    unpack_word(word, &codeword, a_bits, bcd_bits, chroma_bits);            \
+    dequantize_abcd(&codeword, a_bits, bcd_scale);                          \
+    dequantize_chroma(&codeword, chroma_bits);                              \
+    codeword_to_block(&codeword, image, col, row);                          \
+}                                                                           \
+static void luma_to_words_##name(const float *top, const float *bottom,    \
+                                 uint32_t *words, unsigned n)               \
+{                                                                           \
+    for (unsigned col = 0; col < n; col++) {                                \
+        float y[4] = { top[2 * col], top[2 * col + 1],                      \
+                       bottom[2 * col], bottom[2 * col + 1] };              \
+        struct Codeword codeword;                                           \
+        compute_dct(y, &codeword);                                          \
+        quantize_abcd(&codeword, a_bits, bcd_scale, bcd_max);               \
+        words[col] = pack_luma(&codeword, a_bits, bcd_bits, chroma_bits);   \
+    }                                                                       \
+}                                                                           \
+static void chroma_to_words_##name(const float *pb, const float *pr,        \
+                                   uint32_t *words, unsigned n)             \
+{                                                                           \
+    for (unsigned col = 0; col < n; col++) {                                \
+        struct Codeword codeword;                                           \
+        codeword.avg_pb = pb[col];                                          \
+        codeword.avg_pr = pr[col];                                          \
+        quantize_chroma(&codeword, chroma_bits);                            \
+        words[col] |= pack_chroma(&codeword, chroma_bits);                  \
+    }                                                                       \
+}                                                                           \
+static void words_to_luma_##name(const uint32_t *words, float *top,         \
+                                 float *bottom, unsigned n)                 \
+{                                                                           \
+    for (unsigned col = 0; col < n; col++) {                                \
+        struct Codeword codeword;                                           \
+        float y[4];                                                         \
+        unpack_luma(words[col], &codeword, a_bits, bcd_bits, chroma_bits);  \
+        dequantize_abcd(&codeword, a_bits, bcd_scale);                      \
+        inverse_dct(&codeword, y);                                          \
+        top[2 * col] = y[0];                                                \
+        top[2 * col + 1] = y[1];                                            \
+        bottom[2 * col] = y[2];                                             \
+        bottom[2 * col + 1] = y[3];                                         \
+    }                                                                       \
+}                                                                           \
+static void words_to_chroma_##name(const uint32_t *words, float *pb,        \
+                                   float *pr, unsigned n)                   \
+{                                                                           \
+    for (unsigned col = 0; col < n; col++) {                                \
+        struct Codeword codeword;                                           \
+        unpack_chroma(words[col], &codeword, chroma_bits);                  \
+        dequantize_chroma(&codeword, chroma_bits);                          \
+        pb[col] = codeword.avg_pb;                                          \
+        pr[col] = codeword.avg_pr;                                          \
+    }                                                                       \
+}
+PROFILE_TABLE(PROFILE_KERNELS)
+#undef PROFILE_KERNELS
+
+/* the kernels of one profile; the passes over whole arrays come as maps
+   with the apply function inlined (see a2inline.h) */
+struct Kernels
+{
+    A2_blocked_map *to_index, *abcd_to_index, *packing;
+    A2_plain_map *get_bits;
+    A2_blocked_map *index_to_abcd, *to_chroma;
+    Block_encoder *encode_block;
+    Block_decoder *decode_block;
+    Planes_to_words *luma_to_words, *chroma_to_words;
+    Words_to_planes *words_to_luma, *words_to_chroma;
+};
+
+#define KERNELS_ENTRY(name, a_bits, bcd_bits, chroma_bits,                  \
+                      bcd_scale, bcd_max)                                   \
+    { map_to_index_##name, map_abcd_to_index_##name, map_packing_##name,    \
+      map_get_bits_##name, map_index_to_abcd_##name, map_to_chroma_##name,  \
+      encode_block_##name, decode_block_##name,                             \
+      luma_to_words_##name, chroma_to_words_##name,                         \
+      words_to_luma_##name, words_to_chroma_##name },
+static const struct Kernels profile_kernels[PROFILE_COUNT] = {
+    PROFILE_TABLE(KERNELS_ENTRY)
+};
+#undef KERNELS_ENTRY
+
+/* kernels_of()
+ * Purpose: Find the apply functions of a quantization profile
+ * Parameters: The profile
+ * Returns: A pointer to the profile's apply functions
+ */
+static const struct Kernels *kernels_of(const struct Profile *profile)
+{
+    assert(profile != NULL && profile->id < PROFILE_COUNT);
+    return &profile_kernels[profile->id];
+}
+
+/* block_encoder_of()
+ * Purpose: Find the function which codes one 2x2 block with a profile
+ * Parameters: The profile
+ * Returns: A function which takes an image and the column and row of 
+ *          a block, and returns the block's 32-bit word
+ */
+Block_encoder *block_encoder_of(const struct Profile *profile)
+{
+    return kernels_of(profile)->encode_block;
+}
+
+/* block_decoder_of()
+ * Purpose: Find the function which decodes one 32-bit word of a profile
+ * Parameters: The profile
+ * Returns: A function which takes a word, an image, and the column and 
+ *          row of a block, and writes the block's pixels into the image
+ */
+Block_decoder *block_decoder_of(const struct Profile *profile)
+{
+    return kernels_of(profile)->decode_block;
 }
 
 /*block_arith()
  * Purpose: Perform multiple arithmetic steps on each pixel of the pixmap
             in order to convert the data to 32-bit packed codewords
- * Parameters: The pixmap and the methods suite
- * Returns: The pixmap, which is now populated with bitpacked codewords
+ * Parameters: The pixmap, the methods suite, the quantization profile, 
+ *             and the workspace
+ * Returns: The workspace's UArray2 of the bitpacked codewords, one per 
+ *          2x2 block
+ * Notes: The pixmap is left holding one codeword struct per 2x2 block
  */
-Pnm_ppm block_arith(Pnm_ppm pixmap, A2Methods_T methods){
+A2Methods_UArray2 block_arith(Pnm_ppm pixmap, A2Methods_T methods,
+                              const struct Profile *profile,
+                              struct Workspace *ws)
+{
     assert(pixmap != NULL);
     assert(methods != NULL);
-
-    pixmap = average2x2(pixmap, methods); 
-    methods->map_block_major(pixmap->pixels, to_index, NULL); 
-    methods->map_block_major(pixmap->pixels, abcd_to_index, NULL); 
+    assert(profile != NULL);
+    const struct Kernels *kernels = kernels_of(profile);
+
+    STAGE_BEGIN(average_mark);
+    pixmap = average2x2(pixmap, methods, ws->codewords); 
+    size_t nblocks = (size_t)pixmap->width * pixmap->height;
+    STAGE_END(average_mark, "average2x2", nblocks);
+
+    STAGE_BEGIN(index_mark);
+    kernels->to_index(methods, pixmap->pixels, NULL);
+    STAGE_END(index_mark, "to_index", nblocks);
+    STAGE_BEGIN(abcd_mark);
+    kernels->abcd_to_index(methods, pixmap->pixels, NULL);
+    STAGE_END(abcd_mark, "abcd_to_index", nblocks);
     
     A2Methods_T new_methods = uarray2_methods_plain; 
-    A2Methods_UArray2 new_array = new_methods->new(
-                                  pixmap->width, pixmap->height, 
-                                  sizeof(uint32_t));
-    assert(new_array != NULL); 
-    
     struct Image_data image_data;
-    image_data.array = new_array; 
+    image_data.array = ws->words; 
     image_data.methods = new_methods; 
     image_data.pb_sum = 0.0;
     image_data.pr_sum = 0.0;
     
-    methods->map_block_major(pixmap->pixels, packing, &image_data); 
-    print_image(pixmap, new_methods, image_data.array); 
+    STAGE_BEGIN(packing_mark);
+    kernels->packing(methods, pixmap->pixels, &image_data);
+    STAGE_END(packing_mark, "packing", nblocks);
     
-    return pixmap;  
+    return image_data.array;  
+}
+
+/* what find_repeats() marks a 2x2 block as */
+enum { BLOCK_NEW = 0, BLOCK_AS_LEFT, BLOCK_AS_ABOVE };
+
+/* at least 1 block in this many must repeat for encode_words() to 
+   take the blocks one at a time rather than through block_arith() */
+#define REPEAT_SHARE 8
+
+/* same_block()
+ * Purpose: Tell whether two runs of pixels two rows high are the same
+ * Parameters: The first pixel of each, the image's stride, and the 
+ *             number of bytes in one row of the run
+ * Returns: true if every byte matches
+ */
+static inline bool same_block(const unsigned char *a, const unsigned char *b,
+                              size_t stride, size_t bytes)
+{
+    return memcmp(a, b, bytes) == 0 &&
+           memcmp(a + stride, b + stride, bytes) == 0;
+}
+
+/* find_repeats()
+ * Purpose: Mark the 2x2 blocks of an image whose pixels are exactly 
+ *          those of the block to their left or of the block above
+ * Parameters: The image, and the workspace, already fit to the image
+ * Returns: How many blocks repeat another
+ * Notes: A block row that repeats the one above is found with one 
+ *        comparison of the whole row, which is how scanned pages and 
+ *        screenshots mostly repeat; the other rows go block by block
+ */
+size_t find_repeats(const struct Codec40_image *image, struct Workspace *ws)
+{
+    assert(image != NULL && ws->repeats != NULL);
+    unsigned blocks_wide = ws->width / 2, blocks_high = ws->height / 2;
+    size_t stride = image->stride;
+    size_t bytes = 2 * 3 * CODEC40_CHANNEL_BYTES(image->maxval);
+    size_t count = 0;
+
+    for (unsigned row = 0; row < blocks_high; row++) {
+        unsigned char *marks = ws->repeats + (size_t)row * blocks_wide;
+        const unsigned char *pixels = pixel_at(image, 0, 2 * row);
+        const unsigned char *above = pixels - 2 * stride;
+        if (row > 0 && 
+            same_block(pixels, above, stride, blocks_wide * bytes)) {
+            memset(marks, BLOCK_AS_ABOVE, blocks_wide);
+            count += blocks_wide;
+            continue;
+        }
+        for (unsigned col = 0; col < blocks_wide; col++) {
+            const unsigned char *block = pixels + col * bytes;
+            if (col > 0 && same_block(block, block - bytes, stride, bytes)) {
+                marks[col] = BLOCK_AS_LEFT;
+            } else if (row > 0 && 
+                       same_block(block, above + col * bytes, stride, 
+                                  bytes)) {
+                marks[col] = BLOCK_AS_ABOVE;
+            } else {
+                marks[col] = BLOCK_NEW;
+            }
+            count += marks[col] != BLOCK_NEW;
+        }
+    }
+    return count;
+}
+
+/* encode_blocks()
+ * Purpose: Compute the 32-bit word of each 2x2 block of an image, 
+ *          copying the word of a block that another repeats
+ * Parameters: The image, the kernels of its profile, and the workspace,
+ *             with the repeats found
+ * Returns: none
+ * Notes: Goes in row-major order, so the block to the left and the 
+ *        block above always have their words already
+ */
+static void encode_blocks(const struct Codec40_image *image, 
+                          const struct Kernels *kernels, 
+                          struct Workspace *ws)
+{
+    A2Methods_T plain = uarray2_methods_plain;
+    unsigned blocks_wide = ws->width / 2, blocks_high = ws->height / 2;
+    const unsigned char *marks = ws->repeats;
+
+    for (unsigned row = 0; row < blocks_high; row++) {
+        for (unsigned col = 0; col < blocks_wide; col++) {
+            uint32_t *word = plain->at(ws->words, col, row);
+            switch (*marks++) {
+            case BLOCK_AS_LEFT:
+                *word = *(uint32_t *)plain->at(ws->words, col - 1, row);
+                break;
+            case BLOCK_AS_ABOVE:
+                *word = *(uint32_t *)plain->at(ws->words, col, row - 1);
+                break;
+            default:
+                *word = kernels->encode_block(image, col, row);
+                break;
+            }
+        }
+    }
+}
+
+/* word_row()
+ * Purpose: Find one row of the workspace's words
+ * Parameters: The workspace, and the row of 2x2 blocks
+ * Returns: The row's words, which are next to each other in memory, 
+ *          since each row of a plain UArray2 is one UArray
+ */
+static inline uint32_t *word_row(struct Workspace *ws, unsigned row)
+{
+    return uarray2_methods_plain->at(ws->words, 0, row);
+}
+
+/* encode_planes()
+ * Purpose: Compute the 32-bit word of each 2x2 block of an image 
+ *          through the workspace's planes
+ * Parameters: The image, the kernels of its profile, and the workspace,
+ *             which is planar
+ * Returns: none
+ * Notes: Three passes, each in row-major order: the pixels to the y 
+ *        plane and the block averages of pb and pr, then the y plane to
+ *        the a, b, c, d fields of the words, then pb and pr to their 
+ *        fields. Luma reads 4 bytes a pixel and chroma 2, where each 
+ *        pass over the interleaved layout reads all 12 of a component 
+ *        video struct or a whole codeword struct. The sums are those 
+ *        of block_arith(), so the words are the same.
+ */
+static void encode_planes(const struct Codec40_image *image, 
+                          const struct Kernels *kernels, 
+                          struct Workspace *ws)
+{
+    unsigned width = ws->width;
+    unsigned blocks_wide = width / 2, blocks_high = ws->height / 2;
+    size_t nblocks = (size_t)blocks_wide * blocks_high;
+
+    STAGE_BEGIN(planes_mark);
+    for (unsigned row = 0; row < blocks_high; row++) {
+        float *top = ws->y + (size_t)2 * row * width;
+        float *bottom = top + width;
+        float *pb = ws->pb + (size_t)row * blocks_wide;
+        float *pr = ws->pr + (size_t)row * blocks_wide;
+        for (unsigned col = 0; col < blocks_wide; col++) {
+            struct Codeword codeword;
+            float y[4];
+            block_to_video(image, col, row, y, &codeword);
+            top[2 * col] = y[0];
+            top[2 * col + 1] = y[1];
+            bottom[2 * col] = y[2];
+            bottom[2 * col + 1] = y[3];
+            pb[col] = codeword.avg_pb;
+            pr[col] = codeword.avg_pr;
+        }
+    }
+    STAGE_END(planes_mark, "to_planes", 4 * nblocks);
+
+    STAGE_BEGIN(luma_mark);
+    for (unsigned row = 0; row < blocks_high; row++) {
+        const float *top = ws->y + (size_t)2 * row * width;
+        kernels->luma_to_words(top, top + width, word_row(ws, row), 
+                               blocks_wide);
+    }
+    STAGE_END(luma_mark, "luma_to_words", nblocks);
+
+    STAGE_BEGIN(chroma_mark);
+    for (unsigned row = 0; row < blocks_high; row++) {
+        size_t at = (size_t)row * blocks_wide;
+        kernels->chroma_to_words(ws->pb + at, ws->pr + at, 
+                                 word_row(ws, row), blocks_wide);
+    }
+    STAGE_END(chroma_mark, "chroma_to_words", nblocks);
+}
+
+/* patch_words()
+ * Purpose: Code a rectangle of 2x2 blocks of an image again, over the 
+ *          words of a plain payload
+ * Parameters: The image, the quantization profile, the first column and
+ *             row of blocks and how many of each, and the payload, 
+ *             which has one big-endian word per block of the image
+ * Returns: How many words changed
+ * Notes: Only words that differ are written, so a memory-mapped payload
+ *        only has the pages dirtied that really changed
+ */
+size_t patch_words(const struct Codec40_image *image, 
+                   const struct Profile *profile, unsigned col, 
+                   unsigned row, unsigned cols, unsigned rows, 
+                   unsigned char *payload)
+{
+    assert(image != NULL && payload != NULL);
+    const struct Kernels *kernels = kernels_of(profile);
+    size_t blocks_wide = image->width / 2;
+    size_t changed = 0;
+
+    for (unsigned r = row; r < row + rows; r++) {
+        unsigned char *cursor = payload + (r * blocks_wide + col) * 4;
+        for (unsigned c = col; c < col + cols; c++, cursor += 4) {
+            uint32_t word = kernels->encode_block(image, c, r);
+            uint32_t old = (uint32_t)cursor[0] << 24 | 
+                           (uint32_t)cursor[1] << 16 |
+                           (uint32_t)cursor[2] << 8 | cursor[3];
+            if (word != old) {
+                unsigned char *location = cursor;
+                store_codeword(c, r, NULL, &word, &location);
+                changed++;
+            }
+        }
+    }
+    return changed;
+}
+
+/* encode_words()
+ * Purpose: Compress an image to one 32-bit packed word per 2x2 block
+ * Parameters: The image, the pixmap to fill in, the quantization 
+ *             profile, and the workspace
+ * Returns: The workspace's UArray2 of the words, with the pixmap's 
+ *          width and height set to the image's in 2x2 blocks
+ * Notes: Blocks that repeat the block to their left or above get a 
+ *        copy of its word. When enough blocks repeat, as on scanned 
+ *        documents and screenshots, the blocks are taken one at a time 
+ *        so that only the new ones are computed; otherwise the image 
+ *        goes through the planes, or through convert_to_floating() and 
+ *        block_arith() when the workspace is not planar. The words are 
+ *        the same every way.
+ */
+A2Methods_UArray2 encode_words(const struct Codec40_image *image, 
+                               Pnm_ppm pixmap, const struct Profile *profile,
+                               struct Workspace *ws)
+{
+    assert(image != NULL && pixmap != NULL && profile != NULL);
+    unsigned width = image->width - image->width % 2;
+    unsigned height = image->height - image->height % 2;
+    size_t nblocks = (size_t)(width / 2) * (height / 2);
+    workspace_fit(ws, width, height);
+
+    STAGE_BEGIN(repeats_mark);
+    size_t repeats = find_repeats(image, ws);
+    STAGE_END(repeats_mark, "find_repeats", nblocks);
+    INSTRUMENT_COUNT("repeated_blocks", repeats);
+    if (repeats >= nblocks / REPEAT_SHARE) {
+        STAGE_BEGIN(blocks_mark);
+        encode_blocks(image, kernels_of(profile), ws);
+        STAGE_END(blocks_mark, "encode_blocks", nblocks - repeats);
+    } else if (ws->planar) {
+        encode_planes(image, kernels_of(profile), ws);
+    } else {
+        convert_to_floating(image, pixmap, ws);
+        return block_arith(pixmap, ws->blocked, profile, ws);
+    }
+    pixmap->width = width / 2;
+    pixmap->height = height / 2;
+    pixmap->denominator = image->maxval;
+    pixmap->methods = uarray2_methods_plain;
+    pixmap->pixels = ws->words;
+    return ws->words;
+}
+
+/* read_samples()
+ * Purpose: Read one row of a plane of samples as floats
+ * Parameters: The row, how many samples, whether each is a uint16_t 
+ *             rather than a byte, the offset to take off each, the 
+ *             scale to multiply it by, and where to put the floats
+ * Returns: none
+ */
+static inline void read_samples(const unsigned char *row, unsigned n, 
+                                bool wide, float offset, float scale, 
+                                float *values)
+{
+    for (unsigned col = 0; col < n; col++) {
+        unsigned sample;
+        if (wide) {
+            uint16_t wide_sample;
+            memcpy(&wide_sample, row + 2 * (size_t)col, 
+                   sizeof(wide_sample));
+            sample = wide_sample;
+        } else {
+            sample = row[col];
+        }
+        values[col] = ((float)sample - offset) * scale;
+    }
+}
+
+/* write_samples()
+ * Purpose: Write floats out as one row of a plane of samples
+ * Parameters: The floats, how many, the scale to multiply each by, the 
+ *             offset to add after, the largest sample, and the row
+ * Returns: none
+ * Notes: Samples are rounded, and pushed into 0 to maxval; a uint16_t 
+ *        each when maxval is 256 or more, and otherwise a byte
+ */
+static inline void write_samples(const float *values, unsigned n, 
+                                 float scale, float offset, 
+                                 unsigned maxval, unsigned char *row)
+{
+    for (unsigned col = 0; col < n; col++) {
+        float value = values[col] * scale + offset;
+        push_into_range(&value, maxval, 0.0);
+        /* round(), for a value that cannot be negative */
+        unsigned sample = (unsigned)((double)value + 0.5);
+        if (maxval < 256) {
+            row[col] = sample;
+        } else {
+            uint16_t wide_sample = sample;
+            memcpy(row + 2 * (size_t)col, &wide_sample, 
+                   sizeof(wide_sample));
+        }
+    }
+}
+
+/* chroma_offset()
+ * Purpose: Find the sample of zero chroma in a Y'PbPr image
+ * Parameters: The image's maxval
+ * Returns: (maxval + 1) / 2, which is 128 for bytes
+ */
+static inline float chroma_offset(unsigned maxval)
+{
+    return (float)((maxval + 1) / 2);
+}
+
+/* encode_yuv()
+ * Purpose: Compress a Y'PbPr 4:2:0 image to one 32-bit packed word per
+ *          2x2 block
+ * Parameters: The image, the pixmap to fill in, the quantization 
+ *             profile, and the workspace
+ * Returns: The workspace's UArray2 of the words, as encode_words() does
+ * Notes: The image's planes already hold what encode_planes() makes 
+ *        from rgb pixels, so each block row goes straight from its rows
+ *        of samples to the luma and chroma row kernels. Nothing but the
+ *        image and the words is bigger than a row, in either layout.
+ */
+A2Methods_UArray2 encode_yuv(const struct Codec40_yuv *image, 
+                             Pnm_ppm pixmap, const struct Profile *profile,
+                             struct Workspace *ws)
+{
+    assert(image != NULL && pixmap != NULL && profile != NULL);
+    const struct Kernels *kernels = kernels_of(profile);
+    unsigned width = image->width, height = image->height;
+    unsigned blocks_wide = width / 2, blocks_high = height / 2;
+    workspace_fit(ws, width, height);
+    bool wide = image->maxval >= 256;
+    float scale = 1.0f / image->maxval;
+    float offset = chroma_offset(image->maxval);
+    float *y = malloc(3 * (size_t)width * sizeof(float));
+    assert(y != NULL);
+    float *pb = y + 2 * (size_t)width, *pr = pb + blocks_wide;
+
+    STAGE_BEGIN(mark);
+    for (unsigned row = 0; row < blocks_high; row++) {
+        const unsigned char *top = image->y + 
+                                   (size_t)2 * row * image->y_stride;
+        size_t at = (size_t)row * image->chroma_stride;
+        read_samples(top, width, wide, 0.0f, scale, y);
+        read_samples(top + image->y_stride, width, wide, 0.0f, scale, 
+                     y + width);
+        read_samples(image->pb + at, blocks_wide, wide, offset, scale, pb);
+        read_samples(image->pr + at, blocks_wide, wide, offset, scale, pr);
+        uint32_t *words = word_row(ws, row);
+        kernels->luma_to_words(y, y + width, words, blocks_wide);
+        kernels->chroma_to_words(pb, pr, words, blocks_wide);
+    }
+    STAGE_END(mark, "yuv_to_words", (size_t)blocks_wide * blocks_high);
+    free(y);
+
+    pixmap->width = blocks_wide;
+    pixmap->height = blocks_high;
+    pixmap->denominator = image->maxval;
+    pixmap->methods = uarray2_methods_plain;
+    pixmap->pixels = ws->words;
+    return ws->words;
 }
 
 /* average2x2()
  * Purpose: Compute the average pb and pr values in a 2x2 block
- * Parameters: The pixmap and the methods suite
+ * Parameters: The pixmap, the methods suite, and the array of codeword
+ *             structs to fill, which is half the pixmap's size
  * Returns: The pixmap, which is now populated with codeword structs
  * Notes: The Pb and Pr values of each pixel of the original image 
  *        are lost in this step. Only the average is now stored. 
  */
-Pnm_ppm average2x2(Pnm_ppm pixmap, A2Methods_T methods)
+Pnm_ppm average2x2(Pnm_ppm pixmap, A2Methods_T methods, 
+                   A2Methods_UArray2 new_array)
 {
     assert(pixmap != NULL);
     assert(methods != NULL);
+    assert(new_array != NULL); 
 
-    int new_width = pixmap->width / 2;
-    int new_height = pixmap->height / 2;
     A2Methods_UArray2 old_array = pixmap->pixels; 
-    A2Methods_UArray2 new_array = methods->new_with_blocksize(
-                                  new_width, new_height, 
-                                  sizeof(struct Codeword), 1);
-    assert(new_array != NULL); 
     
     /* create a new struct to store the new array */ 
     struct Image_data image_data;  
@@ -291,14 +1292,12 @@ Pnm_ppm average2x2(Pnm_ppm pixmap, A2Methods_T methods)
     image_data.methods = methods; 
     image_data.pb_sum = 0.0; 
     image_data.pr_sum = 0.0; 
-    methods->map_block_major(old_array, populate_small, &image_data); 
+    map_populate_small(methods, old_array, &image_data);
     pixmap->pixels = image_data.array; 
     
     /* update the width and height of the pixmap */
     pixmap->width/=2;
     pixmap->height/=2;
-    
-    free_old_array(old_array, methods); 
     return pixmap; 
 }
 
@@ -372,7 +1371,8 @@ void populate_small(int col, int row, A2Methods_UArray2 u2,
  * Purpose: Performs discrete cosine transformation on one 2x2 block of pixels
  * Parameters: An array of y values, a pointer to the codeword
  * Returns: None
- * Notes: Computes a, b, c, and d, and ensures that they are in range 
+ * Notes: Computes a, b, c, and d, and ensures that a is in range; b, c 
+ *        and d are clamped by quantize_abcd(), to their profile's bcd_max
  */
 void compute_dct(float array[], struct Codeword *codeword)
 {
@@ -383,9 +1383,6 @@ void compute_dct(float array[], struct Codeword *codeword)
     float d = (array[3] - array[2] - array[1] + array[0]) / 4.0;
 
     push_into_range(&a, 1.0, 0.0);
-    push_into_range(&b, 0.3, -0.3);
-    push_into_range(&c, 0.3, -0.3);
-    push_into_range(&d, 0.3, -0.3);
 
     codeword->a = a; 
     codeword->b = b; 
@@ -394,151 +1391,224 @@ void compute_dct(float array[], struct Codeword *codeword)
     
 }
 
-/* to_index()
- * Purpose: Converts the average pb and pr values of a 2x2 block to an index
- * Parameters: The current column, the current row, the UArray, a 
- *             pointer to the current element, and a closure (NULL)
- * Returns: None
- * Notes: The exact pb and pr values of the 2x2 block are lost in this 
- *        step, as we are quantizing the values in a range of -15 to 15 
+/* decode_planes()
+ * Purpose: Decompress the workspace's words into an image through the 
+ *          workspace's planes
+ * Parameters: The image, which is the workspace's size, the kernels of
+ *             the words' profile, and the workspace, which is planar
+ * Returns: none
+ * Notes: The inverse of encode_planes(): the words to the pb and pr 
+ *        planes, then to the y plane, then each pixel from its y and 
+ *        its block's pb and pr. The values are those unpack_code() 
+ *        puts in the component video array, so the pixels are the same.
  */
-void to_index(int col, int row, A2Methods_UArray2 u2, void *elem, void *cl)
+static void decode_planes(const struct Codec40_image *image, 
+                          const struct Kernels *kernels, 
+                          struct Workspace *ws)
 {
-    (void)u2;
-    (void)col;
-    (void)row;
-    (void)cl;
-    
-    struct Codeword *codeword = (struct Codeword*)elem; 
-    assert(codeword != NULL);
-    float avg_pb = codeword->avg_pb;
-    float avg_pr = codeword->avg_pr;
+    unsigned width = ws->width, height = ws->height;
+    unsigned blocks_wide = width / 2, blocks_high = height / 2;
+    size_t nblocks = (size_t)blocks_wide * blocks_high;
+
+    STAGE_BEGIN(chroma_mark);
+    for (unsigned row = 0; row < blocks_high; row++) {
+        size_t at = (size_t)row * blocks_wide;
+        kernels->words_to_chroma(word_row(ws, row), ws->pb + at, 
+                                 ws->pr + at, blocks_wide);
+    }
+    STAGE_END(chroma_mark, "words_to_chroma", nblocks);
 
-    codeword->pb_index = Arith40_index_of_chroma(avg_pb); 
-    codeword->pr_index = Arith40_index_of_chroma(avg_pr); 
+    STAGE_BEGIN(luma_mark);
+    for (unsigned row = 0; row < blocks_high; row++) {
+        float *top = ws->y + (size_t)2 * row * width;
+        kernels->words_to_luma(word_row(ws, row), top, top + width, 
+                               blocks_wide);
+    }
+    STAGE_END(luma_mark, "words_to_luma", nblocks);
+
+    STAGE_BEGIN(rgb_mark);
+    for (unsigned row = 0; row < height; row++) {
+        const float *y = ws->y + (size_t)row * width;
+        const float *pb = ws->pb + (size_t)(row / 2) * blocks_wide;
+        const float *pr = ws->pr + (size_t)(row / 2) * blocks_wide;
+        for (unsigned col = 0; col < width; col++) {
+            struct Pnm_cv_T cv = { y[col], pb[col / 2], pr[col / 2] };
+            to_rgb(col, row, NULL, &cv, (void *)image);
+        }
+    }
+    STAGE_END(rgb_mark, "from_planes", (size_t)width * height);
 }
 
-/* unpack_code()
- * Purpose: Transforms an array of 32-bit words to an expanded 
-            array which contains a, b, c, d, pb index, and pr index
- * Parameters: The pixmap and the methods suite
- * Returns: A Pnm_ppm, which contains the aforementioned pixel data
+/* decode_words()
+ * Purpose: Decompress the workspace's words into an image
+ * Parameters: The image, which is the workspace's size, the pixmap of 
+ *             the words, the profile they were packed with, and the 
+ *             workspace
+ * Returns: none
+ * Notes: Goes through the planes, or through unpack_code() and 
+ *        convert_to_rgb() when the workspace is not planar
  */
-Pnm_ppm unpack_code(Pnm_ppm pixmap, A2Methods_T methods)
+void decode_words(const struct Codec40_image *image, Pnm_ppm pixmap,
+                  const struct Profile *profile, struct Workspace *ws)
 {
-    assert(pixmap != NULL);
-    assert(methods != NULL);
-
-    A2Methods_UArray2 new_array = methods->new_with_blocksize(pixmap->width, 
-                                pixmap->height, sizeof(struct Codeword), 1);
-    
-    A2Methods_T new_methods = uarray2_methods_plain;
-    new_methods->map_row_major(pixmap->pixels, get_bits, new_array);
-    
-    A2Methods_UArray2 old_array = pixmap->pixels; 
-    pixmap->methods = uarray2_methods_blocked;
-    pixmap->pixels = new_array; 
-    
-    methods->map_block_major(pixmap->pixels, index_to_abcd, NULL);
-    methods->map_block_major(pixmap->pixels, to_chroma, NULL);
-
-    pixmap = expand_pixmap(pixmap, methods); 
-
-    free_old_array(old_array, new_methods); 
-    return pixmap;  
+    assert(image != NULL && pixmap != NULL && profile != NULL);
+    if (ws->planar) {
+        decode_planes(image, kernels_of(profile), ws);
+        return;
+    }
+    unpack_code(pixmap, ws->blocked, profile, ws);
+    convert_to_rgb(pixmap, image);
 }
 
-/* get_bits()
- * Purpose: Unpack one 32-bit word to reveal a, b, c, d, pb, and pr index
- * Parameters: The current column, the current row, the UArray, a 
- *             pointer to the current element, the new array to be populated
- * Returns: None
- * Notes: Populates a new array
+/* decode_luma()
+ * Purpose: Decompress the luma alone of the workspace's words into a 
+ *          grayscale image
+ * Parameters: The image, which is the workspace's size and has one 
+ *             channel a pixel, the profile the words were packed with, 
+ *             and the workspace
+ * Returns: none
+ * Notes: Only the a, b, c and d of each word are read. Each block row 
+ *        goes through two rows of y and straight out to the image, so 
+ *        nothing but the words and the image is bigger than a row. A 
+ *        pixel is what to_rgb() makes of its y with no chroma, which is
+ *        what every one of its three channels would be.
  */
-void get_bits(int col, int row, A2Methods_UArray2 u2, void *elem, void *array)
+void decode_luma(const struct Codec40_image *image, 
+                 const struct Profile *profile, struct Workspace *ws)
 {
-    (void)u2; 
-    
-    uint32_t word = *(uint32_t *)elem;
-    A2Methods_UArray2 new_array = (A2Methods_UArray2) array;
-    A2Methods_T methods = uarray2_methods_blocked;
-
-    unsigned a_int = Bitpack_getu(word, 6, 26);
+    assert(image != NULL && profile != NULL);
+    const struct Kernels *kernels = kernels_of(profile);
+    unsigned width = ws->width, height = ws->height;
+    unsigned blocks_wide = width / 2, blocks_high = height / 2;
+    float *y = malloc(2 * (size_t)width * sizeof(float));
+    assert(y != NULL);
+    float scale = image->maxval;
+
+    STAGE_BEGIN(mark);
+    for (unsigned row = 0; row < blocks_high; row++) {
+        kernels->words_to_luma(word_row(ws, row), y, y + width, 
+                               blocks_wide);
+        for (unsigned half = 0; half < 2; half++) {
+            write_samples(y + (size_t)half * width, width, scale, 0.0f, 
+                          image->maxval, image->pixels + 
+                          (size_t)(2 * row + half) * image->stride);
+        }
+    }
+    STAGE_END(mark, "words_to_gray", (size_t)width * height);
+    free(y);
+}
 
-    int b_int = Bitpack_gets(word, 6, 20);
-    int c_int = Bitpack_gets(word, 6, 14);
-    int d_int = Bitpack_gets(word, 6, 8);
-    unsigned pb_index = Bitpack_getu(word, 4, 4);
-    unsigned pr_index = Bitpack_getu(word, 4, 0);
-    
-    struct Codeword *location = (struct Codeword *)methods->at(
-                                                   new_array, col, row);
-    location->a_int = a_int; 
-    location->b_int = b_int; 
-    location->c_int = c_int; 
-    location->d_int = d_int; 
-    location->pb_index = pb_index; 
-    location->pr_index = pr_index; 
-}
-
-/* to_chroma()
- * Purpose: Convert one pixel's pb and pr index to its chroma value
- * Parameters: The current column, the current row, the UArray, a 
- *             pointer to the current element, the new array to be populated
- * Returns: None
- * Notes: The pb and pr indices which are populated by this function 
- *        are the closest that we can achieve to the original value, since the 
- *        original value was quantized
+/* decode_yuv()
+ * Purpose: Decompress the workspace's words into a Y'PbPr 4:2:0 image
+ * Parameters: The image, which is the workspace's size, the profile the
+ *             words were packed with, and the workspace
+ * Returns: none
+ * Notes: The inverse of encode_yuv(): each block row of words goes 
+ *        through the luma and chroma row kernels and straight out to 
+ *        its rows of samples. The chroma is each block's, as the words 
+ *        hold it, so it is never spread over the pixels or turned to 
+ *        rgb.
  */
-void to_chroma(int col, int row, A2Methods_UArray2 u2, void *elem, void*cl)
+void decode_yuv(const struct Codec40_yuv *image, 
+                const struct Profile *profile, struct Workspace *ws)
 {
-    (void)u2;
-    (void)col;
-    (void)row;
-    (void)cl;
-
-    struct Codeword *codeword = (struct Codeword*)elem; 
-    assert(codeword != NULL);
+    assert(image != NULL && profile != NULL);
+    const struct Kernels *kernels = kernels_of(profile);
+    unsigned width = ws->width, height = ws->height;
+    unsigned blocks_wide = width / 2, blocks_high = height / 2;
+    float scale = image->maxval;
+    float offset = chroma_offset(image->maxval);
+    float *y = malloc(3 * (size_t)width * sizeof(float));
+    assert(y != NULL);
+    float *pb = y + 2 * (size_t)width, *pr = pb + blocks_wide;
+
+    STAGE_BEGIN(mark);
+    for (unsigned row = 0; row < blocks_high; row++) {
+        const uint32_t *words = word_row(ws, row);
+        unsigned char *top = image->y + (size_t)2 * row * image->y_stride;
+        size_t at = (size_t)row * image->chroma_stride;
+        kernels->words_to_luma(words, y, y + width, blocks_wide);
+        kernels->words_to_chroma(words, pb, pr, blocks_wide);
+        write_samples(y, width, scale, 0.0f, image->maxval, top);
+        write_samples(y + width, width, scale, 0.0f, image->maxval, 
+                      top + image->y_stride);
+        write_samples(pb, blocks_wide, scale, offset, image->maxval, 
+                      image->pb + at);
+        write_samples(pr, blocks_wide, scale, offset, image->maxval, 
+                      image->pr + at);
+    }
+    STAGE_END(mark, "words_to_yuv", (size_t)width * height);
+    free(y);
+}
 
-    unsigned pb_index = codeword->pb_index; 
-    unsigned pr_index = codeword->pr_index; 
+/* unpack_code()
+ * Purpose: Transforms an array of 32-bit words to an expanded 
+            array which contains a, b, c, d, pb index, and pr index
+ * Parameters: The pixmap, the methods suite, the profile the words were 
+ *             packed with, and the workspace
+ * Returns: A Pnm_ppm, which contains the aforementioned pixel data in 
+ *          the workspace's component video array
+ */
+Pnm_ppm unpack_code(Pnm_ppm pixmap, A2Methods_T methods, 
+                    const struct Profile *profile, struct Workspace *ws)
+{
+    assert(pixmap != NULL);
+    assert(methods != NULL);
+    const struct Kernels *kernels = kernels_of(profile);
+    size_t nblocks = (size_t)pixmap->width * pixmap->height;
 
-    codeword->avg_pb = Arith40_chroma_of_index(pb_index); 
-    codeword->avg_pr = Arith40_chroma_of_index(pr_index);  
+    STAGE_BEGIN(bits_mark);
+    struct Image_data image_data;
+    image_data.array = ws->codewords;
+    image_data.methods = methods;
+    kernels->get_bits(pixmap->pixels, &image_data);
+    STAGE_END(bits_mark, "get_bits", nblocks);
+    
+    pixmap->methods = methods;
+    pixmap->pixels = ws->codewords; 
+    
+    STAGE_BEGIN(abcd_mark);
+    kernels->index_to_abcd(methods, pixmap->pixels, NULL);
+    STAGE_END(abcd_mark, "index_to_abcd", nblocks);
+    STAGE_BEGIN(chroma_mark);
+    kernels->to_chroma(methods, pixmap->pixels, NULL);
+    STAGE_END(chroma_mark, "to_chroma", nblocks);
+
+    STAGE_BEGIN(expand_mark);
+    pixmap = expand_pixmap(pixmap, methods, ws->video); 
+    STAGE_END(expand_mark, "expand_pixmap", nblocks);
+    return pixmap;  
 }
 
 /* expand_pixmap()
  * Purpose: Expand the compressed pixmap to be twice its size
- * Parameters: The Pnm_ppm and the methods suite
+ * Parameters: The Pnm_ppm, the methods suite, and the array of 
+ *             component video to fill, which is twice the pixmap's size
  * Returns: A Pnm_ppm, which has been expanded and will 
  *          now store component video data
  */
-Pnm_ppm expand_pixmap(Pnm_ppm pixmap, A2Methods_T methods)
+Pnm_ppm expand_pixmap(Pnm_ppm pixmap, A2Methods_T methods, 
+                      A2Methods_UArray2 new_array)
 {
     assert(pixmap != NULL);
     assert(methods != NULL);
+    assert(new_array != NULL); 
 
     int new_width = pixmap->width * 2;
     int new_height = pixmap->height * 2;
 
     A2Methods_UArray2 old_array = pixmap->pixels; 
-    A2Methods_UArray2 new_array = methods->new_with_blocksize(
-                                  new_width, new_height, 
-                                  sizeof(struct Pnm_cv_T), 2);
-    assert(new_array != NULL); 
-    
+
     /*create a new struct to store the new array*/
     struct Image_data image; 
     image.array = new_array; 
-    image.methods = uarray2_methods_blocked;
-    methods->map_block_major(old_array, populate_big, &image); 
+    image.methods = methods;
+    map_populate_big(methods, old_array, &image);
     pixmap->pixels = image.array;  
     
     /*update the width and height of the pixmap*/
     pixmap->width = new_width;
     pixmap->height = new_height;
-    
-    free_old_array(old_array, methods); 
     return pixmap; 
 }
 
@@ -555,7 +1625,7 @@ void populate_big(int col, int row, A2Methods_UArray2 u2, void *elem,
 {
     (void)u2; 
     struct Codeword codeword = *(struct Codeword*)elem;
-    struct Image_data image = *(struct Image_data*)Image_data;
+    struct Image_data *image = (struct Image_data*)Image_data;
 
     float avg_pb = codeword.avg_pb;
     float avg_pr = codeword.avg_pr;
@@ -578,10 +1648,10 @@ void populate_big(int col, int row, A2Methods_UArray2 u2, void *elem,
     int new_col = col * 2;
     int new_row = row * 2;
     
-    Pnm_cv cv1 = (Pnm_cv)image.methods->at(image.array, new_col, new_row);
-    Pnm_cv cv2 = (Pnm_cv)image.methods->at(image.array, new_col + 1, new_row);
-    Pnm_cv cv3 = (Pnm_cv)image.methods->at(image.array, new_col, new_row + 1);
-    Pnm_cv cv4 = (Pnm_cv)image.methods->at(image.array, new_col + 1, 
+    Pnm_cv cv1 = (Pnm_cv)image->methods->at(image->array, new_col, new_row);
+    Pnm_cv cv2 = (Pnm_cv)image->methods->at(image->array, new_col + 1, new_row);
+    Pnm_cv cv3 = (Pnm_cv)image->methods->at(image->array, new_col, new_row + 1);
+    Pnm_cv cv4 = (Pnm_cv)image->methods->at(image->array, new_col + 1, 
                                                         new_row + 1);
 
     init_cv(cv1, avg_pb, avg_pr, y1); 
@@ -604,204 +1674,415 @@ void init_cv(Pnm_cv cv, float avg_pb, float avg_pr, float y){
 }
 
 
-/* abcd_to_index()
- * Purpose: an apply function that covert a, b, c, d
- *          into a, b, c, d index 
- * Parameters: col of 2d array, row of 2d array, Uarray2b, codeword struct, 
- *             closure (NULL)
- * Returns: none
+/* write_header()
+ * Purpose: write the header of a compressed image
+ * Parameters: where to write it (at least HEADER_MAX bytes), the width 
+ *             and height in blocks, whether the codewords are entropy 
+ *             coded, whether they are laid out coarse to fine (not both),
+ *             and their profile
+ * Returns: the number of bytes written
  */
-void abcd_to_index(int col, int row, A2Methods_UArray2 u2, 
-                   void *elem, void *cl)
+size_t write_header(unsigned char *out, unsigned width, unsigned height,
+                    bool entropy, bool progressive, 
+                    const struct Profile *profile)
 {
-    (void) col;
-    (void) row;
-    (void) u2;
-    (void) cl;
+    assert(!(entropy && progressive));
+    bool named = profile->id != PROFILE_default;
+    int len = snprintf((char *)out, HEADER_MAX, MAGIC "%s%s%s\n%u %u\n", 
+                       entropy ? "r" : progressive ? "p" : "", 
+                       named ? " " : "", 
+                       named ? profile->name : "", width, height);
+    assert(len > 0 && len < HEADER_MAX);
+    return len;
+}
 
-    struct Codeword *codeword = (struct Codeword*)elem;
-    unsigned a = round(codeword->a * 63.0);
-    int b = round(codeword->b * 50.0);
-    int c = round(codeword->c * 50.0);
-    int d = round(codeword->d * 50.0);
-   
-    codeword->a_int = a; 
-    codeword->b_int = b; 
-    codeword->c_int = c; 
-    codeword->d_int = d; 
+/* store_image()
+ * Purpose: write a compressed image, codewords in big-endian order
+ * Parameters: pixmap, plain methods, Uarray2 of codewords, profile of 
+ *             the codewords, and where to write (the header's size plus 
+ *             four bytes per codeword)
+ * Returns: the number of bytes written
+ */
+size_t store_image(Pnm_ppm pixmap, A2Methods_T methods, 
+                   A2Methods_UArray2 words, const struct Profile *profile,
+                   unsigned char *out)
+{
+    size_t len = write_header(out, pixmap->width, pixmap->height, false, 
+                              false, profile);
+    return len + store_words(pixmap, methods, words, out + len);
 }
 
+/* store_words()
+ * Purpose: write the codewords of a compressed image, with no header, 
+ *          in big-endian order
+ * Parameters: pixmap, plain methods, Uarray2 of codewords, and where to 
+ *             write (four bytes per codeword)
+ * Returns: the number of bytes written
+ */
+size_t store_words(Pnm_ppm pixmap, A2Methods_T methods, 
+                   A2Methods_UArray2 words, unsigned char *out)
+{
+    assert(methods == uarray2_methods_plain);
+    STAGE_BEGIN(mark);
+    unsigned char *cursor = out;
+    map_store_codeword(words, &cursor);
+    STAGE_END(mark, "store_image", (size_t)pixmap->width * pixmap->height);
+    INSTRUMENT_COUNT("codeword_bytes", 
+                     sizeof(uint32_t) * pixmap->width * pixmap->height);
+    return cursor - out;
+}
 
-/* index_to_abcd()
- * Purpose: an apply function that covert the a, b, c, d index 
- *          into a, b, c, d
- * Parameters: col of 2d array, row of 2d array, Uarray2b, codeword struct,
- *             closure (NULL)
- * Returns: none
+/* store_entropy_image()
+ * Purpose: write a compressed image, with the codewords passed through 
+ *          the entropy coder
+ * Parameters: pixmap, plain methods, Uarray2 of codewords, profile of 
+ *             the codewords, where to write and how much room it has, 
+ *             and the workspace
+ * Returns: the size of the compressed image, which is only written if 
+ *          it fits
+ * Notes: codes straight into out when the worst case fits there, 
+ *        otherwise into the workspace, and copies it if it fits
  */
-void index_to_abcd(int col, int row, A2Methods_UArray2 u2, 
-                   void *elem, void *cl)
+size_t store_entropy_image(Pnm_ppm pixmap, A2Methods_T methods,
+                           A2Methods_UArray2 words, 
+                           const struct Profile *profile,
+                           unsigned char *out, size_t capacity,
+                           struct Workspace *ws)
 {
-    (void) col;
-    (void) row;
-    (void) u2;
-    (void) cl;
-    struct Codeword *codeword = (struct Codeword*)elem;
-    float a = (float)(codeword->a_int / 63.0);
-    float b = (float)(codeword->b_int / 50.0);
-    float c = (float)(codeword->c_int / 50.0);
-    float d = (float)(codeword->d_int / 50.0);
+    assert(methods == uarray2_methods_plain);
+    STAGE_BEGIN(encode_mark);
+    size_t nwords = (size_t)pixmap->width * pixmap->height;
+    uint32_t *flat = ws->flat;
+    uint32_t *cursor = flat;
+    map_flatten_word(words, &cursor);
+
+    unsigned char header[HEADER_MAX];
+    size_t header_len = write_header(header, pixmap->width, pixmap->height,
+                                     true, false, profile);
+    size_t bound = Entropy_bound(pixmap->width, pixmap->height, profile);
+    bool in_place = capacity >= header_len + bound;
+    assert(bound <= ws->payload_size);
+    unsigned char *payload = in_place ? out + header_len : ws->payload;
+    size_t len = header_len + Entropy_encode(flat, pixmap->width, 
+                                             pixmap->height, profile, 
+                                             payload, ws->scratch);
+    STAGE_END(encode_mark, "entropy_encode", nwords);
+    
+    if (len <= capacity) {
+        memcpy(out, header, header_len);
+        if (!in_place) {
+            memcpy(out + header_len, payload, len - header_len);
+        }
+    }
+    INSTRUMENT_COUNT("codeword_bytes", len - header_len);
+    return len;
+}
 
-    codeword->a = a; 
-    codeword->b = b; 
-    codeword->c = c; 
-    codeword->d = d; 
+/* store_progressive_image()
+ * Purpose: write a compressed image, with the codewords laid out coarse 
+ *          to fine (see progressive40.h)
+ * Parameters: pixmap, plain methods, Uarray2 of codewords, profile of 
+ *             the codewords, where to write (the header's size plus 
+ *             Progressive40_bytes()), and the workspace
+ * Returns: the number of bytes written
+ */
+size_t store_progressive_image(Pnm_ppm pixmap, A2Methods_T methods,
+                               A2Methods_UArray2 words, 
+                               const struct Profile *profile,
+                               unsigned char *out, struct Workspace *ws)
+{
+    assert(methods == uarray2_methods_plain);
+    uint32_t *cursor = ws->flat;
+    map_flatten_word(words, &cursor);
+    size_t len = write_header(out, pixmap->width, pixmap->height, false, 
+                              true, profile);
+    Progressive40_encode(ws->flat, pixmap->width, pixmap->height, profile,
+                         out + len);
+    size_t payload = Progressive40_bytes(pixmap->width, pixmap->height, 
+                                         profile);
+    INSTRUMENT_COUNT("codeword_bytes", payload);
+    return len + payload;
 }
 
-/* packing()
- * Purpose: an apply function that packs a, b, c, d, average pb, 
- *          and average pr into A 32-bit words into a Uarray2
- * Parameters: col of 2d array, row of 2d array, Uarray2b, 32 bit word, 
- *             struct Image_data 
+/* flatten_word()
+ * Purpose: an apply function that copies each code word, in row-major 
+ *          order, into a flat array
+ * Parameters: col of 2d array, row of 2d array, Uarray2, 32 bit word, 
+ *             pointer to the next free slot of the flat array
  * Returns: none
  */
-void packing(int col, int row, A2Methods_UArray2 u2, void *elem, 
-                                              void *Image_data)
+void flatten_word(int col, int row, A2Methods_UArray2 u2, 
+                  void *elem, void *words)
 {
     (void) col;
     (void) row;
     (void) u2;
 
-    struct Image_data *image = (struct Image_data *)Image_data;
-    struct Codeword codeword = *(struct Codeword *)elem;
-
-    uint32_t word = 0;
-    word = (uint32_t)Bitpack_newu(word, 6, 26, codeword.a_int);
-    word = (uint32_t)Bitpack_news(word, 6, 20, codeword.b_int);
-    word = (uint32_t)Bitpack_news(word, 6, 14, codeword.c_int);
-    word = (uint32_t)Bitpack_news(word, 6, 8, codeword.d_int);
-    word = (uint32_t)Bitpack_newu(word, 4, 4, codeword.pb_index);
-    word = (uint32_t)Bitpack_newu(word, 4, 0, codeword.pr_index);
-
-    uint32_t *location = image->methods->at(image->array, col, row);
-    *location = word;  
+    uint32_t **cursor = (uint32_t **)words;
+    **cursor = *(uint32_t *)elem;
+    (*cursor)++;
 }
 
-/* print_image()
- * Purpose: write a compressed binary image to standard output
- * Parameters: pixmap, blocked methods, Uarray2
+/* unflatten_word()
+ * Purpose: an apply function that copies each code word, in row-major 
+ *          order, out of a flat array; the inverse of flatten_word()
+ * Parameters: col of 2d array, row of 2d array, Uarray2, 32 bit word, 
+ *             pointer to the next slot of the flat array
  * Returns: none
  */
-void print_image(Pnm_ppm pixmap, A2Methods_T methods, 
-                         A2Methods_UArray2 new_array)
+void unflatten_word(int col, int row, A2Methods_UArray2 u2, 
+                    void *elem, void *words)
 {
-    printf("COMP40 Compressed image format 2\n%u %u\n", pixmap->width, 
-             pixmap->height); 
-    methods->map_row_major(new_array, print_codeword, &pixmap->width);
-    free_old_array (new_array, methods); 
+    (void) col;
+    (void) row;
+    (void) u2;
+
+    uint32_t **cursor = (uint32_t **)words;
+    *(uint32_t *)elem = **cursor;
+    (*cursor)++;
 }
 
-/* print_codeword()
- * Purpose: an apply function that write out the each code words
+/* store_codeword()
+ * Purpose: an apply function that writes out each code word, most 
+ *          significant byte first
  * Parameters: col of 2d array, row of 2d array, Uarray2, 32 bit word, 
- *             file pointer
+ *             pointer to the next free byte of the output
  * Returns: none
- * Notes: putchar() write a single byte
  */
-void print_codeword(int col, int row, A2Methods_UArray2 u2, 
+void store_codeword(int col, int row, A2Methods_UArray2 u2, 
                     void *elem, void *cl)
 {
     (void) col;
     (void) row;
     (void) u2;
-    (void) cl; 
 
+    unsigned char **cursor = (unsigned char **)cl;
     uint32_t codeword = *(uint32_t*)elem;
 
-    uint32_t first_byte = codeword; 
-    first_byte = first_byte >> 24;
-    putchar(first_byte); 
-
-    uint32_t second_byte = codeword;
-    second_byte = second_byte << 8; 
-    second_byte = second_byte >> 24;
-    putchar(second_byte); 
-
-    uint32_t third_byte = codeword;
-    third_byte = third_byte << 16; 
-    third_byte = third_byte >> 24;
-    putchar(third_byte); 
-
-    uint32_t last_byte = codeword;
-    last_byte = last_byte << 24; 
-    last_byte = last_byte >> 24;
-    putchar(last_byte); 
+    (*cursor)[0] = codeword >> 24;
+    (*cursor)[1] = codeword >> 16;
+    (*cursor)[2] = codeword >> 8;
+    (*cursor)[3] = codeword;
+    *cursor += 4;
 }
 
-/* read_compressed_file()
- * Purpose: Read in information from a compressed binary file. 
- *          Store file's information in a new Pnm_ppm. 
- * Parameters: file pointer
- * Returns: pixmap 
+/* read_header()
+ * Purpose: Parse and check the header of a compressed image
+ * Parameters: the compressed image and its length, and the header to 
+ *             fill in
+ * Returns: CODEC40_OK, or why the header cannot be used
  */
-Pnm_ppm read_compressed_file(FILE *fp)
+enum Codec40_status read_header(const unsigned char *in, size_t len,
+                                struct Header *header)
 {
-    unsigned height, width; 
-    int read = fscanf(fp, "COMP40 Compressed image format 2\n%u %u", 
-                      &width, &height); 
-    assert(read == 2); 
-    int c = getc(fp); 
-    assert(c == '\n'); 
+    char line[HEADER_MAX];
+    size_t n = len < sizeof(line) - 1 ? len : sizeof(line) - 1;
+    memcpy(line, in, n);
+    line[n] = '\0';
+
+    if (strncmp(line, MAGIC, strlen(MAGIC)) != 0) {
+        bool prefix = n < strlen(MAGIC) && n == len && 
+                      strncmp(line, MAGIC, n) == 0;
+        return prefix ? CODEC40_TRUNCATED : CODEC40_BAD_HEADER;
+    }
+    char *p = line + strlen(MAGIC);
+    header->entropy = *p == 'r';
+    header->progressive = *p == 'p';
+    if (header->entropy || header->progressive) {
+        p++;
+    }
+    header->profile = Profile_default();
+    if (*p == ' ') {
+        p++;
+        size_t name_len = strcspn(p, "\n");
+        if (p[name_len] != '\n') {
+            return n == len ? CODEC40_TRUNCATED : CODEC40_BAD_HEADER;
+        }
+        p[name_len] = '\0';
+        header->profile = Profile_named(p);
+        if (header->profile == NULL) {
+            return CODEC40_BAD_HEADER;
+        }
+        p += name_len;
+    } else if (*p != '\n') {
+        return *p == '\0' && n == len ? CODEC40_TRUNCATED 
+                                      : CODEC40_BAD_HEADER;
+    }
+    p++;
+
+    /* the width and height, in blocks: "%u %u\n" */
+    unsigned long size[2];
+    for (int i = 0; i < 2; i++) {
+        char *end;
+        size[i] = strtoul(p, &end, 10);
+        if (*end == '\0' && n == len) {
+            return CODEC40_TRUNCATED;
+        }
+        if (!isdigit((unsigned char)*p) || *end != (i == 0 ? ' ' : '\n') ||
+            size[i] == 0 || size[i] > CODEC40_MAX_SIDE / 2) {
+            return CODEC40_BAD_HEADER;
+        }
+        p = end + 1;
+    }
+    header->width = size[0];
+    header->height = size[1];
+    header->size = p - line;
+    return CODEC40_OK;
+}
 
-    A2Methods_T methods = uarray2_methods_plain;
-    A2Methods_UArray2 array = methods->new(width, height, sizeof(uint32_t));
-    
-    methods->map_row_major(array, read_32bit, fp);   
+/* check_payload()
+ * Purpose: Check the length of a payload against its header, before
+ *          anything is allocated for the image
+ * Parameters: the bytes after the header, and the header
+ * Returns: CODEC40_TRUNCATED if no decoder could use so few bytes, 
+ *          CODEC40_CORRUPT if there are more than the image can have, 
+ *          and otherwise CODEC40_OK
+ * Notes: exact for plain codewords; a progressive payload may stop 
+ *        anywhere after its first pass (read_partial_words()), and an 
+ *        entropy coded one need only hold its tables (Entropy_min_bytes())
+ */
+enum Codec40_status check_payload(size_t len, const struct Header *header)
+{
+    size_t least, most;
+    if (header->entropy) {
+        least = Entropy_min_bytes(header->profile);
+        most = SIZE_MAX;
+    } else if (header->progressive) {
+        least = Progressive40_preview_bytes(header->width, header->height,
+                                            header->profile);
+        most = Progressive40_bytes(header->width, header->height,
+                                   header->profile);
+    } else {
+        least = most = (size_t)header->width * header->height * 
+                       sizeof(uint32_t);
+    }
+    return len < least ? CODEC40_TRUNCATED 
+                       : len > most ? CODEC40_CORRUPT : CODEC40_OK;
+}
 
-    Pnm_ppm pixmap = malloc(sizeof(struct Pnm_ppm));
-    pixmap->width = width;
-    pixmap->height = height;
-    pixmap->denominator = 255;
-    pixmap->pixels = array;
-    pixmap->methods = methods;
+/* read_words()
+ * Purpose: Read the codewords which follow the header of a compressed 
+ *          image, decoding them first if they are entropy coded
+ * Parameters: the bytes after the header and how many there are, the 
+ *             header, the workspace (fit to the image), and where to 
+ *             put the UArray2 of codewords
+ * Returns: CODEC40_OK, or why the codewords cannot be read; *words is 
+ *          only set on success
+ * Notes: plain and progressive codewords must fill the input exactly
+ */
+enum Codec40_status read_words(const unsigned char *in, size_t len,
+                               const struct Header *header,
+                               struct Workspace *ws, 
+                               A2Methods_UArray2 *words)
+{
+    if (header->progressive) {
+        size_t whole = Progressive40_bytes(header->width, header->height, 
+                                           header->profile);
+        if (len != whole) {
+            return len < whole ? CODEC40_TRUNCATED : CODEC40_CORRUPT;
+        }
+        size_t refined;
+        return read_partial_words(in, len, header, ws, words, &refined);
+    }
+    STAGE_BEGIN(mark);
+    size_t nwords = (size_t)header->width * header->height;
+    A2Methods_UArray2 array = ws->words;
+    assert(ws->width == header->width * 2);
+    assert(ws->height == header->height * 2);
+
+    if (header->entropy) {
+        STAGE_BEGIN(decode_mark);
+        bool ok = Entropy_decode(in, len, ws->flat, header->width, 
+                                 header->height, header->profile, 
+                                 ws->scratch);
+        STAGE_END(decode_mark, "entropy_decode", nwords);
+        if (!ok) {
+            return CODEC40_CORRUPT;
+        }
+        uint32_t *cursor = ws->flat;
+        map_unflatten_word(array, &cursor);
+    } else {
+        if (len < nwords * sizeof(uint32_t)) {
+            return CODEC40_TRUNCATED;
+        }
+        if (len > nwords * sizeof(uint32_t)) {
+            return CODEC40_CORRUPT;
+        }
+        const unsigned char *cursor = in;
+        map_load_codeword(array, &cursor);
+    }
+    STAGE_END(mark, "read_compressed", nwords);
+    *words = array;
+    return CODEC40_OK;
+}
 
-    assert((unsigned)methods->width(array) == width); 
-    assert((unsigned)methods->height(array) == height); 
-    
-    return pixmap;
+/* read_partial_words()
+ * Purpose: Read the codewords of a compressed image from as much of its 
+ *          payload as has arrived
+ * Parameters: as for read_words(), and where to put how many blocks, 
+ *             from the first, are whole
+ * Returns: CODEC40_OK, or why the codewords cannot be read; a 
+ *          progressive image needs at least its first pass 
+ *          (Progressive40_preview_bytes()), and any other the whole 
+ *          payload
+ * Notes: the blocks of a progressive image past *refined have b, c and d
+ *        0, so they are flat
+ */
+enum Codec40_status read_partial_words(const unsigned char *in, size_t len,
+                                       const struct Header *header,
+                                       struct Workspace *ws, 
+                                       A2Methods_UArray2 *words,
+                                       size_t *refined)
+{
+    size_t nwords = (size_t)header->width * header->height;
+    if (!header->progressive) {
+        enum Codec40_status status = read_words(in, len, header, ws, words);
+        *refined = status == CODEC40_OK ? nwords : 0;
+        return status;
+    }
+    assert(ws->width == header->width * 2);
+    assert(ws->height == header->height * 2);
+    size_t preview = Progressive40_preview_bytes(header->width, 
+                                                 header->height, 
+                                                 header->profile);
+    size_t whole = Progressive40_bytes(header->width, header->height, 
+                                       header->profile);
+    if (len < preview) {
+        return CODEC40_TRUNCATED;
+    }
+    if (len > whole) {
+        return CODEC40_CORRUPT;
+    }
+    STAGE_BEGIN(mark);
+    *refined = Progressive40_decode(in, len, ws->flat, header->width, 
+                                    header->height, header->profile);
+    uint32_t *cursor = ws->flat;
+    map_unflatten_word(ws->words, &cursor);
+    STAGE_END(mark, "read_compressed", nwords);
+    *words = ws->words;
+    return CODEC40_OK;
 }
 
-/* read_32bit()
- * Purpose: an apply function that read in the 32-bit code words in 
- *          sequence and store each word in a 2D array. 
+/* load_codeword()
+ * Purpose: an apply function that reads in the 32-bit code words in 
+ *          sequence and stores each word in a 2D array; the inverse of 
+ *          store_codeword()
  * Parameters: col of 2d array, row of 2d array, Uarray2, 32 bit word, 
- *             file pointer
+ *             pointer to the next byte of the input
  * Returns: none
- * Notes: Since we write a single byte using putchar(), we read in 
- *        1 byte using getc().  
  */
-void read_32bit (int col, int row, A2Methods_UArray2 u2, void *elem, void *fp)
+void load_codeword(int col, int row, A2Methods_UArray2 u2, 
+                   void *elem, void *cl)
 {
     (void)col;
     (void)row;
-    (void) u2;
-
-    FILE *file_p = (FILE *)fp;
-    assert(file_p != NULL);
-
-    uint32_t *location = (uint32_t*)elem;
-    uint32_t first_byte = (uint32_t)getc(file_p);
-    uint32_t second_byte = (uint32_t)getc(file_p);
-    uint32_t third_byte = (uint32_t)getc(file_p);
-    uint32_t last_byte = (uint32_t)getc(file_p);
-
-    uint32_t word = 0;
-    word = Bitpack_newu(word, 8, 24, first_byte);
-    word = Bitpack_newu(word, 8, 16, second_byte); 
-    word = Bitpack_newu(word, 8, 8, third_byte);
-    word = Bitpack_newu(word, 8, 0, last_byte);
+    (void)u2;
 
-    *location = word;
+    const unsigned char **cursor = (const unsigned char **)cl;
+    const unsigned char *bytes = *cursor;
+    *(uint32_t *)elem = (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 |
+                        (uint32_t)bytes[2] << 8 | bytes[3];
+    *cursor += 4;
 }
 
 /* push_into_range()
@@ -14,61 +14,166 @@
 #include "a2methods.h"
 #include "a2plain.h"
 #include "a2blocked.h"
+#include "a2order.h"
 #include "pnm.h"
 #include "bitpack.h"
 #include "arith40.h"
 #include "math.h"
+#include "codec_options.h"
+#include "profile.h"
+#include "codec40.h"
 
 typedef struct Pnm_cv_T *Pnm_cv;
 struct Codeword;
 struct Image_data; 
 
-/*Compression functions*/
-Pnm_ppm read_and_populate(FILE *input_file, A2Methods_T methods);
-void populate_new(int col, int row, A2Methods_UArray2 u2, 
-                  void *elem, void *new_array);
+/* room for the longest header of a compressed image */
+#define HEADER_MAX CODEC40_HEADER_MAX
+
+/* what the header of a compressed image says */
+struct Header
+{
+    /* width and height in 2x2 blocks */
+    unsigned width, height;
+    bool entropy;
+    /* laid out coarse to fine (see progressive40.h) */
+    bool progressive;
+    const struct Profile *profile;
+    /* bytes taken by the header */
+    size_t size;
+};
+
+/* the arrays and buffers that one image goes through, kept so that 
+   images of the same size can reuse them */
+struct Workspace
+{
+    /* width and height of the image in pixels, both even */
+    unsigned width, height;
+    /* whether images go through the planes below rather than through 
+       the component video and codeword arrays (see ARITH40_LAYOUT) */
+    bool planar;
+    /* component video as planes, row-major: y is width x height, and pb
+       and pr hold the average of each 2x2 block, so each is a quarter 
+       of the size; NULL unless planar */
+    float *y, *pb, *pr;
+    /* the methods the blocked arrays were made with, which lay out and 
+       map their blocks in one order (see a2order.h) */
+    A2Methods_T blocked;
+    /* component video, width x height, blocksize 2; NULL when planar */
+    A2Methods_UArray2 video;
+    /* struct Codeword per 2x2 block, blocksize 1; NULL when planar */
+    A2Methods_UArray2 codewords;
+    /* 32-bit codeword per 2x2 block, plain */
+    A2Methods_UArray2 words;
+    /* the codewords in row-major order, for the entropy coder */
+    uint32_t *flat;
+    /* entropy coded payload, when it is not coded in place */
+    unsigned char *payload;
+    size_t payload_size;
+    /* Entropy_scratch_bytes() for the entropy coder */
+    void *scratch;
+    /* per 2x2 block, row-major: which earlier block it repeats, if any */
+    unsigned char *repeats;
+};
+
+void workspace_init(struct Workspace *ws);
+void workspace_fit(struct Workspace *ws, unsigned width, unsigned height);
+void workspace_free(struct Workspace *ws);
+
+/* one 2x2 block to or from its 32-bit word, for blocks taken one at a 
+   time rather than a whole image at once */
+typedef uint32_t Block_encoder(const struct Codec40_image *image, 
+                               int col, int row);
+typedef void Block_decoder(uint32_t word, const struct Codec40_image *image,
+                           int col, int row);
+Block_encoder *block_encoder_of(const struct Profile *profile);
+Block_decoder *block_decoder_of(const struct Profile *profile);
 
-Pnm_ppm convert_to_floating(Pnm_ppm pixmap);
+/*Compression functions*/
+A2Methods_UArray2 encode_words(const struct Codec40_image *image, 
+                               Pnm_ppm pixmap, const struct Profile *profile,
+                               struct Workspace *ws);
+A2Methods_UArray2 encode_yuv(const struct Codec40_yuv *image, 
+                             Pnm_ppm pixmap, const struct Profile *profile,
+                             struct Workspace *ws);
+size_t find_repeats(const struct Codec40_image *image, struct Workspace *ws);
+size_t patch_words(const struct Codec40_image *image, 
+                   const struct Profile *profile, unsigned col, 
+                   unsigned row, unsigned cols, unsigned rows, 
+                   unsigned char *payload);
+Pnm_ppm convert_to_floating(const struct Codec40_image *image, 
+                            Pnm_ppm pixmap, struct Workspace *ws);
 void to_floating(int col, int row, A2Methods_UArray2 u2, 
-                 void *elem, void *pixmap);
-Pnm_ppm convert_to_rgb(Pnm_ppm pixmap);
-void to_rgb(int col, int row, A2Methods_UArray2 u2, void *elem, void *pixmap);
+                 void *elem, void *image);
 
-Pnm_ppm block_arith(Pnm_ppm pixmap, A2Methods_T methods); 
-Pnm_ppm average2x2(Pnm_ppm pixmap, A2Methods_T methods); 
+A2Methods_UArray2 block_arith(Pnm_ppm pixmap, A2Methods_T methods,
+                              const struct Profile *profile,
+                              struct Workspace *ws); 
+Pnm_ppm average2x2(Pnm_ppm pixmap, A2Methods_T methods, 
+                   A2Methods_UArray2 new_array); 
 void populate_small(int col, int row, A2Methods_UArray2 u2, 
                     void *elem, void *Image_data); 
-void to_index(int col, int row, A2Methods_UArray2 u2, void *elem, void *cl);
-void abcd_to_index(int col, int row, A2Methods_UArray2 u2, 
-                   void *elem, void *cl); 
 void compute_dct(float array[], struct Codeword *codeword); 
 
-void print_codeword(int col, int row, A2Methods_UArray2 u2, 
+size_t write_header(unsigned char *out, unsigned width, unsigned height,
+                    bool entropy, bool progressive, 
+                    const struct Profile *profile);
+size_t store_image(Pnm_ppm pixmap, A2Methods_T methods, 
+                   A2Methods_UArray2 words, const struct Profile *profile,
+                   unsigned char *out);
+size_t store_words(Pnm_ppm pixmap, A2Methods_T methods, 
+                   A2Methods_UArray2 words, unsigned char *out);
+size_t store_entropy_image(Pnm_ppm pixmap, A2Methods_T methods,
+                           A2Methods_UArray2 words, 
+                           const struct Profile *profile,
+                           unsigned char *out, size_t capacity,
+                           struct Workspace *ws);
+size_t store_progressive_image(Pnm_ppm pixmap, A2Methods_T methods,
+                               A2Methods_UArray2 words, 
+                               const struct Profile *profile,
+                               unsigned char *out, struct Workspace *ws);
+void store_codeword(int col, int row, A2Methods_UArray2 u2, 
                     void *elem, void *cl); 
-void print_image(Pnm_ppm pixmap, A2Methods_T methods, 
-                 A2Methods_UArray2 new_array);
+void flatten_word(int col, int row, A2Methods_UArray2 u2, 
+                  void *elem, void *words);
+void unflatten_word(int col, int row, A2Methods_UArray2 u2, 
+                    void *elem, void *words);
 
 
 /*Decompression functions*/
-Pnm_ppm read_compressed_file(FILE *fp);
-Pnm_ppm unpack_code(Pnm_ppm pixmap, A2Methods_T methods);
-void to_chroma(int col, int row, A2Methods_UArray2 u2, void *elem, void*cl); 
+enum Codec40_status read_header(const unsigned char *in, size_t len,
+                                struct Header *header);
+enum Codec40_status check_payload(size_t len, const struct Header *header);
+enum Codec40_status read_words(const unsigned char *in, size_t len,
+                               const struct Header *header,
+                               struct Workspace *ws, 
+                               A2Methods_UArray2 *words);
+enum Codec40_status read_partial_words(const unsigned char *in, size_t len,
+                                       const struct Header *header,
+                                       struct Workspace *ws, 
+                                       A2Methods_UArray2 *words,
+                                       size_t *refined);
+void decode_words(const struct Codec40_image *image, Pnm_ppm pixmap,
+                  const struct Profile *profile, struct Workspace *ws);
+void decode_luma(const struct Codec40_image *image, 
+                 const struct Profile *profile, struct Workspace *ws);
+void decode_yuv(const struct Codec40_yuv *image, 
+                const struct Profile *profile, struct Workspace *ws);
+void load_codeword(int col, int row, A2Methods_UArray2 u2, 
+                   void *elem, void *cl); 
+Pnm_ppm unpack_code(Pnm_ppm pixmap, A2Methods_T methods, 
+                    const struct Profile *profile, struct Workspace *ws);
 
-Pnm_ppm expand_pixmap(Pnm_ppm pixmap, A2Methods_T methods);
+Pnm_ppm expand_pixmap(Pnm_ppm pixmap, A2Methods_T methods, 
+                      A2Methods_UArray2 new_array);
 void populate_big(int col, int row, A2Methods_UArray2 u2, 
                   void *elem, void *Image_data); 
 void init_cv(Pnm_cv cv, float avg_pb, float avg_pr, float y); 
 
-void index_to_abcd(int col, int row, A2Methods_UArray2 u2, 
-                                    void *elem, void *cl);
-void packing(int col, int row, A2Methods_UArray2 u2, 
-                      void *elem, void *Image_data); 
-void read_32bit (int col, int row, A2Methods_UArray2 u2, 
-                                  void *elem, void *fp); 
-void get_bits(int col, int row, A2Methods_UArray2 u2, void *elem, void *array); 
+void convert_to_rgb(Pnm_ppm pixmap, const struct Codec40_image *image);
+void to_rgb(int col, int row, A2Methods_UArray2 u2, void *elem, void *image);
 
 
 /* Helper functions*/
 void push_into_range(float *value, float max, float min);
 void free_old_array (A2Methods_UArray2 old_array, A2Methods_T methods); 
-
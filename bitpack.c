@@ -11,7 +11,6 @@
  */ 
 
 #include "bitpack.h"
-#include "math.h"
 #include "assert.h"
 #include <stdlib.h>
 #include <stdio.h>
@@ -25,17 +24,12 @@
 bool Bitpack_fitsu(uint64_t n, unsigned width)
 {
     assert(width > 0 && width <= 64);
-    /* the number of ints we can represent is 
-    2^width - 1 (the -1 accounts for 0) */
-    uint64_t num_ints = pow(2, width) - 1;
-    uint64_t range_hi = num_ints;
-
-    /* if n is in the range of 0 to num_ints, then it fits */
-    if(n <= range_hi){
+    /* n fits if it has no bits set at or above width; a shift by 64 
+    is undefined, and every n fits in 64 bits */
+    if (width == 64) {
         return true;
-    } else {
-        return false;
     }
+    return (n >> width) == 0;
 }
 
 /* Bitpack_fitss()
@@ -47,15 +41,14 @@ bool Bitpack_fitsu(uint64_t n, unsigned width)
 bool Bitpack_fitss(int64_t n, unsigned width)
 {
     assert(width > 0 && width <= 64);
-    int64_t num_ints = pow(2, width) - 1;
-    int64_t range_hi = num_ints / 2;
-    int64_t range_lo = range_hi - num_ints;
-    
-    if(n <= range_hi && n >= range_lo){
+    if (width == 64) {
         return true;
     }
-    return false;
+    /* the range is -2^(width - 1) to 2^(width - 1) - 1 */
+    int64_t range_hi = (int64_t)((UINT64_C(1) << (width - 1)) - 1);
+    int64_t range_lo = -range_hi - 1;
 
+    return n <= range_hi && n >= range_lo;
 }
 
 /* Bitpack_getu()
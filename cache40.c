@@ -0,0 +1,455 @@
+/*
+ *     cache40.c
+ *     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
+ *     Date: 10-26-20
+ *     arith
+ *
+ *     Purpose: An on-disk cache of 40image results (see cache40.h).
+ *              Each result is one file in the cache directory, named by
+ *              its key: a small header, which repeats the key, and then
+ *              the output bytes. Hits are mapped into memory rather
+ *              than read.
+ *
+ *              Processes share the directory without taking locks to
+ *              read or write. A result is written to a temporary file
+ *              and renamed into place, so a reader sees all of it or
+ *              none of it, and a file that is unlinked while mapped
+ *              stays readable. A hit bumps its file's modification
+ *              time, which is what eviction goes by. Only the eviction
+ *              scan takes a lock, so that two processes do not scan at
+ *              once.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "assert.h"
+#include "cache40.h"
+#include "instrument.h"
+
+/* Part of every key. Change it whenever the codec's output for the same
+   input changes, so results from an older codec are never returned. */
+#define CODEC_VERSION "COMP40 Compressed image format 2; codec 1"
+
+/* the default size bound when ARITH40_CACHE_SIZE is not set */
+#define DEFAULT_MAX_BYTES ((uint64_t)256 << 20)
+
+#define ENTRY_MAGIC "A40CACHE"
+
+/* A temporary file this old was left by a writer that was killed
+   before it could rename or remove it; no result takes this long to
+   write. */
+#define STALE_TMP_SECONDS (60 * 60)
+
+/* a key as a file name: two 64-bit hashes in hex */
+#define NAME_LEN 32
+
+/* the header of a result file; the file is in host byte order, since
+   the cache is only ever read by the machine that wrote it */
+struct Entry
+{
+    char magic[8];
+    uint64_t hash[2];
+    uint64_t in_len;
+    uint64_t out_len;
+};
+
+struct Cache40_T
+{
+    char *dir;
+    uint64_t max_bytes;
+    /* the mapping of the last hit */
+    void *map;
+    size_t map_len;
+};
+
+/* one result file, for eviction */
+struct File
+{
+    struct timespec mtime;
+    off_t size;
+    char name[NAME_LEN + 1];
+};
+
+#define PRIME1 UINT64_C(0x9E3779B185EBCA87)
+#define PRIME2 UINT64_C(0xC2B2AE3D27D4EB4F)
+#define PRIME3 UINT64_C(0x165667B19E3779F9)
+
+static inline uint64_t rotl(uint64_t x, int r)
+{
+    return x << r | x >> (64 - r);
+}
+
+static inline uint64_t read64(const unsigned char *p)
+{
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    return word;
+}
+
+/* hash_bytes()
+ * Purpose: A fast 64-bit hash of a buffer, in the style of xxHash: four
+ *          independent lanes over 32-byte stripes, so the multiplies
+ *          overlap, then the tail and a final mix
+ * Parameters: The bytes, how many, and a seed
+ * Returns: The hash
+ */
+static uint64_t hash_bytes(const unsigned char *p, size_t len, uint64_t seed)
+{
+    uint64_t lane[4] = { seed + PRIME1 + PRIME2, seed + PRIME2, seed,
+                         seed - PRIME1 };
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        for (int j = 0; j < 4; j++) {
+            lane[j] = rotl(lane[j] + read64(p + i + 8 * j) * PRIME2, 31) *
+                      PRIME1;
+        }
+    }
+    uint64_t h = rotl(lane[0], 1) + rotl(lane[1], 7) + rotl(lane[2], 12) +
+                 rotl(lane[3], 18) + len;
+    for (; i + 8 <= len; i += 8) {
+        h ^= rotl(read64(p + i) * PRIME2, 31) * PRIME1;
+        h = rotl(h, 27) * PRIME1 + PRIME3;
+    }
+    for (; i < len; i++) {
+        h ^= p[i] * PRIME3;
+        h = rotl(h, 11) * PRIME1;
+    }
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+/* Cache40_key()
+ * Purpose: Find what a result is filed under
+ * Parameters: What is done to the input (for example "compress" and the
+ *             options), and the input and its length
+ * Returns: The key
+ */
+struct Cache40_key Cache40_key(const char *op, const unsigned char *in,
+                               size_t len)
+{
+    assert(op != NULL && in != NULL);
+    uint64_t seed = hash_bytes((const unsigned char *)CODEC_VERSION,
+                               strlen(CODEC_VERSION), 0);
+    seed = hash_bytes((const unsigned char *)op, strlen(op), seed);
+    struct Cache40_key key;
+    key.hash[0] = hash_bytes(in, len, seed);
+    key.hash[1] = hash_bytes(in, len, ~seed);
+    key.len = len;
+    return key;
+}
+
+/* Cache40_open()
+ * Purpose: Open the cache named by the environment
+ * Parameters: none
+ * Returns: The cache, or NULL if ARITH40_CACHE is not set or its
+ *          directory cannot be made
+ */
+Cache40_T Cache40_open(void)
+{
+    const char *dir = getenv("ARITH40_CACHE");
+    if (dir == NULL || *dir == '\0') {
+        return NULL;
+    }
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+        fprintf(stderr, "40image: cache %s: %s, not caching\n", dir,
+                strerror(errno));
+        return NULL;
+    }
+    Cache40_T cache = calloc(1, sizeof(*cache));
+    assert(cache != NULL);
+    cache->dir = malloc(strlen(dir) + 1);
+    assert(cache->dir != NULL);
+    strcpy(cache->dir, dir);
+
+    const char *size = getenv("ARITH40_CACHE_SIZE");
+    cache->max_bytes = size != NULL ? strtoull(size, NULL, 10) : 0;
+    if (cache->max_bytes == 0) {
+        cache->max_bytes = DEFAULT_MAX_BYTES;
+    }
+    return cache;
+}
+
+/* unmap()
+ * Purpose: Let go of the last hit
+ * Parameters: The cache
+ * Returns: none
+ */
+static void unmap(Cache40_T cache)
+{
+    if (cache->map != NULL) {
+        munmap(cache->map, cache->map_len);
+        cache->map = NULL;
+    }
+}
+
+/* Cache40_close()
+ * Purpose: Close the cache, unmapping the last hit
+ * Parameters: A pointer to the cache, which is set to NULL
+ * Returns: none
+ */
+void Cache40_close(Cache40_T *cache)
+{
+    if (cache == NULL || *cache == NULL) {
+        return;
+    }
+    unmap(*cache);
+    free((*cache)->dir);
+    free(*cache);
+    *cache = NULL;
+}
+
+/* entry_path()
+ * Purpose: Find the file a key is stored in
+ * Parameters: The cache, and the key
+ * Returns: The path, which the caller frees
+ */
+static char *entry_path(Cache40_T cache, const struct Cache40_key *key)
+{
+    size_t len = strlen(cache->dir) + 1 + NAME_LEN + 1;
+    char *path = malloc(len);
+    assert(path != NULL);
+    snprintf(path, len, "%s/%016llx%016llx", cache->dir,
+             (unsigned long long)key->hash[0],
+             (unsigned long long)key->hash[1]);
+    return path;
+}
+
+/* Cache40_get()
+ * Purpose: Look up a result
+ * Parameters: The cache, the key, and where to put the result's length
+ * Returns: The result, or NULL on a miss; the result stays mapped until
+ *          the next Cache40_get() or Cache40_close()
+ */
+const unsigned char *Cache40_get(Cache40_T cache,
+                                 const struct Cache40_key *key, size_t *len)
+{
+    assert(cache != NULL && key != NULL && len != NULL);
+    unmap(cache);
+    char *path = entry_path(cache, key);
+    int fd = open(path, O_RDONLY);
+    free(path);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 ||
+        (size_t)st.st_size <= sizeof(struct Entry)) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        INSTRUMENT_COUNT("cache_misses", 1);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    const struct Entry *entry = map;
+    if (map == MAP_FAILED ||
+        memcmp(entry->magic, ENTRY_MAGIC, sizeof(entry->magic)) != 0 ||
+        entry->hash[0] != key->hash[0] || entry->hash[1] != key->hash[1] ||
+        entry->in_len != key->len ||
+        entry->out_len != st.st_size - sizeof(struct Entry)) {
+        if (map != MAP_FAILED) {
+            munmap(map, st.st_size);
+        }
+        close(fd);
+        INSTRUMENT_COUNT("cache_misses", 1);
+        return NULL;
+    }
+    /* a hit is a use, for the LRU order */
+    futimens(fd, NULL);
+    close(fd);
+
+    cache->map = map;
+    cache->map_len = st.st_size;
+    *len = entry->out_len;
+    INSTRUMENT_COUNT("cache_hits", 1);
+    INSTRUMENT_COUNT("cache_bytes_saved", *len);
+    return (const unsigned char *)map + sizeof(struct Entry);
+}
+
+/* write_all()
+ * Purpose: Write a whole buffer to a file descriptor
+ * Parameters: The descriptor, the bytes, and how many
+ * Returns: True if they were all written
+ */
+static bool write_all(int fd, const void *bytes, size_t len)
+{
+    const unsigned char *p = bytes;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static int compare_mtimes(const void *a, const void *b)
+{
+    const struct timespec *x = &((const struct File *)a)->mtime;
+    const struct timespec *y = &((const struct File *)b)->mtime;
+    if (x->tv_sec != y->tv_sec) {
+        return x->tv_sec < y->tv_sec ? -1 : 1;
+    }
+    return (x->tv_nsec > y->tv_nsec) - (x->tv_nsec < y->tv_nsec);
+}
+
+/* is_entry_name()
+ * Purpose: Tell result files from anything else in the directory
+ * Parameters: A file name
+ * Returns: True if it is a key in hex
+ */
+static bool is_entry_name(const char *name)
+{
+    return strlen(name) == NAME_LEN &&
+           strspn(name, "0123456789abcdef") == NAME_LEN;
+}
+
+/* is_stale_tmp()
+ * Purpose: Find temporary files that their writers left behind
+ * Parameters: A file name and its status
+ * Returns: True if it is a temporary result file (see Cache40_put)
+ *          older than STALE_TMP_SECONDS
+ */
+static bool is_stale_tmp(const char *name, const struct stat *st)
+{
+    return strncmp(name, ".tmp.", 5) == 0 &&
+           st->st_mtime < time(NULL) - STALE_TMP_SECONDS;
+}
+
+/* evict()
+ * Purpose: Bring the cache under its size bound, removing the least
+ *          recently used results first
+ * Parameters: The cache
+ * Returns: none
+ * Notes: Evicts down to 90% of the bound, so that the next few results
+ *        do not each set off a scan. Skipped if another process holds
+ *        the lock, since it is already evicting. The scan also removes
+ *        stale temporary files, which count toward no bound and would
+ *        otherwise stay forever.
+ */
+static void evict(Cache40_T cache)
+{
+    size_t len = strlen(cache->dir) + sizeof("/.lock");
+    char *lock_path = malloc(len);
+    assert(lock_path != NULL);
+    snprintf(lock_path, len, "%s/.lock", cache->dir);
+    int lock = open(lock_path, O_RDWR | O_CREAT, 0666);
+    free(lock_path);
+    if (lock < 0) {
+        return;
+    }
+    if (flock(lock, LOCK_EX | LOCK_NB) != 0) {
+        close(lock);
+        return;
+    }
+
+    DIR *dir = opendir(cache->dir);
+    size_t nfiles = 0, capacity = 64;
+    struct File *files = malloc(capacity * sizeof(*files));
+    assert(files != NULL);
+    uint64_t total = 0;
+    size_t stale = 0;
+    struct dirent *dirent;
+    while (dir != NULL && (dirent = readdir(dir)) != NULL) {
+        struct stat st;
+        if (fstatat(dirfd(dir), dirent->d_name, &st, 0) != 0) {
+            continue;
+        }
+        if (is_stale_tmp(dirent->d_name, &st)) {
+            stale += unlinkat(dirfd(dir), dirent->d_name, 0) == 0;
+            continue;
+        }
+        if (!is_entry_name(dirent->d_name)) {
+            continue;
+        }
+        if (nfiles == capacity) {
+            capacity *= 2;
+            files = realloc(files, capacity * sizeof(*files));
+            assert(files != NULL);
+        }
+        files[nfiles].mtime = st.st_mtim;
+        files[nfiles].size = st.st_size;
+        strcpy(files[nfiles].name, dirent->d_name);
+        total += st.st_size;
+        nfiles++;
+    }
+
+    if (total > cache->max_bytes) {
+        qsort(files, nfiles, sizeof(*files), compare_mtimes);
+        uint64_t target = cache->max_bytes / 10 * 9;
+        size_t evicted = 0;
+        for (size_t i = 0; i < nfiles && total > target; i++) {
+            if (unlinkat(dirfd(dir), files[i].name, 0) == 0) {
+                total -= files[i].size;
+                evicted++;
+            }
+        }
+        INSTRUMENT_COUNT("cache_evictions", evicted);
+    }
+    INSTRUMENT_COUNT("cache_stale_files", stale);
+
+    free(files);
+    if (dir != NULL) {
+        closedir(dir);
+    }
+    flock(lock, LOCK_UN);
+    close(lock);
+}
+
+/* Cache40_put()
+ * Purpose: Store a result
+ * Parameters: The cache, the key, and the result and its length
+ * Returns: none
+ * Notes: A result that cannot be stored is quietly not cached
+ */
+void Cache40_put(Cache40_T cache, const struct Cache40_key *key,
+                 const unsigned char *out, size_t len)
+{
+    assert(cache != NULL && key != NULL && out != NULL);
+    if (len + sizeof(struct Entry) > cache->max_bytes) {
+        return;
+    }
+    struct Entry entry;
+    memcpy(entry.magic, ENTRY_MAGIC, sizeof(entry.magic));
+    entry.hash[0] = key->hash[0];
+    entry.hash[1] = key->hash[1];
+    entry.in_len = key->len;
+    entry.out_len = len;
+
+    static unsigned serial = 0;
+    size_t tmp_len = strlen(cache->dir) + 64;
+    char *tmp = malloc(tmp_len);
+    assert(tmp != NULL);
+    snprintf(tmp, tmp_len, "%s/.tmp.%ld.%u", cache->dir, (long)getpid(),
+             serial++);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0666);
+    if (fd >= 0) {
+        bool written = write_all(fd, &entry, sizeof(entry)) &&
+                       write_all(fd, out, len);
+        char *path = entry_path(cache, key);
+        if (close(fd) != 0 || !written || rename(tmp, path) != 0) {
+            unlink(tmp);
+        } else {
+            INSTRUMENT_COUNT("cache_bytes_stored", len);
+        }
+        free(path);
+    }
+    free(tmp);
+    evict(cache);
+}
@@ -0,0 +1,47 @@
+/*
+ *     cache40.h
+ *     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
+ *     Date: 10-26-20
+ *     arith
+ *
+ *     Purpose: Interface for cache40.c: an on-disk cache of 40image
+ *              results, keyed by a hash of the input bytes, what was
+ *              done to them, and the codec version. It is on when
+ *              ARITH40_CACHE names a directory; ARITH40_CACHE_SIZE
+ *              bounds its size in bytes, past which the least recently
+ *              used results are evicted. Any number of processes may
+ *              share one directory.
+ */
+
+#ifndef CACHE40_INCLUDED
+#define CACHE40_INCLUDED
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct Cache40_T *Cache40_T;
+
+/* what a result is filed under */
+struct Cache40_key
+{
+    uint64_t hash[2];
+    uint64_t len;
+};
+
+/* NULL when the cache is off */
+extern Cache40_T Cache40_open(void);
+extern void Cache40_close(Cache40_T *cache);
+
+/* op says what is done to the input, with which options */
+extern struct Cache40_key Cache40_key(const char *op,
+                                      const unsigned char *in, size_t len);
+
+/* a hit is mapped into memory until the next lookup or the close */
+extern const unsigned char *Cache40_get(Cache40_T cache,
+                                        const struct Cache40_key *key,
+                                        size_t *len);
+extern void Cache40_put(Cache40_T cache, const struct Cache40_key *key,
+                        const unsigned char *out, size_t len);
+
+#endif
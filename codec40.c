@@ -0,0 +1,893 @@
+/*
+ *     codec40.c
+ *     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
+ *     Date: 10-26-20
+ *     arith
+ *
+ *     Purpose: Compress and decompress images held in memory (see
+ *              codec40.h). Checks everything the caller or the
+ *              compressed image can get wrong before running the
+ *              pipeline in arith_helper.c, so that the asserts left in
+ *              the pipeline only guard against bugs.
+ *
+ *              A Codec40_T keeps the pipeline's arrays between calls,
+ *              so a run of images of one size allocates them once.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "assert.h"
+#include "codec40.h"
+#include "arith_helper.h"
+#include "entropy.h"
+#include "progressive40.h"
+#include "instrument.h"
+
+struct Codec40_T
+{
+    struct Workspace ws;
+};
+
+static const char *messages[] = {
+    [CODEC40_OK] = "success",
+    [CODEC40_BAD_ARGUMENT] = "bad argument",
+    [CODEC40_BAD_HEADER] = "not a compressed image",
+    [CODEC40_TRUNCATED] = "compressed image is truncated",
+    [CODEC40_CORRUPT] = "compressed image is corrupt",
+    [CODEC40_NO_SPACE] = "output buffer is too small",
+    [CODEC40_NO_MEMORY] = "out of memory",
+};
+
+/* Codec40_strerror()
+ * Purpose: Describe a status
+ * Parameters: The status
+ * Returns: A message, which the caller must not free
+ */
+const char *Codec40_strerror(enum Codec40_status status)
+{
+    if ((unsigned)status >= sizeof(messages) / sizeof(messages[0])) {
+        return "unknown status";
+    }
+    return messages[status];
+}
+
+/* check_image()
+ * Purpose: Check that an image can be compressed, or decompressed into
+ * Parameters: The image, and its channels a pixel: 3, or 1 for gray
+ * Returns: CODEC40_OK or CODEC40_BAD_ARGUMENT
+ */
+static enum Codec40_status check_image(const struct Codec40_image *image,
+                                       unsigned channels)
+{
+    if (image == NULL || image->pixels == NULL) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+    if (image->maxval == 0 || image->maxval > 65535) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+    if (image->width < 2 || image->height < 2 ||
+        image->width > CODEC40_MAX_SIDE || image->height > CODEC40_MAX_SIDE) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+    size_t row_bytes = (size_t)image->width * channels *
+                       CODEC40_CHANNEL_BYTES(image->maxval);
+    if (image->stride < row_bytes) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+    return CODEC40_OK;
+}
+
+/* check_yuv()
+ * Purpose: Check that a Y'PbPr image can be compressed, or decompressed
+ *          into
+ * Parameters: The image
+ * Returns: CODEC40_OK or CODEC40_BAD_ARGUMENT
+ */
+static enum Codec40_status check_yuv(const struct Codec40_yuv *image)
+{
+    if (image == NULL || image->y == NULL || image->pb == NULL ||
+        image->pr == NULL) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+    if (image->maxval == 0 || image->maxval > 65535) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+    if (image->width < 2 || image->height < 2 ||
+        image->width % 2 != 0 || image->height % 2 != 0 ||
+        image->width > CODEC40_MAX_SIDE || image->height > CODEC40_MAX_SIDE) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+    size_t row_bytes = (size_t)image->width *
+                       CODEC40_CHANNEL_BYTES(image->maxval);
+    if (image->y_stride < row_bytes || image->chroma_stride < row_bytes / 2) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+    return CODEC40_OK;
+}
+
+/* profile_of()
+ * Purpose: Find the profile the options ask for
+ * Parameters: The options, or NULL for the defaults
+ * Returns: The profile
+ */
+static const struct Profile *profile_of(const struct Codec_options *options)
+{
+    if (options == NULL || options->profile == NULL) {
+        return Profile_default();
+    }
+    return options->profile;
+}
+
+/* Codec40_encode_bound()
+ * Purpose: The most bytes an image of a given size can compress to
+ * Parameters: The width and height in pixels, and the options (NULL for
+ *             the defaults)
+ * Returns: The bound, which is the buffer size Codec40_encode() needs
+ *          to never return CODEC40_NO_SPACE
+ */
+size_t Codec40_encode_bound(unsigned width, unsigned height,
+                            const struct Codec_options *options)
+{
+    size_t blocks = (size_t)(width / 2) * (height / 2);
+    size_t bound = blocks * sizeof(uint32_t);
+    if (options != NULL && options->entropy) {
+        size_t entropy = Entropy_bound(width / 2, height / 2,
+                                       profile_of(options));
+        bound = entropy > bound ? entropy : bound;
+    }
+    if (options != NULL && options->progressive) {
+        size_t progressive = Progressive40_bytes(width / 2, height / 2,
+                                                 profile_of(options));
+        bound = progressive > bound ? progressive : bound;
+    }
+    return HEADER_MAX + bound;
+}
+
+/* encode()
+ * Purpose: Compress an image, as Codec40_encode() or
+ *          Codec40_encode_yuv() describes
+ * Parameters: The workspace to use, the image as rgb pixels or as
+ *             Y'PbPr planes, one of which is NULL, then as for
+ *             Codec40_encode()
+ * Returns: As for Codec40_encode()
+ */
+static enum Codec40_status encode(struct Workspace *ws,
+                                  const struct Codec40_image *image,
+                                  const struct Codec40_yuv *yuv,
+                                  const struct Codec_options *options,
+                                  unsigned char *out, size_t capacity,
+                                  size_t *len)
+{
+    if (len == NULL || (out == NULL && capacity > 0)) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+    enum Codec40_status status = yuv != NULL ? check_yuv(yuv)
+                                             : check_image(image, 3);
+    if (status != CODEC40_OK) {
+        return status;
+    }
+    unsigned width = yuv != NULL ? yuv->width : image->width;
+    unsigned height = yuv != NULL ? yuv->height : image->height;
+    const struct Profile *profile = profile_of(options);
+    bool entropy = options != NULL && options->entropy;
+    bool progressive = options != NULL && options->progressive;
+    if (entropy && progressive) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+
+    if (!entropy) {
+        unsigned char header[HEADER_MAX];
+        size_t payload = progressive
+            ? Progressive40_bytes(width / 2, height / 2, profile)
+            : (size_t)(width / 2) * (height / 2) * sizeof(uint32_t);
+        *len = write_header(header, width / 2, height / 2, false,
+                            progressive, profile) + payload;
+        if (*len > capacity) {
+            return CODEC40_NO_SPACE;
+        }
+    }
+
+    A2Methods_T plain = uarray2_methods_plain;
+    struct Pnm_ppm pixmap;
+    A2Methods_UArray2 words = yuv != NULL
+                              ? encode_yuv(yuv, &pixmap, profile, ws)
+                              : encode_words(image, &pixmap, profile, ws);
+    if (entropy) {
+        *len = store_entropy_image(&pixmap, plain, words, profile, out,
+                                   capacity, ws);
+    } else if (progressive) {
+        *len = store_progressive_image(&pixmap, plain, words, profile, out,
+                                       ws);
+    } else {
+        *len = store_image(&pixmap, plain, words, profile, out);
+    }
+
+    return *len <= capacity ? CODEC40_OK : CODEC40_NO_SPACE;
+}
+
+/* Codec40_encode()
+ * Purpose: Compress an image into a buffer supplied by the caller
+ * Parameters: The image, the options (NULL for the defaults), the
+ *             buffer and its size, and where to put the compressed size
+ * Returns: CODEC40_OK, or CODEC40_NO_SPACE if the buffer is too small,
+ *          in which case *len is the size it needed to be
+ * Notes: A plain or progressive image's size is known before
+ *        compressing, so a call with no buffer is a cheap size query; an
+ *        entropy coded image is compressed before its size is known.
+ *        Asking for both entropy coding and the progressive layout is
+ *        CODEC40_BAD_ARGUMENT.
+ */
+enum Codec40_status Codec40_encode(const struct Codec40_image *image,
+                                   const struct Codec_options *options,
+                                   unsigned char *out, size_t capacity,
+                                   size_t *len)
+{
+    struct Workspace ws;
+    workspace_init(&ws);
+    enum Codec40_status status = encode(&ws, image, NULL, options, out,
+                                        capacity, len);
+    workspace_free(&ws);
+    return status;
+}
+
+/* Codec40_encode_yuv()
+ * Purpose: Compress a Y'PbPr 4:2:0 image into a buffer supplied by the
+ *          caller
+ * Parameters: The image, then as for Codec40_encode()
+ * Returns: As for Codec40_encode()
+ * Notes: Skips the conversion from rgb and the averaging of the chroma
+ *        over each block, which the planes have already had
+ */
+enum Codec40_status Codec40_encode_yuv(const struct Codec40_yuv *image,
+                                       const struct Codec_options *options,
+                                       unsigned char *out, size_t capacity,
+                                       size_t *len)
+{
+    if (image == NULL) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+    struct Workspace ws;
+    workspace_init(&ws);
+    enum Codec40_status status = encode(&ws, NULL, image, options, out,
+                                        capacity, len);
+    workspace_free(&ws);
+    return status;
+}
+
+/* Codec40_encode_alloc()
+ * Purpose: Compress an image into a buffer allocated by the codec
+ * Parameters: The image, the options (NULL for the defaults), and where
+ *             to put the buffer and the compressed size
+ * Returns: CODEC40_OK or why the image could not be compressed; on
+ *          success the caller frees *out with free()
+ */
+enum Codec40_status Codec40_encode_alloc(const struct Codec40_image *image,
+                                         const struct Codec_options *options,
+                                         unsigned char **out, size_t *len)
+{
+    if (out == NULL || len == NULL) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+    enum Codec40_status status = check_image(image, 3);
+    if (status != CODEC40_OK) {
+        return status;
+    }
+    size_t capacity = Codec40_encode_bound(image->width, image->height,
+                                           options);
+    unsigned char *buffer = malloc(capacity);
+    if (buffer == NULL) {
+        return CODEC40_NO_MEMORY;
+    }
+    status = Codec40_encode(image, options, buffer, capacity, len);
+    if (status != CODEC40_OK) {
+        free(buffer);
+        return status;
+    }
+    unsigned char *shrunk = realloc(buffer, *len);
+    *out = shrunk != NULL ? shrunk : buffer;
+    return CODEC40_OK;
+}
+
+/* Codec40_decode_info()
+ * Purpose: Find the size of the image a compressed image decodes to
+ * Parameters: The compressed image and its length, and where to put
+ *             the width and height in pixels
+ * Returns: CODEC40_OK, or why the image cannot be decompressed: its
+ *          header cannot be used, or its payload is shorter or longer
+ *          than the header allows (check_payload())
+ * Notes: Reads only the header, but checks the length, so that a caller
+ *        allocates nothing for an image whose payload is not there
+ */
+enum Codec40_status Codec40_decode_info(const unsigned char *in, size_t len,
+                                        unsigned *width, unsigned *height)
+{
+    if (in == NULL || width == NULL || height == NULL) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+    struct Header header;
+    enum Codec40_status status = read_header(in, len, &header);
+    if (status == CODEC40_OK) {
+        status = check_payload(len - header.size, &header);
+    }
+    if (status != CODEC40_OK) {
+        return status;
+    }
+    *width = header.width * 2;
+    *height = header.height * 2;
+    return CODEC40_OK;
+}
+
+/* Codec40_write_header()
+ * Purpose: Write the header of a compressed image
+ * Parameters: The width and height of the image in pixels (an odd last
+ *             row or column is dropped), the options (NULL for the
+ *             defaults), and where to write it
+ * Returns: The size of the header
+ */
+size_t Codec40_write_header(unsigned width, unsigned height,
+                            const struct Codec_options *options,
+                            unsigned char out[CODEC40_HEADER_MAX])
+{
+    assert(out != NULL);
+    return write_header(out, width / 2, height / 2,
+                        options != NULL && options->entropy,
+                        options != NULL && options->progressive,
+                        profile_of(options));
+}
+
+/* Codec40_read_header()
+ * Purpose: Parse and check the header of a compressed image
+ * Parameters: The compressed image, or as much of it as the caller has,
+ *             its length, and the header to fill in
+ * Returns: CODEC40_OK, or why the header cannot be used
+ * Notes: The payload starts header->size bytes in
+ */
+enum Codec40_status Codec40_read_header(const unsigned char *in, size_t len,
+                                        struct Codec40_header *header)
+{
+    if (in == NULL || header == NULL) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+    struct Header parsed;
+    enum Codec40_status status = read_header(in, len, &parsed);
+    if (status != CODEC40_OK) {
+        return status;
+    }
+    header->width = parsed.width * 2;
+    header->height = parsed.height * 2;
+    header->options.entropy = parsed.entropy;
+    header->options.progressive = parsed.progressive;
+    header->options.profile = parsed.profile;
+    header->size = parsed.size;
+    return CODEC40_OK;
+}
+
+/* decode_payload()
+ * Purpose: Decompress the payload of an image
+ * Parameters: The workspace to use, the payload and its length, the
+ *             header, the image to fill in, which is the size the
+ *             header says, whether it is gray, and NULL to take only
+ *             the whole payload, or where to put how many blocks are
+ *             whole, as Codec40_decode_partial() describes
+ * Returns: As for Codec40_decode()
+ */
+static enum Codec40_status decode_payload(struct Workspace *ws,
+                                          const unsigned char *in,
+                                          size_t len,
+                                          const struct Header *header,
+                                          const struct Codec40_image *image,
+                                          bool gray, size_t *refined)
+{
+    workspace_fit(ws, image->width, image->height);
+    A2Methods_UArray2 words;
+    enum Codec40_status status =
+        refined != NULL
+        ? read_partial_words(in, len, header, ws, &words, refined)
+        : read_words(in, len, header, ws, &words);
+    if (status != CODEC40_OK) {
+        return status;
+    }
+    if (gray) {
+        decode_luma(image, header->profile, ws);
+        return CODEC40_OK;
+    }
+
+    struct Pnm_ppm pixmap;
+    pixmap.width = header->width;
+    pixmap.height = header->height;
+    pixmap.denominator = image->maxval;
+    pixmap.pixels = words;
+    pixmap.methods = uarray2_methods_plain;
+    decode_words(image, &pixmap, header->profile, ws);
+    return CODEC40_OK;
+}
+
+/* decode()
+ * Purpose: Decompress an image, as Codec40_decode() describes
+ * Parameters: The workspace to use, then as for Codec40_decode(), then
+ *             whether to decompress only the luma, as
+ *             Codec40_decode_gray() describes, and as for
+ *             decode_payload()
+ * Returns: As for Codec40_decode()
+ */
+static enum Codec40_status decode(struct Workspace *ws,
+                                  const unsigned char *in, size_t len,
+                                  const struct Codec40_image *image,
+                                  bool gray, size_t *refined)
+{
+    if (in == NULL) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+    struct Header header;
+    enum Codec40_status status = read_header(in, len, &header);
+    if (status != CODEC40_OK) {
+        return status;
+    }
+    status = check_image(image, gray ? 1 : 3);
+    if (status != CODEC40_OK) {
+        return status;
+    }
+    if (image->width != header.width * 2 ||
+        image->height != header.height * 2) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+    status = check_payload(len - header.size, &header);
+    if (status != CODEC40_OK) {
+        return status;
+    }
+    return decode_payload(ws, in + header.size, len - header.size, &header,
+                          image, gray, refined);
+}
+
+/* Codec40_decode()
+ * Purpose: Decompress an image into pixels supplied by the caller
+ * Parameters: The compressed image and its length, and the image to
+ *             fill in, whose width and height must be those given by
+ *             Codec40_decode_info() and whose maxval may be anything
+ * Returns: CODEC40_OK or why the image could not be decompressed; the
+ *          pixels are only written on success
+ */
+enum Codec40_status Codec40_decode(const unsigned char *in, size_t len,
+                                   const struct Codec40_image *image)
+{
+    struct Workspace ws;
+    workspace_init(&ws);
+    enum Codec40_status status = decode(&ws, in, len, image, false, NULL);
+    workspace_free(&ws);
+    return status;
+}
+
+/* Codec40_decode_partial()
+ * Purpose: Decompress as much of a compressed image as has arrived into
+ *          pixels supplied by the caller
+ * Parameters: The first len bytes of the compressed image, the image to
+ *             fill in, as for Codec40_decode(), and where to put how
+ *             many 2x2 blocks, in row-major order from the first, are
+ *             whole
+ * Returns: CODEC40_OK, or why the image could not be decompressed; the
+ *          pixels are only written on success
+ * Notes: A progressive image decodes once its first pass has arrived
+ *        (CODEC40_TRUNCATED until then), with the blocks past *refined
+ *        flat. Any other image needs all of its bytes. Given the whole
+ *        of an image, this is Codec40_decode().
+ */
+enum Codec40_status Codec40_decode_partial(const unsigned char *in,
+                                           size_t len,
+                                           const struct Codec40_image *image,
+                                           size_t *refined)
+{
+    if (refined == NULL) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+    struct Workspace ws;
+    workspace_init(&ws);
+    enum Codec40_status status = decode(&ws, in, len, image, false,
+                                        refined);
+    workspace_free(&ws);
+    return status;
+}
+
+/* Codec40_decode_gray()
+ * Purpose: Decompress the luma of an image alone, into a grayscale image
+ *          supplied by the caller
+ * Parameters: The compressed image and its length, and the image to
+ *             fill in, as for Codec40_decode() but with one channel a
+ *             pixel
+ * Returns: CODEC40_OK or why the image could not be decompressed; the
+ *          pixels are only written on success
+ * Notes: The chroma are never read, so this does about a third of the
+ *        work of Codec40_decode() and writes a third of the bytes
+ */
+enum Codec40_status Codec40_decode_gray(const unsigned char *in, size_t len,
+                                        const struct Codec40_image *image)
+{
+    struct Workspace ws;
+    workspace_init(&ws);
+    enum Codec40_status status = decode(&ws, in, len, image, true, NULL);
+    workspace_free(&ws);
+    return status;
+}
+
+/* decode_yuv_using()
+ * Purpose: Decompress an image into Y'PbPr planes, as
+ *          Codec40_decode_yuv() describes
+ * Parameters: The workspace to use, then as for Codec40_decode_yuv()
+ * Returns: As for Codec40_decode_yuv()
+ */
+static enum Codec40_status decode_yuv_using(struct Workspace *ws,
+                                            const unsigned char *in,
+                                            size_t len,
+                                            const struct Codec40_yuv *image)
+{
+    if (in == NULL) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+    struct Header header;
+    enum Codec40_status status = read_header(in, len, &header);
+    if (status != CODEC40_OK) {
+        return status;
+    }
+    status = check_yuv(image);
+    if (status != CODEC40_OK) {
+        return status;
+    }
+    if (image->width != header.width * 2 ||
+        image->height != header.height * 2) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+    status = check_payload(len - header.size, &header);
+    if (status != CODEC40_OK) {
+        return status;
+    }
+    workspace_fit(ws, image->width, image->height);
+    A2Methods_UArray2 words;
+    status = read_words(in + header.size, len - header.size, &header, ws,
+                        &words);
+    if (status != CODEC40_OK) {
+        return status;
+    }
+    decode_yuv(image, header.profile, ws);
+    return CODEC40_OK;
+}
+
+/* Codec40_decode_yuv()
+ * Purpose: Decompress an image into Y'PbPr 4:2:0 planes supplied by the
+ *          caller
+ * Parameters: The compressed image and its length, and the image to
+ *             fill in, whose width and height must be those given by
+ *             Codec40_decode_info() and whose maxval may be anything
+ * Returns: CODEC40_OK or why the image could not be decompressed; the
+ *          planes are only written on success
+ * Notes: Skips spreading each block's chroma over its pixels and the
+ *        conversion to rgb, and writes half the bytes of rgb
+ */
+enum Codec40_status Codec40_decode_yuv(const unsigned char *in, size_t len,
+                                       const struct Codec40_yuv *image)
+{
+    struct Workspace ws;
+    workspace_init(&ws);
+    enum Codec40_status status = decode_yuv_using(&ws, in, len, image);
+    workspace_free(&ws);
+    return status;
+}
+
+/* Codec40_decode_alloc()
+ * Purpose: Decompress an image into pixels allocated by the codec
+ * Parameters: The compressed image and its length, the maxval to
+ *             decompress to, and the image to fill in
+ * Returns: CODEC40_OK or why the image could not be decompressed; on
+ *          success the caller frees image->pixels with free()
+ * Notes: The rows of the image are packed, with no padding
+ */
+enum Codec40_status Codec40_decode_alloc(const unsigned char *in,
+                                         size_t len, unsigned maxval,
+                                         struct Codec40_image *image)
+{
+    if (image == NULL || maxval == 0 || maxval > 65535) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+    struct Codec40_image decoded;
+    enum Codec40_status status = Codec40_decode_info(in, len,
+                                                     &decoded.width,
+                                                     &decoded.height);
+    if (status != CODEC40_OK) {
+        return status;
+    }
+    decoded.maxval = maxval;
+    decoded.stride = (size_t)decoded.width * 3 *
+                     CODEC40_CHANNEL_BYTES(maxval);
+    decoded.pixels = malloc(decoded.stride * decoded.height);
+    if (decoded.pixels == NULL) {
+        return CODEC40_NO_MEMORY;
+    }
+    status = Codec40_decode(in, len, &decoded);
+    if (status != CODEC40_OK) {
+        free(decoded.pixels);
+        return status;
+    }
+    *image = decoded;
+    return CODEC40_OK;
+}
+
+/* Codec40_new()
+ * Purpose: Make a codec context, which keeps its working arrays between
+ *          calls
+ * Parameters: none
+ * Returns: The context, or NULL if out of memory; free it with
+ *          Codec40_free()
+ * Notes: A context is not safe to use from two threads at once; give
+ *        each thread its own
+ */
+Codec40_T Codec40_new(void)
+{
+    Codec40_T codec = malloc(sizeof(*codec));
+    if (codec != NULL) {
+        workspace_init(&codec->ws);
+    }
+    return codec;
+}
+
+/* Codec40_free()
+ * Purpose: Free a codec context and its working arrays
+ * Parameters: A pointer to the context, which is set to NULL
+ * Returns: none
+ */
+void Codec40_free(Codec40_T *codec)
+{
+    if (codec == NULL || *codec == NULL) {
+        return;
+    }
+    workspace_free(&(*codec)->ws);
+    free(*codec);
+    *codec = NULL;
+}
+
+/* Codec40_encode_using()
+ * Purpose: Codec40_encode(), reusing a context's working arrays
+ * Parameters: The context, then as for Codec40_encode()
+ * Returns: As for Codec40_encode()
+ */
+enum Codec40_status Codec40_encode_using(Codec40_T codec,
+                                         const struct Codec40_image *image,
+                                         const struct Codec_options *options,
+                                         unsigned char *out, size_t capacity,
+                                         size_t *len)
+{
+    if (codec == NULL) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+    return encode(&codec->ws, image, NULL, options, out, capacity, len);
+}
+
+/* Codec40_decode_using()
+ * Purpose: Codec40_decode(), reusing a context's working arrays
+ * Parameters: The context, then as for Codec40_decode()
+ * Returns: As for Codec40_decode()
+ */
+enum Codec40_status Codec40_decode_using(Codec40_T codec,
+                                         const unsigned char *in, size_t len,
+                                         const struct Codec40_image *image)
+{
+    if (codec == NULL) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+    return decode(&codec->ws, in, len, image, false, NULL);
+}
+
+/* Codec40_encode_yuv_using()
+ * Purpose: Codec40_encode_yuv(), reusing a context's working arrays
+ * Parameters: The context, then as for Codec40_encode_yuv()
+ * Returns: As for Codec40_encode_yuv()
+ */
+enum Codec40_status
+Codec40_encode_yuv_using(Codec40_T codec, const struct Codec40_yuv *image,
+                         const struct Codec_options *options,
+                         unsigned char *out, size_t capacity, size_t *len)
+{
+    if (codec == NULL || image == NULL) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+    return encode(&codec->ws, NULL, image, options, out, capacity, len);
+}
+
+/* Codec40_decode_yuv_using()
+ * Purpose: Codec40_decode_yuv(), reusing a context's working arrays
+ * Parameters: The context, then as for Codec40_decode_yuv()
+ * Returns: As for Codec40_decode_yuv()
+ */
+enum Codec40_status
+Codec40_decode_yuv_using(Codec40_T codec, const unsigned char *in,
+                         size_t len, const struct Codec40_yuv *image)
+{
+    if (codec == NULL) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+    return decode_yuv_using(&codec->ws, in, len, image);
+}
+
+/* Codec40_encode_many()
+ * Purpose: Compress a run of images with one context
+ * Parameters: The context, the number of images, the images, the
+ *             options for all of them (NULL for the defaults), a buffer
+ *             for each (bytes and capacity in, len out), and a status
+ *             for each
+ * Returns: How many of the images were compressed
+ * Notes: A failure only affects its own image
+ */
+size_t Codec40_encode_many(Codec40_T codec, size_t n,
+                           const struct Codec40_image *images,
+                           const struct Codec_options *options,
+                           struct Codec40_buffer *outs,
+                           enum Codec40_status *statuses)
+{
+    size_t done = 0;
+    for (size_t i = 0; i < n; i++) {
+        statuses[i] = Codec40_encode_using(codec, &images[i], options,
+                                           outs[i].bytes, outs[i].capacity,
+                                           &outs[i].len);
+        done += statuses[i] == CODEC40_OK;
+    }
+    return done;
+}
+
+/* Codec40_decode_many()
+ * Purpose: Decompress a run of images with one context
+ * Parameters: The context, the number of images, the compressed images
+ *             (bytes and len), the images to fill in, and a status for
+ *             each
+ * Returns: How many of the images were decompressed
+ * Notes: A failure only affects its own image
+ */
+size_t Codec40_decode_many(Codec40_T codec, size_t n,
+                           const struct Codec40_buffer *ins,
+                           const struct Codec40_image *images,
+                           enum Codec40_status *statuses)
+{
+    size_t done = 0;
+    for (size_t i = 0; i < n; i++) {
+        statuses[i] = Codec40_decode_using(codec, ins[i].bytes, ins[i].len,
+                                           &images[i]);
+        done += statuses[i] == CODEC40_OK;
+    }
+    return done;
+}
+
+/* Codec40_encode_band()
+ * Purpose: Compress a band of an image, with no header
+ * Parameters: The context, the band, the options of the whole image
+ *             (NULL for the defaults), the buffer and its size, and
+ *             where to put the size of the band's payload
+ * Returns: CODEC40_OK, or CODEC40_NO_SPACE if the buffer is too small,
+ *          in which case *len is the size it needed to be
+ * Notes: Every band but the last must be an even number of rows; an odd
+ *        last row or column is dropped, as for a whole image. Entropy
+ *        coded and progressive images cannot be coded in bands.
+ */
+enum Codec40_status Codec40_encode_band(Codec40_T codec,
+                                        const struct Codec40_image *band,
+                                        const struct Codec_options *options,
+                                        unsigned char *out, size_t capacity,
+                                        size_t *len)
+{
+    if (codec == NULL || len == NULL || (out == NULL && capacity > 0) ||
+        (options != NULL && (options->entropy || options->progressive))) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+    enum Codec40_status status = check_image(band, 3);
+    if (status != CODEC40_OK) {
+        return status;
+    }
+    *len = (size_t)(band->width / 2) * (band->height / 2) * sizeof(uint32_t);
+    if (*len > capacity) {
+        return CODEC40_NO_SPACE;
+    }
+
+    struct Pnm_ppm pixmap;
+    A2Methods_UArray2 words = encode_words(band, &pixmap, profile_of(options),
+                                           &codec->ws);
+    store_words(&pixmap, uarray2_methods_plain, words, out);
+    return CODEC40_OK;
+}
+
+/* Codec40_decode_band()
+ * Purpose: Decompress a band of an image
+ * Parameters: The context, the band's payload and its length, the
+ *             options from the image's header (NULL for the defaults),
+ *             and the band to fill in, whose width is the image's and
+ *             whose height is even
+ * Returns: CODEC40_OK or why the band could not be decompressed
+ * Notes: The payload must be exactly the band's codewords
+ */
+enum Codec40_status Codec40_decode_band(Codec40_T codec,
+                                        const unsigned char *in, size_t len,
+                                        const struct Codec_options *options,
+                                        const struct Codec40_image *band)
+{
+    if (codec == NULL || in == NULL ||
+        (options != NULL && (options->entropy || options->progressive))) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+    enum Codec40_status status = check_image(band, 3);
+    if (status != CODEC40_OK) {
+        return status;
+    }
+    if (band->width % 2 != 0 || band->height % 2 != 0) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+    struct Header header = { band->width / 2, band->height / 2, false,
+                             false, profile_of(options), 0 };
+    return decode_payload(&codec->ws, in, len, &header, band, false, NULL);
+}
+
+/* Codec40_patch()
+ * Purpose: Bring a compressed image up to date with a changed image, in
+ *          place, coding only the 2x2 blocks in the rectangles given
+ * Parameters: The new image, which is the size of the compressed one,
+ *             the rectangles that changed and how many (none for the
+ *             whole image), the compressed image and its length, and
+ *             where to put how many codewords changed
+ * Returns: CODEC40_OK, or why the image could not be patched; entropy
+ *          coded and progressive images cannot be, since their words
+ *          have no fixed place
+ * Notes: Rectangles are widened out to whole blocks and cut down to the
+ *        image. The compressed image is left as Codec40_encode() would
+ *        make it from the new image, provided that the pixels outside
+ *        the rectangles did not change; only words that differ are
+ *        written.
+ */
+enum Codec40_status Codec40_patch(const struct Codec40_image *image,
+                                  const struct Codec40_rect *rects,
+                                  size_t nrects, unsigned char *compressed,
+                                  size_t len, size_t *patched)
+{
+    if (compressed == NULL || patched == NULL ||
+        (rects == NULL && nrects > 0)) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+    struct Header header;
+    enum Codec40_status status = read_header(compressed, len, &header);
+    if (status != CODEC40_OK) {
+        return status;
+    }
+    status = check_image(image, 3);
+    if (status != CODEC40_OK) {
+        return status;
+    }
+    if (header.entropy || header.progressive ||
+        image->width / 2 != header.width ||
+        image->height / 2 != header.height) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+    size_t payload = (size_t)header.width * header.height * sizeof(uint32_t);
+    if (len - header.size != payload) {
+        return len - header.size < payload ? CODEC40_TRUNCATED
+                                           : CODEC40_CORRUPT;
+    }
+
+    struct Codec40_rect whole = { 0, 0, image->width, image->height };
+    if (nrects == 0) {
+        rects = &whole;
+        nrects = 1;
+    }
+    STAGE_BEGIN(mark);
+    size_t blocks = 0;
+    *patched = 0;
+    for (size_t i = 0; i < nrects; i++) {
+        unsigned col = rects[i].x / 2, row = rects[i].y / 2;
+        if (col >= header.width || row >= header.height ||
+            rects[i].width == 0 || rects[i].height == 0) {
+            continue;
+        }
+        /* a block is in if any of its pixels is */
+        unsigned cols = (rects[i].x % 2 + (size_t)rects[i].width + 1) / 2;
+        unsigned rows = (rects[i].y % 2 + (size_t)rects[i].height + 1) / 2;
+        cols = cols < header.width - col ? cols : header.width - col;
+        rows = rows < header.height - row ? rows : header.height - row;
+        *patched += patch_words(image, header.profile, col, row, cols, rows,
+                                compressed + header.size);
+        blocks += (size_t)cols * rows;
+    }
+    STAGE_END(mark, "patch", blocks);
+    INSTRUMENT_COUNT("patched_words", *patched);
+    return CODEC40_OK;
+}
@@ -0,0 +1,212 @@
+/*
+ *     codec40.h
+ *     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
+ *     Date: 10-26-20
+ *     arith
+ *
+ *     Purpose: Interface for codec40.c: compress and decompress images
+ *              held in memory. The caller supplies the RGB pixels and
+ *              either supplies the output buffer or has the codec
+ *              allocate it. Nothing here touches a FILE, keeps global
+ *              state, or exits the process: bad input is reported by
+ *              the returned status. 40image is a wrapper over these.
+ *
+ *              A Codec40_T context keeps the codec's working arrays
+ *              between images, for callers that code many images of
+ *              the same size one after another.
+ */
+
+#ifndef CODEC40_INCLUDED
+#define CODEC40_INCLUDED
+
+#include <stddef.h>
+#include "codec_options.h"
+
+/* an RGB image in memory: pixels are red, green, blue, with one byte
+   per channel when maxval is below 256 and otherwise two (a uint16_t in
+   host byte order); Codec40_decode_gray() writes one gray channel */
+struct Codec40_image
+{
+    unsigned width, height;
+    unsigned maxval;
+    /* bytes from the start of one row to the start of the next */
+    size_t stride;
+    unsigned char *pixels;
+};
+
+/* a Y'PbPr image in memory as three planes, 4:2:0: y has a sample per
+   pixel, and pb and pr one per 2x2 block, so they are half as wide and
+   half as high. Samples are one byte when maxval is below 256 and
+   otherwise a uint16_t in host byte order. y runs from 0 to maxval, and
+   pb and pr are offset by (maxval + 1) / 2, so with a maxval of 255 the
+   planes are the full-range YUV 4:2:0 (I420) of JPEG. The codec's own
+   chroma is the average of each 2x2 block, so these planes are what it
+   holds, with no conversion to or from RGB. */
+struct Codec40_yuv
+{
+    /* in pixels, both even */
+    unsigned width, height;
+    unsigned maxval;
+    /* bytes from the start of one row of y to the next, and of pb or pr */
+    size_t y_stride, chroma_stride;
+    unsigned char *y, *pb, *pr;
+};
+
+/* a compressed image, or room for one */
+struct Codec40_buffer
+{
+    unsigned char *bytes;
+    size_t capacity;
+    size_t len;
+};
+
+#define CODEC40_CHANNEL_BYTES(maxval) ((maxval) < 256 ? 1 : 2)
+
+/* largest width or height, in pixels, that the codec accepts */
+#define CODEC40_MAX_SIDE 65536
+
+/* longest header of a compressed image, in bytes */
+#define CODEC40_HEADER_MAX 128
+
+enum Codec40_status
+{
+    CODEC40_OK = 0,
+    CODEC40_BAD_ARGUMENT,   /* image or buffer cannot be used */
+    CODEC40_BAD_HEADER,     /* not a compressed image, or bad profile */
+    CODEC40_TRUNCATED,      /* payload shorter than the header says */
+    CODEC40_CORRUPT,        /* payload is the wrong length or garbled */
+    CODEC40_NO_SPACE,       /* output buffer too small */
+    CODEC40_NO_MEMORY
+};
+
+extern const char *Codec40_strerror(enum Codec40_status status);
+
+/* Compression. An odd last row or column is dropped. */
+extern size_t Codec40_encode_bound(unsigned width, unsigned height,
+                                   const struct Codec_options *options);
+extern enum Codec40_status
+Codec40_encode(const struct Codec40_image *image,
+               const struct Codec_options *options,
+               unsigned char *out, size_t capacity, size_t *len);
+extern enum Codec40_status
+Codec40_encode_alloc(const struct Codec40_image *image,
+                     const struct Codec_options *options,
+                     unsigned char **out, size_t *len);
+
+/* Decompression. The image is always an even width and height. */
+extern enum Codec40_status Codec40_decode_info(const unsigned char *in,
+                                               size_t len, unsigned *width,
+                                               unsigned *height);
+extern enum Codec40_status Codec40_decode(const unsigned char *in,
+                                          size_t len,
+                                          const struct Codec40_image *image);
+extern enum Codec40_status Codec40_decode_alloc(const unsigned char *in,
+                                                size_t len, unsigned maxval,
+                                                struct Codec40_image *image);
+
+/* Partial decompression. A progressive image (options.progressive, see
+   progressive40.h) has every block's a, pb and pr before any block's
+   b, c and d, so once that first pass has arrived the whole image can
+   be decompressed, each 2x2 block flat until its detail arrives.
+   *refined is how many blocks are whole, in row-major order; they are
+   all whole, and the image is what Codec40_decode() gives, once every
+   byte has arrived. */
+extern enum Codec40_status
+Codec40_decode_partial(const unsigned char *in, size_t len,
+                       const struct Codec40_image *image, size_t *refined);
+
+/* Grayscale decompression: the luma alone, into an image with one
+   channel a pixel rather than three (one byte, or a uint16_t when maxval
+   is 256 or more), so stride need only be width channels */
+extern enum Codec40_status Codec40_decode_gray(const unsigned char *in,
+                                               size_t len,
+                                               const struct Codec40_image
+                                               *image);
+
+/* Y'PbPr 4:2:0, straight to and from the codewords (see struct
+   Codec40_yuv). A frame to decompress into must be the size given by
+   Codec40_decode_info(). */
+extern enum Codec40_status
+Codec40_encode_yuv(const struct Codec40_yuv *image,
+                   const struct Codec_options *options,
+                   unsigned char *out, size_t capacity, size_t *len);
+extern enum Codec40_status Codec40_decode_yuv(const unsigned char *in,
+                                              size_t len,
+                                              const struct Codec40_yuv
+                                              *image);
+
+/* Headers. A compressed image is its header and then its payload. */
+struct Codec40_header
+{
+    /* width and height of the image in pixels */
+    unsigned width, height;
+    struct Codec_options options;
+    /* bytes taken by the header */
+    size_t size;
+};
+
+extern size_t Codec40_write_header(unsigned width, unsigned height,
+                                   const struct Codec_options *options,
+                                   unsigned char out[CODEC40_HEADER_MAX]);
+extern enum Codec40_status Codec40_read_header(const unsigned char *in,
+                                               size_t len,
+                                               struct Codec40_header *header);
+
+/* Contexts: the same, reusing working arrays between calls */
+typedef struct Codec40_T *Codec40_T;
+
+extern Codec40_T Codec40_new(void);
+extern void Codec40_free(Codec40_T *codec);
+extern enum Codec40_status
+Codec40_encode_using(Codec40_T codec, const struct Codec40_image *image,
+                     const struct Codec_options *options,
+                     unsigned char *out, size_t capacity, size_t *len);
+extern enum Codec40_status
+Codec40_decode_using(Codec40_T codec, const unsigned char *in, size_t len,
+                     const struct Codec40_image *image);
+extern enum Codec40_status
+Codec40_encode_yuv_using(Codec40_T codec, const struct Codec40_yuv *image,
+                         const struct Codec_options *options,
+                         unsigned char *out, size_t capacity, size_t *len);
+extern enum Codec40_status
+Codec40_decode_yuv_using(Codec40_T codec, const unsigned char *in,
+                         size_t len, const struct Codec40_yuv *image);
+extern size_t Codec40_encode_many(Codec40_T codec, size_t n,
+                                  const struct Codec40_image *images,
+                                  const struct Codec_options *options,
+                                  struct Codec40_buffer *outs,
+                                  enum Codec40_status *statuses);
+extern size_t Codec40_decode_many(Codec40_T codec, size_t n,
+                                  const struct Codec40_buffer *ins,
+                                  const struct Codec40_image *images,
+                                  enum Codec40_status *statuses);
+
+/* Bands. The payload of a plain (not entropy coded or progressive)
+   image is its codewords a row of 2x2 blocks at a time, so an image can
+   be coded a band of rows at a time: the payload of a band of 2k pixel
+   rows is the next k block rows of the image's payload. */
+extern enum Codec40_status
+Codec40_encode_band(Codec40_T codec, const struct Codec40_image *band,
+                    const struct Codec_options *options,
+                    unsigned char *out, size_t capacity, size_t *len);
+extern enum Codec40_status
+Codec40_decode_band(Codec40_T codec, const unsigned char *in, size_t len,
+                    const struct Codec_options *options,
+                    const struct Codec40_image *band);
+
+/* Patching. Each 2x2 block of a plain image has its codeword at a fixed
+   place in the payload, so when part of an image changes, the words of
+   the blocks under it can be coded again in place, at a cost that goes
+   with the area changed rather than with the size of the image. */
+struct Codec40_rect
+{
+    /* left column, top row, width and height, in pixels */
+    unsigned x, y, width, height;
+};
+
+extern enum Codec40_status
+Codec40_patch(const struct Codec40_image *image,
+              const struct Codec40_rect *rects, size_t nrects,
+              unsigned char *compressed, size_t len, size_t *patched);
+
+#endif
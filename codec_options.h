@@ -0,0 +1,68 @@
+/*
+ *     codec_options.h
+ *     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
+ *     Date: 10-26-20
+ *     arith
+ *
+ *     Purpose: Options which select the optional stages of the codec,
+ *              and the compress entry point which takes them, along
+ *              with the entry points for grayscale and yuv files and
+ *              those which patch, transform and describe a compressed
+ *              file
+ */
+
+#ifndef CODEC_OPTIONS_INCLUDED
+#define CODEC_OPTIONS_INCLUDED
+
+#include <stdbool.h>
+#include <stdio.h>
+#include "profile.h"
+
+struct Codec_options
+{
+    /* entropy code the codewords (see entropy.h) */
+    bool entropy;
+    /* how the codewords are quantized (see profile.h), NULL for the
+       default profile */
+    const struct Profile *profile;
+    /* lay the codewords out coarse to fine (see progressive40.h); not
+       with entropy */
+    bool progressive;
+};
+
+/* what compress40() uses: plain 32-bit codewords */
+#define CODEC_OPTIONS_DEFAULT { false, NULL, false }
+
+extern void compress40_with(FILE *input, const struct Codec_options *options);
+
+/* decompresses the luma alone, to a pgm */
+extern void decompress40_gray(FILE *input);
+
+/* compress a raw 8-bit Y'PbPr 4:2:0 (I420) frame of the given size, and
+   decompress to one, with no conversion to or from rgb (see struct
+   Codec40_yuv in codec40.h) */
+extern void compress40_yuv(FILE *input, const struct Codec_options *options,
+                           unsigned width, unsigned height);
+extern void decompress40_yuv(FILE *input);
+
+/* decompresses as much of a progressive image as has arrived (see
+   Codec40_decode_partial() in codec40.h) */
+extern void decompress40_partial(FILE *input);
+
+/* brings the compressed image at path up to date with the ppm on input,
+   coding only the rectangles given (see Codec40_patch() in codec40.h) */
+struct Codec40_rect;
+extern void patch40(const char *path, FILE *input,
+                    const struct Codec40_rect *rects, size_t nrects);
+
+/* writes the compressed image on input flipped, rotated or transposed
+   by the transform named op (see transform40.h), cropped first to crop
+   if it is not NULL */
+extern void transform40(FILE *input, const char *op,
+                        const struct Codec40_rect *crop);
+
+/* prints the brightness and color statistics of the compressed image on
+   input, as JSON, without decompressing it (see stats40.h) */
+extern void stats40(FILE *input);
+
+#endif
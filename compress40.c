@@ -2,13 +2,219 @@
  *     compress40.c
  *     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
  *     Date: 10-26-20
- *     arith 
+ *     arith
  *
- *     Purpose: Compress or decomporess an image from a file
+ *     Purpose: Compress or decomporess an image from a file. A thin
+ *              layer over codec40.h: reads the file into memory, runs
+ *              the codec, and writes the result to standard output
  */
 
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "assert.h"
 #include "compress40.h"
-#include "arith_helper.h"
+#include "codec_options.h"
+#include "codec40.h"
+#include "cache40.h"
+#include "transform40.h"
+#include "stats40.h"
+#include "ppm40.h"
+#include "pages40.h"
+#include "instrument.h"
+
+/* check_status()
+ * Purpose: Exit with a message if the codec failed
+ * Parameters: The status the codec returned
+ * Returns: None
+ */
+static void check_status(enum Codec40_status status)
+{
+    if (status != CODEC40_OK) {
+        fprintf(stderr, "40image: %s\n", Codec40_strerror(status));
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* read_image()
+ * Purpose: Read a ppm file into a flat image
+ * Parameters: A file pointer which accesses the ppm file
+ * Returns: The image, whose pixels the caller frees with free_image()
+ * Notes: Exits with a message if the file is not a ppm
+ */
+static struct Codec40_image read_image(FILE *input)
+{
+    assert(input != NULL);
+    struct Codec40_image image;
+    const char *error = Ppm40_read(input, &image);
+    if (error != NULL) {
+        fprintf(stderr, "40image: %s\n", error);
+        exit(EXIT_FAILURE);
+    }
+    return image;
+}
+
+/* free_image()
+ * Purpose: Free the pixels of an image from read_image()
+ * Parameters: The image
+ * Returns: None
+ */
+static void free_image(struct Codec40_image *image)
+{
+    Pages40_free(image->pixels, image->stride * image->height + 1);
+    image->pixels = NULL;
+}
+
+/* read_all()
+ * Purpose: Read the whole of a file into memory
+ * Parameters: A file pointer, and where to put the number of bytes read
+ * Returns: The bytes, which the caller frees
+ */
+static unsigned char *read_all(FILE *input, size_t *len)
+{
+    assert(input != NULL);
+    size_t capacity = 1 << 16;
+    unsigned char *bytes = malloc(capacity);
+    assert(bytes != NULL);
+    size_t got;
+    *len = 0;
+    while ((got = fread(bytes + *len, 1, capacity - *len, input)) > 0) {
+        *len += got;
+        if (*len == capacity) {
+            capacity *= 2;
+            bytes = realloc(bytes, capacity);
+            assert(bytes != NULL);
+        }
+    }
+    return bytes;
+}
+
+/* what decompress_to() makes */
+enum Output
+{
+    OUTPUT_PPM,
+    OUTPUT_PGM,     /* the luma alone */
+    OUTPUT_YUV,     /* raw 8-bit Y'PbPr 4:2:0 */
+    OUTPUT_PARTIAL  /* a ppm of as much of the image as has arrived */
+};
+
+/* decode_ppm()
+ * Purpose: Decompress an image into the bytes of a ppm file, of a pgm
+ *          file of its luma alone, or of a ppm of as much of it as has
+ *          arrived
+ * Parameters: The compressed image and its length, which of those to
+ *             make, and where to put the length of the file
+ * Returns: The file, which the caller frees with Pages40_free()
+ * Notes: Exits with a message if the input is not a compressed image
+ */
+static unsigned char *decode_ppm(const unsigned char *in, size_t len,
+                                 enum Output output, size_t *ppm_len)
+{
+    bool gray = output == OUTPUT_PGM;
+    struct Codec40_image image;
+    check_status(Codec40_decode_info(in, len, &image.width, &image.height));
+    char header[64];
+    int header_len = snprintf(header, sizeof(header), "%s\n%u %u\n%u\n",
+                              gray ? "P5" : "P6", image.width, image.height,
+                              255);
+    image.maxval = 255;
+    image.stride = (size_t)image.width * (gray ? 1 : 3);
+    *ppm_len = header_len + image.stride * image.height;
+    unsigned char *ppm = Pages40_alloc(*ppm_len);
+    check_status(ppm != NULL ? CODEC40_OK : CODEC40_NO_MEMORY);
+    memcpy(ppm, header, header_len);
+    image.pixels = ppm + header_len;
+    size_t refined;
+    if (output == OUTPUT_PARTIAL) {
+        check_status(Codec40_decode_partial(in, len, &image, &refined));
+        INSTRUMENT_COUNT("refined_blocks", refined);
+    } else {
+        check_status(gray ? Codec40_decode_gray(in, len, &image)
+                          : Codec40_decode(in, len, &image));
+    }
+    return ppm;
+}
+
+/* yuv_planes()
+ * Purpose: Lay out a raw 8-bit Y'PbPr 4:2:0 frame: the y plane, then
+ *          pb, then pr, each packed, as I420 files are
+ * Parameters: The frame's bytes, its width and height, which are even,
+ *             and the image to fill in
+ * Returns: The size of the frame in bytes
+ */
+static size_t yuv_planes(unsigned char *bytes, unsigned width,
+                         unsigned height, struct Codec40_yuv *image)
+{
+    size_t luma = (size_t)width * height;
+    image->width = width;
+    image->height = height;
+    image->maxval = 255;
+    image->y_stride = width;
+    image->chroma_stride = width / 2;
+    image->y = bytes;
+    image->pb = bytes + luma;
+    image->pr = image->pb + luma / 4;
+    return luma + luma / 2;
+}
+
+/* decode_yuv_file()
+ * Purpose: Decompress an image into the bytes of a raw Y'PbPr 4:2:0
+ *          frame
+ * Parameters: The compressed image and its length, and where to put the
+ *             length of the frame
+ * Returns: The frame, which the caller frees with Pages40_free()
+ * Notes: Exits with a message if the input is not a compressed image
+ */
+static unsigned char *decode_yuv_file(const unsigned char *in, size_t len,
+                                      size_t *yuv_len)
+{
+    unsigned width, height;
+    check_status(Codec40_decode_info(in, len, &width, &height));
+    struct Codec40_yuv image;
+    *yuv_len = (size_t)width * height * 3 / 2;
+    unsigned char *yuv = Pages40_alloc(*yuv_len);
+    check_status(yuv != NULL ? CODEC40_OK : CODEC40_NO_MEMORY);
+    yuv_planes(yuv, width, height, &image);
+    check_status(Codec40_decode_yuv(in, len, &image));
+    return yuv;
+}
+
+/* write_output()
+ * Purpose: Write a result to standard output
+ * Parameters: The stage to time it as, and the bytes and how many
+ * Returns: None
+ */
+static void write_output(const char *stage, const unsigned char *out,
+                         size_t len)
+{
+    (void)stage;
+    STAGE_BEGIN(mark);
+    fwrite(out, 1, len, stdout);
+    STAGE_END(mark, stage, len);
+}
+
+/* encode_stream()
+ * Purpose: Compress a ppm file
+ * Parameters: A file pointer which accesses the file, the options, and
+ *             where to put the length of the compressed image
+ * Returns: The compressed image, which the caller frees
+ * Notes: Exits with a message if the image cannot be compressed
+ */
+static unsigned char *encode_stream(FILE *input,
+                                    const struct Codec_options *options,
+                                    size_t *len)
+{
+    struct Codec40_image image = read_image(input);
+    unsigned char *out;
+    check_status(Codec40_encode_alloc(&image, options, &out, len));
+    free_image(&image);
+    return out;
+}
 
 /* compress40()
  * Purpose: Compress a ppm file that was provided bu the user
@@ -17,27 +223,407 @@
  */
 extern void compress40(FILE *input)
 {
-    A2Methods_T methods = uarray2_methods_blocked;
-    Pnm_ppm pixmap = read_and_populate(input, methods);
-    pixmap = convert_to_floating(pixmap);
-    pixmap = block_arith(pixmap, methods); 
-    Pnm_ppmfree(&pixmap);
+    struct Codec_options options = CODEC_OPTIONS_DEFAULT;
+    compress40_with(input, &options);
 }
 
+/* compress40_with()
+ * Purpose: Compress a ppm file, with the optional stages in options
+ * Parameters: A file pointer which accesses the file to be compressed,
+ *             and the options
+ * Returns: None
+ * Notes: Exits with a message if the image cannot be compressed. With
+ *        the cache on (see cache40.h), the whole file is read first, to
+ *        look up its hash.
+ */
+extern void compress40_with(FILE *input, const struct Codec_options *options)
+{
+    assert(options != NULL);
+    Cache40_T cache = Cache40_open();
+    size_t len;
+    if (cache == NULL) {
+        unsigned char *out = encode_stream(input, options, &len);
+        write_output("write_compressed", out, len);
+        free(out);
+        INSTRUMENT_REPORT();
+        return;
+    }
+
+    size_t in_len;
+    unsigned char *in = read_all(input, &in_len);
+    const struct Profile *profile = options->profile != NULL
+                                    ? options->profile : Profile_default();
+    char op[64];
+    snprintf(op, sizeof(op), "compress%s%s %s",
+             options->entropy ? " -e" : "",
+             options->progressive ? " -l" : "", profile->name);
+    struct Cache40_key key = Cache40_key(op, in, in_len);
+    const unsigned char *hit = Cache40_get(cache, &key, &len);
+    if (hit != NULL) {
+        write_output("write_compressed", hit, len);
+    } else {
+        /* fmemopen() will not open an empty buffer */
+        FILE *stream = in_len > 0 ? fmemopen(in, in_len, "rb") : input;
+        assert(stream != NULL);
+        unsigned char *out = encode_stream(stream, options, &len);
+        if (stream != input) {
+            fclose(stream);
+        }
+        write_output("write_compressed", out, len);
+        Cache40_put(cache, &key, out, len);
+        free(out);
+    }
+    free(in);
+    Cache40_close(&cache);
+    INSTRUMENT_REPORT();
+}
+
+/* compress40_yuv()
+ * Purpose: Compress a raw 8-bit Y'PbPr 4:2:0 frame
+ * Parameters: A file pointer which accesses the frame, the options, and
+ *             the frame's width and height, which are even
+ * Returns: None
+ * Notes: Exits with a message if the file is not a whole frame of that
+ *        size. The frame is read whole, so it goes through the cache
+ *        as compress40_with() does.
+ */
+extern void compress40_yuv(FILE *input, const struct Codec_options *options,
+                           unsigned width, unsigned height)
+{
+    assert(options != NULL);
+    size_t in_len, len;
+    STAGE_BEGIN(read_mark);
+    unsigned char *in = read_all(input, &in_len);
+    STAGE_END(read_mark, "yuvread", in_len);
+    struct Codec40_yuv image;
+    if (width % 2 != 0 || height % 2 != 0 ||
+        yuv_planes(in, width, height, &image) != in_len) {
+        fprintf(stderr, "40image: input is not a %ux%u yuv 4:2:0 frame\n",
+                width, height);
+        exit(EXIT_FAILURE);
+    }
+
+    Cache40_T cache = Cache40_open();
+    struct Cache40_key key;
+    const unsigned char *hit = NULL;
+    if (cache != NULL) {
+        const struct Profile *profile = options->profile != NULL
+                                        ? options->profile
+                                        : Profile_default();
+        char op[64];
+        snprintf(op, sizeof(op), "compress -y %ux%u%s%s %s", width, height,
+                 options->entropy ? " -e" : "",
+                 options->progressive ? " -l" : "", profile->name);
+        key = Cache40_key(op, in, in_len);
+        hit = Cache40_get(cache, &key, &len);
+    }
+    if (hit != NULL) {
+        write_output("write_compressed", hit, len);
+    } else {
+        size_t capacity = Codec40_encode_bound(width, height, options);
+        unsigned char *out = malloc(capacity);
+        check_status(out != NULL ? CODEC40_OK : CODEC40_NO_MEMORY);
+        check_status(Codec40_encode_yuv(&image, options, out, capacity,
+                                        &len));
+        write_output("write_compressed", out, len);
+        if (cache != NULL) {
+            Cache40_put(cache, &key, out, len);
+        }
+        free(out);
+    }
+    free(in);
+    Cache40_close(&cache);
+    INSTRUMENT_REPORT();
+}
+
+/* decompress_to()
+ * Purpose: Decompress a compressed image to a ppm, to a pgm of its luma
+ *          alone, to a raw yuv frame, or to a ppm of as much of it as
+ *          has arrived
+ * Parameters: A file pointer which accesses the file to be decompressed,
+ *             and what to make
+ * Returns: None
+ * Notes: Exits with a message if the file is not a compressed image
+ */
+static void decompress_to(FILE *input, enum Output output)
+{
+    static const char *ops[] = {
+        [OUTPUT_PPM] = "decompress",
+        [OUTPUT_PGM] = "decompress -g",
+        [OUTPUT_YUV] = "decompress -y",
+        [OUTPUT_PARTIAL] = "decompress -l",
+    };
+    const char *stage = output == OUTPUT_YUV ? "yuvwrite" : "ppmwrite";
+    size_t len, out_len;
+    unsigned char *in = read_all(input, &len);
+    Cache40_T cache = Cache40_open();
+    struct Cache40_key key;
+    const unsigned char *hit = NULL;
+    if (cache != NULL) {
+        key = Cache40_key(ops[output], in, len);
+        hit = Cache40_get(cache, &key, &out_len);
+    }
+    if (hit != NULL) {
+        write_output(stage, hit, out_len);
+    } else {
+        unsigned char *out = output == OUTPUT_YUV
+                             ? decode_yuv_file(in, len, &out_len)
+                             : decode_ppm(in, len, output, &out_len);
+        write_output(stage, out, out_len);
+        if (cache != NULL) {
+            Cache40_put(cache, &key, out, out_len);
+        }
+        Pages40_free(out, out_len);
+    }
+    free(in);
+    Cache40_close(&cache);
+    INSTRUMENT_REPORT();
+}
 
 /* decompress40()
  * Purpose: decompress a ppm file that was provided bu the user
  * Parameters: A file pointer which accesses the file to be decompressed
  * Returns: None
+ * Notes: Exits with a message if the file is not a compressed image
  */
 extern void decompress40(FILE *input)
 {
-    A2Methods_T methods = uarray2_methods_blocked;
-    Pnm_ppm pixmap = read_compressed_file(input); 
-    pixmap = unpack_code(pixmap, methods); 
-    pixmap = convert_to_rgb(pixmap);
-    Pnm_ppmwrite(stdout, pixmap);
-    Pnm_ppmfree(&pixmap);
+    decompress_to(input, OUTPUT_PPM);
+}
+
+/* decompress40_gray()
+ * Purpose: Decompress the luma of a compressed image alone, to a pgm
+ * Parameters: A file pointer which accesses the file to be decompressed
+ * Returns: None
+ * Notes: Exits with a message if the file is not a compressed image
+ */
+extern void decompress40_gray(FILE *input)
+{
+    decompress_to(input, OUTPUT_PGM);
+}
+
+/* decompress40_yuv()
+ * Purpose: Decompress a compressed image to a raw 8-bit Y'PbPr 4:2:0
+ *          frame, with no conversion to rgb
+ * Parameters: A file pointer which accesses the file to be decompressed
+ * Returns: None
+ * Notes: Exits with a message if the file is not a compressed image
+ */
+extern void decompress40_yuv(FILE *input)
+{
+    decompress_to(input, OUTPUT_YUV);
+}
+
+/* decompress40_partial()
+ * Purpose: Decompress as much of a progressive image as has arrived, to
+ *          a ppm
+ * Parameters: A file pointer which accesses the file to be decompressed,
+ *             which may stop short
+ * Returns: None
+ * Notes: The blocks whose detail has not arrived are flat. Exits with a
+ *        message if the file is not a compressed image, or is too
+ *        short to show (see Codec40_decode_partial()).
+ */
+extern void decompress40_partial(FILE *input)
+{
+    decompress_to(input, OUTPUT_PARTIAL);
+}
+
+/* patch40()
+ * Purpose: Bring a compressed image file up to date with a changed ppm,
+ *          in place
+ * Parameters: The path of the compressed image, a file pointer which
+ *             accesses the new ppm, and the rectangles that changed and
+ *             how many (none for the whole image)
+ * Returns: None
+ * Notes: The file is mapped into memory, so only the pages holding
+ *        codewords that changed are written back. Exits with a message
+ *        if the file cannot be patched: if it is entropy coded or
+ *        progressive, or not the size of the ppm (less any odd last
+ *        row or column).
+ */
+extern void patch40(const char *path, FILE *input,
+                    const struct Codec40_rect *rects, size_t nrects)
+{
+    assert(path != NULL);
+    int fd = open(path, O_RDWR);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        fprintf(stderr, "40image: %s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    size_t len = info.st_size;
+    if (len == 0) {
+        check_status(CODEC40_BAD_HEADER);
+    }
+    unsigned char *compressed = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                                     MAP_SHARED, fd, 0);
+    if (compressed == MAP_FAILED) {
+        fprintf(stderr, "40image: %s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+
+    struct Codec40_image image = read_image(input);
+    struct Codec40_header header;
+    check_status(Codec40_read_header(compressed, len, &header));
+    if (header.options.entropy || header.options.progressive) {
+        fprintf(stderr, "40image: %s: cannot patch %s image\n", path,
+                header.options.entropy ? "an entropy coded"
+                                       : "a progressive");
+        exit(EXIT_FAILURE);
+    }
+    if (image.width / 2 * 2 != header.width ||
+        image.height / 2 * 2 != header.height) {
+        fprintf(stderr, "40image: image is %ux%u, %s is %ux%u\n",
+                image.width, image.height, path, header.width,
+                header.height);
+        exit(EXIT_FAILURE);
+    }
+    size_t patched;
+    enum Codec40_status status = Codec40_patch(&image, rects, nrects,
+                                               compressed, len, &patched);
+    free_image(&image);
+    munmap(compressed, len);
+    check_status(status);
+    INSTRUMENT_REPORT();
+}
+
+/* transform40()
+ * Purpose: Flip, rotate, transpose or crop a compressed image, without
+ *          decompressing it
+ * Parameters: A file pointer which accesses the compressed image, the
+ *             name of the transform, and the crop, or NULL for none
+ * Returns: None
+ * Notes: Exits with a message if the image cannot be transformed
+ */
+extern void transform40(FILE *input, const char *op,
+                        const struct Codec40_rect *crop)
+{
+    enum Transform40_op transform = Transform40_named(op);
+    assert(transform != TRANSFORM40_COUNT);
+    size_t len, out_len, bound;
+    unsigned char *in = read_all(input, &len);
+    check_status(Transform40_bound(in, len, transform, crop, &bound));
+    unsigned char *out = Pages40_alloc(bound);
+    check_status(out != NULL ? CODEC40_OK : CODEC40_NO_MEMORY);
+    check_status(Transform40_apply(in, len, transform, crop, out, bound,
+                                   &out_len));
+    write_output("write_compressed", out, out_len);
+    Pages40_free(out, bound);
+    free(in);
+    INSTRUMENT_REPORT();
+}
+
+/* map_input()
+ * Purpose: Get the whole of a file into memory, mapping it when it is a
+ *          regular file rather than copying it
+ * Parameters: A file pointer, where to put the length, and where to put
+ *             whether the bytes are mapped
+ * Returns: The bytes, which the caller frees with unmap_input()
+ */
+static unsigned char *map_input(FILE *input, size_t *len, bool *mapped)
+{
+    struct stat info;
+    int fd = fileno(input);
+    *mapped = false;
+    if (fd >= 0 && fstat(fd, &info) == 0 && S_ISREG(info.st_mode) &&
+        info.st_size > 0 && ftell(input) == 0) {
+        void *bytes = mmap(NULL, info.st_size, PROT_READ,
+                           MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        if (bytes != MAP_FAILED) {
+            *len = info.st_size;
+            *mapped = true;
+            return bytes;
+        }
+    }
+    return read_all(input, len);
 }
 
+/* unmap_input()
+ * Purpose: Free the bytes from map_input()
+ * Parameters: The bytes, their length, and whether they are mapped
+ * Returns: None
+ */
+static void unmap_input(unsigned char *bytes, size_t len, bool mapped)
+{
+    if (mapped) {
+        munmap(bytes, len);
+    } else {
+        free(bytes);
+    }
+}
 
+/* print_histogram()
+ * Purpose: Print a histogram as a JSON array
+ * Parameters: The counts, and how many there are
+ * Returns: None
+ */
+static void print_histogram(const size_t *counts, unsigned n)
+{
+    printf("[");
+    for (unsigned i = 0; i < n; i++) {
+        printf("%s%zu", i > 0 ? ", " : "", counts[i]);
+    }
+    printf("]");
+}
+
+/* print_chroma()
+ * Purpose: Print the statistics of one chroma channel as a JSON object
+ * Parameters: The statistics, the channel's name, mean, variance and
+ *             histogram, and whether it is the last member printed
+ * Returns: None
+ */
+static void print_chroma(const struct Stats40 *stats, const char *name,
+                         double mean, double variance,
+                         const size_t *histogram, bool last)
+{
+    printf("  \"%s\": {\"mean\": %.6f, \"variance\": %.6f,\n"
+           "    \"values\": [", name, mean, variance);
+    for (unsigned i = 0; i < stats->chroma_levels; i++) {
+        printf("%s%.6f", i > 0 ? ", " : "", stats->chroma_value[i]);
+    }
+    printf("],\n    \"histogram\": ");
+    print_histogram(histogram, stats->chroma_levels);
+    printf(last ? "}}\n" : "},\n");
+}
+
+/* stats40()
+ * Purpose: Print the statistics of a compressed image, without
+ *          decompressing it
+ * Parameters: A file pointer which accesses the compressed image
+ * Returns: None
+ * Notes: Luma runs from 0 to 1 and chroma from -0.5 to 0.5. Bin i of
+ *        the luma histogram is a luma of i / (levels - 1); the chroma
+ *        bins' values are listed with them. Exits with a message if the
+ *        file is not a compressed image.
+ */
+extern void stats40(FILE *input)
+{
+    size_t len;
+    bool mapped;
+    unsigned char *in = map_input(input, &len, &mapped);
+    struct Stats40 *stats = malloc(sizeof(*stats));
+    assert(stats != NULL);
+    check_status(Stats40_scan(in, len, stats));
+    unmap_input(in, len, mapped);
+
+    printf("{\"width\": %u, \"height\": %u, \"blocks\": %zu, "
+           "\"profile\": \"%s\",\n", stats->width, stats->height,
+           stats->blocks, stats->profile->name);
+    printf("  \"flat_fraction\": %.6f,\n",
+           (double)stats->flat / stats->blocks);
+    printf("  \"rgb_mean\": [%.6f, %.6f, %.6f],\n", stats->rgb_mean[0],
+           stats->rgb_mean[1], stats->rgb_mean[2]);
+    printf("  \"luma\": {\"mean\": %.6f, \"variance\": %.6f, "
+           "\"block_variance\": %.6f,\n    \"histogram\": ",
+           stats->luma_mean, stats->luma_variance, stats->block_variance);
+    print_histogram(stats->luma, stats->luma_levels);
+    printf("},\n");
+    print_chroma(stats, "pb", stats->pb_mean, stats->pb_variance,
+                 stats->pb, false);
+    print_chroma(stats, "pr", stats->pr_mean, stats->pr_variance,
+                 stats->pr, true);
+    free(stats);
+    INSTRUMENT_REPORT();
+}
@@ -0,0 +1,561 @@
+/*
+ *     entropy.c
+ *     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
+ *     Date: 10-26-20
+ *     arith
+ *
+ *     Purpose: Lossless second stage for the 32-bit codewords. Each
+ *              word is split into its a, b, c, d, pb and pr fields,
+ *              laid out as its quantization profile says.
+ *              The a and chroma fields are predicted from the
+ *              neighbouring blocks (left, above and above-left) and
+ *              only the residual is coded; b, c and d already cluster
+ *              around zero and are coded as they are. Every field has
+ *              its own static frequency table, and the symbols are
+ *              coded with two interleaved byte-wise rANS states.
+ *
+ *              Stream layout (big-endian, like print_codeword):
+ *                  a frequency table per field, 2 bytes per symbol
+ *                  the payload length, 4 bytes
+ *                  the rANS payload
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "assert.h"
+#include "entropy.h"
+
+#define PROB_BITS 12
+#define PROB_SCALE (1u << PROB_BITS)
+#define RANS_L (1u << 23)
+#define NFIELDS PROFILE_NFIELDS
+#define MAX_SYMS 512
+
+/* interleaving two states relies on fields alternating between them */
+#if NFIELDS % 2 != 0
+#error "NFIELDS must be even"
+#endif
+
+/* where the fields of a codeword are, for the profile being coded */
+struct Layout
+{
+    unsigned width[NFIELDS];
+    unsigned lsb[NFIELDS];
+    /* a, pb and pr are smooth between blocks, b, c and d are not:
+       these are the bits of the predicted fields, and the top bit of
+       each of them */
+    uint32_t predicted_mask;
+    uint32_t predicted_high;
+};
+
+/* how the encoder codes one symbol of a field (division-free rANS) */
+struct Enc_symbol
+{
+    uint32_t x_max;
+    uint32_t rcp_freq;
+    uint32_t bias;
+    uint16_t cmpl_freq;
+    uint16_t rcp_shift;
+};
+
+/* the coding table of one field */
+struct Model
+{
+    uint16_t freq[MAX_SYMS];
+    uint16_t start[MAX_SYMS];
+    struct Enc_symbol enc[MAX_SYMS];
+    /* maps a slot in [0, PROB_SCALE) back to its symbol */
+    uint16_t symbol[PROB_SCALE];
+};
+
+/* layout_of()
+ * Purpose: Work out the codeword layout of a profile
+ * Parameters: The profile, and the layout to fill in
+ * Returns: none
+ */
+static void layout_of(const struct Profile *profile, struct Layout *layout)
+{
+    static const int predicted[] = { FIELD_A, FIELD_PB, FIELD_PR };
+
+    for (int f = 0; f < NFIELDS; f++) {
+        layout->width[f] = profile->width[f];
+        layout->lsb[f] = profile->lsb[f];
+    }
+    layout->predicted_mask = 0;
+    layout->predicted_high = 0;
+    for (unsigned k = 0; k < sizeof(predicted) / sizeof(predicted[0]); k++) {
+        unsigned width = profile->width[predicted[k]];
+        unsigned lsb = profile->lsb[predicted[k]];
+        layout->predicted_mask |= (uint32_t)((1ull << width) - 1) << lsb;
+        layout->predicted_high |= (uint32_t)1 << (lsb + width - 1);
+    }
+}
+
+static inline unsigned field_of(const struct Layout *layout, uint32_t word,
+                                int f)
+{
+    return (word >> layout->lsb[f]) & ((1u << layout->width[f]) - 1);
+}
+
+/* med()
+ * Purpose: Median edge detector prediction from three neighbours
+ * Parameters: The left, above and above-left values
+ * Returns: The predicted value
+ * Notes: The prediction is the median of left, up and the gradient
+ *        left + up - upleft, written without branches since the
+ *        outcome is close to random on textured images
+ */
+static inline unsigned med(int left, int up, int upleft)
+{
+    int lo = left < up ? left : up;
+    int hi = left < up ? up : left;
+    int grad = left + up - upleft;
+
+    grad = grad < hi ? grad : hi;
+    return grad > lo ? grad : lo;
+}
+
+/* shift_fields()
+ * Purpose: Add or subtract a prediction from every predicted field of
+ *          a word, modulo the width of each field
+ * Parameters: The layout, the word, a word holding the predictions, and
+ *             whether to subtract (encoding) or add (decoding)
+ * Returns: The word with its predicted fields replaced
+ * Notes: All fields are done at once, SWAR style: the top bit of each
+ *        field is handled apart so no carry or borrow leaves a field
+ */
+static inline uint32_t shift_fields(const struct Layout *layout,
+                                    uint32_t word, uint32_t pred,
+                                    bool subtract)
+{
+    uint32_t mask = layout->predicted_mask;
+    uint32_t high = layout->predicted_high;
+    uint32_t x = word & mask;
+    uint32_t y = pred & mask;
+    uint32_t fields;
+
+    if (subtract) {
+        fields = ((x | high) - (y & ~high)) ^ ((x ^ ~y) & high);
+    } else {
+        fields = ((x & ~high) + (y & ~high)) ^ ((x ^ y) & high);
+    }
+    return (word & ~mask) | (fields & mask);
+}
+
+/* predict_med()
+ * Purpose: Predict every predicted field of a block from its left,
+ *          above and above-left neighbours
+ * Parameters: The layout, and the three neighbouring words
+ * Returns: A word holding the predictions
+ */
+static inline uint32_t predict_med(const struct Layout *l, uint32_t left,
+                                   uint32_t up, uint32_t upleft)
+{
+    return med(field_of(l, left, FIELD_A), field_of(l, up, FIELD_A),
+               field_of(l, upleft, FIELD_A)) << l->lsb[FIELD_A]
+         | med(field_of(l, left, FIELD_PB), field_of(l, up, FIELD_PB),
+               field_of(l, upleft, FIELD_PB)) << l->lsb[FIELD_PB]
+         | med(field_of(l, left, FIELD_PR), field_of(l, up, FIELD_PR),
+               field_of(l, upleft, FIELD_PR)) << l->lsb[FIELD_PR];
+}
+
+/* predict()
+ * Purpose: Predict the predicted fields of one word from the words
+ *          before it in row-major order
+ * Parameters: The layout, the words, the word's index, its column and
+ *             row, and the width of the image in blocks
+ * Returns: A word holding the predictions
+ * Notes: The first row predicts from the left, the first column from
+ *        above, and the first word from nothing (0, which shift_fields()
+ *        leaves the word alone for). When decoding, the words before
+ *        this one have already been restored, so the decoder predicts
+ *        exactly as the encoder.
+ */
+static inline uint32_t predict(const struct Layout *layout,
+                               const uint32_t *words, size_t i,
+                               unsigned col, unsigned row, unsigned width)
+{
+    if (row == 0) {
+        return col == 0 ? 0 : words[i - 1];
+    }
+    if (col == 0) {
+        return words[i - width];
+    }
+    return predict_med(layout, words[i - 1], words[i - width],
+                       words[i - width - 1]);
+}
+
+/* residuals()
+ * Purpose: Replace the predicted fields of every word by their
+ *          difference from the prediction, and count the symbols of
+ *          every field
+ * Parameters: The layout, the words to read, the residuals to write,
+ *             the image dimensions in blocks, and the counts to add to
+ * Returns: none
+ * Notes: Entropy_decode() restores each word as soon as it is decoded,
+ *        so that no second pass over the words is needed there
+ */
+static void residuals(const struct Layout *layout, const uint32_t *in,
+                      uint32_t *out, unsigned width, unsigned height,
+                      uint32_t counts[NFIELDS][MAX_SYMS])
+{
+    size_t i = 0;
+    for (unsigned row = 0; row < height; row++) {
+        for (unsigned col = 0; col < width; col++, i++) {
+            uint32_t res = shift_fields(layout, in[i],
+                                        predict(layout, in, i, col, row,
+                                                width),
+                                        true);
+            for (int f = 0; f < NFIELDS; f++) {
+                counts[f][field_of(layout, res, f)]++;
+            }
+            out[i] = res;
+        }
+    }
+}
+
+/* normalize()
+ * Purpose: Scale symbol counts so that they sum to PROB_SCALE, keeping
+ *          every symbol that occurs at a frequency of at least one
+ * Parameters: The counts, the number of symbols, and the output table
+ * Returns: none
+ */
+static void normalize(const uint32_t *counts, unsigned nsyms,
+                      uint16_t *freq)
+{
+    uint64_t total = 0;
+    for (unsigned s = 0; s < nsyms; s++) {
+        total += counts[s];
+    }
+    if (total == 0) {
+        memset(freq, 0, nsyms * sizeof(freq[0]));
+        freq[0] = PROB_SCALE;
+        return;
+    }
+
+    unsigned sum = 0;
+    unsigned biggest = 0;
+    for (unsigned s = 0; s < nsyms; s++) {
+        freq[s] = 0;
+        if (counts[s] != 0) {
+            uint64_t f = counts[s] * (uint64_t)PROB_SCALE / total;
+            freq[s] = f == 0 ? 1 : f;
+        }
+        sum += freq[s];
+        if (counts[s] > counts[biggest]) {
+            biggest = s;
+        }
+    }
+
+    /* rounding down leaves slack, which goes to the likeliest symbol */
+    if (sum < PROB_SCALE) {
+        freq[biggest] += PROB_SCALE - sum;
+        return;
+    }
+    /* bumping rare symbols up to one can overshoot: steal it back */
+    while (sum > PROB_SCALE) {
+        unsigned max = 0;
+        for (unsigned s = 0; s < nsyms; s++) {
+            if (freq[s] > freq[max]) {
+                max = s;
+            }
+        }
+        freq[max]--;
+        sum--;
+    }
+}
+
+/* build_model()
+ * Purpose: Fill in the cumulative starts, the encoder reciprocals and
+ *          the slot lookup of a model
+ * Parameters: The model, whose freq table is set, and its symbol count
+ * Returns: True if the frequencies describe a valid table
+ */
+static bool build_model(struct Model *model, unsigned nsyms)
+{
+    unsigned start = 0;
+    for (unsigned s = 0; s < nsyms; s++) {
+        unsigned freq = model->freq[s];
+        struct Enc_symbol *enc = &model->enc[s];
+
+        if (start + freq > PROB_SCALE) {
+            return false;
+        }
+        model->start[s] = start;
+        for (unsigned slot = start; slot < start + freq; slot++) {
+            model->symbol[slot] = s;
+        }
+
+        /* x / freq becomes a multiply and shift by a reciprocal */
+        enc->x_max = ((RANS_L >> PROB_BITS) << 8) * freq;
+        enc->cmpl_freq = PROB_SCALE - freq;
+        if (freq < 2) {
+            enc->rcp_freq = ~0u;
+            enc->rcp_shift = 0;
+            enc->bias = start + PROB_SCALE - 1;
+        } else {
+            unsigned shift = 0;
+            while (freq > (1u << shift)) {
+                shift++;
+            }
+            enc->rcp_freq = (uint32_t)(((1ull << (shift + 31)) + freq - 1)
+                                       / freq);
+            enc->rcp_shift = shift - 1;
+            enc->bias = start;
+        }
+        start += freq;
+    }
+    return start == PROB_SCALE;
+}
+
+static inline void rans_put(uint32_t *state, unsigned char **ptr,
+                            const struct Enc_symbol *enc)
+{
+    uint32_t x = *state;
+
+    while (x >= enc->x_max) {
+        *--(*ptr) = (unsigned char)x;
+        x >>= 8;
+    }
+    uint32_t q = (uint32_t)(((uint64_t)x * enc->rcp_freq) >> 32)
+                 >> enc->rcp_shift;
+    *state = x + enc->bias + q * enc->cmpl_freq;
+}
+
+static inline uint32_t rans_get(uint32_t *state, const unsigned char **ptr,
+                                const unsigned char *end,
+                                const struct Model *model)
+{
+    uint32_t x = *state;
+    unsigned slot = x & (PROB_SCALE - 1);
+    unsigned s = model->symbol[slot];
+
+    x = model->freq[s] * (x >> PROB_BITS) + slot - model->start[s];
+    while (x < RANS_L) {
+        x = (x << 8) | (*ptr < end ? *(*ptr)++ : 0);
+    }
+    *state = x;
+    return s;
+}
+
+static inline void rans_flush(uint32_t state, unsigned char **ptr)
+{
+    *ptr -= 4;
+    (*ptr)[0] = state >> 24;
+    (*ptr)[1] = state >> 16;
+    (*ptr)[2] = state >> 8;
+    (*ptr)[3] = state;
+}
+
+static inline uint32_t read_be(const unsigned char *p, int nbytes)
+{
+    uint32_t value = 0;
+    for (int i = 0; i < nbytes; i++) {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+static inline void write_be(unsigned char *p, uint32_t value, int nbytes)
+{
+    for (int i = nbytes - 1; i >= 0; i--) {
+        p[i] = (unsigned char)value;
+        value >>= 8;
+    }
+}
+
+static size_t table_bytes(const struct Profile *profile)
+{
+    size_t bytes = 0;
+    for (int f = 0; f < NFIELDS; f++) {
+        bytes += 2u << profile->width[f];
+    }
+    return bytes;
+}
+
+/* Entropy_bound()
+ * Purpose: Upper bound on the size of an encoded image
+ * Parameters: The width and height of the image in blocks, and the
+ *             quantization profile of its codewords
+ * Returns: The number of bytes Entropy_encode may write
+ * Notes: A symbol costs at most PROB_BITS bits, so two bytes each
+ */
+size_t Entropy_bound(unsigned width, unsigned height,
+                     const struct Profile *profile)
+{
+    return table_bytes(profile) + 4 + 8
+           + (size_t)width * height * NFIELDS * 2;
+}
+
+/* Entropy_min_bytes()
+ * Purpose: Lower bound on the size of an encoded image
+ * Parameters: The quantization profile of its codewords
+ * Returns: The bytes of the coding tables, the payload length and the
+ *          two coder states, which every encoded image has
+ * Notes: A symbol can cost no bits at all, so this is all that can be
+ *        said whatever the image's size
+ */
+size_t Entropy_min_bytes(const struct Profile *profile)
+{
+    return table_bytes(profile) + 4 + 8;
+}
+
+/* Entropy_scratch_bytes()
+ * Purpose: Size of the scratch space the coder works in
+ * Parameters: The width and height of the image in blocks
+ * Returns: The number of bytes; enough for both encoding and decoding
+ * Notes: The coding tables come first, then one residual per codeword
+ */
+size_t Entropy_scratch_bytes(unsigned width, unsigned height)
+{
+    return NFIELDS * sizeof(struct Model)
+           + (size_t)width * height * sizeof(uint32_t);
+}
+
+/* Entropy_encode()
+ * Purpose: Entropy code a row-major array of 32-bit codewords
+ * Parameters: The codewords, the width and height of the image in
+ *             blocks, the profile of the codewords, a buffer of at
+ *             least Entropy_bound() bytes, and Entropy_scratch_bytes()
+ *             of scratch space (NULL to allocate it for this call)
+ * Returns: The number of bytes written to the buffer
+ */
+size_t Entropy_encode(const uint32_t *words, unsigned width,
+                      unsigned height, const struct Profile *profile,
+                      unsigned char *out, void *scratch)
+{
+    assert(words != NULL || (size_t)width * height == 0);
+    assert(profile != NULL);
+    assert(out != NULL);
+    size_t nwords = (size_t)width * height;
+    struct Layout layout;
+    layout_of(profile, &layout);
+
+    void *owned = NULL;
+    if (scratch == NULL) {
+        owned = scratch = malloc(Entropy_scratch_bytes(width, height));
+        assert(scratch != NULL);
+    }
+    struct Model *models = scratch;
+    uint32_t *res = (uint32_t *)(models + NFIELDS);
+
+    /* first pass: residuals, and the statistics of every field */
+    uint32_t counts[NFIELDS][MAX_SYMS];
+    memset(counts, 0, sizeof(counts));
+    residuals(&layout, words, res, width, height, counts);
+
+    unsigned char *p = out;
+    for (int f = 0; f < NFIELDS; f++) {
+        unsigned nsyms = 1u << layout.width[f];
+        normalize(counts[f], nsyms, models[f].freq);
+        build_model(&models[f], nsyms);
+        for (unsigned s = 0; s < nsyms; s++, p += 2) {
+            write_be(p, models[f].freq[s], 2);
+        }
+    }
+
+    /* second pass: rANS codes backwards, from the end of the buffer;
+       with an even number of fields, even fields go to state 0 */
+    unsigned char *end = out + Entropy_bound(width, height, profile);
+    unsigned char *ptr = end;
+    uint32_t state0 = RANS_L, state1 = RANS_L;
+    for (size_t i = nwords; i-- > 0; ) {
+        uint32_t word = res[i];
+        for (int f = NFIELDS - 1; f > 0; f -= 2) {
+            rans_put(&state1, &ptr,
+                     &models[f].enc[field_of(&layout, word, f)]);
+            rans_put(&state0, &ptr,
+                     &models[f - 1].enc[field_of(&layout, word, f - 1)]);
+        }
+    }
+    rans_flush(state1, &ptr);
+    rans_flush(state0, &ptr);
+    free(owned);
+
+    size_t payload = end - ptr;
+    write_be(p, payload, 4);
+    p += 4;
+    memmove(p, ptr, payload);
+    return (p - out) + payload;
+}
+
+/* Entropy_decode()
+ * Purpose: Restore the codewords written by Entropy_encode()
+ * Parameters: The encoded bytes and their length, an array of
+ *             width * height words to fill, the image dimensions in
+ *             blocks, the profile named in the header, and scratch
+ *             space as for Entropy_encode()
+ * Returns: True on success, false if the stream is malformed
+ */
+bool Entropy_decode(const unsigned char *in, size_t len, uint32_t *words,
+                    unsigned width, unsigned height,
+                    const struct Profile *profile, void *scratch)
+{
+    assert(in != NULL || len == 0);
+    assert(words != NULL || (size_t)width * height == 0);
+    assert(profile != NULL);
+    if (len < table_bytes(profile) + 4) {
+        return false;
+    }
+    struct Layout layout;
+    layout_of(profile, &layout);
+
+    void *owned = NULL;
+    if (scratch == NULL) {
+        owned = scratch = malloc(NFIELDS * sizeof(struct Model));
+        assert(scratch != NULL);
+    }
+    struct Model *models = scratch;
+    const unsigned char *p = in;
+    for (int f = 0; f < NFIELDS; f++) {
+        unsigned nsyms = 1u << layout.width[f];
+        for (unsigned s = 0; s < nsyms; s++, p += 2) {
+            models[f].freq[s] = read_be(p, 2);
+        }
+        if (!build_model(&models[f], nsyms)) {
+            free(owned);
+            return false;
+        }
+    }
+    size_t payload = read_be(p, 4);
+    p += 4;
+    if (payload < 8 || payload > len - (size_t)(p - in)) {
+        free(owned);
+        return false;
+    }
+
+    const unsigned char *ptr = p;
+    const unsigned char *end = p + payload;
+    uint32_t state0 = read_be(ptr, 4);
+    uint32_t state1 = read_be(ptr + 4, 4);
+    ptr += 8;
+    /* the encoder keeps both states in [RANS_L, RANS_L << 8); from a
+       state below it, such as a zeroed payload's, renormalizing would
+       shift in zeros forever */
+    if (state0 < RANS_L || state1 < RANS_L ||
+        state0 >= RANS_L << 8 || state1 >= RANS_L << 8) {
+        free(owned);
+        return false;
+    }
+
+    /* each word is restored from its residual as soon as it is
+       decoded, while the states wait on their next table lookups */
+    size_t i = 0;
+    for (unsigned row = 0; row < height; row++) {
+        for (unsigned col = 0; col < width; col++, i++) {
+            uint32_t word = 0;
+            for (int f = 0; f < NFIELDS; f += 2) {
+                word |= rans_get(&state0, &ptr, end, &models[f])
+                        << layout.lsb[f];
+                word |= rans_get(&state1, &ptr, end, &models[f + 1])
+                        << layout.lsb[f + 1];
+            }
+            words[i] = shift_fields(&layout, word,
+                                    predict(&layout, words, i, col, row,
+                                            width),
+                                    false);
+        }
+    }
+    free(owned);
+    return state0 == RANS_L && state1 == RANS_L && ptr == end;
+}
@@ -0,0 +1,31 @@
+/*
+ *     entropy.h
+ *     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
+ *     Date: 10-26-20
+ *     arith
+ *
+ *     Purpose: Interface for entropy.c: an optional lossless second
+ *              stage which models the fields of each 32-bit codeword
+ *              and codes them with a static rANS coder
+ */
+
+#ifndef ENTROPY_INCLUDED
+#define ENTROPY_INCLUDED
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "profile.h"
+
+size_t Entropy_bound(unsigned width, unsigned height,
+                     const struct Profile *profile);
+size_t Entropy_min_bytes(const struct Profile *profile);
+size_t Entropy_scratch_bytes(unsigned width, unsigned height);
+size_t Entropy_encode(const uint32_t *words, unsigned width,
+                      unsigned height, const struct Profile *profile,
+                      unsigned char *out, void *scratch);
+bool Entropy_decode(const unsigned char *in, size_t len, uint32_t *words,
+                    unsigned width, unsigned height,
+                    const struct Profile *profile, void *scratch);
+
+#endif
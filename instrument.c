@@ -0,0 +1,348 @@
+/*
+ *     instrument.c
+ *     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
+ *     Date: 10-26-20
+ *     arith
+ *
+ *     Purpose: Per-stage timing and counters for the codec pipeline
+ *              (see instrument.h). Stages and counters are kept in
+ *              small tables in order of first use, and summed over
+ *              every time they run. The tables are shared by every
+ *              thread and kept under one lock, which is taken once a
+ *              stage, not once an element; what a stage measures is
+ *              read outside it.
+ */
+
+#ifdef ARITH_INSTRUMENT
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "instrument.h"
+#include "pages40.h"
+
+#define MAX_STAGES 32
+
+/* the hardware counters read per stage, and their column headings */
+#define NMISSES INSTRUMENT_MISSES
+static const char *miss_names[NMISSES] = {
+    "LLC miss", "dTLB miss", "remote"
+};
+/* a read that misses the local node's memory is a remote access */
+static const unsigned long long miss_configs[NMISSES] = {
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_CACHE_DTLB | PERF_COUNT_HW_CACHE_OP_READ << 8 |
+    PERF_COUNT_HW_CACHE_RESULT_MISS << 16,
+    PERF_COUNT_HW_CACHE_NODE | PERF_COUNT_HW_CACHE_OP_READ << 8 |
+    PERF_COUNT_HW_CACHE_RESULT_MISS << 16
+};
+static const unsigned miss_types[NMISSES] = {
+    PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE
+};
+
+struct Stage
+{
+    const char *name;
+    unsigned long calls;
+    double seconds;
+    size_t elements;
+    long heap;
+    long faults;
+    /* summed hardware counters, or -1 if they could not be read */
+    long long misses[NMISSES];
+};
+
+struct Counter
+{
+    const char *name;
+    size_t amount;
+};
+
+static int enabled = -1;    /* -1 until the environment is checked */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct Stage stages[MAX_STAGES];
+static int nstages = 0;
+static struct Counter counters[MAX_STAGES];
+static int ncounters = 0;
+
+/* is_enabled()
+ * Purpose: Whether stats are being gathered
+ * Parameters: none
+ * Returns: True if Instrument_enable() was called or ARITH40_STATS is
+ *          set to anything other than 0
+ * Notes: Threads that find it unchecked at once all check it, and come
+ *        to the same answer
+ */
+static int is_enabled(void)
+{
+    int on = __atomic_load_n(&enabled, __ATOMIC_RELAXED);
+    if (on < 0) {
+        const char *env = getenv("ARITH40_STATS");
+        on = env != NULL && strcmp(env, "0") != 0;
+        int unchecked = -1;
+        __atomic_compare_exchange_n(&enabled, &unchecked, on, 0,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        on = __atomic_load_n(&enabled, __ATOMIC_RELAXED);
+    }
+    return on;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* counter_fds()
+ * Purpose: Open this thread's hardware counters, the first time
+ * Parameters: none
+ * Returns: One file descriptor per counter, -1 for a counter this 
+ *          machine or kernel will not count (perf_event_paranoid, 
+ *          or no counters in a virtual machine)
+ * Notes: Counters count only the thread that opened them, so each 
+ *        thread has its own
+ */
+static int *counter_fds(void)
+{
+    static __thread int fds[NMISSES];
+    static __thread int opened = 0;
+    if (!opened) {
+        for (int i = 0; i < NMISSES; i++) {
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = miss_types[i];
+            attr.config = miss_configs[i];
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        }
+        opened = 1;
+    }
+    return fds;
+}
+
+/* read_misses()
+ * Purpose: Read this thread's hardware counters
+ * Parameters: Where to put them; -1 for a counter that cannot be read
+ * Returns: none
+ */
+static void read_misses(long long misses[NMISSES])
+{
+    int *fds = counter_fds();
+    for (int i = 0; i < NMISSES; i++) {
+        if (fds[i] < 0 || 
+            read(fds[i], &misses[i], sizeof(misses[i])) != 
+            sizeof(misses[i])) {
+            misses[i] = -1;
+        }
+    }
+}
+
+/* page_faults()
+ * Purpose: Page faults taken by this thread so far
+ * Parameters: none
+ * Returns: The count, minor and major
+ * Notes: Per thread, like the hardware counters, so that a stage is not
+ *        charged with faults taken by others running at the same time
+ */
+static long page_faults(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_THREAD, &usage);
+    return usage.ru_minflt + usage.ru_majflt;
+}
+
+/* heap_in_use()
+ * Purpose: Bytes of heap in use, counting large mmap'd blocks and the
+ *          buffers mapped by pages40.c
+ * Parameters: none
+ * Returns: The byte count, or only the mapped buffers where the C 
+ *          library cannot tell us
+ */
+static long heap_in_use(void)
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    struct mallinfo2 info = mallinfo2();
+    return (long)(info.uordblks + info.hblkhd + Pages40_mapped());
+#else
+    return (long)Pages40_mapped();
+#endif
+}
+
+/* Instrument_enable()
+ * Purpose: Turn on stats gathering regardless of the environment
+ * Parameters: none
+ * Returns: none
+ */
+void Instrument_enable(void)
+{
+    __atomic_store_n(&enabled, 1, __ATOMIC_RELAXED);
+}
+
+/* Instrument_begin()
+ * Purpose: Mark the start of a stage
+ * Parameters: The mark to fill in
+ * Returns: none
+ */
+void Instrument_begin(struct Stage_mark *mark)
+{
+    mark->active = is_enabled();
+    if (!mark->active) {
+        return;
+    }
+    mark->heap = heap_in_use();
+    mark->faults = page_faults();
+    read_misses(mark->misses);
+    mark->start = now();
+}
+
+/* Instrument_end()
+ * Purpose: Mark the end of a stage and add it to the stage's totals
+ * Parameters: The name of the stage (a string literal), the mark from
+ *             Instrument_begin(), and the number of elements processed
+ * Returns: none
+ */
+void Instrument_end(const char *stage, struct Stage_mark *mark,
+                    size_t elements)
+{
+    if (!mark->active) {
+        return;
+    }
+    double seconds = now() - mark->start;
+    long long misses[NMISSES];
+    read_misses(misses);
+    long heap = heap_in_use() - mark->heap;
+    long faults = page_faults() - mark->faults;
+
+    pthread_mutex_lock(&lock);
+    int i;
+    for (i = 0; i < nstages; i++) {
+        if (strcmp(stages[i].name, stage) == 0) {
+            break;
+        }
+    }
+    if (i == nstages) {
+        if (nstages == MAX_STAGES) {
+            pthread_mutex_unlock(&lock);
+            return;
+        }
+        stages[nstages].name = stage;
+        for (int k = 0; k < NMISSES; k++) {
+            stages[nstages].misses[k] = 0;
+        }
+        nstages++;
+    }
+    stages[i].calls++;
+    stages[i].seconds += seconds;
+    stages[i].elements += elements;
+    stages[i].heap += heap;
+    stages[i].faults += faults;
+    for (int k = 0; k < NMISSES; k++) {
+        if (misses[k] < 0 || mark->misses[k] < 0 || 
+            stages[i].misses[k] < 0) {
+            stages[i].misses[k] = -1;
+        } else {
+            stages[i].misses[k] += misses[k] - mark->misses[k];
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/* Instrument_count()
+ * Purpose: Add to a named counter
+ * Parameters: The name of the counter (a string literal), and the amount
+ * Returns: none
+ */
+void Instrument_count(const char *counter, size_t amount)
+{
+    if (!is_enabled()) {
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    int i;
+    for (i = 0; i < ncounters; i++) {
+        if (strcmp(counters[i].name, counter) == 0) {
+            break;
+        }
+    }
+    if (i == ncounters) {
+        if (ncounters == MAX_STAGES) {
+            pthread_mutex_unlock(&lock);
+            return;
+        }
+        counters[ncounters++].name = counter;
+    }
+    counters[i].amount += amount;
+    pthread_mutex_unlock(&lock);
+}
+
+/* Instrument_report()
+ * Purpose: Print the totals of every stage and counter, then reset them
+ * Parameters: Where to print
+ * Returns: none
+ */
+void Instrument_report(FILE *out)
+{
+    if (!is_enabled()) {
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    if (nstages == 0 && ncounters == 0) {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+    double total = 0;
+    for (int i = 0; i < nstages; i++) {
+        total += stages[i].seconds;
+    }
+
+    fprintf(out, "%-18s %6s %10s %6s %12s %9s %11s %8s",
+            "stage", "calls", "ms", "%", "elements", "Melem/s", "heap KB",
+            "faults");
+    for (int k = 0; k < NMISSES; k++) {
+        fprintf(out, " %12s", miss_names[k]);
+    }
+    fprintf(out, "\n");
+    for (int i = 0; i < nstages; i++) {
+        struct Stage *s = &stages[i];
+        fprintf(out, "%-18s %6lu %10.3f %6.1f %12zu %9.2f %11ld %8ld",
+                s->name, s->calls, s->seconds * 1e3,
+                total > 0 ? 100 * s->seconds / total : 0.0, s->elements,
+                s->seconds > 0 ? s->elements / s->seconds / 1e6 : 0.0,
+                s->heap / 1024, s->faults);
+        for (int k = 0; k < NMISSES; k++) {
+            if (s->misses[k] < 0) {
+                fprintf(out, " %12s", "-");
+            } else {
+                fprintf(out, " %12lld", s->misses[k]);
+            }
+        }
+        fprintf(out, "\n");
+    }
+    fprintf(out, "%-18s %6s %10.3f\n", "total", "", total * 1e3);
+    for (int i = 0; i < ncounters; i++) {
+        fprintf(out, "%-18s %zu\n", counters[i].name, counters[i].amount);
+    }
+    memset(stages, 0, sizeof(stages));
+    memset(counters, 0, sizeof(counters));
+    nstages = 0;
+    ncounters = 0;
+    pthread_mutex_unlock(&lock);
+}
+
+#else
+
+/* ISO C forbids an empty translation unit */
+typedef int instrument_compiled_out;
+
+#endif
@@ -0,0 +1,77 @@
+/*
+ *     instrument.h
+ *     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
+ *     Date: 10-26-20
+ *     arith
+ *
+ *     Purpose: Interface for instrument.c: per-stage timing and counters
+ *              for the codec pipeline. Each named stage records wall
+ *              time, elements processed, net heap growth, page faults
+ *              and, where the kernel lets a process read the hardware
+ *              counters (perf_event_open), last-level cache misses,
+ *              data TLB misses and reads from another NUMA node's
+ *              memory; named counters record plain event counts. The
+ *              summary goes to stderr when ARITH40_STATS is set in the
+ *              environment or 40image is given -s. A stage nested in
+ *              another is counted in both.
+ *
+ *              Any number of threads may run stages at once, and their
+ *              totals are summed. Time, elements, page faults and the
+ *              hardware counters are each thread's own. The heap is the
+ *              process's, so when stages overlap on several threads a
+ *              stage's heap growth includes what the others allocated
+ *              while it ran; it is exact only for a stage that runs
+ *              alone.
+ *
+ *              Everything is compiled in only with -DARITH_INSTRUMENT;
+ *              without it the macros below expand to nothing.
+ */
+
+#ifndef INSTRUMENT_INCLUDED
+#define INSTRUMENT_INCLUDED
+
+#include <stddef.h>
+#include <stdio.h>
+
+#ifdef ARITH_INSTRUMENT
+
+/* LLC misses, dTLB misses and reads from another NUMA node's memory */
+#define INSTRUMENT_MISSES 3
+
+/* the state of the process when a stage began */
+struct Stage_mark
+{
+    double start;
+    long faults;
+    long heap;
+    /* hardware counters, or -1 where they cannot be read */
+    long long misses[INSTRUMENT_MISSES];
+    int active;
+};
+
+void Instrument_enable(void);
+void Instrument_begin(struct Stage_mark *mark);
+void Instrument_end(const char *stage, struct Stage_mark *mark,
+                    size_t elements);
+void Instrument_count(const char *counter, size_t amount);
+void Instrument_report(FILE *out);
+
+#define STAGE_BEGIN(mark) struct Stage_mark mark; Instrument_begin(&mark)
+#define STAGE_END(mark, stage, elements) \
+    Instrument_end(stage, &mark, elements)
+#define INSTRUMENT_COUNT(counter, amount) \
+    Instrument_count(counter, amount)
+#define INSTRUMENT_ENABLE() Instrument_enable()
+#define INSTRUMENT_REPORT() Instrument_report(stderr)
+
+#else
+
+#define STAGE_BEGIN(mark)
+#define STAGE_END(mark, stage, elements) ((void)sizeof(elements))
+#define INSTRUMENT_COUNT(counter, amount) ((void)0)
+#define INSTRUMENT_ENABLE() ((void)0)
+#define INSTRUMENT_REPORT() ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,230 @@
+/*
+ *     latbench.c
+ *     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
+ *     Date: 10-26-20
+ *     arith
+ *
+ *     Purpose: Per-image latency of the in-memory codec on small
+ *              images, the way a tile server uses it. Codes a set of
+ *              synthetic tiles many times, once with a fresh codec per
+ *              call (Codec40_encode) and once with one reused context
+ *              (Codec40_encode_using), and prints one JSON line per
+ *              operation and mode with the p50, p99 and mean latency.
+ *
+ *              Usage: latbench [-n tiles] [-r rounds] [-s WxH] [-e]
+ *                              [-q profile]
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "assert.h"
+#include "codec40.h"
+
+#define RESULT_FORMAT "{\"op\":\"%s\",\"mode\":\"%s\",\"width\":%u," \
+                      "\"height\":%u,\"entropy\":%s,\"profile\":\"%s\"," \
+                      "\"samples\":%zu,\"p50_us\":%.2f,\"p99_us\":%.2f," \
+                      "\"mean_us\":%.2f}\n"
+
+struct Config
+{
+    size_t tiles;
+    int rounds;
+    unsigned width, height;
+    struct Codec_options options;
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* make_tile()
+ * Purpose: Fill a tile with smooth shading plus a little texture, so
+ *          that every tile is different and looks like part of a photo
+ * Parameters: The tile, and which tile it is
+ * Returns: none
+ */
+static void make_tile(struct Codec40_image *tile, unsigned seed)
+{
+    double phase = seed * 0.37;
+    for (unsigned row = 0; row < tile->height; row++) {
+        unsigned char *p = tile->pixels + row * tile->stride;
+        for (unsigned col = 0; col < tile->width; col++) {
+            double x = (double)col / tile->width;
+            double y = (double)row / tile->height;
+            double texture = 12 * sin(col * 0.9 + row * 0.4 + phase);
+            p[3 * col] = 128 + 100 * sin(3 * x + phase) + texture;
+            p[3 * col + 1] = 128 + 90 * cos(2 * y - phase) + texture;
+            p[3 * col + 2] = 128 + 80 * sin(2 * (x + y) + phase);
+        }
+    }
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* report()
+ * Purpose: Print the latency percentiles of one operation and mode
+ * Parameters: The configuration, the operation and mode, and the
+ *             latencies in seconds (which are sorted)
+ * Returns: none
+ */
+static void report(const struct Config *config, const char *op,
+                   const char *mode, double *latency, size_t n)
+{
+    qsort(latency, n, sizeof(double), compare_doubles);
+    double sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += latency[i];
+    }
+    const struct Profile *profile = config->options.profile;
+    printf(RESULT_FORMAT, op, mode, config->width, config->height,
+           config->options.entropy ? "true" : "false",
+           profile != NULL ? profile->name : "default", n,
+           latency[n / 2] * 1e6, latency[(n * 99) / 100] * 1e6,
+           sum / n * 1e6);
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+    struct Config config = { 64, 20, 256, 256, CODEC_OPTIONS_DEFAULT };
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            config.tiles = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            config.rounds = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%ux%u", &config.width,
+                       &config.height) != 2) {
+                config.width = 0;
+            }
+        } else if (strcmp(argv[i], "-e") == 0) {
+            config.options.entropy = true;
+        } else if (strcmp(argv[i], "-q") == 0 && i + 1 < argc) {
+            config.options.profile = Profile_named(argv[++i]);
+            if (config.options.profile == NULL) {
+                fprintf(stderr, "%s: unknown profile '%s'\n", argv[0],
+                        argv[i]);
+                return EXIT_FAILURE;
+            }
+        } else {
+            config.tiles = 0;
+            break;
+        }
+    }
+    if (config.tiles == 0 || config.rounds < 1 || config.width < 2 ||
+        config.height < 2) {
+        fprintf(stderr, "Usage: %s [-n tiles] [-r rounds] [-s WxH] [-e] "
+                "[-q profile]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    size_t n = config.tiles;
+    struct Codec40_image *tiles = calloc(n, sizeof(*tiles));
+    struct Codec40_image *decoded = calloc(n, sizeof(*decoded));
+    struct Codec40_buffer *coded = calloc(n, sizeof(*coded));
+    enum Codec40_status *statuses = calloc(n, sizeof(*statuses));
+    size_t samples = n * config.rounds;
+    double *latency = malloc(samples * sizeof(double));
+    assert(tiles != NULL && decoded != NULL && coded != NULL);
+    assert(statuses != NULL && latency != NULL);
+
+    size_t capacity = Codec40_encode_bound(config.width, config.height,
+                                           &config.options);
+    for (size_t i = 0; i < n; i++) {
+        struct Codec40_image tile = { config.width, config.height, 255,
+                                      (size_t)config.width * 3, NULL };
+        tile.pixels = malloc(tile.stride * tile.height);
+        assert(tile.pixels != NULL);
+        make_tile(&tile, i);
+        tiles[i] = tile;
+
+        struct Codec40_image out = { config.width & ~1u,
+                                     config.height & ~1u, 255,
+                                     (size_t)(config.width & ~1u) * 3,
+                                     NULL };
+        out.pixels = malloc(out.stride * out.height);
+        assert(out.pixels != NULL);
+        decoded[i] = out;
+
+        coded[i].bytes = malloc(capacity);
+        assert(coded[i].bytes != NULL);
+        coded[i].capacity = capacity;
+    }
+
+    Codec40_T codec = Codec40_new();
+    assert(codec != NULL);
+    const char *modes[] = { "fresh", "context" };
+
+    for (int mode = 0; mode < 2; mode++) {
+        /* one untimed pass, so the context starts warm */
+        Codec40_encode_many(codec, n, tiles, &config.options, coded,
+                            statuses);
+        for (int r = 0; r < config.rounds; r++) {
+            for (size_t i = 0; i < n; i++) {
+                double start = now();
+                enum Codec40_status status = mode == 0
+                    ? Codec40_encode(&tiles[i], &config.options,
+                                     coded[i].bytes, coded[i].capacity,
+                                     &coded[i].len)
+                    : Codec40_encode_using(codec, &tiles[i],
+                                           &config.options, coded[i].bytes,
+                                           coded[i].capacity,
+                                           &coded[i].len);
+                latency[r * n + i] = now() - start;
+                assert(status == CODEC40_OK);
+            }
+        }
+        report(&config, "encode", modes[mode], latency, samples);
+
+        for (int r = 0; r < config.rounds; r++) {
+            for (size_t i = 0; i < n; i++) {
+                double start = now();
+                enum Codec40_status status = mode == 0
+                    ? Codec40_decode(coded[i].bytes, coded[i].len,
+                                     &decoded[i])
+                    : Codec40_decode_using(codec, coded[i].bytes,
+                                           coded[i].len, &decoded[i]);
+                latency[r * n + i] = now() - start;
+                assert(status == CODEC40_OK);
+            }
+        }
+        report(&config, "decode", modes[mode], latency, samples);
+    }
+
+    /* the batch interface, timed as a whole */
+    double start = now();
+    size_t done = Codec40_encode_many(codec, n, tiles, &config.options,
+                                      coded, statuses);
+    double encode_seconds = now() - start;
+    start = now();
+    done += Codec40_decode_many(codec, n, coded, decoded, statuses);
+    double decode_seconds = now() - start;
+    assert(done == 2 * n);
+    printf("{\"op\":\"encode_many\",\"images\":%zu,\"per_image_us\":%.2f}\n"
+           "{\"op\":\"decode_many\",\"images\":%zu,\"per_image_us\":%.2f}\n",
+           n, encode_seconds / n * 1e6, n, decode_seconds / n * 1e6);
+
+    Codec40_free(&codec);
+    for (size_t i = 0; i < n; i++) {
+        free(tiles[i].pixels);
+        free(decoded[i].pixels);
+        free(coded[i].bytes);
+    }
+    free(tiles);
+    free(decoded);
+    free(coded);
+    free(statuses);
+    free(latency);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,433 @@
+/*
+ *     microbench.c
+ *     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
+ *     Date: 10-26-20
+ *     arith
+ *
+ *     Purpose: Microbenchmarks for the primitives the codec is built on:
+ *              Bitpack get/new/fits across field widths, sequential and
+ *              random UArray2_at and UArray2b_at across blocksizes, the
+ *              same accesses through the A2Methods indirection, and
+ *              map throughput for several element sizes and for each
+ *              block order (a2order.h). Prints one JSON
+ *              line per measurement (ns per operation, best of -r runs)
+ *              so results can be kept and compared over time.
+ *
+ *              Usage: microbench [-r reps] [-s WxH] [-f filter]
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "assert.h"
+#include "bitpack.h"
+#include "uarray2.h"
+#include "uarray2b.h"
+#include "a2methods.h"
+#include "a2plain.h"
+#include "a2blocked.h"
+#include "a2order.h"
+
+#define RESULT_FORMAT "{\"bench\":\"%s\",\"variant\":\"%s\"," \
+                      "\"param\":%d,\"ops\":%zu,\"ns_per_op\":%.3f}\n"
+
+/* every field is placed at this lsb; above 0 so that Bitpack_newu's
+   64 - lsb shift stays defined */
+#define LSB 8
+#define NVALUES 4096
+
+static const unsigned widths[] = { 1, 4, 8, 16, 24, 32 };
+static const int blocksizes[] = { 1, 2, 4, 8, 16, 64 };
+static const int elem_sizes[] = { 1, 4, 12, 16, 64 };
+
+#define NELEMS(a) (sizeof(a) / sizeof((a)[0]))
+
+struct Config
+{
+    int reps;
+    int width, height;
+    const char *filter;
+};
+
+/* results are folded into this so the compiler cannot drop the work */
+static volatile uint64_t sink;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* next_random()
+ * Purpose: A small xorshift generator, so runs are repeatable
+ * Parameters: The generator state
+ * Returns: The next pseudo-random number
+ */
+static uint64_t next_random(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+/* selected()
+ * Purpose: Whether a benchmark was asked for with -f
+ * Parameters: The configuration, and the benchmark's name
+ * Returns: True if there is no filter or the name contains it
+ */
+static bool selected(const struct Config *config, const char *bench)
+{
+    return config->filter == NULL || strstr(bench, config->filter) != NULL;
+}
+
+static void report(const char *bench, const char *variant, int param,
+                   size_t ops, double seconds)
+{
+    printf(RESULT_FORMAT, bench, variant, param, ops, seconds * 1e9 / ops);
+    fflush(stdout);
+}
+
+/*********** Bitpack **********/
+
+enum Bitpack_op { GETU, GETS, NEWU, NEWS, FITSU, FITSS };
+static const char *bitpack_names[] = {
+    "bitpack_getu", "bitpack_gets", "bitpack_newu", "bitpack_news",
+    "bitpack_fitsu", "bitpack_fitss"
+};
+
+/* run_bitpack()
+ * Purpose: One timed pass of a Bitpack function over a table of values
+ * Parameters: The function, the field width, the words and the values
+ *             (which fit in the width), and how many passes to make
+ * Returns: The elapsed seconds
+ */
+static double run_bitpack(enum Bitpack_op op, unsigned width,
+                          const uint64_t *words, const uint64_t *uvalues,
+                          const int64_t *svalues, int passes)
+{
+    uint64_t acc = 0;
+    double start = now();
+    for (int p = 0; p < passes; p++) {
+        for (int i = 0; i < NVALUES; i++) {
+            switch (op) {
+            case GETU:
+                acc += Bitpack_getu(words[i], width, LSB);
+                break;
+            case GETS:
+                acc += Bitpack_gets(words[i], width, LSB);
+                break;
+            case NEWU:
+                acc ^= Bitpack_newu(words[i], width, LSB, uvalues[i]);
+                break;
+            case NEWS:
+                acc ^= Bitpack_news(words[i], width, LSB, svalues[i]);
+                break;
+            case FITSU:
+                acc += Bitpack_fitsu(words[i], width);
+                break;
+            case FITSS:
+                acc += Bitpack_fitss((int64_t)words[i], width);
+                break;
+            }
+        }
+    }
+    double seconds = now() - start;
+    sink += acc;
+    return seconds;
+}
+
+static void bench_bitpack(const struct Config *config)
+{
+    uint64_t *words = malloc(NVALUES * sizeof(*words));
+    uint64_t *uvalues = malloc(NVALUES * sizeof(*uvalues));
+    int64_t *svalues = malloc(NVALUES * sizeof(*svalues));
+    assert(words != NULL && uvalues != NULL && svalues != NULL);
+    int passes = 64;
+
+    for (size_t w = 0; w < NELEMS(widths); w++) {
+        unsigned width = widths[w];
+        uint64_t state = 0x9e3779b97f4a7c15u;
+        for (int i = 0; i < NVALUES; i++) {
+            words[i] = next_random(&state);
+            uvalues[i] = next_random(&state) >> (64 - width);
+            svalues[i] = (int64_t)(next_random(&state)) >> (64 - width);
+        }
+        for (int op = GETU; op <= FITSS; op++) {
+            if (!selected(config, bitpack_names[op])) {
+                continue;
+            }
+            double best = 1e30;
+            for (int r = 0; r < config->reps; r++) {
+                double t = run_bitpack(op, width, words, uvalues, svalues,
+                                       passes);
+                best = t < best ? t : best;
+            }
+            report(bitpack_names[op], "width", width,
+                   (size_t)NVALUES * passes, best);
+        }
+    }
+    free(words);
+    free(uvalues);
+    free(svalues);
+}
+
+/*********** Element access **********/
+
+/* one way of reaching a cell: directly or through an A2Methods suite */
+struct Access
+{
+    const char *variant;
+    void *(*at)(void *array, int col, int row);
+    A2Methods_T methods;
+};
+
+static void *plain_at(void *array, int col, int row)
+{
+    return UArray2_at(array, col, row);
+}
+
+static void *blocked_at(void *array, int col, int row)
+{
+    return UArray2b_at(array, col, row);
+}
+
+/* make_coords()
+ * Purpose: Build the order in which the access benchmarks visit cells
+ * Parameters: The image size, whether to shuffle, and the coordinate
+ *             arrays to fill (width * height entries each)
+ * Returns: none
+ * Notes: Sequential order is row-major, which is what the codec's
+ *        row-major passes do and the worst case for blocked arrays
+ */
+static void make_coords(int width, int height, bool shuffle,
+                        int *cols, int *rows)
+{
+    size_t n = (size_t)width * height;
+    for (size_t i = 0; i < n; i++) {
+        cols[i] = i % width;
+        rows[i] = i / width;
+    }
+    if (!shuffle) {
+        return;
+    }
+    uint64_t state = 0x2545f4914f6cdd1du;
+    for (size_t i = n - 1; i > 0; i--) {
+        size_t j = next_random(&state) % (i + 1);
+        int c = cols[i], r = rows[i];
+        cols[i] = cols[j];
+        rows[i] = rows[j];
+        cols[j] = c;
+        rows[j] = r;
+    }
+}
+
+/* run_access()
+ * Purpose: One timed pass reading a word from every cell
+ * Parameters: The array, how to reach a cell, and the visiting order
+ * Returns: The elapsed seconds
+ */
+static double run_access(void *array, const struct Access *access,
+                         const int *cols, const int *rows, size_t n)
+{
+    uint64_t acc = 0;
+    double start = now();
+    if (access->methods != NULL) {
+        A2Methods_T methods = access->methods;
+        for (size_t i = 0; i < n; i++) {
+            acc += *(uint32_t *)methods->at(array, cols[i], rows[i]);
+        }
+    } else {
+        for (size_t i = 0; i < n; i++) {
+            acc += *(uint32_t *)access->at(array, cols[i], rows[i]);
+        }
+    }
+    double seconds = now() - start;
+    sink += acc;
+    return seconds;
+}
+
+static void time_access(const struct Config *config, const char *bench,
+                        void *array, const struct Access *access, int param,
+                        const int *cols, const int *rows)
+{
+    size_t n = (size_t)config->width * config->height;
+    double best = 1e30;
+    for (int r = 0; r < config->reps; r++) {
+        double t = run_access(array, access, cols, rows, n);
+        best = t < best ? t : best;
+    }
+    report(bench, access->variant, param, n, best);
+}
+
+static void bench_access(const struct Config *config)
+{
+    int width = config->width, height = config->height;
+    size_t n = (size_t)width * height;
+    int *cols = malloc(n * sizeof(int));
+    int *rows = malloc(n * sizeof(int));
+    assert(cols != NULL && rows != NULL);
+
+    for (int shuffle = 0; shuffle <= 1; shuffle++) {
+        const char *plain_name = shuffle ? "uarray2_at_random"
+                                         : "uarray2_at_seq";
+        const char *blocked_name = shuffle ? "uarray2b_at_random"
+                                           : "uarray2b_at_seq";
+        if (!selected(config, plain_name) &&
+            !selected(config, blocked_name)) {
+            continue;
+        }
+        make_coords(width, height, shuffle, cols, rows);
+
+        if (selected(config, plain_name)) {
+            struct Access direct = { "direct", plain_at, NULL };
+            struct Access methods = { "a2methods", NULL,
+                                      uarray2_methods_plain };
+            UArray2_T array = UArray2_new(width, height, sizeof(uint32_t));
+            time_access(config, plain_name, array, &direct, 0, cols, rows);
+            time_access(config, plain_name, array, &methods, 0, cols, rows);
+            UArray2_free(&array);
+        }
+        if (!selected(config, blocked_name)) {
+            continue;
+        }
+        for (size_t b = 0; b < NELEMS(blocksizes); b++) {
+            struct Access direct = { "direct", blocked_at, NULL };
+            struct Access methods = { "a2methods", NULL,
+                                      uarray2_methods_blocked };
+            UArray2b_T array = UArray2b_new(width, height, sizeof(uint32_t),
+                                            blocksizes[b]);
+            time_access(config, blocked_name, array, &direct, blocksizes[b],
+                        cols, rows);
+            time_access(config, blocked_name, array, &methods,
+                        blocksizes[b], cols, rows);
+            UArray2b_free(&array);
+        }
+    }
+    free(cols);
+    free(rows);
+}
+
+/*********** Map throughput **********/
+
+static void touch(int col, int row, A2Methods_UArray2 array2, void *elem,
+                  void *cl)
+{
+    (void) col;
+    (void) row;
+    (void) array2;
+    *(uint64_t *)cl += *(unsigned char *)elem;
+}
+
+static void small_touch(void *elem, void *cl)
+{
+    *(uint64_t *)cl += *(unsigned char *)elem;
+}
+
+/* time_map()
+ * Purpose: Time one map function over an array
+ * Parameters: The configuration, the benchmark name and variant, the
+ *             element size, the array, and either a map or a small map
+ * Returns: none
+ */
+static void time_map(const struct Config *config, const char *bench,
+                     const char *variant, int elem_size,
+                     A2Methods_UArray2 array, A2Methods_mapfun *map,
+                     A2Methods_smallmapfun *small_map)
+{
+    double best = 1e30;
+    for (int r = 0; r < config->reps; r++) {
+        uint64_t acc = 0;
+        double start = now();
+        if (map != NULL) {
+            map(array, touch, &acc);
+        } else {
+            small_map(array, small_touch, &acc);
+        }
+        double t = now() - start;
+        sink += acc;
+        best = t < best ? t : best;
+    }
+    report(bench, variant, elem_size,
+           (size_t)config->width * config->height, best);
+}
+
+static void bench_map(const struct Config *config)
+{
+    A2Methods_T plain = uarray2_methods_plain;
+    A2Methods_T blocked = uarray2_methods_blocked;
+    int width = config->width, height = config->height;
+
+    for (size_t e = 0; e < NELEMS(elem_sizes); e++) {
+        int size = elem_sizes[e];
+        if (selected(config, "uarray2_map")) {
+            A2Methods_UArray2 array = plain->new(width, height, size);
+            time_map(config, "uarray2_map", "row_major", size, array,
+                     plain->map_row_major, NULL);
+            time_map(config, "uarray2_map", "col_major", size, array,
+                     plain->map_col_major, NULL);
+            time_map(config, "uarray2_map", "small_row_major", size, array,
+                     NULL, plain->small_map_row_major);
+            plain->free(&array);
+        }
+        if (selected(config, "uarray2b_map")) {
+            A2Methods_UArray2 array = blocked->new(width, height, size);
+            time_map(config, "uarray2b_map", "block_major", size, array,
+                     blocked->map_block_major, NULL);
+            time_map(config, "uarray2b_map", "small_block_major", size,
+                     array, NULL, blocked->small_map_block_major);
+            blocked->free(&array);
+        }
+        if (selected(config, "uarray2b_order")) {
+            /* blocksize 2, laid out and mapped in each order, as the
+               codec's arrays are */
+            static const char *orders[A2_ORDER_COUNT] = {
+                "columns", "rows", "morton"
+            };
+            for (int order = 0; order < A2_ORDER_COUNT; order++) {
+                A2Methods_T ordered = uarray2_methods_blocked_in(order);
+                A2Methods_UArray2 array = ordered->new_with_blocksize(
+                                              width, height, size, 2);
+                time_map(config, "uarray2b_order", orders[order], size,
+                         array, ordered->map_block_major, NULL);
+                ordered->free(&array);
+            }
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    struct Config config = { 5, 1024, 1024, NULL };
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            config.reps = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &config.width,
+                       &config.height) != 2) {
+                config.width = 0;
+            }
+        } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            config.filter = argv[++i];
+        } else {
+            config.reps = 0;
+            break;
+        }
+    }
+    if (config.reps < 1 || config.width < 1 || config.height < 1) {
+        fprintf(stderr, "Usage: %s [-r reps] [-s WxH] [-f filter]\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    bench_bitpack(&config);
+    bench_access(&config);
+    bench_map(&config);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,195 @@
+/*
+ *     pages40.c
+ *     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
+ *     Date: 10-26-20
+ *     arith
+ *
+ *     Purpose: Large buffers on huge pages and chosen NUMA nodes (see
+ *              pages40.h). The policies are read from the environment at
+ *              each allocation, which is rare enough not to matter.
+ *
+ *              A huge page only backs a whole, aligned 2 MB of a mapping,
+ *              so every mapping is a whole number of huge pages starting
+ *              on a huge page boundary. The slack at the end is never
+ *              written, and so never takes memory.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "pages40.h"
+
+/* the size of a huge page on x86-64 and arm64 */
+#define HUGE_PAGE ((size_t)2 << 20)
+
+/* bits in the node masks given to the kernel */
+#define MAX_NODES 1024
+
+enum Huge_mode { HUGE_OFF, HUGE_THP, HUGE_EXPLICIT };
+
+static size_t mapped = 0;
+
+/* huge_mode()
+ * Purpose: Find how ARITH40_HUGEPAGES asks for buffers to be backed
+ * Parameters: none
+ * Returns: The mode, HUGE_THP when the variable is unset or unknown
+ */
+static enum Huge_mode huge_mode(void)
+{
+    const char *name = getenv("ARITH40_HUGEPAGES");
+    if (name != NULL && strcmp(name, "off") == 0) {
+        return HUGE_OFF;
+    }
+    if (name != NULL && strcmp(name, "explicit") == 0) {
+        return HUGE_EXPLICIT;
+    }
+    return HUGE_THP;
+}
+
+/* interleaved()
+ * Purpose: Find whether ARITH40_NUMA asks for pages to be interleaved
+ * Parameters: none
+ * Returns: true for "interleave", false for first-touch
+ */
+static bool interleaved(void)
+{
+    const char *name = getenv("ARITH40_NUMA");
+    return name != NULL && strcmp(name, "interleave") == 0;
+}
+
+/* map_size()
+ * Purpose: Find how much is mapped for a buffer
+ * Parameters: The length of the buffer
+ * Returns: The length rounded up to whole huge pages
+ */
+static size_t map_size(size_t len)
+{
+    return (len + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+}
+
+/* map_aligned()
+ * Purpose: Map anonymous memory starting on a huge page boundary
+ * Parameters: The length, a whole number of huge pages
+ * Returns: The memory, or NULL if it cannot be mapped
+ * Notes: Maps a huge page more than asked for, and unmaps what is
+ *        before the boundary and after the end
+ */
+static void *map_aligned(size_t size)
+{
+    size_t over = size + HUGE_PAGE;
+    char *map = mmap(NULL, over, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    char *start = (char *)(((uintptr_t)map + HUGE_PAGE - 1) &
+                           ~(uintptr_t)(HUGE_PAGE - 1));
+    if (start > map) {
+        munmap(map, start - map);
+    }
+    munmap(start + size, map + over - (start + size));
+    return start;
+}
+
+/* interleave()
+ * Purpose: Spread the pages of a mapping over the NUMA nodes the
+ *          process may use, before any of them is touched
+ * Parameters: The mapping and its length
+ * Returns: none
+ * Notes: On a kernel or machine without NUMA the mapping is left as
+ *        it is
+ */
+static void interleave(void *map, size_t size)
+{
+    unsigned long nodes[MAX_NODES / (8 * sizeof(unsigned long))];
+    memset(nodes, 0, sizeof(nodes));
+    if (syscall(SYS_get_mempolicy, NULL, nodes, MAX_NODES, NULL,
+                MPOL_F_MEMS_ALLOWED) == 0) {
+        syscall(SYS_mbind, map, size, MPOL_INTERLEAVE, nodes, MAX_NODES,
+                0);
+    }
+}
+
+/* Pages40_alloc()
+ * Purpose: Allocate a buffer
+ * Parameters: Its length in bytes
+ * Returns: The buffer, or NULL if there is no memory
+ * Notes: A mapped buffer is not touched, so its pages are only placed
+ *        when they are first written (see Pages40_touch())
+ */
+void *Pages40_alloc(size_t len)
+{
+    if (len < PAGES40_MAP_MIN) {
+        return malloc(len);
+    }
+    size_t size = map_size(len);
+    enum Huge_mode mode = huge_mode();
+    void *map = NULL;
+    if (mode == HUGE_EXPLICIT) {
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        map = map != MAP_FAILED ? map : NULL;
+    }
+    if (map == NULL) {
+        map = map_aligned(size);
+        if (map == NULL) {
+            return NULL;
+        }
+        madvise(map, size, mode == HUGE_OFF ? MADV_NOHUGEPAGE
+                                            : MADV_HUGEPAGE);
+    }
+    if (interleaved()) {
+        interleave(map, size);
+    }
+    __atomic_add_fetch(&mapped, size, __ATOMIC_RELAXED);
+    return map;
+}
+
+/* Pages40_free()
+ * Purpose: Free a buffer from Pages40_alloc()
+ * Parameters: The buffer, or NULL, and the length it was allocated with
+ * Returns: none
+ */
+void Pages40_free(void *buffer, size_t len)
+{
+    if (buffer == NULL) {
+        return;
+    }
+    if (len < PAGES40_MAP_MIN) {
+        free(buffer);
+        return;
+    }
+    munmap(buffer, map_size(len));
+    __atomic_sub_fetch(&mapped, map_size(len), __ATOMIC_RELAXED);
+}
+
+/* Pages40_touch()
+ * Purpose: Fault in the pages of a new buffer
+ * Parameters: The buffer and its length
+ * Returns: none
+ * Notes: Writes a zero to each page, so it is for buffers nothing has
+ *        been written to yet
+ */
+void Pages40_touch(void *buffer, size_t len)
+{
+    volatile unsigned char *bytes = buffer;
+    size_t page = sysconf(_SC_PAGESIZE);
+    for (size_t at = 0; at < len; at += page) {
+        bytes[at] = 0;
+    }
+}
+
+/* Pages40_mapped()
+ * Purpose: Find how much memory the mapped buffers take
+ * Parameters: none
+ * Returns: Bytes mapped by Pages40_alloc() and not yet freed
+ */
+size_t Pages40_mapped(void)
+{
+    return __atomic_load_n(&mapped, __ATOMIC_RELAXED);
+}
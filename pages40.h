@@ -0,0 +1,46 @@
+/*
+ *     pages40.h
+ *     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
+ *     Date: 10-26-20
+ *     arith
+ *
+ *     Purpose: Interface for pages40.c: memory for the large flat
+ *              buffers an image goes through (pixels, codewords, coded
+ *              payloads and pipeline bands). A buffer of PAGES40_MAP_MIN
+ *              bytes or more gets a mapping of its own, aligned to a
+ *              huge page, so that the environment can choose how its
+ *              pages are backed and which NUMA nodes they are on:
+ *                ARITH40_HUGEPAGES  "thp" (the default) asks for
+ *                                   transparent huge pages; "explicit"
+ *                                   takes huge pages from the reserved
+ *                                   pool (vm.nr_hugepages), and falls
+ *                                   back to "thp" when the pool is
+ *                                   empty; "off" uses small pages
+ *                ARITH40_NUMA       "first-touch" (the default) puts
+ *                                   each page on the node of the thread
+ *                                   that first writes it; "interleave"
+ *                                   spreads the pages over every node
+ *                                   the process may use
+ *              Smaller buffers come from malloc().
+ */
+
+#ifndef PAGES40_INCLUDED
+#define PAGES40_INCLUDED
+
+#include <stddef.h>
+
+/* buffers smaller than this are not mapped on their own */
+#define PAGES40_MAP_MIN (256 * 1024)
+
+/* NULL when there is no memory; len must be the same when freed */
+extern void *Pages40_alloc(size_t len);
+extern void Pages40_free(void *buffer, size_t len);
+
+/* faults in a new buffer's pages from the calling thread, so that under
+   first-touch they are on its node */
+extern void Pages40_touch(void *buffer, size_t len);
+
+/* bytes mapped by Pages40_alloc() and not yet freed */
+extern size_t Pages40_mapped(void);
+
+#endif
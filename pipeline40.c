@@ -0,0 +1,509 @@
+/*
+ *     pipeline40.c
+ *     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
+ *     Date: 10-26-20
+ *     arith
+ *
+ *     Purpose: Compress and decompress with reading, coding and writing
+ *              overlapped (see pipeline40.h). A reader thread fills
+ *              bands of input, the calling thread codes each band with
+ *              Codec40_encode_band() or Codec40_decode_band(), and a
+ *              writer thread drains the coded bands to standard output.
+ *              Each pair of stages is joined by two Spsc_T rings: one
+ *              carries full bands forward and the other hands the empty
+ *              buffers back, so nothing is allocated once it starts.
+ *
+ *              The reader and writer use plain blocking stdio on their
+ *              own threads. That works on pipes and on any file system,
+ *              and the stdio buffering already turns each band into a
+ *              few large reads and writes.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "assert.h"
+#include "compress40.h"
+#include "codec40.h"
+#include "pipeline40.h"
+#include "spsc.h"
+#include "pages40.h"
+#include "instrument.h"
+
+/* buffers in flight between each pair of stages */
+#define DEPTH 4
+
+/* rough size of one band of pixels, in bytes */
+#define BAND_BYTES (1 << 20)
+
+/* the most bytes of a header read before deciding on the ordinary path */
+#define PEEK_MAX 256
+
+/* one band of input or output, in flight between two stages */
+struct Band
+{
+    unsigned char *bytes;
+    size_t len;
+    /* how many pixel rows the band is */
+    unsigned rows;
+    enum Codec40_status status;
+};
+
+struct Pipeline
+{
+    FILE *input;
+    /* bands are numbered from 0; every band but the last is in_size
+       bytes of input, and the last is in_last */
+    size_t nbands;
+    size_t in_size, in_last;
+    /* the most bytes a coded band takes */
+    size_t out_size;
+    /* pixel rows in each band but the last, and in the last */
+    unsigned band_rows, last_rows;
+    /* two-byte samples in the input, which are big-endian in a ppm */
+    bool swap16;
+    /* a decoded image has no bytes after its last band */
+    bool whole_input;
+
+    /* reader -> coder, and the empty buffers back */
+    Spsc_T in_full, in_free;
+    /* coder -> writer, and the empty buffers back */
+    Spsc_T out_full, out_free;
+    struct Band in[DEPTH], out[DEPTH];
+
+    /* codes one band; run by the calling thread */
+    enum Codec40_status (*code)(struct Pipeline *pipeline,
+                                const struct Band *in, struct Band *out);
+    Codec40_T codec;
+    const struct Codec_options *options;
+    unsigned width;
+    unsigned maxval;
+};
+
+/* Peeked input: the bytes read while deciding how to handle a stream,
+   kept so they can be replayed to the ordinary path */
+struct Peek
+{
+    FILE *input;
+    unsigned char seen[PEEK_MAX];
+    size_t n;
+};
+
+/* peek_getc()
+ * Purpose: Read one byte, remembering it
+ * Parameters: The peeked input
+ * Returns: The byte, or EOF at the end of the input or once PEEK_MAX
+ *          bytes have been read
+ */
+static int peek_getc(struct Peek *peek)
+{
+    if (peek->n == PEEK_MAX) {
+        return EOF;
+    }
+    int c = getc(peek->input);
+    if (c != EOF) {
+        peek->seen[peek->n++] = c;
+    }
+    return c;
+}
+
+/* replay()
+ * Purpose: Put the peeked bytes back in front of the rest of the input
+ * Parameters: The peeked input, and where to put the buffer behind the
+ *             new stream, which the caller frees after closing it
+ * Returns: A stream which reads the peeked bytes and then the rest of
+ *          the input
+ */
+static FILE *replay(struct Peek *peek, unsigned char **buffer)
+{
+    size_t capacity = PEEK_MAX + (1 << 16);
+    size_t len = peek->n;
+    unsigned char *bytes = malloc(capacity);
+    assert(bytes != NULL);
+    memcpy(bytes, peek->seen, len);
+    size_t got;
+    while ((got = fread(bytes + len, 1, capacity - len, peek->input)) > 0) {
+        len += got;
+        if (len == capacity) {
+            capacity *= 2;
+            bytes = realloc(bytes, capacity);
+            assert(bytes != NULL);
+        }
+    }
+    /* fmemopen() will not open an empty buffer */
+    FILE *stream = fmemopen(bytes, len > 0 ? len : 1, "rb");
+    assert(stream != NULL);
+    if (len == 0) {
+        getc(stream);
+    }
+    *buffer = bytes;
+    return stream;
+}
+
+/* read_number()
+ * Purpose: Read a decimal number from a ppm header, skipping the
+ *          whitespace and comments before it
+ * Parameters: The peeked input
+ * Returns: The number, or 0 if there is none
+ */
+static unsigned long read_number(struct Peek *peek)
+{
+    int c = peek_getc(peek);
+    while (c == '#' || isspace(c)) {
+        if (c == '#') {
+            while (c != '\n' && c != EOF) {
+                c = peek_getc(peek);
+            }
+        }
+        c = peek_getc(peek);
+    }
+    unsigned long n = 0;
+    while (isdigit(c) && n <= 1000000) {
+        n = n * 10 + (c - '0');
+        c = peek_getc(peek);
+    }
+    /* the single whitespace after the last number ends the header */
+    return isspace(c) ? n : 0;
+}
+
+/* remaining()
+ * Purpose: Find how many bytes are left in the input, if that is known
+ * Parameters: The input
+ * Returns: The number of bytes, or -1 for a pipe or other stream whose
+ *          length is not known in advance
+ */
+static long long remaining(FILE *input)
+{
+    struct stat st;
+    long offset = ftell(input);
+    if (offset < 0 || fstat(fileno(input), &st) != 0 ||
+        !S_ISREG(st.st_mode)) {
+        return -1;
+    }
+    return (long long)st.st_size - offset;
+}
+
+/* reader()
+ * Purpose: The first stage: fill each band with input, in order
+ * Parameters: The pipeline
+ * Returns: NULL
+ * Notes: After a short read every later band is passed on empty with
+ *        the error, so the other stages still see every band
+ */
+static void *reader(void *cl)
+{
+    struct Pipeline *pipeline = cl;
+    enum Codec40_status status = CODEC40_OK;
+
+    for (size_t i = 0; i < pipeline->nbands; i++) {
+        struct Band *band = Spsc_pop(pipeline->in_free);
+        bool last = i + 1 == pipeline->nbands;
+        band->rows = last ? pipeline->last_rows : pipeline->band_rows;
+        band->len = last ? pipeline->in_last : pipeline->in_size;
+        if (status == CODEC40_OK &&
+            fread(band->bytes, 1, band->len, pipeline->input) != band->len) {
+            status = CODEC40_TRUNCATED;
+        }
+        if (status == CODEC40_OK && last && pipeline->whole_input &&
+            getc(pipeline->input) != EOF) {
+            status = CODEC40_CORRUPT;
+        }
+        if (status == CODEC40_OK && pipeline->swap16) {
+            for (size_t j = 0; j + 1 < band->len; j += 2) {
+                uint16_t sample = band->bytes[j] << 8 | band->bytes[j + 1];
+                memcpy(band->bytes + j, &sample, sizeof(sample));
+            }
+        }
+        band->status = status;
+        Spsc_push(pipeline->in_full, band);
+    }
+    return NULL;
+}
+
+/* writer()
+ * Purpose: The last stage: write each coded band to standard output
+ * Parameters: The pipeline
+ * Returns: NULL
+ * Notes: Stops writing at the first band that failed
+ */
+static void *writer(void *cl)
+{
+    struct Pipeline *pipeline = cl;
+    bool failed = false;
+
+    for (size_t i = 0; i < pipeline->nbands; i++) {
+        struct Band *band = Spsc_pop(pipeline->out_full);
+        failed = failed || band->status != CODEC40_OK;
+        if (!failed) {
+            fwrite(band->bytes, 1, band->len, stdout);
+        }
+        Spsc_push(pipeline->out_free, band);
+    }
+    return NULL;
+}
+
+/* run()
+ * Purpose: Run a pipeline to the end, coding on the calling thread
+ * Parameters: The pipeline, with everything but its rings and buffers
+ *             set
+ * Returns: CODEC40_OK, or the first error of any band
+ */
+static enum Codec40_status run(struct Pipeline *pipeline)
+{
+    pipeline->in_full = Spsc_new(DEPTH);
+    pipeline->in_free = Spsc_new(DEPTH);
+    pipeline->out_full = Spsc_new(DEPTH);
+    pipeline->out_free = Spsc_new(DEPTH);
+    size_t in_size = pipeline->in_size > pipeline->in_last
+                     ? pipeline->in_size : pipeline->in_last;
+    for (int i = 0; i < DEPTH; i++) {
+        pipeline->in[i].bytes = Pages40_alloc(in_size);
+        pipeline->out[i].bytes = Pages40_alloc(pipeline->out_size);
+        assert(pipeline->in[i].bytes != NULL);
+        assert(pipeline->out[i].bytes != NULL);
+        /* the coder reads and writes every band, while the reader and
+           writer only copy them, so under first-touch the bands go on
+           the coder's node rather than the reader's */
+        Pages40_touch(pipeline->in[i].bytes, in_size);
+        Pages40_touch(pipeline->out[i].bytes, pipeline->out_size);
+        Spsc_push(pipeline->in_free, &pipeline->in[i]);
+        Spsc_push(pipeline->out_free, &pipeline->out[i]);
+    }
+    pipeline->codec = Codec40_new();
+    assert(pipeline->codec != NULL);
+
+    pthread_t read_thread, write_thread;
+    int failed = pthread_create(&read_thread, NULL, reader, pipeline);
+    failed = failed || pthread_create(&write_thread, NULL, writer, pipeline);
+    assert(!failed);
+
+    enum Codec40_status status = CODEC40_OK;
+    for (size_t i = 0; i < pipeline->nbands; i++) {
+        struct Band *in = Spsc_pop(pipeline->in_full);
+        struct Band *out = Spsc_pop(pipeline->out_free);
+        if (status == CODEC40_OK) {
+            status = in->status != CODEC40_OK
+                     ? in->status : pipeline->code(pipeline, in, out);
+        }
+        out->status = status;
+        Spsc_push(pipeline->out_full, out);
+        Spsc_push(pipeline->in_free, in);
+    }
+
+    pthread_join(read_thread, NULL);
+    pthread_join(write_thread, NULL);
+    INSTRUMENT_COUNT("pipeline_bands", pipeline->nbands);
+    INSTRUMENT_COUNT("pipeline_input_waits",
+                     Spsc_pop_waits(pipeline->in_full));
+    INSTRUMENT_COUNT("pipeline_output_waits",
+                     Spsc_pop_waits(pipeline->out_free));
+
+    Codec40_free(&pipeline->codec);
+    for (int i = 0; i < DEPTH; i++) {
+        Pages40_free(pipeline->in[i].bytes, in_size);
+        Pages40_free(pipeline->out[i].bytes, pipeline->out_size);
+    }
+    Spsc_free(&pipeline->in_full);
+    Spsc_free(&pipeline->in_free);
+    Spsc_free(&pipeline->out_full);
+    Spsc_free(&pipeline->out_free);
+    return status;
+}
+
+/* plan_bands()
+ * Purpose: Cut an image into bands of whole 2x2 blocks
+ * Parameters: The pipeline, the height of the image in pixels, and the
+ *             bytes per pixel row of the band buffers
+ * Returns: none
+ * Notes: Each band is an even number of rows of about BAND_BYTES; an
+ *        odd last row is left out of the bands
+ */
+static void plan_bands(struct Pipeline *pipeline, unsigned height,
+                       size_t row_bytes)
+{
+    unsigned even = height & ~1u;
+    size_t rows = (BAND_BYTES / row_bytes) & ~(size_t)1;
+    if (rows < 2) {
+        rows = 2;
+    }
+    if (rows > even) {
+        rows = even;
+    }
+    pipeline->band_rows = rows;
+    pipeline->nbands = (even + rows - 1) / rows;
+    pipeline->last_rows = even - (pipeline->nbands - 1) * rows;
+}
+
+/* encode_band()
+ * Purpose: Code one band of a compress pipeline
+ * Parameters: The pipeline, the band of pixels, and the band to fill in
+ *             with its codewords
+ * Returns: As for Codec40_encode_band()
+ */
+static enum Codec40_status encode_band(struct Pipeline *pipeline,
+                                       const struct Band *in,
+                                       struct Band *out)
+{
+    struct Codec40_image band;
+    band.width = pipeline->width;
+    band.height = in->rows;
+    band.maxval = pipeline->maxval;
+    band.stride = (size_t)band.width * 3 *
+                  CODEC40_CHANNEL_BYTES(band.maxval);
+    band.pixels = in->bytes;
+    return Codec40_encode_band(pipeline->codec, &band, pipeline->options,
+                               out->bytes, pipeline->out_size, &out->len);
+}
+
+/* compress40_pipelined()
+ * Purpose: compress40_with(), with reading, coding and writing overlapped
+ * Parameters: A file pointer which accesses the file to be compressed,
+ *             and the options
+ * Returns: None
+ * Notes: Exits with a message if the image cannot be compressed
+ */
+extern void compress40_pipelined(FILE *input,
+                                 const struct Codec_options *options)
+{
+    assert(input != NULL && options != NULL);
+    if (options->entropy || options->progressive) {
+        compress40_with(input, options);
+        return;
+    }
+
+    struct Peek peek = { input, { 0 }, 0 };
+    bool raw = peek_getc(&peek) == 'P' && peek_getc(&peek) == '6';
+    unsigned long width = raw ? read_number(&peek) : 0;
+    unsigned long height = width > 0 ? read_number(&peek) : 0;
+    unsigned long maxval = height > 0 ? read_number(&peek) : 0;
+    if (width < 2 || height < 2 || maxval == 0 || maxval > 65535 ||
+        width > CODEC40_MAX_SIDE || height > CODEC40_MAX_SIDE) {
+        unsigned char *bytes;
+        FILE *stream = replay(&peek, &bytes);
+        compress40_with(stream, options);
+        fclose(stream);
+        free(bytes);
+        return;
+    }
+
+    STAGE_BEGIN(mark);
+    size_t row_bytes = width * 3 * CODEC40_CHANNEL_BYTES(maxval);
+    struct Pipeline pipeline;
+    memset(&pipeline, 0, sizeof(pipeline));
+    pipeline.input = input;
+    pipeline.swap16 = maxval > 255;
+    pipeline.code = encode_band;
+    pipeline.options = options;
+    pipeline.width = width;
+    pipeline.maxval = maxval;
+    plan_bands(&pipeline, height, row_bytes);
+    pipeline.in_size = pipeline.band_rows * row_bytes;
+    /* an odd last row is read with the last band, and dropped */
+    pipeline.in_last = (pipeline.last_rows + height % 2) * row_bytes;
+    pipeline.out_size = (size_t)(pipeline.band_rows / 2) * (width / 2) *
+                        sizeof(uint32_t);
+
+    unsigned char header[CODEC40_HEADER_MAX];
+    fwrite(header, 1, Codec40_write_header(width, height, options, header),
+           stdout);
+    enum Codec40_status status = run(&pipeline);
+    STAGE_END(mark, "pipeline", (size_t)width * height);
+    if (status != CODEC40_OK) {
+        fprintf(stderr, "40image: %s\n", status == CODEC40_TRUNCATED
+                ? "image is truncated" : Codec40_strerror(status));
+        exit(EXIT_FAILURE);
+    }
+    INSTRUMENT_REPORT();
+}
+
+/* decode_band()
+ * Purpose: Code one band of a decompress pipeline
+ * Parameters: The pipeline, the band of codewords, and the band to fill
+ *             in with its pixels
+ * Returns: As for Codec40_decode_band()
+ */
+static enum Codec40_status decode_band(struct Pipeline *pipeline,
+                                       const struct Band *in,
+                                       struct Band *out)
+{
+    struct Codec40_image band;
+    band.width = pipeline->width;
+    band.height = in->rows;
+    band.maxval = pipeline->maxval;
+    band.stride = (size_t)band.width * 3;
+    band.pixels = out->bytes;
+    out->len = band.stride * band.height;
+    return Codec40_decode_band(pipeline->codec, in->bytes, in->len,
+                               pipeline->options, &band);
+}
+
+/* decompress40_pipelined()
+ * Purpose: decompress40(), with reading, coding and writing overlapped
+ * Parameters: A file pointer which accesses the file to be decompressed
+ * Returns: None
+ * Notes: Exits with a message if the file is not a compressed image.
+ *        When the length of the input is known, a truncated or padded
+ *        image is caught before anything is written; from a pipe it is
+ *        caught at the band where it goes wrong.
+ */
+extern void decompress40_pipelined(FILE *input)
+{
+    assert(input != NULL);
+    struct Peek peek = { input, { 0 }, 0 };
+    int lines = 0;
+    while (lines < 2 && peek.n < CODEC40_HEADER_MAX) {
+        int c = peek_getc(&peek);
+        if (c == EOF) {
+            break;
+        }
+        lines += c == '\n';
+    }
+    struct Codec40_header header;
+    if (Codec40_read_header(peek.seen, peek.n, &header) != CODEC40_OK ||
+        header.options.entropy || header.options.progressive) {
+        unsigned char *bytes;
+        FILE *stream = replay(&peek, &bytes);
+        decompress40(stream);
+        fclose(stream);
+        free(bytes);
+        return;
+    }
+
+    STAGE_BEGIN(mark);
+    size_t payload = (size_t)(header.width / 2) * (header.height / 2) *
+                     sizeof(uint32_t);
+    long long left = remaining(input);
+    if (left >= 0 && (size_t)left != payload) {
+        fprintf(stderr, "40image: %s\n", Codec40_strerror(
+                (size_t)left < payload ? CODEC40_TRUNCATED
+                                       : CODEC40_CORRUPT));
+        exit(EXIT_FAILURE);
+    }
+
+    size_t row_bytes = (size_t)header.width * 3;
+    struct Pipeline pipeline;
+    memset(&pipeline, 0, sizeof(pipeline));
+    pipeline.input = input;
+    pipeline.whole_input = true;
+    pipeline.code = decode_band;
+    pipeline.options = &header.options;
+    pipeline.width = header.width;
+    pipeline.maxval = 255;
+    plan_bands(&pipeline, header.height, row_bytes);
+    size_t block_row_bytes = (size_t)(header.width / 2) * sizeof(uint32_t);
+    pipeline.in_size = pipeline.band_rows / 2 * block_row_bytes;
+    pipeline.in_last = pipeline.last_rows / 2 * block_row_bytes;
+    pipeline.out_size = pipeline.band_rows * row_bytes;
+
+    printf("P6\n%u %u\n%u\n", header.width, header.height, 255);
+    enum Codec40_status status = run(&pipeline);
+    STAGE_END(mark, "pipeline", (size_t)header.width * header.height);
+    if (status != CODEC40_OK) {
+        fprintf(stderr, "40image: %s\n", Codec40_strerror(status));
+        exit(EXIT_FAILURE);
+    }
+    INSTRUMENT_REPORT();
+}
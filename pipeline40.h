@@ -0,0 +1,30 @@
+/*
+ *     pipeline40.h
+ *     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
+ *     Date: 10-26-20
+ *     arith
+ *
+ *     Purpose: Interface for pipeline40.c: compress40_with() and
+ *              decompress40(), with reading, coding and writing
+ *              overlapped. The image goes through a band of rows at a
+ *              time: one thread reads bands, the calling thread codes
+ *              them, and another thread writes them out, so the disk
+ *              and the CPU are busy at the same time. The output is
+ *              the same as without the pipeline.
+ *
+ *              Entropy coded and progressive images, and input that is
+ *              not a raw (P6) ppm, cannot be split into bands; they go
+ *              through the ordinary path.
+ */
+
+#ifndef PIPELINE40_INCLUDED
+#define PIPELINE40_INCLUDED
+
+#include <stdio.h>
+#include "codec_options.h"
+
+extern void compress40_pipelined(FILE *input,
+                                 const struct Codec_options *options);
+extern void decompress40_pipelined(FILE *input);
+
+#endif
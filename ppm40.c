@@ -0,0 +1,447 @@
+/*
+ *     ppm40.c
+ *     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
+ *     Date: 10-26-20
+ *     arith
+ *
+ *     Purpose: Read a ppm file straight into flat pixels (see ppm40.h).
+ *
+ *              A plain raster is parsed in two passes over chunks that
+ *              end at whitespace, so that no number is split between
+ *              two of them. The first pass counts the numbers in each
+ *              chunk: a number starts at each digit whose byte before
+ *              is not a digit, and that is found for sixteen bytes at
+ *              a time with vector compares. A running sum of the counts
+ *              gives each chunk the index of its first sample. The
+ *              second pass parses each chunk into the pixels from
+ *              there. Both passes run a thread a chunk. With one thread
+ *              there is nothing to place, so only the second pass runs.
+ *              A comment can hold digits that the count would take for
+ *              numbers, so a raster with a '#' in it is parsed by one
+ *              thread, which skips comments as it goes.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "assert.h"
+#include "ppm40.h"
+#include "pages40.h"
+#include "instrument.h"
+
+/* most threads a raster is parsed by */
+#define MAX_THREADS 64
+
+/* fewest bytes of text worth a thread of their own */
+#define MIN_CHUNK (1 << 20)
+
+/* steps of the count before a lane of its counts could overflow */
+#define STEPS_PER_FLUSH 255
+
+typedef uint8_t Bytes16 __attribute__((vector_size(16)));
+
+/* one chunk of a plain raster, and what a thread found in it */
+struct Chunk
+{
+    const unsigned char *start, *end;
+    const struct Codec40_image *image;
+    /* the index of the chunk's first sample, and the image's samples */
+    size_t first, total;
+    /* numbers in the chunk */
+    size_t count;
+    /* NULL, or what is wrong with the chunk */
+    const char *error;
+};
+
+/* is_digit()
+ * Purpose: Check whether a byte is a decimal digit
+ * Parameters: The byte
+ * Returns: true if it is '0' to '9'
+ */
+static inline bool is_digit(unsigned char c)
+{
+    return (unsigned char)(c - '0') < 10;
+}
+
+/* is_space()
+ * Purpose: Check whether a byte is whitespace, as isspace() does in the
+ *          C locale
+ * Parameters: The byte
+ * Returns: true if it is a space, tab, newline, vertical tab, form feed
+ *          or carriage return
+ */
+static inline bool is_space(unsigned char c)
+{
+    return c == ' ' || (unsigned char)(c - '\t') <= '\r' - '\t';
+}
+
+/* count_chunk()
+ * Purpose: A thread which counts the numbers in its chunk
+ * Parameters: Its chunk, whose count is filled in
+ * Returns: NULL
+ * Notes: Each step compares sixteen bytes, and the sixteen bytes one
+ *        before them, with '0' to '9'. A lane of starts is all ones
+ *        where a digit follows a byte that is not one, and taking it
+ *        from the lane's count adds one. The counts are bytes, so they
+ *        are added up every STEPS_PER_FLUSH steps.
+ */
+static void *count_chunk(void *cl)
+{
+    struct Chunk *chunk = cl;
+    const unsigned char *p = chunk->start, *end = chunk->end;
+    size_t count = 0;
+    if (p == end) {
+        chunk->count = 0;
+        return NULL;
+    }
+    /* a chunk starts at whitespace, or at the start of the raster */
+    count += is_digit(*p++);
+
+    while (end - p >= 16) {
+        Bytes16 counts = { 0 };
+        for (int step = 0; step < STEPS_PER_FLUSH && end - p >= 16;
+             step++, p += 16) {
+            Bytes16 here, before;
+            memcpy(&here, p, sizeof(here));
+            memcpy(&before, p - 1, sizeof(before));
+            Bytes16 digits = (Bytes16)((Bytes16)(here - '0') < 10);
+            Bytes16 digits_before = (Bytes16)((Bytes16)(before - '0') < 10);
+            counts -= digits & ~digits_before;
+        }
+        for (int lane = 0; lane < 16; lane++) {
+            count += counts[lane];
+        }
+    }
+    for (; p < end; p++) {
+        count += is_digit(p[0]) && !is_digit(p[-1]);
+    }
+    chunk->count = count;
+    return NULL;
+}
+
+/* parse_numbers()
+ * Purpose: Parse the numbers in a chunk into the image's pixels
+ * Parameters: The chunk, whose count and error are filled in, and
+ *             whether the samples are two bytes
+ * Returns: none
+ * Notes: Inlined into parse_chunk() once for each size of sample, so
+ *        that wide is a constant. Numbers past the image's last sample
+ *        are counted but not stored, as a trailing image in the file
+ *        would be ignored.
+ */
+static inline __attribute__((always_inline))
+void parse_numbers(struct Chunk *chunk, bool wide)
+{
+    const struct Codec40_image *image = chunk->image;
+    const unsigned char *p = chunk->start, *end = chunk->end;
+    unsigned maxval = image->maxval;
+    size_t row_samples = (size_t)image->width * 3;
+    size_t index = chunk->first;
+    size_t col = index % row_samples;
+    unsigned char *row = image->pixels +
+                         index / row_samples * image->stride;
+
+    chunk->error = NULL;
+    while (p < end) {
+        unsigned char c = *p;
+        if (is_digit(c)) {
+            unsigned value = c - '0';
+            while (++p < end && is_digit(*p)) {
+                value = value * 10 + (*p - '0');
+                if (value > maxval) {
+                    break;
+                }
+            }
+            if (value > maxval) {
+                chunk->error = "ppm sample is above its maxval";
+                break;
+            }
+            if (index < chunk->total) {
+                if (wide) {
+                    uint16_t sample = value;
+                    memcpy(row + 2 * col, &sample, sizeof(sample));
+                } else {
+                    row[col] = value;
+                }
+                if (++col == row_samples) {
+                    col = 0;
+                    row += image->stride;
+                }
+            }
+            index++;
+        } else if (is_space(c)) {
+            p++;
+        } else if (c == '#') {
+            while (p < end && *p != '\n') {
+                p++;
+            }
+        } else {
+            chunk->error = "ppm raster holds something not a number";
+            break;
+        }
+    }
+    chunk->count = index - chunk->first;
+}
+
+/* parse_chunk()
+ * Purpose: A thread which parses the numbers in its chunk into the
+ *          image's pixels
+ * Parameters: Its chunk, whose count and error are filled in
+ * Returns: NULL
+ */
+static void *parse_chunk(void *cl)
+{
+    struct Chunk *chunk = cl;
+    if (chunk->image->maxval >= 256) {
+        parse_numbers(chunk, true);
+    } else {
+        parse_numbers(chunk, false);
+    }
+    return NULL;
+}
+
+/* run_chunks()
+ * Purpose: Run a thread on each chunk, and wait for them all
+ * Parameters: The chunks, how many, and the thread to run on each
+ * Returns: None
+ * Notes: The first chunk, and any a thread cannot be made for, is run
+ *        on the calling thread
+ */
+static void run_chunks(struct Chunk *chunks, unsigned n,
+                       void *(*run)(void *))
+{
+    pthread_t threads[MAX_THREADS];
+    bool started[MAX_THREADS];
+    for (unsigned t = 1; t < n; t++) {
+        started[t] = pthread_create(&threads[t], NULL, run,
+                                    &chunks[t]) == 0;
+        if (!started[t]) {
+            run(&chunks[t]);
+        }
+    }
+    run(&chunks[0]);
+    for (unsigned t = 1; t < n; t++) {
+        if (started[t]) {
+            pthread_join(threads[t], NULL);
+        }
+    }
+}
+
+/* Ppm40_parse_plain()
+ * Purpose: Parse the raster of a plain ppm into an image's pixels
+ * Parameters: The text after the header and its length, the image,
+ *             whose size, maxval, stride and pixels are set, and the
+ *             most threads to use, or 0 for one per processor
+ * Returns: NULL, or what is wrong with the text
+ */
+const char *Ppm40_parse_plain(const char *text, size_t len,
+                              const struct Codec40_image *image,
+                              unsigned nthreads)
+{
+    assert(text != NULL || len == 0);
+    assert(image != NULL && image->pixels != NULL);
+    const unsigned char *bytes = (const unsigned char *)text;
+    size_t total = (size_t)image->width * image->height * 3;
+
+    if (nthreads == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = online > 0 ? (unsigned)online : 1;
+    }
+    nthreads = nthreads > MAX_THREADS ? MAX_THREADS : nthreads;
+    if (nthreads > len / MIN_CHUNK) {
+        nthreads = len / MIN_CHUNK;
+    }
+    if (nthreads < 1 || memchr(text, '#', len) != NULL) {
+        nthreads = 1;
+    }
+
+    struct Chunk chunks[MAX_THREADS];
+    const unsigned char *start = bytes;
+    for (unsigned t = 0; t < nthreads; t++) {
+        const unsigned char *end = bytes + len * (t + 1) / nthreads;
+        while (end < bytes + len && !is_space(*end)) {
+            end++;
+        }
+        end = end < start ? start : end;
+        chunks[t] = (struct Chunk){ start, end, image, 0, total, 0, NULL };
+        start = end;
+    }
+
+    if (nthreads > 1) {
+        STAGE_BEGIN(count_mark);
+        run_chunks(chunks, nthreads, count_chunk);
+        for (unsigned t = 1; t < nthreads; t++) {
+            chunks[t].first = chunks[t - 1].first + chunks[t - 1].count;
+        }
+        STAGE_END(count_mark, "p3count", len);
+    }
+    run_chunks(chunks, nthreads, parse_chunk);
+
+    size_t count = 0;
+    for (unsigned t = 0; t < nthreads; t++) {
+        if (chunks[t].error != NULL) {
+            return chunks[t].error;
+        }
+        count += chunks[t].count;
+    }
+    return count < total ? "ppm is truncated" : NULL;
+}
+
+/* header_number()
+ * Purpose: Read a decimal number from a ppm header, skipping the
+ *          whitespace and comments before it
+ * Parameters: The input
+ * Returns: The number, or 0 if there is none
+ * Notes: The single whitespace after the number is read too, which
+ *        after maxval is the end of the header
+ */
+static unsigned long header_number(FILE *input)
+{
+    int c = getc(input);
+    while (c == '#' || isspace(c)) {
+        if (c == '#') {
+            while (c != '\n' && c != EOF) {
+                c = getc(input);
+            }
+        }
+        c = getc(input);
+    }
+    unsigned long n = 0;
+    while (isdigit(c) && n <= 1000000) {
+        n = n * 10 + (c - '0');
+        c = getc(input);
+    }
+    return isspace(c) ? n : 0;
+}
+
+/* read_raw()
+ * Purpose: Read a binary raster into an image's pixels
+ * Parameters: The input, just after the header, and the image
+ * Returns: NULL, or what is wrong with the raster
+ * Notes: Two-byte samples are big-endian in the file, and are turned
+ *        to host order in place
+ */
+static const char *read_raw(FILE *input, const struct Codec40_image *image)
+{
+    size_t len = image->stride * image->height;
+    STAGE_BEGIN(mark);
+    if (fread(image->pixels, 1, len, input) != len) {
+        return "ppm is truncated";
+    }
+    if (image->maxval >= 256) {
+        unsigned char *bytes = image->pixels;
+        for (size_t i = 0; i < len; i += 2) {
+            uint16_t sample = bytes[i] << 8 | bytes[i + 1];
+            memcpy(bytes + i, &sample, sizeof(sample));
+        }
+    }
+    STAGE_END(mark, "ppmread", (size_t)image->width * image->height);
+    return NULL;
+}
+
+/* read_rest()
+ * Purpose: Read the rest of a file into memory
+ * Parameters: A file pointer, and where to put the number of bytes read
+ * Returns: The bytes, which the caller frees
+ */
+static char *read_rest(FILE *input, size_t *len)
+{
+    size_t capacity = 1 << 16;
+    char *bytes = malloc(capacity);
+    assert(bytes != NULL);
+    size_t got;
+    *len = 0;
+    while ((got = fread(bytes + *len, 1, capacity - *len, input)) > 0) {
+        *len += got;
+        if (*len == capacity) {
+            capacity *= 2;
+            bytes = realloc(bytes, capacity);
+            assert(bytes != NULL);
+        }
+    }
+    return bytes;
+}
+
+/* read_plain()
+ * Purpose: Read a plain raster into an image's pixels
+ * Parameters: The input, just after the header, and the image
+ * Returns: NULL, or what is wrong with the raster
+ * Notes: A regular file is mapped and parsed where it lies; anything
+ *        else is read in first
+ */
+static const char *read_plain(FILE *input, const struct Codec40_image *image)
+{
+    STAGE_BEGIN(mark);
+    struct stat info;
+    long at = ftell(input);
+    char *map = NULL, *text;
+    size_t map_len = 0, len;
+    if (at >= 0 && fstat(fileno(input), &info) == 0 &&
+        S_ISREG(info.st_mode) && info.st_size > at) {
+        map_len = info.st_size;
+        map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fileno(input), 0);
+        map = map != MAP_FAILED ? map : NULL;
+    }
+    if (map != NULL) {
+        madvise(map, map_len, MADV_SEQUENTIAL);
+        text = map + at;
+        len = map_len - at;
+    } else {
+        text = read_rest(input, &len);
+    }
+    const char *error = Ppm40_parse_plain(text, len, image, 0);
+    if (map != NULL) {
+        munmap(map, map_len);
+    } else {
+        free(text);
+    }
+    /* bytes of text, so the rate is in MB/s */
+    STAGE_END(mark, "p3read", len);
+    return error;
+}
+
+/* Ppm40_read()
+ * Purpose: Read a ppm file into flat pixels
+ * Parameters: The input, and the image to fill in
+ * Returns: NULL, or what is wrong with the file, in which case the
+ *          image has no pixels
+ * Notes: The pixels are three channels a pixel, packed, each a byte or
+ *        a uint16_t in host order as struct Codec40_image has them
+ */
+const char *Ppm40_read(FILE *input, struct Codec40_image *image)
+{
+    assert(input != NULL && image != NULL);
+    image->pixels = NULL;
+    int c1 = getc(input);
+    int c2 = getc(input);
+    if (c1 != 'P' || (c2 != '3' && c2 != '6')) {
+        return "input is not a ppm";
+    }
+    unsigned long width = header_number(input);
+    unsigned long height = width > 0 ? header_number(input) : 0;
+    unsigned long maxval = height > 0 ? header_number(input) : 0;
+    if (maxval == 0 || maxval > 65535) {
+        return "ppm has a bad header";
+    }
+    image->width = width;
+    image->height = height;
+    image->maxval = maxval;
+    image->stride = (size_t)width * 3 * CODEC40_CHANNEL_BYTES(maxval);
+    image->pixels = Pages40_alloc(image->stride * height + 1);
+    if (image->pixels == NULL) {
+        return "out of memory";
+    }
+    const char *error = c2 == '6' ? read_raw(input, image)
+                                  : read_plain(input, image);
+    if (error != NULL) {
+        Pages40_free(image->pixels, image->stride * height + 1);
+        image->pixels = NULL;
+    }
+    return error;
+}
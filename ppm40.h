@@ -0,0 +1,40 @@
+/*
+ *     ppm40.h
+ *     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
+ *     Date: 10-26-20
+ *     arith
+ *
+ *     Purpose: Interface for ppm40.c: reads a ppm file straight into the
+ *              flat pixels the codec compresses (struct Codec40_image),
+ *              with no array of Pnm_rgb in between.
+ *
+ *              A binary (P6) raster is already those pixels, so it is
+ *              read in whole. A plain (P3) raster is text, one decimal
+ *              number a channel, and parsing it is the cost: it is split
+ *              at whitespace into a chunk per thread, and each thread
+ *              parses its chunk into its own part of the pixels. To know
+ *              where its part starts, each thread first counts the
+ *              numbers in its chunk, comparing sixteen bytes at a time.
+ */
+
+#ifndef PPM40_INCLUDED
+#define PPM40_INCLUDED
+
+#include <stdio.h>
+#include <stddef.h>
+#include "codec40.h"
+
+/* reads a ppm from input into image, whose pixels come from
+   Pages40_alloc() and are stride * height + 1 bytes; returns NULL, or
+   what is wrong with the file, in which case there are no pixels */
+extern const char *Ppm40_read(FILE *input, struct Codec40_image *image);
+
+/* parses the raster of a plain ppm, the text after its header, into
+   an image whose width, height, maxval, stride and pixels are set,
+   using up to nthreads threads (0 for one per processor); returns NULL
+   or what is wrong with the text */
+extern const char *Ppm40_parse_plain(const char *text, size_t len,
+                                     const struct Codec40_image *image,
+                                     unsigned nthreads);
+
+#endif
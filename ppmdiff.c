@@ -0,0 +1,512 @@
+/*
+ *     ppmdiff.c
+ *     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
+ *     Date: 10-26-20
+ *     arith
+ *
+ *     Purpose: Prints the root mean square difference between two ppm
+ *              images, with every channel scaled to [0, 1]. The images
+ *              may differ by one in width or height (compress40 drops an
+ *              odd last row or column); only the overlap is compared.
+ *              Either file may be "-" for standard input.
+ *
+ *              Usage: ppmdiff [-c] [-j threads] image1.ppm image2.ppm
+ *
+ *              -c prints the red, green and blue differences on a second
+ *              line. -j sets how many threads share the rows (one per
+ *              processor by default).
+ *
+ *              Binary (P6) files are mapped into memory and compared
+ *              where they lie, so nothing as big as an image is ever
+ *              allocated, and the threads fault in their own rows. Plain
+ *              (P3) files and standard input are read in first. When both
+ *              images have the same maxval and one byte a channel, which
+ *              is what 40image writes, the differences are whole numbers:
+ *              they are squared and summed sixteen pixels at a time in
+ *              vector registers, exactly. Other images are summed one
+ *              channel at a time in doubles.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "assert.h"
+#include "a2methods.h"
+#include "a2blocked.h"
+#include "pnm.h"
+
+/* most threads the rows are shared among */
+#define MAX_THREADS 64
+
+/* fewest rows worth a thread of their own */
+#define MIN_THREAD_ROWS 16
+
+/* pixels a step of the vector sum takes, and their bytes */
+#define CHUNK_PIXELS 16
+#define CHUNK_BYTES (3 * CHUNK_PIXELS)
+
+/* steps the vector sums can take before a lane could overflow: each
+   adds at most 255^2 to a 32-bit lane */
+#define CHUNKS_PER_FLUSH 65536
+
+typedef uint8_t Bytes8 __attribute__((vector_size(8)));
+typedef int32_t Ints8 __attribute__((vector_size(32)));
+typedef uint32_t Sums8 __attribute__((vector_size(32)));
+
+/* an image as the bytes of a P6 file: each channel of each pixel is
+   one byte, or two big-endian bytes when maxval is 256 or more */
+struct Image
+{
+    unsigned width, height, maxval;
+    /* bytes from the start of one row to the start of the next */
+    size_t stride;
+    const unsigned char *samples;
+    /* what to let go of: a mapping, or memory from malloc() */
+    void *base;
+    size_t len;
+    bool mapped;
+};
+
+/* the rows one thread sums, and its sums */
+struct Slice
+{
+    const struct Image *image1, *image2;
+    unsigned width, row, rows;
+    double sums[3];
+};
+
+/* open_image()
+ * Purpose: Open a file named on the command line
+ * Parameters: The name, or "-" for standard input
+ * Returns: The open file; exits if it cannot be opened
+ */
+static FILE *open_image(const char *name)
+{
+    if (strcmp(name, "-") == 0) {
+        return stdin;
+    }
+    FILE *fp = fopen(name, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "ppmdiff: cannot open '%s'\n", name);
+        exit(1);
+    }
+    return fp;
+}
+
+/* read_all()
+ * Purpose: Read the whole of a file into memory
+ * Parameters: A file pointer, and where to put the number of bytes read
+ * Returns: The bytes, which the caller frees
+ */
+static unsigned char *read_all(FILE *input, size_t *len)
+{
+    size_t capacity = 1 << 16;
+    unsigned char *bytes = malloc(capacity);
+    assert(bytes != NULL);
+    size_t got;
+    *len = 0;
+    while ((got = fread(bytes + *len, 1, capacity - *len, input)) > 0) {
+        *len += got;
+        if (*len == capacity) {
+            capacity *= 2;
+            bytes = realloc(bytes, capacity);
+            assert(bytes != NULL);
+        }
+    }
+    return bytes;
+}
+
+/* read_number()
+ * Purpose: Read a decimal number from a ppm header, skipping the
+ *          whitespace and comments before it
+ * Parameters: The bytes of the file, their length, and the offset to
+ *             read from, which is moved past the number
+ * Returns: The number, or 0 if there is none
+ */
+static unsigned long read_number(const unsigned char *bytes, size_t len,
+                                 size_t *at)
+{
+    while (*at < len && (bytes[*at] == '#' || isspace(bytes[*at]))) {
+        if (bytes[*at] == '#') {
+            while (*at < len && bytes[*at] != '\n') {
+                (*at)++;
+            }
+        } else {
+            (*at)++;
+        }
+    }
+    unsigned long n = 0;
+    while (*at < len && isdigit(bytes[*at]) && n <= 1000000) {
+        n = n * 10 + (bytes[(*at)++] - '0');
+    }
+    return n;
+}
+
+/* parse_p6()
+ * Purpose: Find the size and the pixels of a P6 file in memory
+ * Parameters: The name of the file, its bytes and their length, and the
+ *             image to fill in
+ * Returns: true, or false if the file is not a P6 at all
+ * Notes: Exits with a message if the file is a P6 but a bad one
+ */
+static bool parse_p6(const char *name, const unsigned char *bytes,
+                     size_t len, struct Image *image)
+{
+    if (len < 2 || bytes[0] != 'P' || bytes[1] != '6') {
+        return false;
+    }
+    size_t at = 2;
+    unsigned long width = read_number(bytes, len, &at);
+    unsigned long height = read_number(bytes, len, &at);
+    unsigned long maxval = read_number(bytes, len, &at);
+    /* the single whitespace after maxval ends the header */
+    if (width == 0 || height == 0 || maxval == 0 || maxval > 65535 ||
+        at >= len || !isspace(bytes[at])) {
+        fprintf(stderr, "ppmdiff: '%s' has a bad header\n", name);
+        exit(1);
+    }
+    image->width = width;
+    image->height = height;
+    image->maxval = maxval;
+    image->stride = (size_t)width * 3 * (maxval < 256 ? 1 : 2);
+    image->samples = bytes + at + 1;
+    if (len - at - 1 < image->stride * height) {
+        fprintf(stderr, "ppmdiff: '%s' is truncated\n", name);
+        exit(1);
+    }
+    return true;
+}
+
+/* store_p6()
+ * Purpose: An apply function which writes one pixel as the bytes of a
+ *          P6 file
+ * Parameters: The current column and row, the pixels array, a pointer
+ *             to the current element, and the image to write to
+ * Returns: None
+ */
+static void store_p6(int col, int row, A2Methods_UArray2 u2, void *elem,
+                     void *cl)
+{
+    (void)u2;
+    struct Image *image = cl;
+    Pnm_rgb rgb = elem;
+    unsigned channels[3] = { rgb->red, rgb->green, rgb->blue };
+    unsigned char *pixel = (unsigned char *)image->samples +
+                           (size_t)row * image->stride;
+    for (int i = 0; i < 3; i++) {
+        if (image->maxval < 256) {
+            pixel[3 * col + i] = channels[i];
+        } else {
+            pixel[6 * col + 2 * i] = channels[i] >> 8;
+            pixel[6 * col + 2 * i + 1] = channels[i] & 0xff;
+        }
+    }
+}
+
+/* parse_other()
+ * Purpose: Read a ppm in memory which is not a P6 with Pnm_ppmread(),
+ *          and lay it out as one
+ * Parameters: The bytes of the file and their length, and the image to
+ *             fill in, whose pixels the caller frees with free()
+ * Returns: None
+ */
+static void parse_other(const unsigned char *bytes, size_t len,
+                        struct Image *image)
+{
+    A2Methods_T methods = uarray2_methods_blocked;
+    FILE *stream = fmemopen((void *)bytes, len, "rb");
+    assert(stream != NULL);
+    Pnm_ppm pixmap = Pnm_ppmread(stream, methods);
+    fclose(stream);
+    image->width = pixmap->width;
+    image->height = pixmap->height;
+    image->maxval = pixmap->denominator;
+    image->stride = (size_t)image->width * 3 * (image->maxval < 256 ? 1 : 2);
+    image->len = image->stride * image->height + 1;
+    image->base = malloc(image->len);
+    assert(image->base != NULL);
+    image->samples = image->base;
+    image->mapped = false;
+    methods->map_default(pixmap->pixels, store_p6, image);
+    Pnm_ppmfree(&pixmap);
+}
+
+/* load_image()
+ * Purpose: Get an image named on the command line into memory
+ * Parameters: The name, or "-" for standard input, and the image to
+ *             fill in
+ * Returns: None
+ * Notes: A regular file is mapped rather than read. Exits with a message
+ *        if the file cannot be opened or is not a ppm.
+ */
+static void load_image(const char *name, struct Image *image)
+{
+    FILE *fp = open_image(name);
+    struct stat info;
+    int fd = fileno(fp);
+    image->mapped = false;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) &&
+        info.st_size > 0) {
+        void *map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            /* start reading ahead while the header is parsed */
+            madvise(map, info.st_size, MADV_WILLNEED);
+            image->base = map;
+            image->len = info.st_size;
+            image->mapped = true;
+        }
+    }
+    if (!image->mapped) {
+        image->base = read_all(fp, &image->len);
+    }
+    if (fp != stdin) {
+        fclose(fp);
+    }
+    if (!parse_p6(name, image->base, image->len, image)) {
+        void *base = image->base;
+        size_t len = image->len;
+        bool mapped = image->mapped;
+        parse_other(base, len, image);
+        if (mapped) {
+            munmap(base, len);
+        } else {
+            free(base);
+        }
+    }
+}
+
+/* free_image()
+ * Purpose: Let go of an image from load_image()
+ * Parameters: The image
+ * Returns: None
+ */
+static void free_image(struct Image *image)
+{
+    if (image->mapped) {
+        munmap(image->base, image->len);
+    } else {
+        free(image->base);
+    }
+    image->base = NULL;
+}
+
+/* sum_bytes()
+ * Purpose: Sum the squared differences of one row of two images with
+ *          one byte a channel and the same maxval
+ * Parameters: The two rows, the number of pixels, and the sums of the
+ *             red, green and blue to add to
+ * Returns: None
+ * Notes: Each step takes 16 pixels, 48 bytes, as six vectors of eight
+ *        lanes, and lane j of the sums always holds channel j % 3, so
+ *        the channels are only told apart when the lanes are added up.
+ *        The sums are whole numbers, so they are exact.
+ */
+static void sum_bytes(const unsigned char *row1, const unsigned char *row2,
+                      unsigned width, uint64_t sums[3])
+{
+    size_t chunks = width / CHUNK_PIXELS;
+    size_t done = 0;
+    while (done < chunks) {
+        size_t n = chunks - done < CHUNKS_PER_FLUSH ? chunks - done
+                                                     : CHUNKS_PER_FLUSH;
+        Sums8 lanes[6] = { { 0 } };
+        for (size_t k = 0; k < n; k++) {
+            const unsigned char *a = row1 + (done + k) * CHUNK_BYTES;
+            const unsigned char *b = row2 + (done + k) * CHUNK_BYTES;
+            for (int v = 0; v < 6; v++) {
+                Bytes8 bytes_a, bytes_b;
+                memcpy(&bytes_a, a + 8 * v, sizeof(bytes_a));
+                memcpy(&bytes_b, b + 8 * v, sizeof(bytes_b));
+                Ints8 d = __builtin_convertvector(bytes_a, Ints8) -
+                          __builtin_convertvector(bytes_b, Ints8);
+                lanes[v] += (Sums8)(d * d);
+            }
+        }
+        for (int j = 0; j < CHUNK_BYTES; j++) {
+            sums[j % 3] += lanes[j / 8][j % 8];
+        }
+        done += n;
+    }
+    for (size_t i = chunks * CHUNK_BYTES; i < 3 * (size_t)width; i++) {
+        int d = row1[i] - row2[i];
+        sums[i % 3] += d * d;
+    }
+}
+
+/* sample_at()
+ * Purpose: Read one channel of a row of an image
+ * Parameters: The row, the index of the channel in it, and whether
+ *             channels are two bytes
+ * Returns: The channel
+ */
+static inline unsigned sample_at(const unsigned char *row, size_t i,
+                                 bool wide)
+{
+    return wide ? (unsigned)row[2 * i] << 8 | row[2 * i + 1] : row[i];
+}
+
+/* sum_rows()
+ * Purpose: A thread which sums the squared differences of its rows
+ * Parameters: Its slice
+ * Returns: NULL
+ */
+static void *sum_rows(void *cl)
+{
+    struct Slice *slice = cl;
+    const struct Image *image1 = slice->image1, *image2 = slice->image2;
+    bool exact = image1->maxval == image2->maxval && image1->maxval < 256;
+    uint64_t whole[3] = { 0, 0, 0 };
+    double scale1 = 1.0 / image1->maxval, scale2 = 1.0 / image2->maxval;
+    bool wide1 = image1->maxval >= 256, wide2 = image2->maxval >= 256;
+
+    for (unsigned row = slice->row; row < slice->row + slice->rows; row++) {
+        const unsigned char *row1 = image1->samples + row * image1->stride;
+        const unsigned char *row2 = image2->samples + row * image2->stride;
+        if (exact) {
+            sum_bytes(row1, row2, slice->width, whole);
+            continue;
+        }
+        for (size_t i = 0; i < 3 * (size_t)slice->width; i++) {
+            double d = sample_at(row1, i, wide1) * scale1 -
+                       sample_at(row2, i, wide2) * scale2;
+            slice->sums[i % 3] += d * d;
+        }
+    }
+    if (exact) {
+        double scale = scale1 * scale1;
+        for (int i = 0; i < 3; i++) {
+            slice->sums[i] = whole[i] * scale;
+        }
+    }
+    return NULL;
+}
+
+/* rms_difference()
+ * Purpose: Compute the root mean square difference of two images over
+ *          the pixels they share, overall and by channel
+ * Parameters: The two images, the number of columns and rows to use,
+ *             the most threads to use, and where to put the red, green
+ *             and blue differences
+ * Returns: The difference, between 0 and 1
+ */
+static double rms_difference(const struct Image *image1,
+                             const struct Image *image2, unsigned width,
+                             unsigned height, unsigned nthreads,
+                             double channels[3])
+{
+    if (nthreads > height / MIN_THREAD_ROWS) {
+        nthreads = height / MIN_THREAD_ROWS;
+    }
+    nthreads = nthreads < 1 ? 1 : nthreads;
+    struct Slice slices[MAX_THREADS];
+    pthread_t threads[MAX_THREADS];
+    bool started[MAX_THREADS];
+    unsigned row = 0;
+    for (unsigned t = 0; t < nthreads; t++) {
+        unsigned rows = height / nthreads + (t < height % nthreads);
+        slices[t] = (struct Slice){ image1, image2, width, row, rows,
+                                    { 0, 0, 0 } };
+        row += rows;
+    }
+    /* the first slice, and any a thread cannot be made for, is summed
+       on this thread */
+    for (unsigned t = 1; t < nthreads; t++) {
+        started[t] = pthread_create(&threads[t], NULL, sum_rows,
+                                    &slices[t]) == 0;
+        if (!started[t]) {
+            sum_rows(&slices[t]);
+        }
+    }
+    sum_rows(&slices[0]);
+
+    double sums[3] = { slices[0].sums[0], slices[0].sums[1],
+                       slices[0].sums[2] };
+    for (unsigned t = 1; t < nthreads; t++) {
+        if (started[t]) {
+            pthread_join(threads[t], NULL);
+        }
+        for (int i = 0; i < 3; i++) {
+            sums[i] += slices[t].sums[i];
+        }
+    }
+    if (width == 0 || height == 0) {
+        channels[0] = channels[1] = channels[2] = 0.0;
+        return 0.0;
+    }
+    double pixels = (double)width * height;
+    for (int i = 0; i < 3; i++) {
+        channels[i] = sqrt(sums[i] / pixels);
+    }
+    return sqrt((sums[0] + sums[1] + sums[2]) / (3.0 * pixels));
+}
+
+/* usage()
+ * Purpose: Print how to run the program, and exit
+ * Parameters: The program's name
+ * Returns: None
+ */
+static void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [-c] [-j threads] image1.ppm image2.ppm\n"
+            "       (at most one of them may be '-')\n", program);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+    bool by_channel = false;
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned nthreads = online > 0 ? (unsigned)online : 1;
+    int i = 1;
+    for (; i < argc - 2; i++) {
+        if (strcmp(argv[i], "-c") == 0) {
+            by_channel = true;
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc - 2) {
+            nthreads = atoi(argv[++i]);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (argc - i != 2 || (strcmp(argv[i], "-") == 0 &&
+                          strcmp(argv[i + 1], "-") == 0)) {
+        usage(argv[0]);
+    }
+    nthreads = nthreads < 1 ? 1 : nthreads;
+    nthreads = nthreads > MAX_THREADS ? MAX_THREADS : nthreads;
+
+    struct Image image1, image2;
+    load_image(argv[i], &image1);
+    load_image(argv[i + 1], &image2);
+
+    int dw = (int)image1.width - (int)image2.width;
+    int dh = (int)image1.height - (int)image2.height;
+    if (abs(dw) > 1 || abs(dh) > 1) {
+        fprintf(stderr, "ppmdiff: sizes differ by more than one "
+                "(%ux%u vs %ux%u)\n", image1.width, image1.height,
+                image2.width, image2.height);
+        printf("1.0\n");
+    } else {
+        unsigned width = dw < 0 ? image1.width : image2.width;
+        unsigned height = dh < 0 ? image1.height : image2.height;
+        double channels[3];
+        printf("%0.4f\n", rms_difference(&image1, &image2, width, height,
+                                         nthreads, channels));
+        if (by_channel) {
+            printf("%0.4f %0.4f %0.4f\n", channels[0], channels[1],
+                   channels[2]);
+        }
+    }
+
+    free_image(&image1);
+    free_image(&image2);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,61 @@
+/*
+ *     profile.c
+ *     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
+ *     Date: 10-26-20
+ *     arith
+ *
+ *     Purpose: The quantization profiles, generated from PROFILE_TABLE,
+ *              and lookup of a profile by the name stored in the
+ *              compressed header
+ */
+
+#include <string.h>
+#include <stddef.h>
+#include "profile.h"
+
+#define PROFILE_ENTRY(name, a_bits, bcd_bits, chroma_bits,             \
+                      bcd_scale, bcd_max)                              \
+    { #name, PROFILE_##name, a_bits, bcd_bits, chroma_bits,            \
+      bcd_scale, bcd_max,                                              \
+      { a_bits, bcd_bits, bcd_bits, bcd_bits, chroma_bits, chroma_bits },\
+      { 2 * chroma_bits + 3 * bcd_bits, 2 * chroma_bits + 2 * bcd_bits, \
+        2 * chroma_bits + bcd_bits, 2 * chroma_bits, chroma_bits, 0 } },
+
+const struct Profile Profile_table[PROFILE_COUNT] = {
+    PROFILE_TABLE(PROFILE_ENTRY)
+};
+
+#undef PROFILE_ENTRY
+
+/* every profile must fit in a 32-bit codeword */
+#define PROFILE_FITS(name, a_bits, bcd_bits, chroma_bits,              \
+                     bcd_scale, bcd_max)                               \
+    typedef char profile_##name##_fits                                 \
+        [(a_bits) + 3 * (bcd_bits) + 2 * (chroma_bits) <= 32 ? 1 : -1];
+PROFILE_TABLE(PROFILE_FITS)
+#undef PROFILE_FITS
+
+/* Profile_default()
+ * Purpose: The profile of the original compressed format
+ * Parameters: none
+ * Returns: A pointer to the default profile
+ */
+const struct Profile *Profile_default(void)
+{
+    return &Profile_table[PROFILE_default];
+}
+
+/* Profile_named()
+ * Purpose: Look up a profile by name
+ * Parameters: The name, as given on the command line or in a header
+ * Returns: A pointer to the profile, or NULL if there is none by that name
+ */
+const struct Profile *Profile_named(const char *name)
+{
+    for (int i = 0; i < PROFILE_COUNT; i++) {
+        if (strcmp(Profile_table[i].name, name) == 0) {
+            return &Profile_table[i];
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,61 @@
+/*
+ *     profile.h
+ *     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
+ *     Date: 10-26-20
+ *     arith
+ *
+ *     Purpose: Interface for profile.c: the quantization profiles,
+ *              which decide how many bits of the 32-bit codeword go
+ *              to a, to each of b, c and d, and to each chroma index,
+ *              and how b, c and d are scaled
+ */
+
+#ifndef PROFILE_INCLUDED
+#define PROFILE_INCLUDED
+
+/*
+ * The profile table. Everything profile specific (the Profile structs
+ * and the quantize, pack and unpack kernels in arith_helper.c) is
+ * generated from it, so adding a row is all a new profile takes.
+ *
+ * X(name, a_bits, bcd_bits, chroma_bits, bcd_scale, bcd_max)
+ *     a is quantized to 2^a_bits - 1 steps over [0, 1]
+ *     b, c and d are clamped to +-bcd_max and multiplied by bcd_scale;
+ *         bcd_max * bcd_scale must fit in a signed bcd_bits field
+ *     4-bit chroma uses the Arith40 table, other widths are uniform
+ *     a_bits + 3 * bcd_bits + 2 * chroma_bits must be at most 32
+ *
+ * The first row is the original format and must stay first.
+ */
+#define PROFILE_TABLE(X) \
+    X(default, 6, 6, 4, 50.0, 0.3)  \
+    X(luma9,   9, 5, 4, 50.0, 0.3)  \
+    X(chroma5, 7, 5, 5, 50.0, 0.3)  \
+    X(smooth,  8, 4, 6, 25.0, 0.28)
+
+/* the fields of a codeword, from the most significant down */
+enum { FIELD_A, FIELD_B, FIELD_C, FIELD_D, FIELD_PB, FIELD_PR,
+       PROFILE_NFIELDS };
+
+#define PROFILE_ID(name, a_bits, bcd_bits, chroma_bits, bcd_scale, bcd_max) \
+    PROFILE_##name,
+enum Profile_id { PROFILE_TABLE(PROFILE_ID) PROFILE_COUNT };
+#undef PROFILE_ID
+
+struct Profile
+{
+    const char *name;
+    enum Profile_id id;
+    unsigned a_bits, bcd_bits, chroma_bits;
+    double bcd_scale, bcd_max;
+    /* width and least significant bit of each field, by FIELD_ */
+    unsigned width[PROFILE_NFIELDS];
+    unsigned lsb[PROFILE_NFIELDS];
+};
+
+extern const struct Profile Profile_table[PROFILE_COUNT];
+
+const struct Profile *Profile_default(void);
+const struct Profile *Profile_named(const char *name);
+
+#endif
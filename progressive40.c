@@ -0,0 +1,241 @@
+/*
+ *     progressive40.c
+ *     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
+ *     Date: 10-26-20
+ *     arith
+ *
+ *     Purpose: The progressive layout of the codewords (see
+ *              progressive40.h).
+ *
+ *              The fields of a codeword run a, b, c, d, pb, pr from the
+ *              most significant bit down, with nothing between them
+ *              (see profile.c). So a block's coarse bits are a, and pb
+ *              and pr as one field at the bottom of the word; its detail
+ *              is b, c and d as one field in the middle. Each pass is a
+ *              big-endian stream of one such field a block, written and
+ *              read through a 64-bit accumulator a byte at a time.
+ */
+
+#include "assert.h"
+#include "progressive40.h"
+#include "instrument.h"
+
+/* where a profile's fields lie for the two passes */
+struct Layout
+{
+    unsigned a_lsb, a_bits;
+    /* pb and pr together, at the bottom of the word */
+    unsigned chroma_bits;
+    /* b, c and d together */
+    unsigned detail_lsb, detail_bits;
+};
+
+/* a stream of fields, most significant bit first */
+struct Bits
+{
+    uint64_t acc;
+    /* bits in acc not yet written, or not yet read */
+    unsigned n;
+};
+
+/* layout_of()
+ * Purpose: Find where a profile's fields lie for the two passes
+ * Parameters: The profile, and the layout to fill in
+ * Returns: none
+ */
+static void layout_of(const struct Profile *profile, struct Layout *layout)
+{
+    assert(profile->lsb[FIELD_PR] == 0);
+    assert(profile->lsb[FIELD_PB] == profile->chroma_bits);
+    assert(profile->lsb[FIELD_D] == 2 * profile->chroma_bits);
+    layout->a_lsb = profile->lsb[FIELD_A];
+    layout->a_bits = profile->a_bits;
+    layout->chroma_bits = 2 * profile->chroma_bits;
+    layout->detail_lsb = profile->lsb[FIELD_D];
+    layout->detail_bits = 3 * profile->bcd_bits;
+}
+
+/* mask()
+ * Purpose: The mask of a field's width
+ * Parameters: The width, 1 to 32
+ * Returns: The low width bits set
+ */
+static inline uint32_t mask(unsigned width)
+{
+    return (uint32_t)(((uint64_t)1 << width) - 1);
+}
+
+/* put_bits()
+ * Purpose: Write a field to a stream
+ * Parameters: The stream, the field and its width (at most 32), and the
+ *             next byte to write, which is moved along
+ * Returns: none
+ */
+static inline void put_bits(struct Bits *bits, uint32_t value, unsigned width,
+                            unsigned char **out)
+{
+    bits->acc = bits->acc << width | value;
+    bits->n += width;
+    while (bits->n >= 8) {
+        bits->n -= 8;
+        *(*out)++ = bits->acc >> bits->n;
+    }
+}
+
+/* flush_bits()
+ * Purpose: Write the last bits of a stream, padded with zeros to a byte
+ * Parameters: The stream, and the next byte to write, which is moved
+ *             along
+ * Returns: none
+ */
+static inline void flush_bits(struct Bits *bits, unsigned char **out)
+{
+    if (bits->n > 0) {
+        *(*out)++ = bits->acc << (8 - bits->n);
+        bits->n = 0;
+    }
+}
+
+/* get_bits()
+ * Purpose: Read a field from a stream
+ * Parameters: The stream, the field's width (at most 32), and the next
+ *             byte to read, which is moved along
+ * Returns: The field
+ * Notes: Reads no more bytes than the fields read so far take up
+ */
+static inline uint32_t get_bits(struct Bits *bits, unsigned width,
+                                const unsigned char **in)
+{
+    while (bits->n < width) {
+        bits->acc = bits->acc << 8 | *(*in)++;
+        bits->n += 8;
+    }
+    bits->n -= width;
+    return (uint32_t)(bits->acc >> bits->n) & mask(width);
+}
+
+/* pass_bytes()
+ * Purpose: The bytes one pass takes
+ * Parameters: The number of blocks, and the bits each has in the pass
+ * Returns: The bytes, the last one padded
+ */
+static size_t pass_bytes(size_t nwords, unsigned bits)
+{
+    return (nwords * bits + 7) / 8;
+}
+
+/* Progressive40_preview_bytes()
+ * Purpose: The bytes of the first pass: a, pb and pr for every block
+ * Parameters: The image's width and height in blocks, and its profile
+ * Returns: The bytes, which is the least Progressive40_decode() takes
+ */
+size_t Progressive40_preview_bytes(unsigned width, unsigned height,
+                                   const struct Profile *profile)
+{
+    struct Layout layout;
+    layout_of(profile, &layout);
+    return pass_bytes((size_t)width * height,
+                      layout.a_bits + layout.chroma_bits);
+}
+
+/* Progressive40_bytes()
+ * Purpose: The bytes of a whole progressive payload
+ * Parameters: The image's width and height in blocks, and its profile
+ * Returns: The bytes of both passes, which is at most one more than the
+ *          plain layout takes
+ */
+size_t Progressive40_bytes(unsigned width, unsigned height,
+                           const struct Profile *profile)
+{
+    struct Layout layout;
+    layout_of(profile, &layout);
+    size_t nwords = (size_t)width * height;
+    return pass_bytes(nwords, layout.a_bits + layout.chroma_bits) +
+           pass_bytes(nwords, layout.detail_bits);
+}
+
+/* Progressive40_encode()
+ * Purpose: Lay out codewords coarse to fine
+ * Parameters: The words, row-major, the image's width and height in
+ *             blocks, its profile, and where to write the payload
+ *             (Progressive40_bytes())
+ * Returns: none
+ */
+void Progressive40_encode(const uint32_t *words, unsigned width,
+                          unsigned height, const struct Profile *profile,
+                          unsigned char *out)
+{
+    STAGE_BEGIN(mark);
+    struct Layout layout;
+    layout_of(profile, &layout);
+    size_t nwords = (size_t)width * height;
+    const unsigned a_lsb = layout.a_lsb, a_bits = layout.a_bits;
+    const unsigned chroma_bits = layout.chroma_bits;
+    const unsigned coarse_bits = a_bits + chroma_bits;
+    const uint32_t a_mask = mask(a_bits), chroma_mask = mask(chroma_bits);
+    struct Bits bits = { 0, 0 };
+
+    for (size_t i = 0; i < nwords; i++) {
+        uint32_t word = words[i];
+        uint32_t coarse = (word >> a_lsb & a_mask) << chroma_bits |
+                          (word & chroma_mask);
+        put_bits(&bits, coarse, coarse_bits, &out);
+    }
+    flush_bits(&bits, &out);
+
+    const unsigned detail_lsb = layout.detail_lsb;
+    const unsigned detail_bits = layout.detail_bits;
+    const uint32_t detail_mask = mask(detail_bits);
+    for (size_t i = 0; i < nwords; i++) {
+        put_bits(&bits, words[i] >> detail_lsb & detail_mask, detail_bits,
+                 &out);
+    }
+    flush_bits(&bits, &out);
+    STAGE_END(mark, "progressive_encode", nwords);
+}
+
+/* Progressive40_decode()
+ * Purpose: Read codewords back from a progressive payload, or from as
+ *          much of one as has arrived
+ * Parameters: The payload and its length, which is at least
+ *             Progressive40_preview_bytes() and at most
+ *             Progressive40_bytes(), the words to fill in, row-major,
+ *             the image's width and height in blocks, and its profile
+ * Returns: How many blocks, from the first, had their b, c and d; the
+ *          rest have them 0, which is a flat block of the right
+ *          brightness and color
+ */
+size_t Progressive40_decode(const unsigned char *in, size_t len,
+                            uint32_t *words, unsigned width,
+                            unsigned height, const struct Profile *profile)
+{
+    STAGE_BEGIN(mark);
+    struct Layout layout;
+    layout_of(profile, &layout);
+    size_t nwords = (size_t)width * height;
+    const unsigned a_lsb = layout.a_lsb, chroma_bits = layout.chroma_bits;
+    const unsigned coarse_bits = layout.a_bits + chroma_bits;
+    const uint32_t chroma_mask = mask(chroma_bits);
+    size_t preview = pass_bytes(nwords, coarse_bits);
+    assert(len >= preview);
+    assert(len <= preview + pass_bytes(nwords, layout.detail_bits));
+    const unsigned char *cursor = in;
+    struct Bits bits = { 0, 0 };
+
+    for (size_t i = 0; i < nwords; i++) {
+        uint32_t coarse = get_bits(&bits, coarse_bits, &cursor);
+        words[i] = (coarse >> chroma_bits) << a_lsb | (coarse & chroma_mask);
+    }
+
+    const unsigned detail_lsb = layout.detail_lsb;
+    const unsigned detail_bits = layout.detail_bits;
+    size_t refined = (len - preview) * 8 / detail_bits;
+    refined = refined < nwords ? refined : nwords;
+    cursor = in + preview;
+    bits.n = 0;
+    for (size_t i = 0; i < refined; i++) {
+        words[i] |= get_bits(&bits, detail_bits, &cursor) << detail_lsb;
+    }
+    STAGE_END(mark, "progressive_decode", nwords);
+    return refined;
+}
@@ -0,0 +1,50 @@
+/*
+ *     progressive40.h
+ *     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
+ *     Date: 10-26-20
+ *     arith
+ *
+ *     Purpose: Interface for progressive40.c: an optional layout of the
+ *              codewords, coarse to fine. The a, pb and pr of every
+ *              block come first, in row-major order, packed tight with
+ *              no bits between them; then the b, c and d of every block,
+ *              the same way. Each of the two passes starts on a byte.
+ *
+ *              a, pb and pr alone are a flat 2x2 block of the right
+ *              brightness and color, so once the first pass has arrived
+ *              the whole frame can be shown at half resolution. It is
+ *              14 of the 32 bits of a default codeword, under half the
+ *              payload. The detail then sharpens the blocks from the top
+ *              as it arrives, and once it is all there the codewords are
+ *              exactly those of the plain layout.
+ */
+
+#ifndef PROGRESSIVE40_INCLUDED
+#define PROGRESSIVE40_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include "profile.h"
+
+/* bytes of the first pass, and of the whole payload, for an image of
+   width x height blocks */
+size_t Progressive40_preview_bytes(unsigned width, unsigned height,
+                                   const struct Profile *profile);
+size_t Progressive40_bytes(unsigned width, unsigned height,
+                           const struct Profile *profile);
+
+/* lays out width x height row-major words, writing
+   Progressive40_bytes() */
+void Progressive40_encode(const uint32_t *words, unsigned width,
+                          unsigned height, const struct Profile *profile,
+                          unsigned char *out);
+
+/* reads the words back from len bytes, which must hold at least the
+   first pass and at most the whole payload; returns how many blocks,
+   from the first, had their detail, and leaves the b, c and d of the
+   rest 0 */
+size_t Progressive40_decode(const unsigned char *in, size_t len,
+                            uint32_t *words, unsigned width,
+                            unsigned height, const struct Profile *profile);
+
+#endif
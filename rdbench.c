@@ -0,0 +1,649 @@
+/*
+ *     rdbench.c
+ *     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
+ *     Date: 10-26-20
+ *     arith
+ *
+ *     Purpose: Rate-distortion benchmark for 40image. Generates
+ *              synthetic images at several sizes (and takes corpus
+ *              images from the command line), runs a compress and a
+ *              decompress round trip for each profile, with and without
+ *              the entropy coder, and prints one JSON object per run:
+ *              the ppmdiff RMSE and PSNR, MP/s for each direction, peak
+ *              RSS of each child, and the compressed size. With -b, the
+ *              runs are compared to a stored baseline (an earlier output
+ *              of rdbench) and regressions are reported on stderr and in
+ *              the exit status.
+ *
+ *              The size, quality and RSS come from running 40image and
+ *              ppmdiff as children. The MP/s does not: starting a
+ *              process costs more than coding a small image, and varies
+ *              more than the tolerance from one run to the next. So it
+ *              is timed in this process, through one Codec40_T, as the
+ *              best of -r reps, each of which codes the image over and
+ *              over for at least MIN_SECONDS.
+ *
+ *     Usage: rdbench [-x 40image] [-p ppmdiff] [-r reps] [-t percent]
+ *                    [-s WxH]... [-q profile]... [-b baseline.jsonl]
+ *                    [corpus.ppm]...
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include "codec40.h"
+#include "ppm40.h"
+#include "pages40.h"
+
+#define MAX_SIZES 16
+#define MAX_PROFILES 16
+#define MAX_RESULTS 1024
+/* size and quality may not get worse by more than this, in percent */
+#define RATE_TOLERANCE 1.0
+
+/* how long each timing rep codes its image for, at least */
+#define MIN_SECONDS 0.05
+/* how many more times a run that looks slower than its baseline is
+ * timed before it is called a regression */
+#define RETIMES 4
+
+/* one round trip */
+struct Result
+{
+    char image[64];
+    unsigned width, height;
+    char profile[16];
+    int entropy;
+    long bytes;
+    double rmse, psnr;
+    double compress_mps, decompress_mps;
+    long compress_rss_kb, decompress_rss_kb;
+};
+
+#define RESULT_FORMAT "{\"image\":\"%s\",\"width\":%u,\"height\":%u," \
+    "\"profile\":\"%s\",\"entropy\":%d,\"bytes\":%ld,\"rmse\":%.4f,"    \
+    "\"psnr\":%.2f,\"compress_mps\":%.2f,\"decompress_mps\":%.2f,"     \
+    "\"compress_rss_kb\":%ld,\"decompress_rss_kb\":%ld}"
+#define RESULT_SCAN "{\"image\":\"%63[^\"]\",\"width\":%u,\"height\":%u," \
+    "\"profile\":\"%15[^\"]\",\"entropy\":%d,\"bytes\":%ld,\"rmse\":%lf,"  \
+    "\"psnr\":%lf,\"compress_mps\":%lf,\"decompress_mps\":%lf,"           \
+    "\"compress_rss_kb\":%ld,\"decompress_rss_kb\":%ld}"
+
+struct Settings
+{
+    const char *codec;
+    const char *ppmdiff;
+    int reps;
+    double tolerance;
+    unsigned widths[MAX_SIZES], heights[MAX_SIZES];
+    int nsizes;
+    const char *profiles[MAX_PROFILES];
+    int nprofiles;
+    const char *baseline;
+    struct Result *base;
+    int nbase;
+    char tmpdir[64];
+};
+
+static uint32_t rng_state = 1;
+
+static unsigned rng(void)
+{
+    rng_state = rng_state * 1664525u + 1013904223u;
+    return rng_state >> 16;
+}
+
+static unsigned clamp255(double x)
+{
+    return x < 0 ? 0 : x > 255 ? 255 : (unsigned)x;
+}
+
+/* generate_image()
+ * Purpose: Write a synthetic P6 image
+ * Parameters: The kind of image ("photo", "gradient", "document" or
+ *             "noise"), its size, and the path to write it to
+ * Returns: none
+ * Notes: The images are deterministic, so runs compare across builds
+ */
+static void generate_image(const char *kind, unsigned width,
+                           unsigned height, const char *path)
+{
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL) {
+        perror(path);
+        exit(1);
+    }
+    unsigned char *row = malloc(3 * (size_t)width);
+    rng_state = 1;
+    fprintf(fp, "P6\n%u %u\n255\n", width, height);
+
+    for (unsigned y = 0; y < height; y++) {
+        for (unsigned x = 0; x < width; x++) {
+            double r, g, b;
+            double u = (double)x / width, v = (double)y / height;
+            if (strcmp(kind, "photo") == 0) {
+                r = 128 + 90 * sin(7 * u + 3 * v) + (rng() % 9) - 4.0;
+                g = 128 + 80 * cos(5 * v - 2 * u) + (rng() % 9) - 4.0;
+                b = 110 + 70 * sin(11 * u * v) + (rng() % 9) - 4.0;
+            } else if (strcmp(kind, "gradient") == 0) {
+                r = 255 * u;
+                g = 255 * v;
+                b = 255 * (1 - u) * v;
+            } else if (strcmp(kind, "document") == 0) {
+                /* white page with dark "text" runs on every line */
+                bool ink = (y % 24) > 6 && (y % 24) < 18
+                           && ((x / 7) * 2654435761u >> 28) < 7
+                           && x > width / 10 && x < width - width / 10;
+                r = g = b = ink ? 30 : 250;
+            } else {
+                r = rng() % 256;
+                g = rng() % 256;
+                b = rng() % 256;
+            }
+            row[3 * x] = clamp255(r);
+            row[3 * x + 1] = clamp255(g);
+            row[3 * x + 2] = clamp255(b);
+        }
+        fwrite(row, 3, width, fp);
+    }
+    free(row);
+    fclose(fp);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* cpu_now()
+ * Purpose: The CPU time this thread has used
+ * Parameters: none
+ * Returns: The seconds
+ * Notes: Unlike the wall clock, it does not count time the thread was
+ *        not running, so other load on the machine moves it far less
+ */
+static double cpu_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* run_child()
+ * Purpose: Run a program with its standard input and output redirected
+ * Parameters: The argument vector, the input and output paths, and where
+ *             to store the elapsed seconds and the peak RSS in KB
+ * Returns: True if the program exited with status 0
+ */
+static bool run_child(char *const argv[], const char *in, const char *out,
+                      double *seconds, long *rss_kb)
+{
+    double start = now();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        int fd_in = open(in, O_RDONLY);
+        int fd_out = open(out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd_in < 0 || fd_out < 0) {
+            _exit(127);
+        }
+        dup2(fd_in, 0);
+        dup2(fd_out, 1);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        perror("wait4");
+        exit(1);
+    }
+    *seconds = now() - start;
+    *rss_kb = usage.ru_maxrss;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static long file_size(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 ? (long)st.st_size : -1;
+}
+
+/* time_calls()
+ * Purpose: Time one direction of the codec in this process
+ * Parameters: The settings, the codec, the image, the options, the
+ *             compressed image's buffer, its capacity and length, the
+ *             image to decompress into, whether to compress or to
+ *             decompress, and where to put the best seconds per call
+ * Returns: True if every call succeeded
+ * Notes: Compressing sets *len, which decompressing then reads
+ */
+static bool time_calls(const struct Settings *s, Codec40_T codec,
+                       const struct Codec40_image *image,
+                       const struct Codec_options *options,
+                       unsigned char *coded, size_t capacity, size_t *len,
+                       const struct Codec40_image *decoded, bool compress,
+                       double *best)
+{
+    *best = INFINITY;
+    for (int rep = 0; rep < s->reps; rep++) {
+        double start = cpu_now(), seconds;
+        long calls = 0;
+        do {
+            enum Codec40_status status =
+                compress ? Codec40_encode_using(codec, image, options,
+                                                coded, capacity, len)
+                         : Codec40_decode_using(codec, coded, *len,
+                                                decoded);
+            if (status != CODEC40_OK) {
+                return false;
+            }
+            calls++;
+            seconds = cpu_now() - start;
+        } while (seconds < MIN_SECONDS);
+        *best = seconds / calls < *best ? seconds / calls : *best;
+    }
+    return true;
+}
+
+/* time_codec()
+ * Purpose: Time compressing and decompressing an image in this process
+ * Parameters: The settings, the image, the profile name, whether to
+ *             entropy code, and where to put the best seconds per call
+ *             in each direction
+ * Returns: True if both directions succeeded
+ */
+static bool time_codec(const struct Settings *s,
+                       const struct Codec40_image *image,
+                       const char *profile, bool entropy,
+                       double *compress, double *decompress)
+{
+    struct Codec_options options = CODEC_OPTIONS_DEFAULT;
+    options.entropy = entropy;
+    options.profile = Profile_named(profile);
+    if (options.profile == NULL) {
+        return false;
+    }
+    size_t capacity = Codec40_encode_bound(image->width, image->height,
+                                           &options);
+    struct Codec40_image decoded = { image->width & ~1u,
+                                     image->height & ~1u, 255,
+                                     (size_t)(image->width & ~1u) * 3,
+                                     NULL };
+    Codec40_T codec = Codec40_new();
+    unsigned char *coded = malloc(capacity);
+    decoded.pixels = malloc(decoded.stride * decoded.height);
+    size_t len = 0;
+    bool ok = codec != NULL && coded != NULL && decoded.pixels != NULL &&
+              time_calls(s, codec, image, &options, coded, capacity, &len,
+                         &decoded, true, compress) &&
+              time_calls(s, codec, image, &options, coded, capacity, &len,
+                         &decoded, false, decompress);
+    free(decoded.pixels);
+    free(coded);
+    if (codec != NULL) {
+        Codec40_free(&codec);
+    }
+    return ok;
+}
+
+/* round_trip()
+ * Purpose: Benchmark one image with one profile, with or without the
+ *          entropy coder
+ * Parameters: The settings, the image's name, path, size and pixels,
+ *             the profile name, whether to entropy code, and the result
+ * Returns: True if both directions and the comparison succeeded
+ */
+static bool round_trip(const struct Settings *s, const char *name,
+                       const char *path, const struct Codec40_image *image,
+                       const char *profile, bool entropy,
+                       struct Result *result)
+{
+    unsigned width = image->width, height = image->height;
+    char packed[128], unpacked[128], diff[128];
+    snprintf(packed, sizeof(packed), "%s/out.c40", s->tmpdir);
+    snprintf(unpacked, sizeof(unpacked), "%s/out.ppm", s->tmpdir);
+    snprintf(diff, sizeof(diff), "%s/diff.txt", s->tmpdir);
+
+    char *compress[] = { (char *)s->codec, "-c", "-q", (char *)profile,
+                         entropy ? "-e" : NULL, NULL };
+    char *decompress[] = { (char *)s->codec, "-d", NULL };
+    char *compare[] = { (char *)s->ppmdiff, (char *)path, unpacked, NULL };
+
+    memset(result, 0, sizeof(*result));
+    snprintf(result->image, sizeof(result->image), "%s", name);
+    snprintf(result->profile, sizeof(result->profile), "%s", profile);
+    result->width = width;
+    result->height = height;
+    result->entropy = entropy;
+
+    double seconds, best_c, best_d;
+    long rss;
+    if (!run_child(compress, path, packed, &seconds,
+                   &result->compress_rss_kb) ||
+        !run_child(decompress, packed, unpacked, &seconds,
+                   &result->decompress_rss_kb) ||
+        !run_child(compare, "/dev/null", diff, &seconds, &rss) ||
+        !time_codec(s, image, profile, entropy, &best_c, &best_d)) {
+        return false;
+    }
+
+    FILE *fp = fopen(diff, "r");
+    if (fp == NULL || fscanf(fp, "%lf", &result->rmse) != 1) {
+        return false;
+    }
+    fclose(fp);
+
+    double megapixels = (double)width * height / 1e6;
+    result->bytes = file_size(packed);
+    result->psnr = result->rmse > 0 ? 20 * log10(1.0 / result->rmse) : 99;
+    result->compress_mps = megapixels / best_c;
+    result->decompress_mps = megapixels / best_d;
+    return true;
+}
+
+/* worse()
+ * Purpose: Check whether a number got worse by more than a tolerance
+ * Parameters: The baseline and current values, whether bigger is
+ *             better, and the tolerance in percent
+ * Returns: True if the current value is a regression
+ * Notes: From a baseline of 0, such as the rmse of a lossless image,
+ *        any rise is a regression
+ */
+static bool worse(double base, double now, bool bigger_is_better,
+                  double tolerance)
+{
+    if (base == 0) {
+        return bigger_is_better ? now < 0 : now > 0;
+    }
+    double change = 100.0 * (now - base) / base;
+    return bigger_is_better ? change < -tolerance : change > tolerance;
+}
+
+/* load_baseline()
+ * Purpose: Read the stored baseline into the settings
+ * Parameters: The settings
+ * Returns: none
+ * Notes: Exits if the baseline cannot be opened
+ */
+static void load_baseline(struct Settings *s)
+{
+    FILE *fp = fopen(s->baseline, "r");
+    if (fp == NULL) {
+        perror(s->baseline);
+        exit(1);
+    }
+    s->base = malloc(MAX_RESULTS * sizeof(struct Result));
+    s->nbase = 0;
+    char line[1024];
+    while (s->nbase < MAX_RESULTS && fgets(line, sizeof(line), fp) != NULL) {
+        struct Result *b = &s->base[s->nbase];
+        if (sscanf(line, RESULT_SCAN, b->image, &b->width, &b->height,
+                   b->profile, &b->entropy, &b->bytes, &b->rmse, &b->psnr,
+                   &b->compress_mps, &b->decompress_mps,
+                   &b->compress_rss_kb, &b->decompress_rss_kb) == 12) {
+            s->nbase++;
+        }
+    }
+    fclose(fp);
+}
+
+/* find_baseline()
+ * Purpose: Find the baseline of a run
+ * Parameters: The settings and the run
+ * Returns: The baseline with the same image, profile and entropy coding,
+ *          or NULL if there is none
+ */
+static const struct Result *find_baseline(const struct Settings *s,
+                                          const struct Result *r)
+{
+    for (int i = 0; i < s->nbase; i++) {
+        const struct Result *b = &s->base[i];
+        if (strcmp(r->image, b->image) == 0 &&
+            strcmp(r->profile, b->profile) == 0 &&
+            r->entropy == b->entropy) {
+            return b;
+        }
+    }
+    return NULL;
+}
+
+/* retime()
+ * Purpose: Time a run again while its MP/s looks worse than its
+ *          baseline's
+ * Parameters: The settings, the image, and the run's result
+ * Returns: none
+ * Notes: The host can slow down for longer than a whole timing, and a
+ *        slow patch rarely lasts through RETIMES more of them, but a
+ *        slower codec does; the best MP/s seen is kept.
+ */
+static void retime(const struct Settings *s,
+                   const struct Codec40_image *image, struct Result *r)
+{
+    const struct Result *b = find_baseline(s, r);
+    double megapixels = (double)r->width * r->height / 1e6;
+    for (int i = 0; b != NULL && i < RETIMES &&
+         (worse(b->compress_mps, r->compress_mps, true, s->tolerance) ||
+          worse(b->decompress_mps, r->decompress_mps, true, s->tolerance));
+         i++) {
+        double best_c, best_d;
+        if (!time_codec(s, image, r->profile, r->entropy, &best_c,
+                        &best_d)) {
+            return;
+        }
+        if (megapixels / best_c > r->compress_mps) {
+            r->compress_mps = megapixels / best_c;
+        }
+        if (megapixels / best_d > r->decompress_mps) {
+            r->decompress_mps = megapixels / best_d;
+        }
+    }
+}
+
+/* compare_baseline()
+ * Purpose: Report every run that regressed against the stored baseline
+ * Parameters: The settings, and the results of this run
+ * Returns: The number of regressions found
+ */
+static int compare_baseline(const struct Settings *s,
+                            const struct Result *results, int nresults)
+{
+    int regressions = 0;
+    for (int i = 0; i < nresults; i++) {
+        const struct Result *r = &results[i];
+        const struct Result *b = find_baseline(s, r);
+        if (b == NULL) {
+            continue;
+        }
+        struct {
+            const char *what;
+            double base, now;
+            bool bigger_is_better;
+            double tolerance;
+        } checks[] = {
+            { "bytes", b->bytes, r->bytes, false, RATE_TOLERANCE },
+            { "rmse", b->rmse, r->rmse, false, RATE_TOLERANCE },
+            { "compress_mps", b->compress_mps, r->compress_mps,
+              true, s->tolerance },
+            { "decompress_mps", b->decompress_mps, r->decompress_mps,
+              true, s->tolerance },
+            { "compress_rss_kb", b->compress_rss_kb,
+              r->compress_rss_kb, false, s->tolerance },
+            { "decompress_rss_kb", b->decompress_rss_kb,
+              r->decompress_rss_kb, false, s->tolerance },
+        };
+        for (unsigned k = 0; k < sizeof(checks) / sizeof(checks[0]); k++) {
+            if (worse(checks[k].base, checks[k].now,
+                      checks[k].bigger_is_better, checks[k].tolerance)) {
+                fprintf(stderr, "REGRESSION %s %s%s %s: %g -> %g\n",
+                        r->image, r->profile, r->entropy ? "+e" : "",
+                        checks[k].what, checks[k].base, checks[k].now);
+                regressions++;
+            }
+        }
+    }
+    return regressions;
+}
+
+/* bench_image()
+ * Purpose: Run every configuration on one image and print the results
+ * Parameters: The settings, the image's name and path, and the array of
+ *             results with its count
+ * Returns: none
+ */
+static void bench_image(const struct Settings *s, const char *name,
+                        const char *path, struct Result *results,
+                        int *nresults)
+{
+    struct Codec40_image image;
+    FILE *fp = fopen(path, "rb");
+    const char *error = fp != NULL ? Ppm40_read(fp, &image)
+                                   : "cannot be opened";
+    if (fp != NULL) {
+        fclose(fp);
+    }
+    if (error != NULL) {
+        fprintf(stderr, "rdbench: %s: %s\n", path, error);
+        return;
+    }
+    for (int p = 0; p < s->nprofiles; p++) {
+        for (int entropy = 0; entropy <= 1; entropy++) {
+            if (*nresults == MAX_RESULTS) {
+                break;
+            }
+            struct Result *r = &results[*nresults];
+            if (!round_trip(s, name, path, &image, s->profiles[p],
+                            entropy, r)) {
+                fprintf(stderr, "rdbench: round trip failed on %s (%s%s)\n",
+                        name, s->profiles[p], entropy ? ", -e" : "");
+                continue;
+            }
+            retime(s, &image, r);
+            printf(RESULT_FORMAT "\n", r->image, r->width, r->height,
+                   r->profile, r->entropy, r->bytes, r->rmse, r->psnr,
+                   r->compress_mps, r->decompress_mps, r->compress_rss_kb,
+                   r->decompress_rss_kb);
+            fflush(stdout);
+            (*nresults)++;
+        }
+    }
+    Pages40_free(image.pixels, image.stride * image.height + 1);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-x 40image] [-p ppmdiff] [-r reps] "
+            "[-t percent]\n"
+            "       [-s WxH]... [-q profile]... [-b baseline.jsonl] "
+            "[corpus.ppm]...\n", prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    static const char *kinds[] = { "photo", "gradient", "document",
+                                   "noise" };
+    struct Settings s = { "./40image", "./ppmdiff", 10, 10.0,
+                          { 256, 1024, 2048 }, { 256, 768, 1536 }, 0,
+                          { NULL }, 0, NULL, NULL, 0,
+                          "/tmp/rdbench.XXXXXX" };
+    bool sizes_given = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "x:p:r:t:s:q:b:")) != -1) {
+        switch (opt) {
+        case 'x': s.codec = optarg; break;
+        case 'p': s.ppmdiff = optarg; break;
+        case 'r': s.reps = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+        case 't': s.tolerance = atof(optarg); break;
+        case 'b': s.baseline = optarg; break;
+        case 'q':
+            if (s.nprofiles < MAX_PROFILES) {
+                s.profiles[s.nprofiles++] = optarg;
+            }
+            break;
+        case 's':
+            if (!sizes_given) {
+                sizes_given = true;
+                s.nsizes = 0;
+            }
+            if (s.nsizes < MAX_SIZES &&
+                sscanf(optarg, "%ux%u", &s.widths[s.nsizes],
+                       &s.heights[s.nsizes]) == 2) {
+                s.nsizes++;
+            }
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (!sizes_given) {
+        s.nsizes = 3;
+    }
+    if (s.nprofiles == 0) {
+        s.profiles[s.nprofiles++] = "default";
+    }
+    if (s.baseline != NULL) {
+        load_baseline(&s);
+    }
+    if (mkdtemp(s.tmpdir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    struct Result *results = malloc(MAX_RESULTS * sizeof(struct Result));
+    int nresults = 0;
+    char path[128], name[64];
+    snprintf(path, sizeof(path), "%s/in.ppm", s.tmpdir);
+
+    for (int k = 0; k < (int)(sizeof(kinds) / sizeof(kinds[0])); k++) {
+        for (int z = 0; z < s.nsizes; z++) {
+            snprintf(name, sizeof(name), "%s_%ux%u", kinds[k],
+                     s.widths[z], s.heights[z]);
+            generate_image(kinds[k], s.widths[z], s.heights[z], path);
+            bench_image(&s, name, path, results, &nresults);
+        }
+    }
+    remove(path);
+
+    for (int i = optind; i < argc; i++) {
+        const char *base = strrchr(argv[i], '/');
+        bench_image(&s, base != NULL ? base + 1 : argv[i], argv[i],
+                    results, &nresults);
+    }
+
+    char leftover[128];
+    const char *files[] = { "out.c40", "out.ppm", "diff.txt" };
+    for (int i = 0; i < 3; i++) {
+        snprintf(leftover, sizeof(leftover), "%s/%s", s.tmpdir, files[i]);
+        remove(leftover);
+    }
+    rmdir(s.tmpdir);
+
+    int regressions = 0;
+    if (s.baseline != NULL) {
+        regressions = compare_baseline(&s, results, nresults);
+        fprintf(stderr, "rdbench: %d regression(s) against %s\n",
+                regressions, s.baseline);
+    }
+    free(results);
+    free(s.base);
+    return regressions == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,558 @@
+/*
+ *     seq40.c
+ *     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
+ *     Date: 10-26-20
+ *     arith
+ *
+ *     Purpose: Sequences of frames with delta frames in between
+ *              keyframes (see seq40.h). The encoder keeps the pixels
+ *              and codewords of the frame before, codes again only the
+ *              2x2 blocks whose pixels changed, and puts in the frame
+ *              only the codewords that changed. The decoder keeps the
+ *              codewords and writes only the changed blocks.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "assert.h"
+#include "seq40.h"
+#include "arith_helper.h"
+#include "instrument.h"
+
+struct Seq40_encoder_T
+{
+    struct Codec_options options;
+    unsigned keyframe_every;
+    /* frames coded so far */
+    size_t frames;
+    /* the pixels of the frame before, even width and height, which the
+       codewords were coded from */
+    struct Codec40_image previous;
+    /* one codeword per 2x2 block of previous, in row-major order */
+    uint32_t *words;
+    Codec40_T codec;
+};
+
+struct Seq40_decoder_T
+{
+    /* whether SEQ40_MAGIC has been read */
+    bool started;
+    /* the last keyframe's header; width is 0 before the first */
+    struct Codec40_header header;
+    uint32_t *words;
+    Codec40_T codec;
+};
+
+/* put_be32()
+ * Purpose: Write a 32-bit big-endian number
+ * Parameters: Where to write it, and the number
+ * Returns: none
+ */
+static inline void put_be32(unsigned char *out, uint32_t value)
+{
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
+
+/* get_be32()
+ * Purpose: Read a 32-bit big-endian number
+ * Parameters: Where to read it
+ * Returns: The number
+ */
+static inline uint32_t get_be32(const unsigned char *in)
+{
+    return (uint32_t)in[0] << 24 | (uint32_t)in[1] << 16 |
+           (uint32_t)in[2] << 8 | in[3];
+}
+
+/* bitmap_bytes()
+ * Purpose: The size of a delta frame's bitmap
+ * Parameters: The number of 2x2 blocks in a frame
+ * Returns: The size in bytes
+ */
+static inline size_t bitmap_bytes(size_t nblocks)
+{
+    return (nblocks + 7) / 8;
+}
+
+/* Seq40_encoder_new()
+ * Purpose: Start coding a sequence
+ * Parameters: The options (NULL for the defaults), which may not ask
+ *             for entropy coding or the progressive layout, and how
+ *             many frames apart keyframes are (0 for only the first)
+ * Returns: The encoder, or NULL if out of memory or the options cannot
+ *          be used; free it with Seq40_encoder_free()
+ */
+Seq40_encoder_T Seq40_encoder_new(const struct Codec_options *options,
+                                  unsigned keyframe_every)
+{
+    if (options != NULL && (options->entropy || options->progressive)) {
+        return NULL;
+    }
+    Seq40_encoder_T encoder = calloc(1, sizeof(*encoder));
+    if (encoder == NULL) {
+        return NULL;
+    }
+    struct Codec_options defaults = CODEC_OPTIONS_DEFAULT;
+    encoder->options = options != NULL ? *options : defaults;
+    if (encoder->options.profile == NULL) {
+        encoder->options.profile = Profile_default();
+    }
+    encoder->keyframe_every = keyframe_every;
+    encoder->codec = Codec40_new();
+    if (encoder->codec == NULL) {
+        free(encoder);
+        return NULL;
+    }
+    return encoder;
+}
+
+/* Seq40_encoder_free()
+ * Purpose: Free an encoder
+ * Parameters: A pointer to the encoder, which is set to NULL
+ * Returns: none
+ */
+void Seq40_encoder_free(Seq40_encoder_T *encoder)
+{
+    if (encoder == NULL || *encoder == NULL) {
+        return;
+    }
+    Codec40_free(&(*encoder)->codec);
+    free((*encoder)->previous.pixels);
+    free((*encoder)->words);
+    free(*encoder);
+    *encoder = NULL;
+}
+
+/* Seq40_frame_bound()
+ * Purpose: The most bytes one frame of a sequence can take
+ * Parameters: The width and height of the frames in pixels
+ * Returns: The bound, which is the buffer size Seq40_encode_frame()
+ *          needs
+ * Notes: Counts SEQ40_MAGIC, which comes before the first frame
+ */
+size_t Seq40_frame_bound(unsigned width, unsigned height)
+{
+    size_t nblocks = (size_t)(width / 2) * (height / 2);
+    size_t delta = bitmap_bytes(nblocks) + nblocks * sizeof(uint32_t);
+    size_t key = Codec40_encode_bound(width, height, NULL);
+    return strlen(SEQ40_MAGIC) + SEQ40_FRAME_HEADER +
+           (delta > key ? delta : key);
+}
+
+/* same_size()
+ * Purpose: Tell whether a frame can follow the frames before it
+ * Parameters: The encoder, which has coded a frame, and the new frame
+ * Returns: true if it has the same size in 2x2 blocks and the same
+ *          maxval, and its rows are long enough
+ */
+static bool same_size(Seq40_encoder_T encoder,
+                      const struct Codec40_image *frame)
+{
+    const struct Codec40_image *previous = &encoder->previous;
+    return frame->pixels != NULL &&
+           frame->width / 2 == previous->width / 2 &&
+           frame->height / 2 == previous->height / 2 &&
+           frame->maxval == previous->maxval &&
+           frame->stride >= previous->stride;
+}
+
+/* encode_key()
+ * Purpose: Code a keyframe, and keep its pixels and codewords
+ * Parameters: The encoder, the frame, and where to put its body and how
+ *             much room there is
+ * Returns: CODEC40_OK, or why the frame could not be coded, with the
+ *          encoder left as it was
+ */
+static enum Codec40_status encode_key(Seq40_encoder_T encoder,
+                                      const struct Codec40_image *frame,
+                                      unsigned char *body, size_t capacity,
+                                      size_t *len)
+{
+    enum Codec40_status status = Codec40_encode_using(encoder->codec, frame,
+                                                      &encoder->options,
+                                                      body, capacity, len);
+    if (status != CODEC40_OK) {
+        return status;
+    }
+    struct Codec40_image *previous = &encoder->previous;
+    unsigned width = frame->width - frame->width % 2;
+    unsigned height = frame->height - frame->height % 2;
+    size_t row_bytes = (size_t)width * 3 *
+                       CODEC40_CHANNEL_BYTES(frame->maxval);
+    size_t nblocks = (size_t)(width / 2) * (height / 2);
+    if (previous->pixels == NULL || previous->width != width ||
+        previous->height != height || previous->stride != row_bytes) {
+        free(previous->pixels);
+        free(encoder->words);
+        previous->pixels = malloc(row_bytes * height);
+        encoder->words = malloc(nblocks * sizeof(uint32_t));
+        if (previous->pixels == NULL || encoder->words == NULL) {
+            free(previous->pixels);
+            free(encoder->words);
+            previous->pixels = NULL;
+            encoder->words = NULL;
+            return CODEC40_NO_MEMORY;
+        }
+    }
+    previous->width = width;
+    previous->height = height;
+    previous->maxval = frame->maxval;
+    previous->stride = row_bytes;
+    for (unsigned row = 0; row < height; row++) {
+        memcpy(previous->pixels + row * row_bytes,
+               frame->pixels + row * frame->stride, row_bytes);
+    }
+
+    struct Codec40_header header;
+    status = Codec40_read_header(body, *len, &header);
+    assert(status == CODEC40_OK);
+    for (size_t i = 0; i < nblocks; i++) {
+        encoder->words[i] = get_be32(body + header.size + i * 4);
+    }
+    return CODEC40_OK;
+}
+
+/* encode_delta()
+ * Purpose: Code a delta frame: the codewords of the 2x2 blocks that
+ *          changed since the frame before
+ * Parameters: The encoder, the frame, which is the size of the frame
+ *             before, and where to put its body, which has room for
+ *             every block
+ * Returns: The size of the body
+ * Notes: A pair of pixel rows that did not change is passed over with
+ *        one comparison. A block whose pixels changed is coded again,
+ *        but only goes in the frame if its codeword changed.
+ */
+static size_t encode_delta(Seq40_encoder_T encoder,
+                           const struct Codec40_image *frame,
+                           unsigned char *body)
+{
+    STAGE_BEGIN(mark);
+    struct Codec40_image *previous = &encoder->previous;
+    Block_encoder *encode_block = block_encoder_of(encoder->options.profile);
+    unsigned blocks_wide = previous->width / 2;
+    unsigned blocks_high = previous->height / 2;
+    size_t nblocks = (size_t)blocks_wide * blocks_high;
+    size_t bytes = 2 * 3 * CODEC40_CHANNEL_BYTES(previous->maxval);
+    size_t row_bytes = previous->stride;
+    unsigned char *bitmap = body;
+    unsigned char *cursor = body + bitmap_bytes(nblocks);
+    memset(bitmap, 0, bitmap_bytes(nblocks));
+
+    for (unsigned row = 0; row < blocks_high; row++) {
+        const unsigned char *now = frame->pixels + 2 * row * frame->stride;
+        unsigned char *before = previous->pixels + 2 * row * row_bytes;
+        if (memcmp(now, before, row_bytes) == 0 &&
+            memcmp(now + frame->stride, before + row_bytes, row_bytes) == 0) {
+            continue;
+        }
+        for (unsigned col = 0; col < blocks_wide; col++) {
+            size_t at = col * bytes;
+            if (memcmp(now + at, before + at, bytes) == 0 &&
+                memcmp(now + frame->stride + at, before + row_bytes + at,
+                       bytes) == 0) {
+                continue;
+            }
+            memcpy(before + at, now + at, bytes);
+            memcpy(before + row_bytes + at, now + frame->stride + at, bytes);
+            uint32_t word = encode_block(frame, col, row);
+            size_t block = (size_t)row * blocks_wide + col;
+            if (word != encoder->words[block]) {
+                encoder->words[block] = word;
+                bitmap[block / 8] |= 0x80 >> block % 8;
+                put_be32(cursor, word);
+                cursor += 4;
+            }
+        }
+    }
+    STAGE_END(mark, "seq_delta_encode", nblocks);
+    INSTRUMENT_COUNT("seq_changed_blocks",
+                     (cursor - body - bitmap_bytes(nblocks)) / 4);
+    return cursor - body;
+}
+
+/* Seq40_encode_frame()
+ * Purpose: Code the next frame of a sequence
+ * Parameters: The encoder, the frame, and where to put it, with room
+ *             for Seq40_frame_bound() bytes, and where to put its length
+ * Returns: CODEC40_OK, or why the frame could not be coded; a frame
+ *          that is not the size or maxval of the first is a bad argument
+ * Notes: The first frame comes after SEQ40_MAGIC, in the same output.
+ *        An odd last row or column is dropped, as by Codec40_encode().
+ */
+enum Codec40_status Seq40_encode_frame(Seq40_encoder_T encoder,
+                                       const struct Codec40_image *frame,
+                                       unsigned char *out, size_t capacity,
+                                       size_t *len)
+{
+    if (encoder == NULL || frame == NULL || out == NULL || len == NULL) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+    bool first = encoder->frames == 0;
+    if (!first && !same_size(encoder, frame)) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+    *len = Seq40_frame_bound(frame->width, frame->height);
+    if (capacity < *len) {
+        return CODEC40_NO_SPACE;
+    }
+
+    size_t at = first ? strlen(SEQ40_MAGIC) : 0;
+    unsigned char *body = out + at + SEQ40_FRAME_HEADER;
+    bool key = first || (encoder->keyframe_every > 0 &&
+                         encoder->frames % encoder->keyframe_every == 0);
+    size_t body_len;
+    if (key) {
+        enum Codec40_status status = encode_key(encoder, frame, body,
+                                                capacity - (body - out),
+                                                &body_len);
+        if (status != CODEC40_OK) {
+            return status;
+        }
+    } else {
+        body_len = encode_delta(encoder, frame, body);
+    }
+
+    memcpy(out, SEQ40_MAGIC, at);
+    out[at] = key ? 'K' : 'D';
+    put_be32(out + at + 1, body_len);
+    *len = at + SEQ40_FRAME_HEADER + body_len;
+    encoder->frames++;
+    return CODEC40_OK;
+}
+
+/* frame_at()
+ * Purpose: Find the next frame of a sequence
+ * Parameters: The sequence from where the frame starts and its length,
+ *             whether SEQ40_MAGIC comes first, and where to put the
+ *             frame's tag, body and the bytes it takes in all
+ * Returns: CODEC40_OK, or why there is no whole frame there
+ */
+static enum Codec40_status frame_at(const unsigned char *in, size_t len,
+                                    bool magic, char *tag,
+                                    const unsigned char **body,
+                                    size_t *body_len, size_t *used)
+{
+    size_t at = 0;
+    if (magic) {
+        at = strlen(SEQ40_MAGIC);
+        if (len < at || memcmp(in, SEQ40_MAGIC, at) != 0) {
+            return CODEC40_BAD_HEADER;
+        }
+    }
+    if (len - at < SEQ40_FRAME_HEADER) {
+        return CODEC40_TRUNCATED;
+    }
+    *tag = in[at];
+    *body_len = get_be32(in + at + 1);
+    *body = in + at + SEQ40_FRAME_HEADER;
+    if (len - at - SEQ40_FRAME_HEADER < *body_len) {
+        return CODEC40_TRUNCATED;
+    }
+    *used = at + SEQ40_FRAME_HEADER + *body_len;
+    return CODEC40_OK;
+}
+
+/* Seq40_decode_info()
+ * Purpose: Find the size of the frames of a sequence
+ * Parameters: The start of the sequence and its length, and where to
+ *             put the width and height in pixels
+ * Returns: CODEC40_OK, or why the sequence cannot be used
+ */
+enum Codec40_status Seq40_decode_info(const unsigned char *in, size_t len,
+                                      unsigned *width, unsigned *height)
+{
+    if (in == NULL || width == NULL || height == NULL) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+    char tag;
+    const unsigned char *body;
+    size_t body_len, used;
+    enum Codec40_status status = frame_at(in, len, true, &tag, &body,
+                                          &body_len, &used);
+    if (status != CODEC40_OK) {
+        return status;
+    }
+    if (tag != 'K') {
+        return CODEC40_CORRUPT;
+    }
+    return Codec40_decode_info(body, body_len, width, height);
+}
+
+/* Seq40_decoder_new()
+ * Purpose: Start decoding a sequence
+ * Parameters: none
+ * Returns: The decoder, or NULL if out of memory; free it with
+ *          Seq40_decoder_free()
+ */
+Seq40_decoder_T Seq40_decoder_new(void)
+{
+    Seq40_decoder_T decoder = calloc(1, sizeof(*decoder));
+    if (decoder == NULL) {
+        return NULL;
+    }
+    decoder->codec = Codec40_new();
+    if (decoder->codec == NULL) {
+        free(decoder);
+        return NULL;
+    }
+    return decoder;
+}
+
+/* Seq40_decoder_free()
+ * Purpose: Free a decoder
+ * Parameters: A pointer to the decoder, which is set to NULL
+ * Returns: none
+ */
+void Seq40_decoder_free(Seq40_decoder_T *decoder)
+{
+    if (decoder == NULL || *decoder == NULL) {
+        return;
+    }
+    Codec40_free(&(*decoder)->codec);
+    free((*decoder)->words);
+    free(*decoder);
+    *decoder = NULL;
+}
+
+/* decode_key()
+ * Purpose: Decode a keyframe, and keep its codewords
+ * Parameters: The decoder, the frame's body and its length, and the
+ *             frame to fill in
+ * Returns: CODEC40_OK, or why the frame could not be decoded
+ */
+static enum Codec40_status decode_key(Seq40_decoder_T decoder,
+                                      const unsigned char *body,
+                                      size_t len,
+                                      const struct Codec40_image *frame)
+{
+    struct Codec40_header header;
+    enum Codec40_status status = Codec40_read_header(body, len, &header);
+    if (status != CODEC40_OK) {
+        return status;
+    }
+    if (header.options.entropy || header.options.progressive) {
+        return CODEC40_CORRUPT;
+    }
+    status = Codec40_decode_using(decoder->codec, body, len, frame);
+    if (status != CODEC40_OK) {
+        return status;
+    }
+    size_t nblocks = (size_t)(header.width / 2) * (header.height / 2);
+    if (header.width != decoder->header.width ||
+        header.height != decoder->header.height) {
+        free(decoder->words);
+        decoder->words = malloc(nblocks * sizeof(uint32_t));
+        if (decoder->words == NULL) {
+            decoder->header.width = 0;
+            return CODEC40_NO_MEMORY;
+        }
+    }
+    decoder->header = header;
+    for (size_t i = 0; i < nblocks; i++) {
+        decoder->words[i] = get_be32(body + header.size + i * 4);
+    }
+    return CODEC40_OK;
+}
+
+/* decode_delta()
+ * Purpose: Apply a delta frame to the codewords and the pixels of the
+ *          frame before
+ * Parameters: The decoder, the frame's body and its length, and the
+ *             frame, which holds the frame before
+ * Returns: CODEC40_OK, or CODEC40_CORRUPT if the body does not have as
+ *          many codewords as its bitmap says; the frame is untouched
+ * Notes: Bytes of the bitmap with no bits set are passed over whole
+ */
+static enum Codec40_status decode_delta(Seq40_decoder_T decoder,
+                                        const unsigned char *body,
+                                        size_t len,
+                                        const struct Codec40_image *frame)
+{
+    unsigned blocks_wide = decoder->header.width / 2;
+    size_t nblocks = (size_t)blocks_wide * (decoder->header.height / 2);
+    size_t map_len = bitmap_bytes(nblocks);
+    if (len < map_len) {
+        return CODEC40_CORRUPT;
+    }
+    size_t changed = 0;
+    for (size_t i = 0; i < map_len; i++) {
+        changed += __builtin_popcount(body[i]);
+    }
+    if (len - map_len != changed * 4 ||
+        (nblocks % 8 != 0 && (body[map_len - 1] & (0xff >> nblocks % 8)))) {
+        return CODEC40_CORRUPT;
+    }
+
+    STAGE_BEGIN(mark);
+    Block_decoder *decode_block = block_decoder_of(
+                                      decoder->header.options.profile);
+    const unsigned char *cursor = body + map_len;
+    for (size_t i = 0; i < map_len; i++) {
+        for (unsigned bits = body[i]; bits != 0; ) {
+            unsigned bit = __builtin_clz(bits) - 24;
+            bits &= ~(0x80u >> bit);
+            size_t block = i * 8 + bit;
+            uint32_t word = get_be32(cursor);
+            cursor += 4;
+            decoder->words[block] = word;
+            decode_block(word, frame, block % blocks_wide,
+                         block / blocks_wide);
+        }
+    }
+    STAGE_END(mark, "seq_delta_decode", nblocks);
+    INSTRUMENT_COUNT("seq_changed_blocks", changed);
+    return CODEC40_OK;
+}
+
+/* Seq40_decode_frame()
+ * Purpose: Decode the next frame of a sequence
+ * Parameters: The decoder, the sequence from where the frame starts
+ *             (SEQ40_MAGIC, for the first) and how many bytes of it
+ *             there are, where to put how many bytes the frame took,
+ *             and the frame to fill in, which is the size Seq40_decode_
+ *             info() gives and, for a delta frame, holds the frame before
+ * Returns: CODEC40_OK, or why the frame could not be decoded
+ * Notes: A keyframe writes every pixel, and a delta frame only the 2x2
+ *        blocks that changed. The first frame must be a keyframe.
+ */
+enum Codec40_status Seq40_decode_frame(Seq40_decoder_T decoder,
+                                       const unsigned char *in, size_t len,
+                                       size_t *used,
+                                       const struct Codec40_image *frame)
+{
+    if (decoder == NULL || in == NULL || used == NULL || frame == NULL ||
+        frame->pixels == NULL) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+    char tag;
+    const unsigned char *body;
+    size_t body_len;
+    enum Codec40_status status = frame_at(in, len, !decoder->started, &tag,
+                                          &body, &body_len, used);
+    if (status != CODEC40_OK) {
+        return status;
+    }
+    if (tag == 'K') {
+        status = decode_key(decoder, body, body_len, frame);
+    } else if (tag != 'D' || decoder->header.width == 0) {
+        status = CODEC40_CORRUPT;
+    } else if (frame->width != decoder->header.width ||
+               frame->height != decoder->header.height ||
+               frame->maxval == 0 || frame->maxval > 65535 ||
+               frame->stride < (size_t)frame->width * 3 *
+                               CODEC40_CHANNEL_BYTES(frame->maxval)) {
+        status = CODEC40_BAD_ARGUMENT;
+    } else {
+        status = decode_delta(decoder, body, body_len, frame);
+    }
+    if (status == CODEC40_OK) {
+        decoder->started = true;
+    }
+    return status;
+}
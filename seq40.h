@@ -0,0 +1,64 @@
+/*
+ *     seq40.h
+ *     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
+ *     Date: 10-26-20
+ *     arith
+ *
+ *     Purpose: Interface for seq40.c: sequences of frames of one size,
+ *              as from a fixed camera, where most 2x2 blocks keep the
+ *              same codeword from one frame to the next.
+ *
+ *              A sequence starts with SEQ40_MAGIC. Each frame after it
+ *              is a tag byte, the length of its body as 4 big-endian
+ *              bytes, and the body:
+ *                'K' a keyframe: an ordinary plain compressed image
+ *                'D' a delta frame: a bitmap with one bit per 2x2 block,
+ *                    in row-major order and most significant bit first,
+ *                    set for the blocks whose codeword changed, then
+ *                    the new codewords of just those blocks, as 32-bit
+ *                    big-endian words in the same order
+ *              A delta frame changes the frame before it. Coding a delta
+ *              frame only codes the blocks whose pixels changed, and
+ *              decoding one only writes those blocks, into the pixels of
+ *              the frame before.
+ */
+
+#ifndef SEQ40_INCLUDED
+#define SEQ40_INCLUDED
+
+#include <stddef.h>
+#include "codec40.h"
+
+#define SEQ40_MAGIC "COMP40 Sequence 1\n"
+
+/* bytes before the body of each frame */
+#define SEQ40_FRAME_HEADER 5
+
+typedef struct Seq40_encoder_T *Seq40_encoder_T;
+typedef struct Seq40_decoder_T *Seq40_decoder_T;
+
+/* Encoding. keyframe_every is how many frames apart keyframes are, or 0
+   for only the first; options may not ask for entropy coding or the
+   progressive layout. */
+extern Seq40_encoder_T Seq40_encoder_new(const struct Codec_options *options,
+                                         unsigned keyframe_every);
+extern void Seq40_encoder_free(Seq40_encoder_T *encoder);
+extern size_t Seq40_frame_bound(unsigned width, unsigned height);
+extern enum Codec40_status
+Seq40_encode_frame(Seq40_encoder_T encoder,
+                   const struct Codec40_image *frame,
+                   unsigned char *out, size_t capacity, size_t *len);
+
+/* Decoding. The frame given to Seq40_decode_frame() must hold the frame
+   before, as the last call left it. */
+extern enum Codec40_status Seq40_decode_info(const unsigned char *in,
+                                             size_t len, unsigned *width,
+                                             unsigned *height);
+extern Seq40_decoder_T Seq40_decoder_new(void);
+extern void Seq40_decoder_free(Seq40_decoder_T *decoder);
+extern enum Codec40_status
+Seq40_decode_frame(Seq40_decoder_T decoder, const unsigned char *in,
+                   size_t len, size_t *used,
+                   const struct Codec40_image *frame);
+
+#endif
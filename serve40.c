@@ -0,0 +1,936 @@
+/*
+ *     serve40.c
+ *     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
+ *     Date: 10-26-20
+ *     arith
+ *
+ *     Purpose: The codec server and its client calls (see serve40.h).
+ *
+ *              The main thread owns the socket and every connection. It
+ *              waits in ppoll() on the listening socket, on each
+ *              connection that has no job in hand, and on an eventfd the
+ *              workers write when they finish one; a connection with a
+ *              job is left out, which is what keeps it to one at a time.
+ *              A request is read into the connection's one job and the
+ *              connection is put on the queue, a list under a mutex that
+ *              idle workers wait on. The worker codes it, sends the
+ *              reply itself, and gives the connection back.
+ *
+ *              The mappings a connection keeps belong to whichever
+ *              thread has its job, so they need no lock. Each is keyed
+ *              on the buffer's device and inode, which cannot be reused
+ *              while the mapping holds the buffer open.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "assert.h"
+#include "serve40.h"
+
+/* connections open at once; more wait in the listen backlog */
+#define MAX_CONNECTIONS 256
+
+/* buffers a connection keeps mapped */
+#define MAPS 4
+
+/* latencies under this many microseconds have a bin each; above it,
+   each power of two has SUB_BINS */
+#define EXACT_US 16
+#define SUB_BINS 8
+#define BINS (EXACT_US + (64 - 4) * SUB_BINS)
+
+/* one buffer mapped for a connection */
+struct Mapping
+{
+    dev_t dev;
+    ino_t ino;
+    unsigned char *bytes;
+    size_t len;
+    int prot;
+    /* when it was last used, on the connection's own clock */
+    uint64_t used;
+};
+
+struct Connection
+{
+    int fd;
+    /* its job is queued or being worked on */
+    bool busy;
+    /* the job: the request, its input and output, and when it came */
+    struct Serve40_request request;
+    int fds[2];
+    unsigned nfds;
+    uint64_t arrived_us;
+    struct Connection *next;
+    struct Mapping maps[MAPS];
+    uint64_t clock;
+};
+
+struct Histogram
+{
+    uint64_t bins[BINS];
+    uint64_t count, max;
+};
+
+struct Server
+{
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    /* connections whose jobs are waiting, oldest first */
+    struct Connection *head, *tail;
+    unsigned depth, max_depth;
+    bool stopping;
+    /* written by a worker when it gives a connection back */
+    int wake;
+    unsigned workers;
+    uint64_t started_us;
+    uint64_t jobs[SERVE40_OP_COUNT], failed;
+    struct Histogram total, queued;
+    /* the main thread's alone */
+    struct Connection *connections[MAX_CONNECTIONS];
+    unsigned nconnections;
+};
+
+static volatile sig_atomic_t stop_signal;
+
+static void on_stop(int signal)
+{
+    stop_signal = signal;
+}
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* bin_of()
+ * Purpose: The histogram bin of a latency
+ * Parameters: The latency in microseconds
+ * Returns: The bin
+ */
+static unsigned bin_of(uint64_t us)
+{
+    if (us < EXACT_US) {
+        return us;
+    }
+    unsigned octave = 63 - __builtin_clzll(us);
+    unsigned sub = (us >> (octave - 3)) & (SUB_BINS - 1);
+    return EXACT_US + (octave - 4) * SUB_BINS + sub;
+}
+
+/* bin_top()
+ * Purpose: The largest latency in a histogram bin
+ * Parameters: The bin
+ * Returns: The latency in microseconds
+ */
+static uint64_t bin_top(unsigned bin)
+{
+    if (bin < EXACT_US) {
+        return bin;
+    }
+    unsigned octave = (bin - EXACT_US) / SUB_BINS + 4;
+    uint64_t sub = (bin - EXACT_US) % SUB_BINS;
+    return ((SUB_BINS + sub + 1) << (octave - 3)) - 1;
+}
+
+static void record(struct Histogram *histogram, uint64_t us)
+{
+    histogram->bins[bin_of(us)]++;
+    histogram->count++;
+    histogram->max = us > histogram->max ? us : histogram->max;
+}
+
+/* percentile()
+ * Purpose: A percentile of the latencies in a histogram
+ * Parameters: The histogram, and the percentile, 0 to 100
+ * Returns: The top of the bin it falls in, no more than the largest
+ *          latency, or 0 if there are none
+ */
+static uint64_t percentile(const struct Histogram *histogram, double p)
+{
+    if (histogram->count == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(histogram->count * p / 100);
+    rank = rank < histogram->count ? rank : histogram->count - 1;
+    uint64_t seen = 0;
+    for (unsigned bin = 0; bin < BINS; bin++) {
+        seen += histogram->bins[bin];
+        if (seen > rank) {
+            uint64_t top = bin_top(bin);
+            return top < histogram->max ? top : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+/* fill_metrics()
+ * Purpose: Take a snapshot of the server's metrics
+ * Parameters: The server, whose lock the caller holds, and the metrics
+ *             to fill in
+ * Returns: none
+ */
+static void fill_metrics(const struct Server *server,
+                         struct Serve40_metrics *metrics)
+{
+    memset(metrics, 0, sizeof(*metrics));
+    metrics->workers = server->workers;
+    metrics->connections = server->nconnections;
+    metrics->queue_depth = server->depth;
+    metrics->queue_max = server->max_depth;
+    metrics->uptime_ms = (now_us() - server->started_us) / 1000;
+    memcpy(metrics->jobs, server->jobs, sizeof(server->jobs));
+    metrics->failed = server->failed;
+    metrics->total_p50_us = percentile(&server->total, 50);
+    metrics->total_p99_us = percentile(&server->total, 99);
+    metrics->total_max_us = server->total.max;
+    metrics->queue_p50_us = percentile(&server->queued, 50);
+    metrics->queue_p99_us = percentile(&server->queued, 99);
+    metrics->queue_max_us = server->queued.max;
+}
+
+/* map_buffer()
+ * Purpose: Map one of a job's buffers, or find it already mapped
+ * Parameters: The connection, the buffer's descriptor, the least bytes
+ *             it must have, PROT_READ or PROT_READ | PROT_WRITE, where
+ *             to put its length, and where to put the status if it
+ *             cannot be mapped
+ * Returns: The whole buffer, or NULL
+ * Notes: A buffer must be sealed against shrinking, or a client could
+ *        cut it short and the server would fault on it
+ */
+static unsigned char *map_buffer(struct Connection *conn, int fd,
+                                 size_t need, int prot, size_t *len,
+                                 enum Codec40_status *status)
+{
+    struct stat st;
+    int seals = fcntl(fd, F_GET_SEALS);
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || seals < 0 ||
+        (seals & F_SEAL_SHRINK) == 0 || st.st_size <= 0 ||
+        (uint64_t)st.st_size < need) {
+        *status = CODEC40_BAD_ARGUMENT;
+        return NULL;
+    }
+
+    /* the buffer's own slot if it has one, or else the one least
+       recently used; a slot never used has a clock of 0 */
+    struct Mapping *slot = &conn->maps[0];
+    for (unsigned i = 0; i < MAPS; i++) {
+        struct Mapping *map = &conn->maps[i];
+        if (map->bytes != NULL && map->dev == st.st_dev &&
+            map->ino == st.st_ino) {
+            slot = map;
+            break;
+        }
+        if (map->used < slot->used) {
+            slot = map;
+        }
+    }
+    if (slot->bytes != NULL && slot->dev == st.st_dev &&
+        slot->ino == st.st_ino) {
+        if ((slot->prot & prot) == prot && slot->len == (size_t)st.st_size) {
+            slot->used = ++conn->clock;
+            *len = slot->len;
+            return slot->bytes;
+        }
+        /* it has grown, or is wanted for writing now */
+        prot |= slot->prot;
+    }
+    if (slot->bytes != NULL) {
+        munmap(slot->bytes, slot->len);
+        slot->bytes = NULL;
+    }
+    void *bytes = mmap(NULL, st.st_size, prot, MAP_SHARED | MAP_POPULATE,
+                       fd, 0);
+    if (bytes == MAP_FAILED) {
+        *status = errno == EACCES ? CODEC40_BAD_ARGUMENT
+                                  : CODEC40_NO_MEMORY;
+        return NULL;
+    }
+    slot->dev = st.st_dev;
+    slot->ino = st.st_ino;
+    slot->bytes = bytes;
+    slot->len = st.st_size;
+    slot->prot = prot;
+    slot->used = ++conn->clock;
+    *len = slot->len;
+    return bytes;
+}
+
+/* compress_job()
+ * Purpose: Compress the pixels of a request into its output buffer
+ * Parameters: The worker's codec, the connection, and the reply to fill
+ *             in
+ * Returns: The status
+ */
+static enum Codec40_status compress_job(Codec40_T codec,
+                                        struct Connection *conn,
+                                        struct Serve40_reply *reply)
+{
+    const struct Serve40_request *request = &conn->request;
+    if (request->width == 0 || request->height == 0 ||
+        request->width > CODEC40_MAX_SIDE ||
+        request->height > CODEC40_MAX_SIDE || request->maxval == 0 ||
+        request->maxval > 65535 || request->profile >= PROFILE_COUNT) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+    size_t row = (size_t)request->width * 3 *
+                 CODEC40_CHANNEL_BYTES(request->maxval);
+    if (request->stride < row || request->len < row ||
+        (request->len - row) / request->stride < request->height - 1) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+
+    enum Codec40_status status = CODEC40_OK;
+    size_t in_len, out_len;
+    unsigned char *in = map_buffer(conn, conn->fds[0], request->len,
+                                   PROT_READ, &in_len, &status);
+    if (in == NULL) {
+        return status;
+    }
+    unsigned char *out = map_buffer(conn, conn->fds[1], 1,
+                                    PROT_READ | PROT_WRITE, &out_len,
+                                    &status);
+    if (out == NULL) {
+        return status;
+    }
+
+    struct Codec_options options = CODEC_OPTIONS_DEFAULT;
+    options.entropy = (request->flags & SERVE40_ENTROPY) != 0;
+    options.progressive = (request->flags & SERVE40_PROGRESSIVE) != 0;
+    options.profile = &Profile_table[request->profile];
+    struct Codec40_image image = { request->width, request->height,
+                                   request->maxval, request->stride, in };
+    size_t len = 0;
+    status = Codec40_encode_using(codec, &image, &options, out, out_len,
+                                  &len);
+    reply->len = status == CODEC40_NO_SPACE
+                 ? Codec40_encode_bound(image.width, image.height, &options)
+                 : len;
+    return status;
+}
+
+/* decompress_job()
+ * Purpose: Decompress the image of a request into its output buffer,
+ *          as packed rgb with a maxval of 255
+ * Parameters: The worker's codec, the connection, and the reply to fill
+ *             in
+ * Returns: The status
+ */
+static enum Codec40_status decompress_job(Codec40_T codec,
+                                          struct Connection *conn,
+                                          struct Serve40_reply *reply)
+{
+    const struct Serve40_request *request = &conn->request;
+    enum Codec40_status status = CODEC40_OK;
+    size_t in_len, out_len;
+    unsigned char *in = map_buffer(conn, conn->fds[0], request->len,
+                                   PROT_READ, &in_len, &status);
+    if (in == NULL) {
+        return status;
+    }
+    unsigned width, height;
+    status = Codec40_decode_info(in, request->len, &width, &height);
+    if (status != CODEC40_OK) {
+        return status;
+    }
+    reply->width = width;
+    reply->height = height;
+    size_t need = (size_t)width * height * 3;
+    unsigned char *out = map_buffer(conn, conn->fds[1], 1,
+                                    PROT_READ | PROT_WRITE, &out_len,
+                                    &status);
+    if (out == NULL) {
+        return status;
+    }
+    if (out_len < need) {
+        reply->len = need;
+        return CODEC40_NO_SPACE;
+    }
+    struct Codec40_image image = { width, height, 255, (size_t)width * 3,
+                                   out };
+    status = Codec40_decode_using(codec, in, request->len, &image);
+    reply->len = status == CODEC40_OK ? need : 0;
+    return status;
+}
+
+/* run_job()
+ * Purpose: Code a connection's job
+ * Parameters: The worker's codec, the connection, and the reply to fill
+ *             in
+ * Returns: The status
+ * Notes: The input and output must be different buffers, since mapping
+ *        one for writing could move the other
+ */
+static enum Codec40_status run_job(Codec40_T codec, struct Connection *conn,
+                                   struct Serve40_reply *reply)
+{
+    struct stat in, out;
+    if (fstat(conn->fds[0], &in) < 0 || fstat(conn->fds[1], &out) < 0 ||
+        (in.st_dev == out.st_dev && in.st_ino == out.st_ino)) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+    return conn->request.op == SERVE40_COMPRESS
+           ? compress_job(codec, conn, reply)
+           : decompress_job(codec, conn, reply);
+}
+
+/* send_reply()
+ * Purpose: Send a reply, and the metrics after it if there are any
+ * Parameters: The socket, the reply, and the metrics or NULL
+ * Returns: none; a client that has gone is found when its socket hangs
+ *          up
+ */
+static void send_reply(int fd, const struct Serve40_reply *reply,
+                       const struct Serve40_metrics *metrics)
+{
+    struct iovec iov[2] = {
+        { (void *)reply, sizeof(*reply) },
+        { (void *)metrics, metrics != NULL ? sizeof(*metrics) : 0 }
+    };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = metrics != NULL ? 2 : 1;
+    while (sendmsg(fd, &msg, MSG_NOSIGNAL) < 0 && errno == EINTR) {
+    }
+}
+
+/* close_fds()
+ * Purpose: Close the descriptors that came with a connection's job
+ * Parameters: The connection
+ * Returns: none
+ */
+static void close_fds(struct Connection *conn)
+{
+    for (unsigned i = 0; i < conn->nfds; i++) {
+        close(conn->fds[i]);
+    }
+    conn->nfds = 0;
+}
+
+/* work()
+ * Purpose: A worker: code queued jobs until the server stops and the
+ *          queue is empty
+ * Parameters: The server
+ * Returns: NULL
+ */
+static void *work(void *arg)
+{
+    struct Server *server = arg;
+    Codec40_T codec = Codec40_new();
+    assert(codec != NULL);
+
+    for (;;) {
+        pthread_mutex_lock(&server->lock);
+        while (server->head == NULL && !server->stopping) {
+            pthread_cond_wait(&server->ready, &server->lock);
+        }
+        struct Connection *conn = server->head;
+        if (conn == NULL) {
+            pthread_mutex_unlock(&server->lock);
+            break;
+        }
+        server->head = conn->next;
+        if (server->head == NULL) {
+            server->tail = NULL;
+        }
+        server->depth--;
+        pthread_mutex_unlock(&server->lock);
+
+        uint64_t start_us = now_us();
+        struct Serve40_reply reply;
+        memset(&reply, 0, sizeof(reply));
+        reply.magic = SERVE40_MAGIC;
+        reply.id = conn->request.id;
+        enum Codec40_status status = run_job(codec, conn, &reply);
+        uint64_t done_us = now_us();
+        reply.status = status;
+        reply.queue_us = start_us - conn->arrived_us;
+        reply.service_us = done_us - start_us;
+        close_fds(conn);
+
+        /* counted before the reply goes, so that a client that asks for
+           the metrics next finds its job in them */
+        pthread_mutex_lock(&server->lock);
+        server->jobs[conn->request.op]++;
+        server->failed += status != CODEC40_OK;
+        record(&server->total, now_us() - conn->arrived_us);
+        record(&server->queued, reply.queue_us);
+        pthread_mutex_unlock(&server->lock);
+        send_reply(conn->fd, &reply, NULL);
+        pthread_mutex_lock(&server->lock);
+        conn->busy = false;
+        pthread_mutex_unlock(&server->lock);
+        uint64_t one = 1;
+        ssize_t written = write(server->wake, &one, sizeof(one));
+        (void)written;
+    }
+
+    Codec40_free(&codec);
+    return NULL;
+}
+
+/* close_connection()
+ * Purpose: Drop a connection that has no job, with its mappings
+ * Parameters: The server, and the connection's index
+ * Returns: none
+ */
+static void close_connection(struct Server *server, unsigned i)
+{
+    struct Connection *conn = server->connections[i];
+    assert(!conn->busy);
+    for (unsigned m = 0; m < MAPS; m++) {
+        if (conn->maps[m].bytes != NULL) {
+            munmap(conn->maps[m].bytes, conn->maps[m].len);
+        }
+    }
+    close(conn->fd);
+    free(conn);
+    pthread_mutex_lock(&server->lock);
+    server->connections[i] = server->connections[--server->nconnections];
+    pthread_mutex_unlock(&server->lock);
+}
+
+/* receive()
+ * Purpose: Read a request from a connection, and queue it or answer it
+ * Parameters: The server, and the connection's index
+ * Returns: false if the connection is to be closed: it hung up, or sent
+ *          something that is not a request
+ */
+static bool receive(struct Server *server, unsigned i)
+{
+    struct Connection *conn = server->connections[i];
+    union {
+        char bytes[CMSG_SPACE(4 * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = { &conn->request, sizeof(conn->request) };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.bytes;
+    msg.msg_controllen = sizeof(control.bytes);
+    ssize_t n = recvmsg(conn->fd, &msg, MSG_CMSG_CLOEXEC | MSG_DONTWAIT);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+        return true;
+    }
+    conn->nfds = 0;
+    if (n < 0) {
+        /* msg_controllen is left as it was, so there are no cmsgs to
+           read, only the uninitialized control buffer */
+        return false;
+    }
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET ||
+            cmsg->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        unsigned count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        int *fds = (int *)CMSG_DATA(cmsg);
+        for (unsigned f = 0; f < count; f++) {
+            if (conn->nfds < 2) {
+                conn->fds[conn->nfds++] = fds[f];
+            } else {
+                close(fds[f]);
+                conn->nfds = 3;
+            }
+        }
+    }
+    if (n != sizeof(conn->request) || (msg.msg_flags & (MSG_TRUNC |
+        MSG_CTRUNC)) != 0 || conn->request.magic != SERVE40_MAGIC) {
+        conn->nfds = conn->nfds > 2 ? 2 : conn->nfds;
+        close_fds(conn);
+        return false;
+    }
+
+    conn->arrived_us = now_us();
+    struct Serve40_reply reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.magic = SERVE40_MAGIC;
+    reply.id = conn->request.id;
+    if (conn->request.op == SERVE40_METRICS && conn->nfds == 0) {
+        struct Serve40_metrics metrics;
+        pthread_mutex_lock(&server->lock);
+        server->jobs[SERVE40_METRICS]++;
+        fill_metrics(server, &metrics);
+        pthread_mutex_unlock(&server->lock);
+        send_reply(conn->fd, &reply, &metrics);
+        return true;
+    }
+    if (conn->request.op >= SERVE40_METRICS || conn->nfds != 2) {
+        conn->nfds = conn->nfds > 2 ? 2 : conn->nfds;
+        close_fds(conn);
+        reply.status = CODEC40_BAD_ARGUMENT;
+        send_reply(conn->fd, &reply, NULL);
+        pthread_mutex_lock(&server->lock);
+        server->failed++;
+        pthread_mutex_unlock(&server->lock);
+        return true;
+    }
+
+    pthread_mutex_lock(&server->lock);
+    conn->busy = true;
+    conn->next = NULL;
+    if (server->tail != NULL) {
+        server->tail->next = conn;
+    } else {
+        server->head = conn;
+    }
+    server->tail = conn;
+    server->depth++;
+    if (server->depth > server->max_depth) {
+        server->max_depth = server->depth;
+    }
+    pthread_cond_signal(&server->ready);
+    pthread_mutex_unlock(&server->lock);
+    return true;
+}
+
+/* accept_connection()
+ * Purpose: Take a new connection, if there is room for it
+ * Parameters: The server, and the listening socket
+ * Returns: none
+ */
+static void accept_connection(struct Server *server, int listener)
+{
+    int fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (fd < 0) {
+        return;
+    }
+    struct Connection *conn = calloc(1, sizeof(*conn));
+    if (conn == NULL || server->nconnections == MAX_CONNECTIONS) {
+        free(conn);
+        close(fd);
+        return;
+    }
+    conn->fd = fd;
+    pthread_mutex_lock(&server->lock);
+    server->connections[server->nconnections++] = conn;
+    pthread_mutex_unlock(&server->lock);
+}
+
+/* listen_on()
+ * Purpose: Make the server's socket, replacing a stale one at its path
+ * Parameters: The path
+ * Returns: The listening socket, or -1 with errno set
+ * Notes: A socket at the path that nothing answers is left from a
+ *        server that died; one that answers is a server still running,
+ *        and is left alone. The socket is made readable and writable by
+ *        its owner alone.
+ */
+static int listen_on(const char *path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        return -1;
+    }
+    mode_t mask = umask(077);
+    int failed = bind(sock, (struct sockaddr *)&addr, sizeof(addr));
+    struct stat st;
+    if (failed && errno == EADDRINUSE && lstat(path, &st) == 0 &&
+        S_ISSOCK(st.st_mode)) {
+        int probe = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (probe >= 0 && connect(probe, (struct sockaddr *)&addr,
+                                  sizeof(addr)) < 0 &&
+            errno == ECONNREFUSED) {
+            unlink(path);
+            failed = bind(sock, (struct sockaddr *)&addr, sizeof(addr));
+        } else {
+            errno = EADDRINUSE;
+        }
+        if (probe >= 0) {
+            close(probe);
+        }
+    }
+    umask(mask);
+    if (failed || listen(sock, SOMAXCONN) < 0) {
+        int saved = errno;
+        close(sock);
+        errno = saved;
+        return -1;
+    }
+    return sock;
+}
+
+/* start_workers()
+ * Purpose: Start the worker threads
+ * Parameters: The server, the threads, and how many to start
+ * Returns: How many started
+ */
+static unsigned start_workers(struct Server *server, pthread_t *threads,
+                              unsigned n)
+{
+    unsigned started = 0;
+    while (started < n &&
+           pthread_create(&threads[started], NULL, work, server) == 0) {
+        started++;
+    }
+    return started;
+}
+
+/* serve()
+ * Purpose: The main thread's loop: take connections and requests, and
+ *          give connections back to ppoll() as their jobs finish
+ * Parameters: The server, the listening socket, and the signal mask to
+ *             wait with
+ * Returns: When a signal stops the server
+ */
+static void serve(struct Server *server, int listener,
+                  const sigset_t *waitmask)
+{
+    static struct pollfd polls[MAX_CONNECTIONS + 2];
+    static unsigned which[MAX_CONNECTIONS];
+
+    while (stop_signal == 0) {
+        polls[0] = (struct pollfd){ listener, POLLIN, 0 };
+        polls[1] = (struct pollfd){ server->wake, POLLIN, 0 };
+        unsigned npolls = 2;
+        pthread_mutex_lock(&server->lock);
+        for (unsigned i = 0; i < server->nconnections; i++) {
+            if (!server->connections[i]->busy) {
+                which[npolls - 2] = i;
+                polls[npolls++] = (struct pollfd){
+                    server->connections[i]->fd, POLLIN, 0 };
+            }
+        }
+        pthread_mutex_unlock(&server->lock);
+
+        if (ppoll(polls, npolls, NULL, waitmask) < 0) {
+            continue;
+        }
+        if (polls[1].revents & POLLIN) {
+            uint64_t count;
+            ssize_t got = read(server->wake, &count, sizeof(count));
+            (void)got;
+        }
+        /* from the last, so closing one does not move those still to
+           be looked at */
+        for (unsigned p = npolls; p-- > 2;) {
+            if (polls[p].revents == 0) {
+                continue;
+            }
+            unsigned i = which[p - 2];
+            if (!(polls[p].revents & POLLIN) || !receive(server, i)) {
+                close_connection(server, i);
+            }
+        }
+        if (polls[0].revents & POLLIN) {
+            accept_connection(server, listener);
+        }
+    }
+}
+
+bool Serve40_run(const struct Serve40_config *config,
+                 struct Serve40_metrics *final)
+{
+    static struct Server server;
+    memset(&server, 0, sizeof(server));
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.ready, NULL);
+    server.started_us = now_us();
+    stop_signal = 0;
+
+    int listener = listen_on(config->path);
+    if (listener < 0) {
+        return false;
+    }
+    server.wake = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    assert(server.wake >= 0);
+
+    /* SIGINT and SIGTERM reach the main thread alone, inside ppoll() */
+    sigset_t stops, waitmask;
+    sigemptyset(&stops);
+    sigaddset(&stops, SIGINT);
+    sigaddset(&stops, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stops, &waitmask);
+    sigdelset(&waitmask, SIGINT);
+    sigdelset(&waitmask, SIGTERM);
+    struct sigaction action, old_int, old_term, old_pipe;
+    memset(&action, 0, sizeof(action));
+    sigemptyset(&action.sa_mask);
+    action.sa_handler = on_stop;
+    sigaction(SIGINT, &action, &old_int);
+    sigaction(SIGTERM, &action, &old_term);
+    action.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &action, &old_pipe);
+
+    unsigned workers = config->workers;
+    if (workers == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = online > 0 ? online : 1;
+    }
+    pthread_t *threads = malloc(workers * sizeof(*threads));
+    assert(threads != NULL);
+    server.workers = start_workers(&server, threads, workers);
+    assert(server.workers > 0);
+
+    serve(&server, listener, &waitmask);
+
+    /* finish what is queued, then let the workers go */
+    pthread_mutex_lock(&server.lock);
+    server.stopping = true;
+    pthread_cond_broadcast(&server.ready);
+    pthread_mutex_unlock(&server.lock);
+    for (unsigned t = 0; t < server.workers; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    free(threads);
+    close(listener);
+    unlink(config->path);
+    if (final != NULL) {
+        fill_metrics(&server, final);
+    }
+    while (server.nconnections > 0) {
+        close_connection(&server, server.nconnections - 1);
+    }
+    close(server.wake);
+
+    sigaction(SIGINT, &old_int, NULL);
+    sigaction(SIGTERM, &old_term, NULL);
+    sigaction(SIGPIPE, &old_pipe, NULL);
+    pthread_sigmask(SIG_UNBLOCK, &stops, NULL);
+    pthread_cond_destroy(&server.ready);
+    pthread_mutex_destroy(&server.lock);
+    return true;
+}
+
+int Serve40_connect(const char *path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock >= 0 && connect(sock, (struct sockaddr *)&addr,
+                             sizeof(addr)) < 0) {
+        int saved = errno;
+        close(sock);
+        errno = saved;
+        return -1;
+    }
+    return sock;
+}
+
+bool Serve40_call(int sock, const struct Serve40_request *request,
+                  const int *fds, unsigned nfds, struct Serve40_reply *reply,
+                  struct Serve40_metrics *metrics)
+{
+    assert(nfds <= 2);
+    union {
+        char bytes[CMSG_SPACE(2 * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct iovec out = { (void *)request, sizeof(*request) };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &out;
+    msg.msg_iovlen = 1;
+    if (nfds > 0) {
+        msg.msg_control = control.bytes;
+        msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+    }
+    ssize_t n;
+    while ((n = sendmsg(sock, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR) {
+    }
+    if (n != sizeof(*request)) {
+        return false;
+    }
+
+    struct Serve40_metrics scratch;
+    struct iovec in[2] = {
+        { reply, sizeof(*reply) },
+        { metrics != NULL ? metrics : &scratch, sizeof(scratch) }
+    };
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = in;
+    msg.msg_iovlen = 2;
+    while ((n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) < 0 &&
+           errno == EINTR) {
+    }
+    if (n < (ssize_t)sizeof(*reply) || reply->magic != SERVE40_MAGIC) {
+        errno = n < 0 ? errno : n == 0 ? ECONNRESET : EPROTO;
+        return false;
+    }
+    if (request->op == SERVE40_METRICS && reply->status == CODEC40_OK &&
+        n != sizeof(*reply) + sizeof(scratch)) {
+        errno = EPROTO;
+        return false;
+    }
+    return true;
+}
+
+int Serve40_buffer(const char *name, size_t len)
+{
+    int fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd >= 0 && (ftruncate(fd, len) < 0 ||
+                    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK) < 0)) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+void Serve40_print_metrics(FILE *out, const struct Serve40_metrics *metrics)
+{
+    fprintf(out, "{\"workers\":%u,\"connections\":%u,\"queue_depth\":%u,"
+            "\"queue_max\":%u,\"uptime_ms\":%llu,\"compress\":%llu,"
+            "\"decompress\":%llu,\"metrics\":%llu,\"failed\":%llu,"
+            "\"total_p50_us\":%llu,\"total_p99_us\":%llu,"
+            "\"total_max_us\":%llu,\"queue_p50_us\":%llu,"
+            "\"queue_p99_us\":%llu,\"queue_max_us\":%llu}\n",
+            metrics->workers, metrics->connections, metrics->queue_depth,
+            metrics->queue_max,
+            (unsigned long long)metrics->uptime_ms,
+            (unsigned long long)metrics->jobs[SERVE40_COMPRESS],
+            (unsigned long long)metrics->jobs[SERVE40_DECOMPRESS],
+            (unsigned long long)metrics->jobs[SERVE40_METRICS],
+            (unsigned long long)metrics->failed,
+            (unsigned long long)metrics->total_p50_us,
+            (unsigned long long)metrics->total_p99_us,
+            (unsigned long long)metrics->total_max_us,
+            (unsigned long long)metrics->queue_p50_us,
+            (unsigned long long)metrics->queue_p99_us,
+            (unsigned long long)metrics->queue_max_us);
+    fflush(out);
+}
@@ -0,0 +1,144 @@
+/*
+ *     serve40.h
+ *     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
+ *     Date: 10-26-20
+ *     arith
+ *
+ *     Purpose: Interface for serve40.c: a long-running codec server on a
+ *              Unix domain socket, and the calls a client makes to it.
+ *
+ *              Starting 40image for each image pays for exec, dynamic
+ *              linking and cold caches every time. The server pays for
+ *              them once: a pool of worker threads, each with its own
+ *              Codec40_T whose working arrays stay warm between jobs,
+ *              takes jobs from a queue that one thread fills from every
+ *              connection. A connection has one job at a time: its next
+ *              request is not read until the last one's reply is sent,
+ *              so a client waits for each reply, and runs several
+ *              connections to keep several workers busy.
+ *
+ *              The socket is SOCK_SEQPACKET, and a request or a reply is
+ *              one message. No image goes through the socket: a request
+ *              carries two file descriptors (SCM_RIGHTS), the input and
+ *              a buffer for the output, usually memfds the client keeps
+ *              and reuses. The server maps both and codes straight from
+ *              one into the other, so nothing is copied. It keeps the
+ *              mappings of each connection's last few buffers, so a
+ *              client that reuses its buffers has them mapped once.
+ *              Both must be sealed against shrinking (F_SEAL_SHRINK),
+ *              so that the client cannot cut a mapping short under the
+ *              server.
+ */
+
+#ifndef SERVE40_INCLUDED
+#define SERVE40_INCLUDED
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "codec40.h"
+
+/* first word of every request and reply */
+#define SERVE40_MAGIC 0x53303430u
+
+enum Serve40_op
+{
+    /* fds: rgb pixels as described by the request, and the output
+       buffer, which gets the compressed image */
+    SERVE40_COMPRESS,
+    /* fds: a compressed image of request.len bytes, and the output
+       buffer, which gets the pixels: packed rgb, one byte a channel */
+    SERVE40_DECOMPRESS,
+    /* no fds; the reply is followed by a struct Serve40_metrics */
+    SERVE40_METRICS,
+    SERVE40_OP_COUNT
+};
+
+/* request.flags */
+#define SERVE40_ENTROPY     1u
+#define SERVE40_PROGRESSIVE 2u
+
+struct Serve40_request
+{
+    uint32_t magic;
+    /* enum Serve40_op */
+    uint32_t op;
+    /* anything; the reply echoes it */
+    uint64_t id;
+    /* bytes of input, from the start of its fd */
+    uint64_t len;
+    /* compress: the pixels, as struct Codec40_image has them */
+    uint64_t stride;
+    uint32_t width, height, maxval;
+    /* compress: SERVE40_ flags, and the profile (enum Profile_id) */
+    uint32_t flags, profile;
+    uint32_t unused;
+};
+
+struct Serve40_reply
+{
+    uint32_t magic;
+    /* enum Codec40_status */
+    int32_t status;
+    uint64_t id;
+    /* bytes of output written to the buffer; with CODEC40_NO_SPACE, the
+       bytes it needed */
+    uint64_t len;
+    /* decompress: the size of the pixels */
+    uint32_t width, height;
+    /* microseconds the job waited in the queue, and was worked on */
+    uint64_t queue_us, service_us;
+};
+
+struct Serve40_metrics
+{
+    uint32_t workers, connections;
+    /* jobs waiting now, and the most there have been */
+    uint32_t queue_depth, queue_max;
+    uint64_t uptime_ms;
+    /* jobs done, by op, and how many of them failed */
+    uint64_t jobs[SERVE40_OP_COUNT];
+    uint64_t failed;
+    /* microseconds from a job's arrival to its reply, and of that the
+       time it waited in the queue: median, 99th percentile, most. The
+       percentiles are the top of a histogram bin, within 1/8. */
+    uint64_t total_p50_us, total_p99_us, total_max_us;
+    uint64_t queue_p50_us, queue_p99_us, queue_max_us;
+};
+
+struct Serve40_config
+{
+    /* where the socket is made; a stale socket there is replaced */
+    const char *path;
+    /* worker threads, 0 for one per processor */
+    unsigned workers;
+};
+
+/* The server. Runs until SIGINT or SIGTERM, then finishes the jobs it
+   has, removes the socket, and returns true; returns false, with errno
+   set, if the socket cannot be made. The metrics at the end are put in
+   *final if it is not NULL. */
+extern bool Serve40_run(const struct Serve40_config *config,
+                        struct Serve40_metrics *final);
+
+/* The client. Serve40_connect() returns the socket, or -1 with errno
+   set. Serve40_call() sends a request with nfds descriptors (0 or 2)
+   and waits for its reply, and for the metrics after a SERVE40_METRICS
+   reply if metrics is not NULL; it returns false, with errno set, if
+   the connection fails. */
+extern int Serve40_connect(const char *path);
+extern bool Serve40_call(int sock, const struct Serve40_request *request,
+                         const int *fds, unsigned nfds,
+                         struct Serve40_reply *reply,
+                         struct Serve40_metrics *metrics);
+
+/* a memfd of len bytes sealed against shrinking, for a client's
+   buffers; -1 with errno set on failure */
+extern int Serve40_buffer(const char *name, size_t len);
+
+/* prints metrics as one line of JSON */
+extern void Serve40_print_metrics(FILE *out,
+                                  const struct Serve40_metrics *metrics);
+
+#endif
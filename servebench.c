@@ -0,0 +1,475 @@
+/*
+ *     servebench.c
+ *     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
+ *     Date: 10-26-20
+ *     arith
+ *
+ *     Purpose: Load for the codec server (see serve40.h). Each of a
+ *              number of client threads has its own connection, its own
+ *              synthetic image and its own pair of buffers, and sends
+ *              its share of the requests one after another, timing each
+ *              from the call to the reply. Prints one JSON line with the
+ *              throughput and the latency percentiles over all clients,
+ *              then the server's own metrics. The first reply of every
+ *              client is checked against the library.
+ *
+ *              With -x, the same load is run by starting the given
+ *              40image for every request instead, with the input and
+ *              output as its stdin and stdout, which is what the server
+ *              saves.
+ *
+ *              Usage: servebench [-S socket] [-c clients] [-n requests]
+ *                                [-s WxH] [-d] [-e | -l] [-q profile]
+ *                                [-x 40image]
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "assert.h"
+#include "serve40.h"
+
+#define RESULT_FORMAT "{\"mode\":\"%s\",\"op\":\"%s\",\"clients\":%u," \
+                      "\"requests\":%zu,\"width\":%u,\"height\":%u," \
+                      "\"seconds\":%.3f,\"rps\":%.1f,\"mp_per_s\":%.2f," \
+                      "\"p50_us\":%.1f,\"p99_us\":%.1f,\"p999_us\":%.1f," \
+                      "\"max_us\":%.1f,\"checked\":%s}\n"
+
+/* how long to wait for the server to come up */
+#define CONNECT_SECONDS 2.0
+
+struct Config
+{
+    const char *path;
+    unsigned clients;
+    size_t requests;
+    unsigned width, height;
+    bool decompress;
+    struct Codec_options options;
+    /* spawn this 40image per request rather than call the server */
+    const char *exe;
+};
+
+struct Client
+{
+    const struct Config *config;
+    unsigned index;
+    /* this client's share of the requests, and their latencies */
+    size_t requests;
+    double *latency;
+    /* what the client sends, and what should come back */
+    unsigned char *input, *expected;
+    size_t input_len, expected_len;
+    bool checked, failed;
+};
+
+extern char **environ;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* make_tile()
+ * Purpose: Fill an image with smooth shading plus a little texture, as
+ *          latbench does, so that every client's image is different
+ * Parameters: The image, and which client it is for
+ * Returns: none
+ */
+static void make_tile(struct Codec40_image *tile, unsigned seed)
+{
+    double phase = seed * 0.37;
+    for (unsigned row = 0; row < tile->height; row++) {
+        unsigned char *p = tile->pixels + row * tile->stride;
+        for (unsigned col = 0; col < tile->width; col++) {
+            double x = (double)col / tile->width;
+            double y = (double)row / tile->height;
+            double texture = 12 * sin(col * 0.9 + row * 0.4 + phase);
+            p[3 * col] = 128 + 100 * sin(3 * x + phase) + texture;
+            p[3 * col + 1] = 128 + 90 * cos(2 * y - phase) + texture;
+            p[3 * col + 2] = 128 + 80 * sin(2 * (x + y) + phase);
+        }
+    }
+}
+
+/* prepare()
+ * Purpose: Make a client's image, and code it with the library to get
+ *          what the server or 40image should give back
+ * Parameters: The client
+ * Returns: none
+ * Notes: In spawn mode the input to compress is a ppm, and the output
+ *        of a decompress is one
+ */
+static void prepare(struct Client *client)
+{
+    const struct Config *config = client->config;
+    struct Codec40_image tile = { config->width, config->height, 255,
+                                  (size_t)config->width * 3, NULL };
+    char ppm[64];
+    int ppm_len = 0;
+    if (config->exe != NULL) {
+        ppm_len = snprintf(ppm, sizeof(ppm), "P6\n%u %u\n255\n",
+                           tile.width, tile.height);
+    }
+    size_t pixels_len = tile.stride * tile.height;
+    unsigned char *pixels = malloc(ppm_len + pixels_len);
+    assert(pixels != NULL);
+    memcpy(pixels, ppm, ppm_len);
+    tile.pixels = pixels + ppm_len;
+    make_tile(&tile, client->index);
+
+    unsigned char *coded;
+    size_t coded_len;
+    enum Codec40_status status =
+        Codec40_encode_alloc(&tile, &config->options, &coded, &coded_len);
+    assert(status == CODEC40_OK);
+    if (!config->decompress) {
+        client->input = pixels;
+        client->input_len = ppm_len + pixels_len;
+        client->expected = coded;
+        client->expected_len = coded_len;
+        return;
+    }
+
+    unsigned width = tile.width & ~1u, height = tile.height & ~1u;
+    if (config->exe != NULL) {
+        ppm_len = snprintf(ppm, sizeof(ppm), "P6\n%u %u\n255\n", width,
+                           height);
+    }
+    struct Codec40_image decoded = { width, height, 255, (size_t)width * 3,
+                                     NULL };
+    client->expected_len = ppm_len + decoded.stride * height;
+    client->expected = malloc(client->expected_len);
+    assert(client->expected != NULL);
+    memcpy(client->expected, ppm, ppm_len);
+    decoded.pixels = client->expected + ppm_len;
+    status = Codec40_decode(coded, coded_len, &decoded);
+    assert(status == CODEC40_OK);
+    client->input = coded;
+    client->input_len = coded_len;
+    free(pixels);
+}
+
+/* matches()
+ * Purpose: Check what came back in an output buffer
+ * Parameters: The client, the buffer, and how many bytes came back
+ * Returns: true if they are what the library gave
+ */
+static bool matches(const struct Client *client, int fd, size_t len)
+{
+    if (len != client->expected_len) {
+        return false;
+    }
+    unsigned char *got = malloc(len);
+    assert(got != NULL);
+    bool same = pread(fd, got, len, 0) == (ssize_t)len &&
+                memcmp(got, client->expected, len) == 0;
+    free(got);
+    return same;
+}
+
+/* connect_retry()
+ * Purpose: Connect to the server, waiting a little for it to start
+ * Parameters: The socket's path
+ * Returns: The socket, or -1
+ */
+static int connect_retry(const char *path)
+{
+    double give_up = now() + CONNECT_SECONDS;
+    int sock;
+    while ((sock = Serve40_connect(path)) < 0 &&
+           (errno == ENOENT || errno == ECONNREFUSED) && now() < give_up) {
+        nanosleep(&(struct timespec){ 0, 10 * 1000 * 1000 }, NULL);
+    }
+    return sock;
+}
+
+/* call_server()
+ * Purpose: A client thread in daemon mode: send its requests to the
+ *          server over its own connection, reusing one pair of buffers
+ * Parameters: The client
+ * Returns: NULL
+ */
+static void *call_server(void *arg)
+{
+    struct Client *client = arg;
+    const struct Config *config = client->config;
+    const struct Profile *profile = config->options.profile != NULL
+                                    ? config->options.profile
+                                    : Profile_default();
+    int sock = connect_retry(config->path);
+    size_t out_len = config->decompress
+                     ? client->expected_len
+                     : Codec40_encode_bound(config->width, config->height,
+                                            &config->options);
+    int fds[2] = { Serve40_buffer("servebench-in", client->input_len),
+                   Serve40_buffer("servebench-out", out_len) };
+    if (sock < 0 || fds[0] < 0 || fds[1] < 0 ||
+        pwrite(fds[0], client->input, client->input_len, 0) !=
+        (ssize_t)client->input_len) {
+        perror("servebench");
+        client->failed = true;
+        return NULL;
+    }
+
+    struct Serve40_request request;
+    memset(&request, 0, sizeof(request));
+    request.magic = SERVE40_MAGIC;
+    request.op = config->decompress ? SERVE40_DECOMPRESS : SERVE40_COMPRESS;
+    request.len = client->input_len;
+    request.stride = (size_t)config->width * 3;
+    request.width = config->width;
+    request.height = config->height;
+    request.maxval = 255;
+    request.flags = (config->options.entropy ? SERVE40_ENTROPY : 0) |
+                    (config->options.progressive ? SERVE40_PROGRESSIVE : 0);
+    request.profile = profile->id;
+
+    for (size_t r = 0; r < client->requests; r++) {
+        struct Serve40_reply reply;
+        request.id = r;
+        double start = now();
+        bool sent = Serve40_call(sock, &request, fds, 2, &reply, NULL);
+        client->latency[r] = now() - start;
+        if (!sent || reply.status != CODEC40_OK || reply.id != r) {
+            fprintf(stderr, "servebench: request %zu: %s\n", r,
+                    sent ? Codec40_strerror(reply.status)
+                         : strerror(errno));
+            client->failed = true;
+            break;
+        }
+        if (r == 0) {
+            client->checked = matches(client, fds[1], reply.len);
+        }
+    }
+    close(fds[0]);
+    close(fds[1]);
+    close(sock);
+    return NULL;
+}
+
+/* spawn_40image()
+ * Purpose: A client thread in spawn mode: run 40image once a request,
+ *          on a memfd as stdin and another as stdout
+ * Parameters: The client
+ * Returns: NULL
+ */
+static void *spawn_40image(void *arg)
+{
+    struct Client *client = arg;
+    const struct Config *config = client->config;
+    const char *argv[8];
+    int argc = 0;
+    argv[argc++] = config->exe;
+    argv[argc++] = config->decompress ? "-d" : "-c";
+    if (!config->decompress && config->options.entropy) {
+        argv[argc++] = "-e";
+    }
+    if (!config->decompress && config->options.progressive) {
+        argv[argc++] = "-l";
+    }
+    if (!config->decompress && config->options.profile != NULL) {
+        argv[argc++] = "-q";
+        argv[argc++] = config->options.profile->name;
+    }
+    argv[argc] = NULL;
+
+    int in = memfd_create("servebench-in", MFD_CLOEXEC);
+    int out = memfd_create("servebench-out", MFD_CLOEXEC);
+    if (in < 0 || out < 0 || pwrite(in, client->input, client->input_len,
+                                    0) != (ssize_t)client->input_len) {
+        perror("servebench");
+        client->failed = true;
+        return NULL;
+    }
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, in, STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, out, STDOUT_FILENO);
+
+    for (size_t r = 0; r < client->requests; r++) {
+        double start = now();
+        lseek(in, 0, SEEK_SET);
+        lseek(out, 0, SEEK_SET);
+        int failed = ftruncate(out, 0);
+        pid_t pid;
+        int wstatus = 0;
+        failed = failed || posix_spawn(&pid, config->exe, &actions, NULL,
+                                       (char **)argv, environ);
+        failed = failed || waitpid(pid, &wstatus, 0) != pid ||
+                 !WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0;
+        client->latency[r] = now() - start;
+        if (failed) {
+            fprintf(stderr, "servebench: %s failed on request %zu\n",
+                    config->exe, r);
+            client->failed = true;
+            break;
+        }
+        if (r == 0) {
+            client->checked = matches(client, out, lseek(out, 0, SEEK_END));
+        }
+    }
+    posix_spawn_file_actions_destroy(&actions);
+    close(in);
+    close(out);
+    return NULL;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* report()
+ * Purpose: Print the throughput and latency percentiles of a run
+ * Parameters: The configuration, the latencies in seconds (which are
+ *             sorted), how long the run took, and whether every client's
+ *             output checked
+ * Returns: none
+ */
+static void report(const struct Config *config, double *latency, size_t n,
+                   double seconds, bool checked)
+{
+    qsort(latency, n, sizeof(double), compare_doubles);
+    double pixels = (double)config->width * config->height * n;
+    printf(RESULT_FORMAT, config->exe != NULL ? "spawn" : "daemon",
+           config->decompress ? "decompress" : "compress", config->clients,
+           n, config->width, config->height, seconds, n / seconds,
+           pixels / seconds / 1e6, latency[n / 2] * 1e6,
+           latency[(n * 99) / 100] * 1e6, latency[(n * 999) / 1000] * 1e6,
+           latency[n - 1] * 1e6, checked ? "true" : "false");
+    fflush(stdout);
+}
+
+/* print_server_metrics()
+ * Purpose: Ask the server for its metrics and print them
+ * Parameters: The configuration
+ * Returns: none
+ */
+static void print_server_metrics(const struct Config *config)
+{
+    int sock = Serve40_connect(config->path);
+    struct Serve40_request request;
+    memset(&request, 0, sizeof(request));
+    request.magic = SERVE40_MAGIC;
+    request.op = SERVE40_METRICS;
+    struct Serve40_reply reply;
+    struct Serve40_metrics metrics;
+    if (sock < 0 ||
+        !Serve40_call(sock, &request, NULL, 0, &reply, &metrics)) {
+        perror("servebench: metrics");
+    } else {
+        Serve40_print_metrics(stdout, &metrics);
+    }
+    if (sock >= 0) {
+        close(sock);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    struct Config config = { "40serve.sock", 4, 2000, 256, 256, false,
+                             CODEC_OPTIONS_DEFAULT, NULL };
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-S") == 0 && i + 1 < argc) {
+            config.path = argv[++i];
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            config.clients = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            config.requests = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%ux%u", &config.width,
+                       &config.height) != 2) {
+                config.width = 0;
+            }
+        } else if (strcmp(argv[i], "-d") == 0) {
+            config.decompress = true;
+        } else if (strcmp(argv[i], "-e") == 0) {
+            config.options.entropy = true;
+        } else if (strcmp(argv[i], "-l") == 0) {
+            config.options.progressive = true;
+        } else if (strcmp(argv[i], "-q") == 0 && i + 1 < argc) {
+            config.options.profile = Profile_named(argv[++i]);
+            if (config.options.profile == NULL) {
+                fprintf(stderr, "%s: unknown profile '%s'\n", argv[0],
+                        argv[i]);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "-x") == 0 && i + 1 < argc) {
+            config.exe = argv[++i];
+        } else {
+            config.clients = 0;
+            break;
+        }
+    }
+    if (config.clients == 0 || config.requests < config.clients ||
+        config.width < 2 || config.height < 2 ||
+        config.width > CODEC40_MAX_SIDE || config.height > CODEC40_MAX_SIDE ||
+        (config.options.entropy && config.options.progressive)) {
+        fprintf(stderr, "Usage: %s [-S socket] [-c clients] [-n requests] "
+                "[-s WxH] [-d] [-e | -l] [-q profile] [-x 40image]\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    size_t n = config.requests;
+    struct Client *clients = calloc(config.clients, sizeof(*clients));
+    pthread_t *threads = calloc(config.clients, sizeof(*threads));
+    double *latency = malloc(n * sizeof(double));
+    assert(clients != NULL && threads != NULL && latency != NULL);
+    size_t given = 0;
+    for (unsigned c = 0; c < config.clients; c++) {
+        struct Client *client = &clients[c];
+        client->config = &config;
+        client->index = c;
+        client->requests = n / config.clients + (c < n % config.clients);
+        client->latency = latency + given;
+        given += client->requests;
+        prepare(client);
+    }
+
+    double start = now();
+    for (unsigned c = 0; c < config.clients; c++) {
+        int failed = pthread_create(&threads[c], NULL,
+                                    config.exe != NULL ? spawn_40image
+                                                       : call_server,
+                                    &clients[c]);
+        assert(failed == 0);
+    }
+    bool failed = false, checked = true;
+    for (unsigned c = 0; c < config.clients; c++) {
+        pthread_join(threads[c], NULL);
+        failed = failed || clients[c].failed;
+        checked = checked && clients[c].checked;
+    }
+    double seconds = now() - start;
+
+    if (!failed) {
+        report(&config, latency, n, seconds, checked);
+        if (config.exe == NULL) {
+            print_server_metrics(&config);
+        }
+    }
+    for (unsigned c = 0; c < config.clients; c++) {
+        free(clients[c].input);
+        free(clients[c].expected);
+    }
+    free(clients);
+    free(threads);
+    free(latency);
+    return failed || !checked ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,138 @@
+/*
+ *     spsc.c
+ *     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
+ *     Date: 10-26-20
+ *     arith
+ *
+ *     Purpose: A single-producer, single-consumer ring of pointers
+ *              (see spsc.h). The producer owns tail and the consumer
+ *              owns head; each publishes its index with a release store
+ *              and reads the other's with an acquire load, so a slot's
+ *              contents are visible before the index that hands it over.
+ */
+
+#include <stdlib.h>
+#include <sched.h>
+#include <time.h>
+#include "assert.h"
+#include "spsc.h"
+
+/* keeps the two indices on different cache lines, so that the producer
+   and consumer do not keep stealing one line from each other */
+#define CACHE_LINE 64
+
+/* waits spent yielding before a waiting side starts to sleep */
+#define YIELDS 64
+
+struct Spsc_T
+{
+    void **slots;
+    size_t mask;
+    /* written only by the consumer */
+    size_t head;
+    size_t pop_waits;
+    char pad[CACHE_LINE];
+    /* written only by the producer */
+    size_t tail;
+    size_t push_waits;
+};
+
+/* Spsc_new()
+ * Purpose: Make an empty ring
+ * Parameters: How many items it holds, at least 1
+ * Returns: The ring; free it with Spsc_free()
+ */
+Spsc_T Spsc_new(unsigned capacity)
+{
+    assert(capacity > 0);
+    size_t size = 1;
+    while (size < capacity) {
+        size *= 2;
+    }
+    Spsc_T ring = calloc(1, sizeof(*ring));
+    assert(ring != NULL);
+    ring->slots = calloc(size, sizeof(void *));
+    assert(ring->slots != NULL);
+    ring->mask = size - 1;
+    return ring;
+}
+
+/* Spsc_free()
+ * Purpose: Free a ring, but not the items left in it
+ * Parameters: A pointer to the ring, which is set to NULL
+ * Returns: none
+ */
+void Spsc_free(Spsc_T *ring)
+{
+    assert(ring != NULL && *ring != NULL);
+    free((*ring)->slots);
+    free(*ring);
+    *ring = NULL;
+}
+
+/* backoff()
+ * Purpose: Wait a little for the other side of a ring
+ * Parameters: How many times this side has waited so far for the same
+ *             item
+ * Returns: none
+ * Notes: Yields at first, which is enough when both sides are busy, then
+ *        sleeps, so that a side blocked on slow I/O does not hold a CPU
+ */
+static void backoff(unsigned *waits)
+{
+    if (*waits < YIELDS) {
+        sched_yield();
+    } else {
+        struct timespec pause = { 0, 50 * 1000 };
+        nanosleep(&pause, NULL);
+    }
+    (*waits)++;
+}
+
+/* Spsc_push()
+ * Purpose: Add an item to the ring, waiting while it is full
+ * Parameters: The ring, and the item
+ * Returns: none
+ * Notes: Only the producer thread may call this
+ */
+void Spsc_push(Spsc_T ring, void *item)
+{
+    size_t tail = ring->tail;
+    unsigned waits = 0;
+    while (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) >
+           ring->mask) {
+        backoff(&waits);
+    }
+    ring->push_waits += waits > 0;
+    ring->slots[tail & ring->mask] = item;
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/* Spsc_pop()
+ * Purpose: Take the oldest item from the ring, waiting while it is empty
+ * Parameters: The ring
+ * Returns: The item
+ * Notes: Only the consumer thread may call this
+ */
+void *Spsc_pop(Spsc_T ring)
+{
+    size_t head = ring->head;
+    unsigned waits = 0;
+    while (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == head) {
+        backoff(&waits);
+    }
+    ring->pop_waits += waits > 0;
+    void *item = ring->slots[head & ring->mask];
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return item;
+}
+
+size_t Spsc_push_waits(Spsc_T ring)
+{
+    return ring->push_waits;
+}
+
+size_t Spsc_pop_waits(Spsc_T ring)
+{
+    return ring->pop_waits;
+}
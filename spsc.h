@@ -0,0 +1,35 @@
+/*
+ *     spsc.h
+ *     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
+ *     Date: 10-26-20
+ *     arith
+ *
+ *     Purpose: Interface for spsc.c: a bounded ring of pointers between
+ *              exactly one producer thread and one consumer thread. It
+ *              takes no locks: each side owns one index and only reads
+ *              the other's. A push to a full ring or a pop from an
+ *              empty one waits until the other side catches up.
+ */
+
+#ifndef SPSC_INCLUDED
+#define SPSC_INCLUDED
+
+#include <stddef.h>
+
+typedef struct Spsc_T *Spsc_T;
+
+/* the capacity is rounded up to a power of two */
+extern Spsc_T Spsc_new(unsigned capacity);
+extern void Spsc_free(Spsc_T *ring);
+
+/* the producer's side */
+extern void Spsc_push(Spsc_T ring, void *item);
+/* the consumer's side */
+extern void *Spsc_pop(Spsc_T ring);
+
+/* how many times each side found the ring full or empty and had to
+   wait; only meaningful once both sides are done */
+extern size_t Spsc_push_waits(Spsc_T ring);
+extern size_t Spsc_pop_waits(Spsc_T ring);
+
+#endif
@@ -0,0 +1,324 @@
+/*
+ *     stats40.c
+ *     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
+ *     Date: 10-26-20
+ *     arith
+ *
+ *     Purpose: Statistics of a compressed image from its codewords (see
+ *              stats40.h).
+ *
+ *              The scan is one pass over the words which takes each
+ *              field out with a shift and a mask and adds one to its
+ *              bin, six loads and stores a word. The shifts and masks
+ *              are held in locals, so that they stay in registers. This
+ *              was measured against first pulling each field out of a
+ *              chunk of words into an array of its own, which the
+ *              compiler does in vector registers, and against keeping
+ *              several copies of each histogram so that runs of alike
+ *              blocks do not add to one bin back to back: both were
+ *              slower, since the adds are the cost and the processor
+ *              already overlaps them. A plain payload is scanned where
+ *              it lies, big-endian; an entropy coded or progressive one
+ *              is decoded to words first.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "assert.h"
+#include "arith40.h"
+#include "stats40.h"
+#include "entropy.h"
+#include "progressive40.h"
+#include "pages40.h"
+#include "instrument.h"
+
+/* every field of every profile must fit in the histograms */
+#define STATS40_FITS(name, a_bits, bcd_bits, chroma_bits,              \
+                     bcd_scale, bcd_max)                               \
+    typedef char stats40_##name##_fits                                 \
+        [(a_bits) <= STATS40_MAX_BITS && (bcd_bits) <= STATS40_MAX_BITS \
+         && (chroma_bits) <= STATS40_MAX_BITS ? 1 : -1];
+PROFILE_TABLE(STATS40_FITS)
+#undef STATS40_FITS
+
+/* the histograms the scan fills in, by FIELD_; no image has 2^32
+   blocks */
+struct Counts
+{
+    uint32_t field[PROFILE_NFIELDS][STATS40_MAX_LEVELS];
+    size_t flat;
+};
+
+/* count_words()
+ * Purpose: Count the fields of some codewords
+ * Parameters: The words, as big-endian bytes or as host words, and
+ *             which they are, how many there are, their profile, and the
+ *             counts to add to
+ * Returns: none
+ * Notes: Inlined into each of the two callers below, so that big_endian
+ *        is a constant
+ */
+static inline __attribute__((always_inline))
+void count_words(const void *words, bool big_endian, size_t n,
+                 const struct Profile *profile, struct Counts *counts)
+{
+    const unsigned a_lsb = profile->lsb[FIELD_A];
+    const unsigned b_lsb = profile->lsb[FIELD_B];
+    const unsigned c_lsb = profile->lsb[FIELD_C];
+    const unsigned d_lsb = profile->lsb[FIELD_D];
+    const unsigned pb_lsb = profile->lsb[FIELD_PB];
+    const unsigned pr_lsb = profile->lsb[FIELD_PR];
+    const uint32_t a_mask = ((uint32_t)1 << profile->a_bits) - 1;
+    const uint32_t bcd_mask = ((uint32_t)1 << profile->bcd_bits) - 1;
+    const uint32_t chroma_mask = ((uint32_t)1 << profile->chroma_bits) - 1;
+    const uint32_t bcd = (((uint32_t)1 << 3 * profile->bcd_bits) - 1)
+                         << d_lsb;
+    uint32_t (*field)[STATS40_MAX_LEVELS] = counts->field;
+    size_t flat = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        uint32_t word;
+        if (big_endian) {
+            const unsigned char *bytes = (const unsigned char *)words + 4 * i;
+            word = (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 |
+                   (uint32_t)bytes[2] << 8 | bytes[3];
+        } else {
+            word = ((const uint32_t *)words)[i];
+        }
+        field[FIELD_A][word >> a_lsb & a_mask]++;
+        field[FIELD_B][word >> b_lsb & bcd_mask]++;
+        field[FIELD_C][word >> c_lsb & bcd_mask]++;
+        field[FIELD_D][word >> d_lsb & bcd_mask]++;
+        field[FIELD_PB][word >> pb_lsb & chroma_mask]++;
+        field[FIELD_PR][word >> pr_lsb & chroma_mask]++;
+        flat += (word & bcd) == 0;
+    }
+    counts->flat += flat;
+}
+
+/* count_payload()
+ * Purpose: Count the fields of a plain payload
+ * Parameters: The payload, its number of words, their profile, and the
+ *             counts to add to
+ * Returns: none
+ */
+static void count_payload(const unsigned char *payload, size_t nwords,
+                          const struct Profile *profile,
+                          struct Counts *counts)
+{
+    count_words(payload, true, nwords, profile, counts);
+}
+
+/* count_flat()
+ * Purpose: Count the fields of host-order codewords
+ * Parameters: The words and how many, their profile, and the counts to
+ *             add to
+ * Returns: none
+ */
+static void count_flat(const uint32_t *words, size_t nwords,
+                       const struct Profile *profile, struct Counts *counts)
+{
+    count_words(words, false, nwords, profile, counts);
+}
+
+/* count_entropy()
+ * Purpose: Count the fields of an entropy coded payload
+ * Parameters: The payload and its length, the image's width and height
+ *             in blocks, its profile, and the counts to add to
+ * Returns: CODEC40_OK, CODEC40_CORRUPT if the payload cannot be decoded,
+ *          or CODEC40_NO_MEMORY
+ */
+static enum Codec40_status count_entropy(const unsigned char *payload,
+                                         size_t len, unsigned width,
+                                         unsigned height,
+                                         const struct Profile *profile,
+                                         struct Counts *counts)
+{
+    size_t nwords = (size_t)width * height;
+    size_t scratch_bytes = Entropy_scratch_bytes(width, height);
+    uint32_t *words = Pages40_alloc(nwords * sizeof(uint32_t));
+    void *scratch = Pages40_alloc(scratch_bytes);
+    enum Codec40_status status = CODEC40_NO_MEMORY;
+    if (words != NULL && scratch != NULL) {
+        STAGE_BEGIN(decode_mark);
+        bool ok = Entropy_decode(payload, len, words, width, height,
+                                 profile, scratch);
+        STAGE_END(decode_mark, "entropy_decode", nwords);
+        status = ok ? CODEC40_OK : CODEC40_CORRUPT;
+    }
+    if (status == CODEC40_OK) {
+        STAGE_BEGIN(mark);
+        count_flat(words, nwords, profile, counts);
+        STAGE_END(mark, "scan", nwords);
+    }
+    Pages40_free(scratch, scratch_bytes);
+    Pages40_free(words, nwords * sizeof(uint32_t));
+    return status;
+}
+
+/* count_progressive()
+ * Purpose: Count the fields of a progressive payload
+ * Parameters: The payload and its length, the image's width and height
+ *             in blocks, its profile, and the counts to add to
+ * Returns: CODEC40_OK, CODEC40_TRUNCATED or CODEC40_CORRUPT if the
+ *          payload is short or long, or CODEC40_NO_MEMORY
+ */
+static enum Codec40_status count_progressive(const unsigned char *payload,
+                                             size_t len, unsigned width,
+                                             unsigned height,
+                                             const struct Profile *profile,
+                                             struct Counts *counts)
+{
+    size_t whole = Progressive40_bytes(width, height, profile);
+    if (len != whole) {
+        return len < whole ? CODEC40_TRUNCATED : CODEC40_CORRUPT;
+    }
+    size_t nwords = (size_t)width * height;
+    uint32_t *words = Pages40_alloc(nwords * sizeof(uint32_t));
+    if (words == NULL) {
+        return CODEC40_NO_MEMORY;
+    }
+    Progressive40_decode(payload, len, words, width, height, profile);
+    STAGE_BEGIN(mark);
+    count_flat(words, nwords, profile, counts);
+    STAGE_END(mark, "scan", nwords);
+    Pages40_free(words, nwords * sizeof(uint32_t));
+    return CODEC40_OK;
+}
+
+/* moments()
+ * Purpose: Find the mean and variance of a quantized field
+ * Parameters: Its histogram, the value of each level, the number of
+ *             levels and of samples, and where to put the mean and the
+ *             variance
+ * Returns: none
+ */
+static void moments(const size_t *histogram, const double *value,
+                    unsigned levels, size_t samples, double *mean,
+                    double *variance)
+{
+    double sum = 0, squares = 0;
+    for (unsigned i = 0; i < levels; i++) {
+        sum += histogram[i] * value[i];
+        squares += histogram[i] * value[i] * value[i];
+    }
+    *mean = sum / samples;
+    *variance = squares / samples - *mean * *mean;
+    if (*variance < 0) {
+        *variance = 0;
+    }
+}
+
+/* summarize()
+ * Purpose: Work out the statistics from the counts
+ * Parameters: The counts, and the statistics, whose size and profile
+ *             are filled in
+ * Returns: none
+ * Notes: b, c and d are two's complement, so level i of them is i, or
+ *        i - levels in the top half
+ */
+static void summarize(const struct Counts *counts, struct Stats40 *stats)
+{
+    const struct Profile *profile = stats->profile;
+    double luma_value[STATS40_MAX_LEVELS], bcd_value[STATS40_MAX_LEVELS];
+    unsigned bcd_levels = 1u << profile->bcd_bits;
+
+    stats->luma_levels = 1u << profile->a_bits;
+    stats->chroma_levels = 1u << profile->chroma_bits;
+    for (unsigned i = 0; i < stats->luma_levels; i++) {
+        luma_value[i] = i / (double)(stats->luma_levels - 1);
+    }
+    for (unsigned i = 0; i < bcd_levels; i++) {
+        int level = i < bcd_levels / 2 ? (int)i : (int)i - (int)bcd_levels;
+        bcd_value[i] = level / profile->bcd_scale;
+    }
+    for (unsigned i = 0; i < stats->chroma_levels; i++) {
+        stats->chroma_value[i] = profile->chroma_bits == 4
+            ? Arith40_chroma_of_index(i)
+            : i / (double)(stats->chroma_levels - 2) - 0.5;
+    }
+    for (unsigned i = 0; i < STATS40_MAX_LEVELS; i++) {
+        stats->luma[i] = counts->field[FIELD_A][i];
+        stats->pb[i] = counts->field[FIELD_PB][i];
+        stats->pr[i] = counts->field[FIELD_PR][i];
+    }
+    stats->flat = counts->flat;
+
+    size_t n = stats->blocks;
+    moments(stats->luma, luma_value, stats->luma_levels, n,
+            &stats->luma_mean, &stats->block_variance);
+    moments(stats->pb, stats->chroma_value, stats->chroma_levels, n,
+            &stats->pb_mean, &stats->pb_variance);
+    moments(stats->pr, stats->chroma_value, stats->chroma_levels, n,
+            &stats->pr_mean, &stats->pr_variance);
+
+    /* the pixels' spread about their block's mean */
+    double within = 0;
+    for (int f = FIELD_B; f <= FIELD_D; f++) {
+        for (unsigned i = 0; i < bcd_levels; i++) {
+            within += counts->field[f][i] * bcd_value[i] * bcd_value[i];
+        }
+    }
+    stats->luma_variance = stats->block_variance + within / n;
+
+    double y = stats->luma_mean, pb = stats->pb_mean, pr = stats->pr_mean;
+    stats->rgb_mean[0] = y + 1.402 * pr;
+    stats->rgb_mean[1] = y - 0.344136 * pb - 0.714136 * pr;
+    stats->rgb_mean[2] = y + 1.772 * pb;
+}
+
+/* Stats40_scan()
+ * Purpose: Work out the statistics of a compressed image
+ * Parameters: The compressed image and its length, and the statistics
+ *             to fill in
+ * Returns: CODEC40_OK, or why the image cannot be read
+ * Notes: Never decompresses the image; an entropy coded one is decoded
+ *        to its codewords, which is most of the time it takes, and a
+ *        progressive one is put back together into them
+ */
+enum Codec40_status Stats40_scan(const unsigned char *in, size_t len,
+                                 struct Stats40 *stats)
+{
+    if (in == NULL || stats == NULL) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+    struct Codec40_header header;
+    enum Codec40_status status = Codec40_read_header(in, len, &header);
+    if (status != CODEC40_OK) {
+        return status;
+    }
+    unsigned width = header.width / 2, height = header.height / 2;
+    size_t nwords = (size_t)width * height;
+    const unsigned char *payload = in + header.size;
+    size_t payload_len = len - header.size;
+
+    struct Counts *counts = calloc(1, sizeof(*counts));
+    if (counts == NULL) {
+        return CODEC40_NO_MEMORY;
+    }
+    if (header.options.entropy) {
+        status = count_entropy(payload, payload_len, width, height,
+                               header.options.profile, counts);
+    } else if (header.options.progressive) {
+        status = count_progressive(payload, payload_len, width, height,
+                                   header.options.profile, counts);
+    } else if (payload_len != nwords * sizeof(uint32_t)) {
+        status = payload_len < nwords * sizeof(uint32_t)
+                 ? CODEC40_TRUNCATED : CODEC40_CORRUPT;
+    } else {
+        STAGE_BEGIN(mark);
+        count_payload(payload, nwords, header.options.profile, counts);
+        STAGE_END(mark, "scan", nwords);
+    }
+    if (status == CODEC40_OK) {
+        stats->width = header.width;
+        stats->height = header.height;
+        stats->blocks = nwords;
+        stats->profile = header.options.profile;
+        summarize(counts, stats);
+    }
+    free(counts);
+    return status;
+}
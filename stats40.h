@@ -0,0 +1,61 @@
+/*
+ *     stats40.h
+ *     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
+ *     Date: 10-26-20
+ *     arith
+ *
+ *     Purpose: Interface for stats40.c: brightness and color statistics
+ *              of a compressed image, read from its codewords without
+ *              decompressing it.
+ *
+ *              The a of a codeword is the mean luma of its 2x2 block,
+ *              and pb and pr are the block's mean chroma, so histograms
+ *              of those fields are histograms of the image's blocks. The
+ *              luma of the block's four pixels is a +- b +- c +- d, so
+ *              b^2 + c^2 + d^2 is their variance about a, and the luma
+ *              variance of the whole image is the variance of a plus the
+ *              mean of that. Every figure below is worked out from the
+ *              histograms of the six fields, which is all the scan over
+ *              the codewords collects.
+ */
+
+#ifndef STATS40_INCLUDED
+#define STATS40_INCLUDED
+
+#include <stddef.h>
+#include "codec40.h"
+
+/* widest field the histograms have room for */
+#define STATS40_MAX_BITS 10
+#define STATS40_MAX_LEVELS (1 << STATS40_MAX_BITS)
+
+struct Stats40
+{
+    /* of the compressed image: pixels, blocks, and its profile */
+    unsigned width, height;
+    size_t blocks;
+    const struct Profile *profile;
+
+    /* blocks by quantized value: luma[i] for a of i / (luma_levels - 1),
+       and pb[i] and pr[i] for the chroma chroma_value[i] */
+    unsigned luma_levels, chroma_levels;
+    size_t luma[STATS40_MAX_LEVELS];
+    size_t pb[STATS40_MAX_LEVELS], pr[STATS40_MAX_LEVELS];
+    double chroma_value[STATS40_MAX_LEVELS];
+
+    /* blocks with b, c and d all 0, whose four pixels are the same */
+    size_t flat;
+
+    /* luma, 0 to 1: the mean, the variance of the pixels, and the
+       variance of the blocks' means */
+    double luma_mean, luma_variance, block_variance;
+    /* chroma, -0.5 to 0.5: means and variances over the blocks */
+    double pb_mean, pb_variance, pr_mean, pr_variance;
+    /* the mean red, green and blue, 0 to 1, from the means above */
+    double rgb_mean[3];
+};
+
+extern enum Codec40_status Stats40_scan(const unsigned char *in, size_t len,
+                                        struct Stats40 *stats);
+
+#endif
@@ -0,0 +1,294 @@
+#!/bin/sh
+#
+#     check.sh
+#     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
+#     Date: 10-26-20
+#     arith
+#
+#     Purpose: Round-trip tests for 40image (make check). Generates an
+#              odd-sized photo, a 16-bit image and a flat document,
+#              compresses each with every profile, with -e and with -l,
+#              and compares the results to the files in tests/expected.
+#              The same files must come out with -p, with both
+#              ARITH40_LAYOUT values and with all three ARITH40_ORDER
+#              values, and each must decompress to the same image
+#              whichever of those is used.
+#
+#              Then each transform (see transform40.h), with and without
+#              a crop, is checked on the plain, -e, -l and luma9 files:
+#              decompressing the transformed file must give the
+#              transformed pixels of the decompressed original, and four
+#              quarter turns must give back the original file.
+#
+#              Last, damaged files (cut in half, and -e files whose
+#              payload is zeroed after the tables) must make every way
+#              of reading them fail with a message and exit status 1,
+#              within a time limit, rather than abort or hang, and -u
+#              must refuse, with a message, to patch an -e or -l file or
+#              one of another size.
+#
+#              With -w, the expected files are written instead, for
+#              when the format is meant to change.
+#
+#     Usage: tests/check.sh [-w] [40image]
+#
+
+write=false
+if [ "$1" = "-w" ]; then
+    write=true
+    shift
+fi
+codec=${1:-./40image}
+dir=$(dirname "$0")
+expected=$dir/expected
+tmp=$(mktemp -d /tmp/check40.XXXXXX) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+
+failures=0
+checks=0
+
+# fail message
+fail()
+{
+    echo "FAIL: $1" >&2
+    failures=$((failures + 1))
+}
+
+# generate kind width height maxval
+# Prints a plain (P3) ppm; only integer arithmetic, so every awk
+# prints the same file
+generate()
+{
+    awk -v kind="$1" -v w="$2" -v h="$3" -v maxval="$4" 'BEGIN {
+        printf "P3\n%d %d\n%d\n", w, h, maxval
+        for (y = 0; y < h; y++) {
+            for (x = 0; x < w; x++) {
+                if (kind == "document") {
+                    ink = y % 8 < 2 && x % 6 < 4 && x > 4 && x < w - 4
+                    r = g = b = ink ? 0 : maxval
+                } else {
+                    r = (x * 1877 + y * 613) % (maxval + 1)
+                    g = (x * y * 29 + 7) % (maxval + 1)
+                    b = (x * 5 + y * 11) * int((maxval + 1) / 256)
+                    b %= maxval + 1
+                }
+                printf "%d %d %d\n", r, g, b
+            }
+        }
+    }'
+}
+
+# same what expected actual
+same()
+{
+    checks=$((checks + 1))
+    cmp -s "$2" "$3" || fail "$1"
+}
+
+# pixels ppm [transform [x,y,width,height]]
+# Prints the size of a P6 image, as 40image writes them, then one line
+# per pixel in raster order, after taking the crop, if given, and then
+# the transform; 40image -t has to give the same pixels
+pixels()
+{
+    od -An -v -tu1 "$1" | awk -v op="${2:-none}" -v crop="$3" '
+    { for (i = 1; i <= NF; i++) byte[n++] = $i }
+    END {
+        for (tokens = 0; tokens < 4; tokens++) {
+            while (byte[p] == 9 || byte[p] == 10 || byte[p] == 13 ||
+                   byte[p] == 32) {
+                p++
+            }
+            token[tokens] = ""
+            while (p < n && byte[p] != 9 && byte[p] != 10 &&
+                   byte[p] != 13 && byte[p] != 32) {
+                token[tokens] = token[tokens] sprintf("%c", byte[p++])
+            }
+        }
+        p++
+        w = token[1]
+        if (crop == "") {
+            crop = "0,0," w "," token[2]
+        }
+        split(crop, r, ",")
+        cw = r[3]
+        ch = r[4]
+        turned = op == "transpose" || op == "transverse" ||
+                 op == "rotate-90" || op == "rotate-270"
+        ow = turned ? ch : cw
+        oh = turned ? cw : ch
+        print ow, oh
+        for (y = 0; y < oh; y++) {
+            for (x = 0; x < ow; x++) {
+                sx = x
+                sy = y
+                if (op == "flip-h") {
+                    sx = cw - 1 - x
+                } else if (op == "flip-v") {
+                    sy = ch - 1 - y
+                } else if (op == "transpose") {
+                    sx = y
+                    sy = x
+                } else if (op == "transverse") {
+                    sx = cw - 1 - y
+                    sy = ch - 1 - x
+                } else if (op == "rotate-90") {
+                    sx = y
+                    sy = ch - 1 - x
+                } else if (op == "rotate-180") {
+                    sx = cw - 1 - x
+                    sy = ch - 1 - y
+                } else if (op == "rotate-270") {
+                    sx = cw - 1 - y
+                    sy = x
+                }
+                i = p + 3 * ((r[2] + sy) * w + r[1] + sx)
+                print byte[i], byte[i + 1], byte[i + 2]
+            }
+        }
+    }'
+}
+
+# variants
+# The environments that must not change any output
+variants="ARITH40_LAYOUT=planar ARITH40_LAYOUT=interleaved
+          ARITH40_ORDER=columns ARITH40_ORDER=rows ARITH40_ORDER=morton"
+
+generate photo 37 23 255 > "$tmp/odd.ppm"
+generate photo 34 22 65535 > "$tmp/w16.ppm"
+generate document 64 48 255 > "$tmp/doc.ppm"
+
+for image in odd w16 doc; do
+    for case in default luma9 chroma5 smooth e l; do
+        case $case in
+        e) flags="-e" ;;
+        l) flags="-l" ;;
+        *) flags="-q $case" ;;
+        esac
+        name=$image.$case
+        want=$expected/$name.c40
+        checks=$((checks + 1))
+        if ! "$codec" -c $flags "$tmp/$image.ppm" > "$tmp/$name.c40"; then
+            fail "$name: 40image -c $flags"
+            continue
+        fi
+        if $write; then
+            cp "$tmp/$name.c40" "$want"
+            continue
+        fi
+        same "$name" "$want" "$tmp/$name.c40"
+
+        if [ "$case" != l ]; then
+            "$codec" -c $flags -p "$tmp/$image.ppm" > "$tmp/out.c40"
+            same "$name -p" "$want" "$tmp/out.c40"
+        fi
+        for variant in $variants; do
+            env "$variant" "$codec" -c $flags "$tmp/$image.ppm" \
+                > "$tmp/out.c40"
+            same "$name $variant" "$want" "$tmp/out.c40"
+        done
+
+        checks=$((checks + 1))
+        if ! "$codec" -d "$want" > "$tmp/$name.ppm"; then
+            fail "$name: 40image -d"
+            continue
+        fi
+        "$codec" -d -p "$want" > "$tmp/out.ppm"
+        same "$name -d -p" "$tmp/$name.ppm" "$tmp/out.ppm"
+        if [ "$case" = l ]; then
+            "$codec" -d -l "$want" > "$tmp/out.ppm"
+            same "$name -d -l" "$tmp/$name.ppm" "$tmp/out.ppm"
+        fi
+        for variant in $variants; do
+            env "$variant" "$codec" -d "$want" > "$tmp/out.ppm"
+            same "$name -d $variant" "$tmp/$name.ppm" "$tmp/out.ppm"
+        done
+    done
+done
+
+if $write; then
+    [ "$failures" -eq 0 ] && echo "check: wrote $expected"
+    exit "$failures"
+fi
+
+transforms="none flip-h flip-v transpose transverse
+            rotate-90 rotate-180 rotate-270"
+crop=2,4,20,12
+
+for image in odd w16 doc; do
+    for case in default e l luma9; do
+        name=$image.$case
+        file=$expected/$name.c40
+        "$codec" -d "$file" > "$tmp/$name.ppm"
+        for op in $transforms; do
+            for rect in "" $crop; do
+                what="$name -t $op${rect:+ -r $rect}"
+                checks=$((checks + 1))
+                if ! "$codec" -t $op ${rect:+-r $rect} "$file" \
+                     > "$tmp/out.c40"; then
+                    fail "$what"
+                    continue
+                fi
+                "$codec" -d "$tmp/out.c40" > "$tmp/out.ppm"
+                pixels "$tmp/out.ppm" > "$tmp/got"
+                pixels "$tmp/$name.ppm" $op $rect > "$tmp/want"
+                same "$what" "$tmp/want" "$tmp/got"
+            done
+        done
+
+        cp "$file" "$tmp/turned.c40"
+        for turn in 1 2 3 4; do
+            "$codec" -t rotate-90 "$tmp/turned.c40" > "$tmp/out.c40"
+            mv "$tmp/out.c40" "$tmp/turned.c40"
+        done
+        same "$name four quarter turns" "$file" "$tmp/turned.c40"
+    done
+done
+
+# refuses file
+# Every way of reading a damaged file must fail cleanly and promptly
+refuses()
+{
+    for read in "-d" "-d -g" "-d -y" "-d -p" "-i" "-t rotate-90"; do
+        checks=$((checks + 1))
+        timeout 10 "$codec" $read "$1" > /dev/null 2> "$tmp/error"
+        status=$?
+        if [ "$status" -ne 1 ] || ! grep -q . "$tmp/error"; then
+            fail "$(basename "$1") $read: exit status $status"
+        fi
+    done
+}
+
+for image in odd w16 doc; do
+    for case in default e l; do
+        file=$expected/$image.$case.c40
+        size=$(wc -c < "$file")
+        head -c $((size / 2)) "$file" > "$tmp/$image.$case.cut.c40"
+        refuses "$tmp/$image.$case.cut.c40"
+    done
+
+    # keep the header lines, the default profile's 576 bytes of tables
+    # and the payload's length, and zero the rest, rANS states and all
+    file=$expected/$image.e.c40
+    size=$(wc -c < "$file")
+    keep=$(($(head -n 2 "$file" | wc -c) + 576 + 4))
+    { head -c $keep "$file"; head -c $((size - keep)) /dev/zero; } \
+        > "$tmp/$image.e.zeroed.c40"
+    refuses "$tmp/$image.e.zeroed.c40"
+done
+
+# -u can only patch a plain file the size of the image, and must leave
+# any other file as it was
+for case in odd.e odd.l doc.default; do
+    checks=$((checks + 1))
+    cp "$expected/$case.c40" "$tmp/patched.c40"
+    "$codec" -u "$tmp/patched.c40" "$tmp/odd.ppm" 2> "$tmp/error"
+    status=$?
+    if [ "$status" -ne 1 ] || ! grep -q . "$tmp/error" ||
+       ! cmp -s "$expected/$case.c40" "$tmp/patched.c40"; then
+        fail "$case -u odd.ppm: exit status $status"
+    fi
+done
+
+echo "check: $((checks - failures)) of $checks passed"
+[ "$failures" -eq 0 ]
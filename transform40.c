@@ -0,0 +1,542 @@
+/*
+ *     transform40.c
+ *     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
+ *     Date: 10-26-20
+ *     arith
+ *
+ *     Purpose: Flips, rotations, transposes and crops of a compressed
+ *              image, done on its codewords (see transform40.h).
+ *
+ *              Every transform is a transpose or not, then a flip left
+ *              to right or not, then a flip top to bottom or not. Each
+ *              codeword of the result is then one word of the input,
+ *              with its b, c and d moved as the transform says. Where
+ *              that word is goes linearly with the column and row of
+ *              the result, so one start and two strides find them all.
+ *              Without a transpose the input is read a row at a time,
+ *              forwards or backwards; with one it is read down columns,
+ *              so the result is made in square tiles, each of which
+ *              reads a few cache lines of each input row it touches.
+ *
+ *              Plain images are transformed straight from the input's
+ *              payload into the output's. Entropy coded and progressive
+ *              ones are decoded to words, transformed, and coded again.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "assert.h"
+#include "transform40.h"
+#include "entropy.h"
+#include "progressive40.h"
+#include "pages40.h"
+#include "instrument.h"
+
+/* the side of the tiles a transpose is made in, in codewords */
+#define TILE 32
+
+/* what each transform is made of */
+static const struct Move
+{
+    bool transpose, flip_h, flip_v;
+} moves[TRANSFORM40_COUNT] = {
+    [TRANSFORM40_NONE]       = { false, false, false },
+    [TRANSFORM40_FLIP_H]     = { false, true,  false },
+    [TRANSFORM40_FLIP_V]     = { false, false, true  },
+    [TRANSFORM40_TRANSPOSE]  = { true,  false, false },
+    [TRANSFORM40_TRANSVERSE] = { true,  true,  true  },
+    [TRANSFORM40_ROTATE_90]  = { true,  true,  false },
+    [TRANSFORM40_ROTATE_180] = { false, true,  true  },
+    [TRANSFORM40_ROTATE_270] = { true,  false, true  },
+};
+
+#define TRANSFORM40_NAME(id, name) name,
+static const char *names[TRANSFORM40_COUNT] = {
+    TRANSFORM40_TABLE(TRANSFORM40_NAME)
+};
+#undef TRANSFORM40_NAME
+
+/* where the words of the result come from: the word for column c and
+   row r of the result is word start + c * col_step + r * row_step of
+   the input, in row-major order */
+struct Geometry
+{
+    /* the result's width and height in blocks */
+    unsigned width, height;
+    ptrdiff_t start, col_step, row_step;
+    bool transpose;
+};
+
+/* what happens to the b, c and d of each word, which are next to each
+   other, b highest, and each bcd_bits wide */
+struct Word_map
+{
+    /* swap b and c: the bits of each, and how far apart they are */
+    bool swap;
+    uint32_t b_bits, c_bits;
+    unsigned shift;
+    /* negate fields, after any swap: all their bits, their lowest bits,
+       and their highest bits */
+    uint32_t neg, neg_lsb, neg_msb;
+};
+
+/* Transform40_named()
+ * Purpose: Look up a transform by name
+ * Parameters: The name, as given on the command line
+ * Returns: The transform, or TRANSFORM40_COUNT if there is none by that
+ *          name
+ */
+enum Transform40_op Transform40_named(const char *name)
+{
+    for (int op = 0; op < TRANSFORM40_COUNT; op++) {
+        if (strcmp(names[op], name) == 0) {
+            return op;
+        }
+    }
+    return TRANSFORM40_COUNT;
+}
+
+/* Transform40_name()
+ * Purpose: Name a transform
+ * Parameters: The transform
+ * Returns: Its name, which the caller must not free
+ */
+const char *Transform40_name(enum Transform40_op op)
+{
+    assert((unsigned)op < TRANSFORM40_COUNT);
+    return names[op];
+}
+
+/* plan()
+ * Purpose: Work out where the words of a transformed image come from
+ * Parameters: The input's header, the transform, the crop (NULL for the
+ *             whole image), and the geometry to fill in
+ * Returns: CODEC40_OK, or CODEC40_BAD_ARGUMENT if the transform is
+ *          unknown or the crop is not whole blocks inside the image
+ */
+static enum Codec40_status plan(const struct Codec40_header *header,
+                                enum Transform40_op op,
+                                const struct Codec40_rect *crop,
+                                struct Geometry *geometry)
+{
+    if ((unsigned)op >= TRANSFORM40_COUNT) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+    struct Codec40_rect whole = { 0, 0, header->width, header->height };
+    if (crop == NULL) {
+        crop = &whole;
+    }
+    if ((crop->x | crop->y | crop->width | crop->height) % 2 != 0 ||
+        crop->width == 0 || crop->height == 0 ||
+        crop->x > header->width || crop->width > header->width - crop->x ||
+        crop->y > header->height ||
+        crop->height > header->height - crop->y) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+
+    /* the crop, in blocks */
+    ptrdiff_t stride = header->width / 2;
+    ptrdiff_t col0 = crop->x / 2, row0 = crop->y / 2;
+    ptrdiff_t cols = crop->width / 2, rows = crop->height / 2;
+    const struct Move *move = &moves[op];
+
+    /* the steps along the result's rows and columns, in the input,
+       before flipping */
+    ptrdiff_t across = 1, down = stride;
+    geometry->width = cols;
+    geometry->height = rows;
+    if (move->transpose) {
+        across = stride;
+        down = 1;
+        geometry->width = rows;
+        geometry->height = cols;
+    }
+    geometry->start = row0 * stride + col0;
+    geometry->col_step = across;
+    geometry->row_step = down;
+    if (move->flip_h) {
+        geometry->start += (geometry->width - 1) * across;
+        geometry->col_step = -across;
+    }
+    if (move->flip_v) {
+        geometry->start += (geometry->height - 1) * down;
+        geometry->row_step = -down;
+    }
+    geometry->transpose = move->transpose;
+    return CODEC40_OK;
+}
+
+/* word_map_of()
+ * Purpose: Work out what a transform does to each codeword
+ * Parameters: The profile of the codewords, the transform, and the map
+ *             to fill in
+ * Returns: none
+ * Notes: A flip left to right negates c and d, and a flip top to bottom
+ *        negates b and d, after the transpose has swapped b and c
+ */
+static void word_map_of(const struct Profile *profile, enum Transform40_op op,
+                        struct Word_map *map)
+{
+    const struct Move *move = &moves[op];
+    unsigned bits = profile->bcd_bits;
+    uint32_t field = ((uint32_t)1 << bits) - 1;
+    bool negate[PROFILE_NFIELDS] = {
+        [FIELD_B] = move->flip_v,
+        [FIELD_C] = move->flip_h,
+        [FIELD_D] = move->flip_h != move->flip_v,
+    };
+
+    map->swap = move->transpose;
+    map->b_bits = field << profile->lsb[FIELD_B];
+    map->c_bits = field << profile->lsb[FIELD_C];
+    map->shift = bits;
+    map->neg = map->neg_lsb = map->neg_msb = 0;
+    for (int f = FIELD_B; f <= FIELD_D; f++) {
+        if (negate[f]) {
+            map->neg |= field << profile->lsb[f];
+            map->neg_lsb |= (uint32_t)1 << profile->lsb[f];
+            map->neg_msb |= (uint32_t)1 << (profile->lsb[f] + bits - 1);
+        }
+    }
+}
+
+/* map_word()
+ * Purpose: Transform one codeword
+ * Parameters: The word, and what to do to it
+ * Returns: The transformed word
+ * Notes: Negates every field at once, as ~f + 1: adding 1 to the bits
+ *        of ~f below each field's top bit cannot carry out of the 
+ *        field, and the top bit is then fixed up with an xor, which 
+ *        drops the carry out of it
+ */
+static inline uint32_t map_word(uint32_t word, const struct Word_map *map)
+{
+    uint32_t swapped = (word & ~(map->b_bits | map->c_bits)) |
+                       (word >> map->shift & map->c_bits) |
+                       (word << map->shift & map->b_bits);
+    word = map->swap ? swapped : word;
+    uint32_t inverted = (word & map->neg) ^ map->neg;
+    uint32_t negated = (((inverted & ~map->neg_msb) + map->neg_lsb) ^
+                        (inverted & map->neg_msb)) & map->neg;
+    return (word & ~map->neg) | negated;
+}
+
+/* load_word()
+ * Purpose: Read word i of the input
+ * Parameters: The input, as big-endian bytes or as host words, and which
+ *             it is, and the index of the word
+ * Returns: The word
+ */
+static inline uint32_t load_word(const void *in, bool big_endian,
+                                 ptrdiff_t i)
+{
+    if (!big_endian) {
+        return ((const uint32_t *)in)[i];
+    }
+    const unsigned char *bytes = (const unsigned char *)in + 4 * i;
+    return (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 |
+           (uint32_t)bytes[2] << 8 | bytes[3];
+}
+
+/* store_word()
+ * Purpose: Write word i of the output
+ * Parameters: The output, as big-endian bytes or as host words, and
+ *             which it is, the index of the word, and the word
+ * Returns: none
+ */
+static inline void store_word(void *out, bool big_endian, size_t i,
+                              uint32_t word)
+{
+    if (!big_endian) {
+        ((uint32_t *)out)[i] = word;
+        return;
+    }
+    unsigned char *bytes = (unsigned char *)out + 4 * i;
+    bytes[0] = word >> 24;
+    bytes[1] = word >> 16;
+    bytes[2] = word >> 8;
+    bytes[3] = word;
+}
+
+/* transform_words()
+ * Purpose: Make the words of the result from the words of the input
+ * Parameters: The geometry and word map, the input's words and the
+ *             output's, and whether both are big-endian bytes (a plain
+ *             payload) rather than host words
+ * Returns: none
+ * Notes: Without a transpose a tile is a whole row of the result. The
+ *        map is copied, since the stores through the output's bytes
+ *        could otherwise change it, as far as the compiler knows, and
+ *        it would be read again for every word. Inlined into each of
+ *        the two callers below, so that big_endian is a constant.
+ */
+static inline __attribute__((always_inline))
+void transform_words(const struct Geometry *geometry,
+                     const struct Word_map *word_map, const void *in,
+                     void *out, bool big_endian)
+{
+    const struct Word_map map = *word_map;
+    const unsigned width = geometry->width, height = geometry->height;
+    const ptrdiff_t start = geometry->start;
+    const ptrdiff_t col_step = geometry->col_step;
+    const ptrdiff_t row_step = geometry->row_step;
+    const unsigned tile_w = geometry->transpose ? TILE : width;
+    const unsigned tile_h = geometry->transpose ? TILE : 1;
+
+    for (unsigned row0 = 0; row0 < height; row0 += tile_h) {
+        unsigned row1 = height - row0 < tile_h ? height : row0 + tile_h;
+        for (unsigned col0 = 0; col0 < width; col0 += tile_w) {
+            unsigned col1 = width - col0 < tile_w ? width : col0 + tile_w;
+            for (unsigned row = row0; row < row1; row++) {
+                ptrdiff_t from = start + row * row_step + col0 * col_step;
+                size_t to = (size_t)row * width;
+                for (unsigned col = col0; col < col1; col++) {
+                    uint32_t word = load_word(in, big_endian, from);
+                    store_word(out, big_endian, to + col,
+                               map_word(word, &map));
+                    from += col_step;
+                }
+            }
+        }
+    }
+}
+
+/* transform_payload()
+ * Purpose: transform_words() on a plain payload's big-endian bytes
+ * Parameters: The geometry and word map, and the input's and output's
+ *             payloads
+ * Returns: none
+ */
+static void transform_payload(const struct Geometry *geometry,
+                              const struct Word_map *map,
+                              const unsigned char *in, unsigned char *out)
+{
+    transform_words(geometry, map, in, out, true);
+}
+
+/* transform_flat()
+ * Purpose: transform_words() on host words, as the entropy coder has
+ *          them
+ * Parameters: The geometry and word map, and the input's and output's
+ *             words
+ * Returns: none
+ */
+static void transform_flat(const struct Geometry *geometry,
+                           const struct Word_map *map, const uint32_t *in,
+                           uint32_t *out)
+{
+    transform_words(geometry, map, in, out, false);
+}
+
+/* Transform40_bound()
+ * Purpose: The most bytes a transformed image can take
+ * Parameters: The compressed image and its length, the transform, the
+ *             crop (NULL for none), and where to put the bound
+ * Returns: CODEC40_OK, or why the image cannot be transformed
+ * Notes: Only reads the header
+ */
+enum Codec40_status Transform40_bound(const unsigned char *in, size_t len,
+                                      enum Transform40_op op,
+                                      const struct Codec40_rect *crop,
+                                      size_t *bound)
+{
+    if (in == NULL || bound == NULL) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+    struct Codec40_header header;
+    enum Codec40_status status = Codec40_read_header(in, len, &header);
+    if (status != CODEC40_OK) {
+        return status;
+    }
+    struct Geometry geometry;
+    status = plan(&header, op, crop, &geometry);
+    if (status != CODEC40_OK) {
+        return status;
+    }
+    *bound = Codec40_encode_bound(geometry.width * 2, geometry.height * 2,
+                                  &header.options);
+    return CODEC40_OK;
+}
+
+/* transform_entropy()
+ * Purpose: Transform an entropy coded payload
+ * Parameters: The input's header, payload and the payload's length, the
+ *             geometry and word map, and where the output's payload
+ *             goes, how much room there is for it, and where to put its
+ *             length
+ * Returns: CODEC40_OK, CODEC40_CORRUPT if the payload cannot be decoded,
+ *          or CODEC40_NO_MEMORY; the payload is only written if it fits
+ */
+static enum Codec40_status
+transform_entropy(const struct Codec40_header *header,
+                  const unsigned char *in, size_t len,
+                  const struct Geometry *geometry, const struct Word_map *map,
+                  unsigned char *out, size_t capacity, size_t *out_len)
+{
+    unsigned width = header->width / 2, height = header->height / 2;
+    const struct Profile *profile = header->options.profile;
+    size_t nwords = (size_t)width * height;
+    size_t nout = (size_t)geometry->width * geometry->height;
+    size_t bound = Entropy_bound(geometry->width, geometry->height, profile);
+    size_t scratch_bytes = Entropy_scratch_bytes(width, height);
+    bool in_place = capacity >= bound;
+
+    uint32_t *words = Pages40_alloc(nwords * sizeof(uint32_t));
+    uint32_t *moved = Pages40_alloc(nout * sizeof(uint32_t));
+    void *scratch = Pages40_alloc(scratch_bytes);
+    unsigned char *payload = in_place ? out : Pages40_alloc(bound);
+    enum Codec40_status status = CODEC40_NO_MEMORY;
+    if (words != NULL && moved != NULL && scratch != NULL &&
+        payload != NULL) {
+        STAGE_BEGIN(decode_mark);
+        bool ok = Entropy_decode(in, len, words, width, height, profile,
+                                 scratch);
+        STAGE_END(decode_mark, "entropy_decode", nwords);
+        status = ok ? CODEC40_OK : CODEC40_CORRUPT;
+    }
+    if (status == CODEC40_OK) {
+        STAGE_BEGIN(mark);
+        transform_flat(geometry, map, words, moved);
+        STAGE_END(mark, "transform", nout);
+        STAGE_BEGIN(encode_mark);
+        *out_len = Entropy_encode(moved, geometry->width, geometry->height,
+                                  profile, payload, scratch);
+        STAGE_END(encode_mark, "entropy_encode", nout);
+        if (!in_place && *out_len <= capacity) {
+            memcpy(out, payload, *out_len);
+        }
+    }
+    if (!in_place) {
+        Pages40_free(payload, bound);
+    }
+    Pages40_free(scratch, scratch_bytes);
+    Pages40_free(moved, nout * sizeof(uint32_t));
+    Pages40_free(words, nwords * sizeof(uint32_t));
+    return status;
+}
+
+/* transform_progressive()
+ * Purpose: Transform a progressive payload
+ * Parameters: The input's header, payload and the payload's length, the
+ *             geometry and word map, and where the output's payload
+ *             goes, which has room for Progressive40_bytes() of the
+ *             result
+ * Returns: CODEC40_OK, CODEC40_TRUNCATED or CODEC40_CORRUPT if the
+ *          payload is short or long, or CODEC40_NO_MEMORY
+ */
+static enum Codec40_status
+transform_progressive(const struct Codec40_header *header,
+                      const unsigned char *in, size_t len,
+                      const struct Geometry *geometry,
+                      const struct Word_map *map, unsigned char *out)
+{
+    unsigned width = header->width / 2, height = header->height / 2;
+    const struct Profile *profile = header->options.profile;
+    size_t whole = Progressive40_bytes(width, height, profile);
+    if (len != whole) {
+        return len < whole ? CODEC40_TRUNCATED : CODEC40_CORRUPT;
+    }
+    size_t nwords = (size_t)width * height;
+    size_t nout = (size_t)geometry->width * geometry->height;
+    uint32_t *words = Pages40_alloc(nwords * sizeof(uint32_t));
+    uint32_t *moved = Pages40_alloc(nout * sizeof(uint32_t));
+    enum Codec40_status status = CODEC40_NO_MEMORY;
+    if (words != NULL && moved != NULL) {
+        Progressive40_decode(in, len, words, width, height, profile);
+        STAGE_BEGIN(mark);
+        transform_flat(geometry, map, words, moved);
+        STAGE_END(mark, "transform", nout);
+        Progressive40_encode(moved, geometry->width, geometry->height,
+                             profile, out);
+        status = CODEC40_OK;
+    }
+    Pages40_free(moved, nout * sizeof(uint32_t));
+    Pages40_free(words, nwords * sizeof(uint32_t));
+    return status;
+}
+
+/* Transform40_apply()
+ * Purpose: Flip, rotate, transpose or crop a compressed image into a
+ *          buffer supplied by the caller
+ * Parameters: The compressed image and its length, the transform, the
+ *             crop (NULL for none), the buffer and its size, and where
+ *             to put the size of the result
+ * Returns: CODEC40_OK, CODEC40_NO_SPACE if the buffer is too small, in
+ *          which case *out_len is the size it needed to be, or why the
+ *          image cannot be transformed
+ * Notes: Transform40_bound() bytes are always enough. The buffer must
+ *        not overlap the input.
+ */
+enum Codec40_status Transform40_apply(const unsigned char *in, size_t len,
+                                      enum Transform40_op op,
+                                      const struct Codec40_rect *crop,
+                                      unsigned char *out, size_t capacity,
+                                      size_t *out_len)
+{
+    if (in == NULL || out_len == NULL || (out == NULL && capacity > 0)) {
+        return CODEC40_BAD_ARGUMENT;
+    }
+    struct Codec40_header header;
+    enum Codec40_status status = Codec40_read_header(in, len, &header);
+    if (status != CODEC40_OK) {
+        return status;
+    }
+    struct Geometry geometry;
+    status = plan(&header, op, crop, &geometry);
+    if (status != CODEC40_OK) {
+        return status;
+    }
+    struct Word_map map;
+    word_map_of(header.options.profile, op, &map);
+
+    unsigned char out_header[CODEC40_HEADER_MAX];
+    size_t header_len = Codec40_write_header(geometry.width * 2,
+                                             geometry.height * 2,
+                                             &header.options, out_header);
+    const unsigned char *payload = in + header.size;
+    size_t payload_len = len - header.size;
+    size_t nout = (size_t)geometry.width * geometry.height;
+
+    if (header.options.entropy) {
+        size_t room = capacity > header_len ? capacity - header_len : 0;
+        size_t coded;
+        status = transform_entropy(&header, payload, payload_len, &geometry,
+                                   &map, out + (room > 0 ? header_len : 0),
+                                   room, &coded);
+        if (status != CODEC40_OK) {
+            return status;
+        }
+        *out_len = header_len + coded;
+    } else if (header.options.progressive) {
+        *out_len = header_len +
+                   Progressive40_bytes(geometry.width, geometry.height,
+                                       header.options.profile);
+        if (*out_len <= capacity) {
+            status = transform_progressive(&header, payload, payload_len,
+                                           &geometry, &map,
+                                           out + header_len);
+            if (status != CODEC40_OK) {
+                return status;
+            }
+        }
+    } else {
+        size_t nwords = (size_t)(header.width / 2) * (header.height / 2);
+        if (payload_len != nwords * sizeof(uint32_t)) {
+            return payload_len < nwords * sizeof(uint32_t)
+                   ? CODEC40_TRUNCATED : CODEC40_CORRUPT;
+        }
+        *out_len = header_len + nout * sizeof(uint32_t);
+        if (*out_len <= capacity) {
+            STAGE_BEGIN(mark);
+            transform_payload(&geometry, &map, payload, out + header_len);
+            STAGE_END(mark, "transform", nout);
+        }
+    }
+    if (*out_len > capacity) {
+        return CODEC40_NO_SPACE;
+    }
+    memcpy(out, out_header, header_len);
+    INSTRUMENT_COUNT("codeword_bytes", *out_len - header_len);
+    return CODEC40_OK;
+}
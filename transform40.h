@@ -0,0 +1,61 @@
+/*
+ *     transform40.h
+ *     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
+ *     Date: 10-26-20
+ *     arith
+ *
+ *     Purpose: Interface for transform40.c: flips, rotations, transposes
+ *              and crops of a compressed image, done on its codewords
+ *              without decompressing it.
+ *
+ *              Moving the pixels of a 2x2 block around its corners only
+ *              permutes and negates the b, c and d of its codeword: a
+ *              flip left to right negates c and d, a flip top to bottom
+ *              negates b and d, and a transpose swaps b and c. a and the
+ *              chroma are averages over the block, so they do not
+ *              change. The codewords themselves move to the blocks'
+ *              new places. Nothing is quantized again, so the result
+ *              decompresses to the transformed pixels of the original,
+ *              with no further loss.
+ */
+
+#ifndef TRANSFORM40_INCLUDED
+#define TRANSFORM40_INCLUDED
+
+#include <stddef.h>
+#include "codec40.h"
+
+/* turns are clockwise; a transverse is a transpose about the other
+   diagonal */
+#define TRANSFORM40_TABLE(X)           \
+    X(NONE,       "none")              \
+    X(FLIP_H,     "flip-h")            \
+    X(FLIP_V,     "flip-v")            \
+    X(TRANSPOSE,  "transpose")         \
+    X(TRANSVERSE, "transverse")        \
+    X(ROTATE_90,  "rotate-90")         \
+    X(ROTATE_180, "rotate-180")        \
+    X(ROTATE_270, "rotate-270")
+
+#define TRANSFORM40_ID(id, name) TRANSFORM40_##id,
+enum Transform40_op { TRANSFORM40_TABLE(TRANSFORM40_ID) TRANSFORM40_COUNT };
+#undef TRANSFORM40_ID
+
+/* TRANSFORM40_COUNT when no transform has the name */
+extern enum Transform40_op Transform40_named(const char *name);
+extern const char *Transform40_name(enum Transform40_op op);
+
+/* The crop, if not NULL, is taken first, from the original image. It
+   must lie inside the image and be whole 2x2 blocks: x, y, width and
+   height all even. The result keeps the input's profile, and is entropy
+   coded, or progressive, when the input is. */
+extern enum Codec40_status
+Transform40_bound(const unsigned char *in, size_t len,
+                  enum Transform40_op op, const struct Codec40_rect *crop,
+                  size_t *bound);
+extern enum Codec40_status
+Transform40_apply(const unsigned char *in, size_t len,
+                  enum Transform40_op op, const struct Codec40_rect *crop,
+                  unsigned char *out, size_t capacity, size_t *out_len);
+
+#endif
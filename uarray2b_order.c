@@ -0,0 +1,229 @@
+/*
+ *     uarray2b_order.c
+ *     Molly Clawson (mclaws01) and Victoria Chen (vchen05)
+ *     Date: 10-26-20
+ *     arith
+ *
+ *     Purpose: Block orders for UArray2b (see a2order.h), kept apart from
+ *              uarray2b.c, which is generated from uarray2b.nw. Every
+ *              block is visited, or allocated, by each_block(), so the
+ *              order blocks are laid out in memory and the order they
+ *              are mapped over can be made the same. The cells of a
+ *              block are always visited in the order they are stored, so
+ *              whatever a map does to one block it does the same in
+ *              every order.
+ *
+ *              UArray2b_new() and UArray2b_map() go down columns of
+ *              blocks, which is A2_ORDER_COLUMNS here, and an array made
+ *              here is freed by UArray2b_free() like any other.
+ */
+
+#include <math.h>
+#include "assert.h"
+#include "mem.h"
+#include "uarray.h"
+#include "uarray2.h"
+#include "uarray2b.h"
+#include "a2order.h"
+#include "a2inline.h"
+
+#define T UArray2b_T
+
+/* The representation from uarray2b.nw, which does not export it. It
+   must stay the same as the one in uarray2b.c. */
+struct T {
+        int width, height;
+        unsigned blocksize;
+        unsigned size;
+        UArray2_T blocks;   /* of UArray_T, blocksize * blocksize cells */
+};
+
+typedef void visit_fun(int bx, int by, void *cl);
+
+/* each_morton()
+ * Purpose: Visit the blocks of a square of the block grid in Z order
+ * Parameters: The left column and top row of the square, its side, a
+ *             power of 2, the size of the grid, and what to do with
+ *             each block and its closure
+ * Returns: none
+ * Notes: Parts of the square off the grid are skipped whole, so a grid
+ *        that is far from square costs little more than its blocks
+ */
+static void each_morton(int bx, int by, int side, int bw, int bh,
+                        visit_fun visit, void *cl)
+{
+        if (bx >= bw || by >= bh) {
+                return;
+        }
+        if (side == 1) {
+                visit(bx, by, cl);
+                return;
+        }
+        int half = side / 2;
+        each_morton(bx, by, half, bw, bh, visit, cl);
+        each_morton(bx + half, by, half, bw, bh, visit, cl);
+        each_morton(bx, by + half, half, bw, bh, visit, cl);
+        each_morton(bx + half, by + half, half, bw, bh, visit, cl);
+}
+
+/* each_block()
+ * Purpose: Visit every block of a grid in an order
+ * Parameters: The width and height of the grid in blocks, the order,
+ *             and what to do with each block and its closure
+ * Returns: none
+ */
+static void each_block(int bw, int bh, enum A2_order order,
+                       visit_fun visit, void *cl)
+{
+        switch (order) {
+        case A2_ORDER_ROWS:
+                for (int by = 0; by < bh; by++) {
+                        for (int bx = 0; bx < bw; bx++) {
+                                visit(bx, by, cl);
+                        }
+                }
+                break;
+        case A2_ORDER_MORTON: {
+                int side = 1;
+                while (side < bw || side < bh) {
+                        side *= 2;
+                }
+                each_morton(0, 0, side, bw, bh, visit, cl);
+                break;
+        }
+        default:
+                for (int bx = 0; bx < bw; bx++) {
+                        for (int by = 0; by < bh; by++) {
+                                visit(bx, by, cl);
+                        }
+                }
+                break;
+        }
+}
+
+/* new_block()
+ * Purpose: Allocate one block of an array (a visit_fun)
+ * Parameters: The block's column and row, and the array
+ * Returns: none
+ */
+static void new_block(int bx, int by, void *cl)
+{
+        T array = cl;
+        UArray_T *block = UArray2_at(array->blocks, bx, by);
+        *block = UArray_new(array->blocksize * array->blocksize,
+                            array->size);
+}
+
+/* UArray2b_new_ordered()
+ * Purpose: UArray2b_new(), with the blocks allocated in an order
+ * Parameters: As for UArray2b_new(), then the order
+ * Returns: The array
+ * Notes: Blocks allocated one after another are mostly next to each
+ *        other in memory, so an array mapped in the order it was made
+ *        in is read from front to back
+ */
+T UArray2b_new_ordered(int width, int height, int size, int blocksize,
+                       enum A2_order order)
+{
+        assert(blocksize > 0);
+        T array;
+        NEW(array);
+        array->width  = width;
+        array->height = height;
+        array->size   = size;
+        array->blocksize = blocksize;
+        array->blocks = UArray2_new((width  + blocksize - 1) / blocksize,
+                                    (height + blocksize - 1) / blocksize,
+                                    sizeof(UArray_T));
+        each_block(UArray2_width(array->blocks),
+                   UArray2_height(array->blocks), order, new_block, array);
+        return array;
+}
+
+/* UArray2b_new_64K_block_ordered()
+ * Purpose: UArray2b_new_64K_block(), with the blocks allocated in an
+ *          order
+ * Parameters: As for UArray2b_new_64K_block(), then the order
+ * Returns: The array
+ */
+T UArray2b_new_64K_block_ordered(int width, int height, int size,
+                                 enum A2_order order)
+{
+        int blocksize = (int) floor(sqrt((double) (64 * 1024)
+                                         / (double) size));
+        if (blocksize == 0) {
+                blocksize = 1;
+        }
+        /*  assert as big as possible */
+        assert((blocksize + 1) * (blocksize + 1) * size > 64 * 1024);
+        if (size <= 64 * 1024) { /* but no bigger */
+                assert(blocksize * blocksize * size <= 64 * 1024); 
+        }
+        return UArray2b_new_ordered(width, height, size, blocksize, order);
+}
+
+/* what map_block() needs besides the block */
+struct map_closure {
+        T array2b;
+        void (*apply)(int col, int row, T array2b, void *elem, void *cl);
+        void *cl;
+};
+
+/* map_block()
+ * Purpose: Apply a function to every cell of one block, in the order
+ *          the cells are stored (a visit_fun)
+ * Parameters: The block's column and row, and the map_closure
+ * Returns: none
+ */
+static void map_block(int bx, int by, void *vcl)
+{
+        struct map_closure *mcl = vcl;
+        T    array2b = mcl->array2b;
+        int  b       = array2b->blocksize;
+        int  w       = array2b->width;
+        int  h       = array2b->height;
+        UArray_T block = *(UArray_T *)UArray2_at(array2b->blocks, bx, by);
+        int  len     = UArray_length(block);
+        /* (i0, j0) correspond to upper left */
+        /* corner of block (bx, by)          */
+        int i0 = b * bx; 
+        int j0 = b * by; 
+        for (int cell = 0; cell < len; cell++) {
+                int i = i0 + cell / b;
+                int j = j0 + cell % b;
+                /* measured overhead 0.5% to 1.5% */
+                if (i < w && j < h) {
+                        mcl->apply(i, j, array2b, UArray_at(block, cell),
+                                   mcl->cl);
+                }
+        }
+}
+
+/* UArray2b_block_at()
+ * Purpose: Find the cells of one block
+ * Parameters: The array, and the block's column and row in blocks
+ * Returns: The block's first cell; the rest follow it in memory, cell 
+ *          (i, j) of the block at (i * blocksize + j)
+ */
+void *UArray2b_block_at(T array2b, int bx, int by)
+{
+        UArray_T block = *(UArray_T *)UArray2_at(array2b->blocks, bx, by);
+        return UArray_at(block, 0);
+}
+
+/* UArray2b_map_ordered()
+ * Purpose: UArray2b_map(), with the blocks visited in an order
+ * Parameters: The array, the order, and the function to apply and its
+ *             closure
+ * Returns: none
+ */
+void UArray2b_map_ordered(T array2b, enum A2_order order,
+                          void apply(int col, int row, T array2b,
+                                     void *elem, void *cl),
+                          void *cl)
+{
+        assert(array2b);
+        struct map_closure mcl = { array2b, apply, cl };
+        each_block(UArray2_width(array2b->blocks),
+                   UArray2_height(array2b->blocks), order, map_block, &mcl);
+}